@@ -0,0 +1,53 @@
+// Throughput of the CPU separable convolution per instruction set and kernel size
+// g++ -O2 -std=c++14 -pthread -I../include bench_conv_separable.cpp -lopencv_core -lopencv_imgproc -o bench_conv_separable
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <amp_core.h>
+#include <amp_gaussian.h>
+
+int main(int argc, char* argv[])
+{
+	int rows = argc > 2 ? atoi(argv[1]) : 2160;
+	int cols = argc > 2 ? atoi(argv[2]) : 3840;
+	amp::cpu::thread_pool& pool = amp::cpu::default_thread_pool();
+	amp::cpu::plane<float> src(rows, cols), dest(rows, cols), temp(rows, cols);
+	for(int r = 0; r < rows; r++)
+	{
+		for(int c = 0; c < cols; c++)
+		{
+			src.view()(r, c) = float((r * 7 + c * 13) & 0xff);
+		}
+	}
+	const char* level_names[] = { "scalar", "sse4", "avx2", "avx512" };
+	printf("%d x %d, %d threads, Mpix/s\n", cols, rows, pool.size());
+	printf("ksize");
+	for(int level = 0; level <= int(amp::cpu::max_simd_level()); level++)
+	{
+		printf("\t%s", level_names[level]);
+	}
+	printf("\n");
+	const int ksizes[] = { 3, 5, 7, 9, 15, 21, 31, 45, 63 };
+	for(int ksize : ksizes)
+	{
+		printf("%d", ksize);
+		for(int level = 0; level <= int(amp::cpu::max_simd_level()); level++)
+		{
+			amp::cpu::simd_level_limit() = amp::cpu::simd_level(level);
+			amp::gaussian_filter_32f_c1(pool, src, dest, temp, ksize, 0.0f);
+			int iterations = 0;
+			auto start = std::chrono::high_resolution_clock::now();
+			std::chrono::duration<double> elapsed;
+			do
+			{
+				amp::gaussian_filter_32f_c1(pool, src, dest, temp, ksize, 0.0f);
+				iterations++;
+				elapsed = std::chrono::high_resolution_clock::now() - start;
+			} while(elapsed.count() < 0.5);
+			printf("\t%.1f", double(rows) * cols * iterations / elapsed.count() / 1.0e6);
+		}
+		printf("\n");
+	}
+	return 0;
+}
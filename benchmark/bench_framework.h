@@ -0,0 +1,317 @@
+﻿#pragma once
+
+// Minimal Google Benchmark style harness for the CPU backend:
+// operators register with AMP_BENCHMARK, run over every image size and argument,
+// and report Mpix/s, bytes per pixel and bandwidth as a fraction of a STREAM copy.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <memory>
+#include <amp_core.h>
+
+namespace bench
+{
+	struct image_size
+	{
+		const char* name;
+		int cols;
+		int rows;
+	};
+
+	inline const std::vector<image_size>& all_sizes()
+	{
+		static const std::vector<image_size> sizes = { { "vga", 640, 480 }, { "1080p", 1920, 1080 }, { "4k", 3840, 2160 }, { "8k", 7680, 4320 } };
+		return sizes;
+	}
+
+	struct result
+	{
+		std::string name;
+		std::string size;
+		int rows;
+		int cols;
+		int arg;
+		long long iterations;
+		double seconds;
+		double bytes_per_pixel;
+	};
+
+	// Per run state: image size, argument(kernel size etc.) and lazily created test planes
+	class state
+	{
+	public:
+		state(amp::cpu::thread_pool& pool_, const image_size& size_, int arg_, double min_time_)
+			: pool(pool_), size(size_), rows(size_.rows), cols(size_.cols), arg(arg_)
+			, bytes_per_pixel(0.0), iterations(0), seconds(0.0), min_time(min_time_)
+		{
+		}
+
+		// Test pattern planes, index selects the plane, index 0 holds the source image
+		amp::cpu::plane<float>& plane_32f(int index) { return get_plane(planes_32f, index, 255.0f); }
+		amp::cpu::plane<unsigned char>& plane_8u(int index) { return get_plane(planes_8u, index, 255.0f); }
+		amp::cpu::plane<unsigned short>& plane_16u(int index) { return get_plane(planes_16u, index, 65535.0f); }
+
+		// Compulsory traffic of one call(source reads + destination writes), used for the bandwidth figures
+		void set_bytes_per_pixel(double bytes)
+		{
+			bytes_per_pixel = bytes;
+		}
+
+		// Warm up once, then repeat func until min_time has elapsed
+		template<typename Func>
+		void run(const Func& func)
+		{
+			func();
+			iterations = 0;
+			auto start = std::chrono::steady_clock::now();
+			std::chrono::duration<double> elapsed;
+			do
+			{
+				func();
+				iterations++;
+				elapsed = std::chrono::steady_clock::now() - start;
+			} while(elapsed.count() < min_time);
+			seconds = elapsed.count();
+		}
+
+		amp::cpu::thread_pool& pool;
+		const image_size& size;
+		const int rows;
+		const int cols;
+		const int arg;
+		double bytes_per_pixel;
+		long long iterations;
+		double seconds;
+
+	private:
+		template<typename T>
+		amp::cpu::plane<T>& get_plane(std::vector<std::unique_ptr<amp::cpu::plane<T>>>& planes, int index, float max_value)
+		{
+			if(int(planes.size()) <= index)
+			{
+				planes.resize(index + 1);
+			}
+			if(!planes[index])
+			{
+				planes[index].reset(new amp::cpu::plane<T>(rows, cols));
+				// smooth gradient with texture so thresholds and histograms see a spread of values
+				amp::cpu::plane_view<T> view = planes[index]->view();
+				pool.parallel_for(0, rows, [&](int row_first, int row_last)
+				{
+					for(int r = row_first; r < row_last; r++)
+					{
+						for(int c = 0; c < cols; c++)
+						{
+							unsigned int v = (unsigned(r) * 7u + unsigned(c) * 13u + ((unsigned(r) * unsigned(c) >> 3) & 0x3f)) & 0xff;
+							view(r, c) = T(float(v) * max_value / 255.0f);
+						}
+					}
+				});
+			}
+			return *planes[index];
+		}
+
+		double min_time;
+		std::vector<std::unique_ptr<amp::cpu::plane<float>>> planes_32f;
+		std::vector<std::unique_ptr<amp::cpu::plane<unsigned char>>> planes_8u;
+		std::vector<std::unique_ptr<amp::cpu::plane<unsigned short>>> planes_16u;
+	};
+
+	struct benchmark
+	{
+		std::string name;
+		std::vector<int> args;
+		std::function<void(state&)> func;
+	};
+
+	inline std::vector<benchmark>& registry()
+	{
+		static std::vector<benchmark> benchmarks;
+		return benchmarks;
+	}
+
+	struct registrar
+	{
+		registrar(const char* name, std::function<void(state&)> func, std::vector<int> args = { 0 })
+		{
+			registry().push_back({ name, std::move(args), std::move(func) });
+		}
+	};
+
+	// STREAM copy bandwidth in bytes/s(read + write counted, as STREAM does) over buffers well past the last level cache
+	inline double stream_copy_bandwidth(amp::cpu::thread_pool& pool, double min_time)
+	{
+		const size_t count = size_t(64) << 20 >> 3;
+		std::vector<double> a(count, 1.0), b(count, 0.0);
+		int chunk_count = pool.size() * 4;
+		size_t chunk = (count + chunk_count - 1) / chunk_count;
+		auto copy = [&]()
+		{
+			pool.parallel_for(0, chunk_count, 1, [&](int first, int last)
+			{
+				for(int i = first; i < last; i++)
+				{
+					size_t begin = std::min(count, size_t(i) * chunk);
+					size_t end = std::min(count, begin + chunk);
+					std::memcpy(b.data() + begin, a.data() + begin, (end - begin) * sizeof(double));
+				}
+			});
+		};
+		// best of several timed copies, as STREAM reports
+		copy();
+		double best = 1.0e30;
+		auto start = std::chrono::steady_clock::now();
+		do
+		{
+			auto t0 = std::chrono::steady_clock::now();
+			copy();
+			best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+		} while(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < min_time);
+		return 2.0 * sizeof(double) * count / best;
+	}
+
+	inline void json_escape(FILE* file, const std::string& text)
+	{
+		fputc('"', file);
+		for(char ch : text)
+		{
+			if(ch == '"' || ch == '\\') fputc('\\', file);
+			fputc(ch, file);
+		}
+		fputc('"', file);
+	}
+
+	// Same layout as Google Benchmark's --benchmark_format=json so existing diff tools work
+	inline bool write_json(const char* path, const std::vector<result>& results, int threads, const char* simd, double stream_bandwidth)
+	{
+		FILE* file = fopen(path, "w");
+		if(!file)
+		{
+			return false;
+		}
+		char date[64];
+		time_t now = time(nullptr);
+		strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+		fprintf(file, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"num_threads\": %d,\n    \"simd_level\": \"%s\",\n", date, threads, simd);
+		fprintf(file, "    \"stream_copy_gb_per_s\": %.3f\n  },\n  \"benchmarks\": [\n", stream_bandwidth / 1.0e9);
+		for(size_t i = 0; i < results.size(); i++)
+		{
+			const result& r = results[i];
+			double per_iter = r.seconds / double(r.iterations);
+			double pixels = double(r.rows) * r.cols;
+			double bandwidth = pixels * r.bytes_per_pixel / per_iter;
+			std::string full_name = r.name + "/" + r.size + (r.arg ? "/" + std::to_string(r.arg) : std::string());
+			fprintf(file, "    {\n      \"name\": ");
+			json_escape(file, full_name);
+			fprintf(file, ",\n      \"run_name\": ");
+			json_escape(file, r.name);
+			fprintf(file, ",\n      \"size\": \"%s\",\n      \"rows\": %d,\n      \"cols\": %d,\n      \"arg\": %d,\n", r.size.c_str(), r.rows, r.cols, r.arg);
+			fprintf(file, "      \"run_type\": \"iteration\",\n      \"iterations\": %lld,\n      \"real_time\": %.6f,\n      \"cpu_time\": %.6f,\n      \"time_unit\": \"ms\",\n"
+				, r.iterations, per_iter * 1.0e3, per_iter * 1.0e3);
+			fprintf(file, "      \"mpix_per_s\": %.3f,\n      \"bytes_per_pixel\": %.2f,\n", pixels / per_iter / 1.0e6, r.bytes_per_pixel);
+			fprintf(file, "      \"gb_per_s\": %.3f,\n      \"stream_fraction\": %.4f\n    }%s\n", bandwidth / 1.0e9, bandwidth / stream_bandwidth
+				, i + 1 < results.size() ? "," : "");
+		}
+		fprintf(file, "  ]\n}\n");
+		fclose(file);
+		return true;
+	}
+
+	inline bool has_size(const std::string& list, const char* name)
+	{
+		size_t pos = 0;
+		while(pos <= list.size())
+		{
+			size_t end = list.find(',', pos);
+			if(end == std::string::npos) end = list.size();
+			if(list.compare(pos, end - pos, name) == 0) return true;
+			pos = end + 1;
+		}
+		return false;
+	}
+
+	// --filter=<substring> --sizes=vga,1080p,4k,8k --min_time=<seconds> --threads=<n> --simd=<0..3> --json=<path>
+	inline int run_all(int argc, char* argv[])
+	{
+		std::string filter, sizes = "vga,1080p,4k,8k", json_path;
+		double min_time = 0.25;
+		int threads = 0;
+		for(int i = 1; i < argc; i++)
+		{
+			std::string opt = argv[i];
+			size_t eq = opt.find('=');
+			std::string key = opt.substr(0, eq), value = eq == std::string::npos ? std::string() : opt.substr(eq + 1);
+			if(key == "--filter") filter = value;
+			else if(key == "--sizes") sizes = value;
+			else if(key == "--min_time") min_time = atof(value.c_str());
+			else if(key == "--threads") threads = atoi(value.c_str());
+			else if(key == "--simd") amp::cpu::simd_level_limit() = amp::cpu::simd_level(atoi(value.c_str()));
+			else if(key == "--json") json_path = value;
+			else
+			{
+				fprintf(stderr, "usage: %s [--filter=name] [--sizes=vga,1080p,4k,8k] [--min_time=0.25] [--threads=n] [--simd=0..3] [--json=out.json]\n", argv[0]);
+				return 1;
+			}
+		}
+		std::unique_ptr<amp::cpu::thread_pool> own_pool;
+		if(threads > 0) own_pool.reset(new amp::cpu::thread_pool(threads));
+		amp::cpu::thread_pool& pool = own_pool ? *own_pool : amp::cpu::default_thread_pool();
+		const char* simd_names[] = { "scalar", "sse4", "avx2", "avx512" };
+		const char* simd = simd_names[int(amp::cpu::active_simd_level())];
+		double stream_bandwidth = stream_copy_bandwidth(pool, min_time * 2);
+		printf("%d threads, %s, STREAM copy %.2f GB/s\n", pool.size(), simd, stream_bandwidth / 1.0e9);
+		printf("%-36s %6s %8s %12s %10s %8s %8s %7s\n", "benchmark", "size", "arg", "time(ms)", "Mpix/s", "B/px", "GB/s", "stream");
+		std::vector<result> results;
+		for(const image_size& size : all_sizes())
+		{
+			if(!has_size(sizes, size.name))
+			{
+				continue;
+			}
+			for(const benchmark& b : registry())
+			{
+				if(!filter.empty() && b.name.find(filter) == std::string::npos)
+				{
+					continue;
+				}
+				for(int arg : b.args)
+				{
+					state st(pool, size, arg, min_time);
+					b.func(st);
+					if(st.iterations == 0)
+					{
+						continue;
+					}
+					result r = { b.name, size.name, st.rows, st.cols, arg, st.iterations, st.seconds, st.bytes_per_pixel };
+					double per_iter = r.seconds / double(r.iterations);
+					double pixels = double(r.rows) * r.cols;
+					double bandwidth = pixels * r.bytes_per_pixel / per_iter;
+					printf("%-36s %6s %8d %12.3f %10.1f %8.1f %8.2f %6.1f%%\n", r.name.c_str(), r.size.c_str(), arg, per_iter * 1.0e3
+						, pixels / per_iter / 1.0e6, r.bytes_per_pixel, bandwidth / 1.0e9, 100.0 * bandwidth / stream_bandwidth);
+					fflush(stdout);
+					results.push_back(r);
+				}
+			}
+		}
+		if(!json_path.empty() && !write_json(json_path.c_str(), results, pool.size(), simd, stream_bandwidth))
+		{
+			fprintf(stderr, "can't write %s\n", json_path.c_str());
+			return 1;
+		}
+		return 0;
+	}
+}
+
+#define AMP_BENCHMARK_CONCAT2(a, b) a##b
+#define AMP_BENCHMARK_CONCAT(a, b) AMP_BENCHMARK_CONCAT2(a, b)
+// AMP_BENCHMARK(name, { args... }) { body using st }
+#define AMP_BENCHMARK(name, ...) \
+	static void AMP_BENCHMARK_CONCAT(bench_, name)(bench::state& st); \
+	static bench::registrar AMP_BENCHMARK_CONCAT(bench_registrar_, name)(#name, AMP_BENCHMARK_CONCAT(bench_, name), ##__VA_ARGS__); \
+	static void AMP_BENCHMARK_CONCAT(bench_, name)(bench::state& st)
@@ -0,0 +1,512 @@
+// Throughput of every operator with a CPU backend overload, across image sizes(VGA to 8K), kernel sizes and data types
+// g++ -O2 -std=c++14 -pthread -I../include bench_operators.cpp -lopencv_core -lopencv_imgproc -o bench_operators
+// ./bench_operators --sizes=vga,4k --filter=erode --json=release.json
+
+#include "bench_framework.h"
+#include <amp_gaussian.h>
+#include <amp_bilateral.h>
+#include <amp_sobel.h>
+#include <amp_conv_separable.h>
+#include <amp_erode.h>
+#include <amp_dilate.h>
+#include <amp_median.h>
+#include <amp_open.h>
+#include <amp_close.h>
+#include <amp_tophat.h>
+#include <amp_blackhat.h>
+#include <amp_morph_gradient.h>
+#include <amp_geodesic_dilate.h>
+#include <amp_fill_holes.h>
+#include <amp_delete_border_components.h>
+#include <amp_thining.h>
+#include <amp_pruning.h>
+#include <amp_threshold.h>
+#include <amp_lut.h>
+#include <amp_calc_hist.h>
+#include <amp_ccl.h>
+#include <amp_count_nonzero.h>
+#include <amp_max_min.h>
+#include <amp_mean_stddev.h>
+#include <amp_scale.h>
+#include <amp_retinex.h>
+#include <amp_fusion.h>
+#include <amp_find_best_transform.h>
+#include <amp_batch_diff.h>
+#include <amp_cpu_fft.h>
+#include <amp_conv_auto.h>
+
+using namespace amp;
+
+namespace
+{
+	cv::Mat rect_kernel(int ksize)
+	{
+		return cv::getStructuringElement(cv::MORPH_RECT, cv::Size(ksize, ksize));
+	}
+}
+
+// Upload/download
+AMP_BENCHMARK(load_image_8u)
+{
+	cpu::plane<unsigned char>& src = st.plane_8u(0);
+	cpu::plane<float>& dest = st.plane_32f(1);
+	vision_context ctx(st.pool);
+	image_view view(src.view().data, st.rows, st.cols, pixel_depth::u8, 1, src.view().step);
+	st.set_bytes_per_pixel(1 + 4);
+	st.run([&]() { ctx.load_image(view, dest.view()); });
+}
+
+AMP_BENCHMARK(save_image_8u)
+{
+	cpu::plane<float>& src = st.plane_32f(0);
+	cpu::plane<unsigned char>& dest = st.plane_8u(1);
+	vision_context ctx(st.pool);
+	image_view view(dest.view().data, st.rows, st.cols, pixel_depth::u8, 1, dest.view().step);
+	st.set_bytes_per_pixel(4 + 1);
+	st.run([&]() { ctx.save_image(src.view(), view); });
+}
+
+// Linear filters
+AMP_BENCHMARK(gaussian_filter_32f_c1, { 3, 7, 15, 31 })
+{
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { gaussian_filter_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2), st.arg, 0.0f); });
+}
+
+AMP_BENCHMARK(convolve_by_row_32f_c1, { 3, 7, 15, 31 })
+{
+	cv::Mat k = cv::getGaussianKernel(st.arg, 0.0, CV_32F);
+	kernel_wrapper<float, 64U> wrapped(k);
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { convolve_by_row_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), wrapped); });
+}
+
+AMP_BENCHMARK(convolve_by_column_32f_c1, { 3, 7, 15, 31 })
+{
+	cv::Mat k = cv::getGaussianKernel(st.arg, 0.0, CV_32F);
+	kernel_wrapper<float, 64U> wrapped(k);
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { convolve_by_column_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), wrapped); });
+}
+
+AMP_BENCHMARK(sobel_filter_32f_c1, { 3, 5, 7 })
+{
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { sobel_filter_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2), 1, 0, st.arg); });
+}
+
+// Morphology, one benchmark per data type
+AMP_BENCHMARK(erode_32f_c1, { 3, 5, 9, 13 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { erode_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2), k); });
+}
+
+AMP_BENCHMARK(erode_8u_c1, { 3, 5, 9, 13 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(1 + 1);
+	st.run([&]() { erode_8u_c1(st.pool, st.plane_8u(0), st.plane_8u(1), st.plane_8u(2), k); });
+}
+
+AMP_BENCHMARK(erode_16u_c1, { 3, 5, 9, 13 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(2 + 2);
+	st.run([&]() { erode_16u_c1(st.pool, st.plane_16u(0), st.plane_16u(1), st.plane_16u(2), k); });
+}
+
+AMP_BENCHMARK(dilate_32f_c1, { 3, 5, 9, 13 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { dilate_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2), k); });
+}
+
+AMP_BENCHMARK(dilate_8u_c1, { 3, 5, 9, 13 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(1 + 1);
+	st.run([&]() { dilate_8u_c1(st.pool, st.plane_8u(0), st.plane_8u(1), st.plane_8u(2), k); });
+}
+
+AMP_BENCHMARK(dilate_16u_c1, { 3, 5, 9, 13 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(2 + 2);
+	st.run([&]() { dilate_16u_c1(st.pool, st.plane_16u(0), st.plane_16u(1), st.plane_16u(2), k); });
+}
+
+// Rectangles of any size, the time per pixel should stay flat as the kernel grows
+AMP_BENCHMARK(erode_rect_32f_c1, { 3, 13, 31, 61 })
+{
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { erode_rect_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.arg, st.arg); });
+}
+
+AMP_BENCHMARK(erode_rect_8u_c1, { 3, 13, 31, 61 })
+{
+	st.set_bytes_per_pixel(1 + 1);
+	st.run([&]() { erode_rect_8u_c1(st.pool, st.plane_8u(0), st.plane_8u(1), st.arg, st.arg); });
+}
+
+AMP_BENCHMARK(dilate_rect_32f_c1, { 3, 13, 31, 61 })
+{
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { dilate_rect_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.arg, st.arg); });
+}
+
+// 3/5 run the sorting networks, larger windows the histogram median
+AMP_BENCHMARK(median_8u_c1, { 3, 5, 7, 15, 31 })
+{
+	st.set_bytes_per_pixel(1 + 1);
+	st.run([&]() { median_filter_8u_c1(st.pool, st.plane_8u(0), st.plane_8u(1), st.arg); });
+}
+
+AMP_BENCHMARK(median_16u_c1, { 3, 5, 7, 15, 31 })
+{
+	st.set_bytes_per_pixel(2 + 2);
+	st.run([&]() { median_filter_16u_c1(st.pool, st.plane_16u(0), st.plane_16u(1), st.arg); });
+}
+
+// arg is the exact window d, sigma_space = d / 6; the grid time should stay flat as d grows
+AMP_BENCHMARK(bilateral_32f_c1, { 7, 13, 25, 49 })
+{
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { bilateral_filter_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.arg, 25.0f, st.arg / 6.0f); });
+}
+
+AMP_BENCHMARK(bilateral_grid_32f_c1, { 7, 13, 25, 49 })
+{
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { bilateral_grid_filter_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), 25.0f, st.arg / 6.0f); });
+}
+
+AMP_BENCHMARK(open_32f_c1, { 3, 5, 9 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { open_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2), k); });
+}
+
+AMP_BENCHMARK(open_8u_c1, { 3, 5, 9 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(1 + 1);
+	st.run([&]() { open_8u_c1(st.pool, st.plane_8u(0), st.plane_8u(1), st.plane_8u(2), k); });
+}
+
+AMP_BENCHMARK(open_16u_c1, { 3, 5, 9 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(2 + 2);
+	st.run([&]() { open_16u_c1(st.pool, st.plane_16u(0), st.plane_16u(1), st.plane_16u(2), k); });
+}
+
+AMP_BENCHMARK(close_32f_c1, { 3, 5, 9 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { close_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2), k); });
+}
+
+AMP_BENCHMARK(close_8u_c1, { 3, 5, 9 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(1 + 1);
+	st.run([&]() { close_8u_c1(st.pool, st.plane_8u(0), st.plane_8u(1), st.plane_8u(2), k); });
+}
+
+AMP_BENCHMARK(close_16u_c1, { 3, 5, 9 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(2 + 2);
+	st.run([&]() { close_16u_c1(st.pool, st.plane_16u(0), st.plane_16u(1), st.plane_16u(2), k); });
+}
+
+AMP_BENCHMARK(top_hat_32f_c1, { 3, 5, 9 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { top_hat_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2), k); });
+}
+
+AMP_BENCHMARK(black_hat_32f_c1, { 3, 5, 9 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { black_hat_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2), k); });
+}
+
+AMP_BENCHMARK(morph_gradient_32f_c1, { 3, 5, 9 })
+{
+	cv::Mat k = rect_kernel(st.arg);
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { morph_gradient_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2), k); });
+}
+
+// Point operations
+AMP_BENCHMARK(geodesic_dilate_32f_c1)
+{
+	// reconstruction of the image from its 15x15 erosion(opening by reconstruction)
+	cpu::plane<float>& marker = st.plane_32f(1);
+	erode_32f_c1(st.pool, st.plane_32f(0), marker, st.plane_32f(2), cv::Mat::ones(15, 15, CV_8UC1));
+	st.set_bytes_per_pixel(4 + 4 + 4);
+	st.run([&]() { geodesic_dilate_32f_c1(st.pool, marker, st.plane_32f(2), st.plane_32f(0), st.plane_32f(3)); });
+}
+
+AMP_BENCHMARK(fill_holes_32f_c1)
+{
+	cpu::plane<float>& binary = st.plane_32f(1);
+	threshold_32f_c1(st.pool, st.plane_32f(0), binary, 128.0f, 255.0f, cv::THRESH_BINARY);
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { fill_holes_32f_c1(st.pool, binary, st.plane_32f(2)); });
+}
+
+AMP_BENCHMARK(delete_border_components_32f_c1)
+{
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { delete_border_components_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2)); });
+}
+
+AMP_BENCHMARK(thinning_32f_c1)
+{
+	cpu::plane<float>& binary = st.plane_32f(1);
+	threshold_32f_c1(st.pool, st.plane_32f(0), binary, 128.0f, 255.0f, cv::THRESH_BINARY);
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { thinning_32f_c1(st.pool, binary, st.plane_32f(2), st.plane_32f(3)); });
+}
+
+AMP_BENCHMARK(pruning_32f_c1, { 5, 15 })
+{
+	cpu::plane<float>& binary = st.plane_32f(1);
+	threshold_32f_c1(st.pool, st.plane_32f(0), binary, 128.0f, 255.0f, cv::THRESH_BINARY);
+	thinning_32f_c1(st.pool, binary, binary, st.plane_32f(2));
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { pruning_32f_c1(st.pool, binary, st.plane_32f(2), st.plane_32f(3), st.plane_32f(4), st.arg); });
+}
+
+AMP_BENCHMARK(threshold_32f_c1)
+{
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { threshold_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), 128.0f, 255.0f, cv::THRESH_BINARY); });
+}
+
+AMP_BENCHMARK(threshold_8u_c1)
+{
+	st.set_bytes_per_pixel(1 + 1);
+	st.run([&]() { threshold_8u_c1(st.pool, st.plane_8u(0), st.plane_8u(1), 128.0f, 255.0f, cv::THRESH_BINARY); });
+}
+
+AMP_BENCHMARK(threshold_16u_c1)
+{
+	st.set_bytes_per_pixel(2 + 2);
+	st.run([&]() { threshold_16u_c1(st.pool, st.plane_16u(0), st.plane_16u(1), 32768.0f, 65535.0f, cv::THRESH_BINARY); });
+}
+
+AMP_BENCHMARK(threshold_otsu_8u_c1)
+{
+	// histogram pass + threshold pass
+	st.set_bytes_per_pixel(1 + 1 + 1);
+	st.run([&]() { threshold_8u_c1(st.pool, st.plane_8u(0), st.plane_8u(1), 0.0f, 255.0f, cv::THRESH_BINARY | cv::THRESH_OTSU); });
+}
+
+AMP_BENCHMARK(lut_32f_c1)
+{
+	std::vector<float> table(256);
+	for(int i = 0; i < 256; i++) table[i] = 255.0f - float(i);
+	cpu::plane_view<const float> src = st.plane_32f(0).view();
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { lut_32f_c1(st.pool, src, table, st.plane_32f(1).view()); });
+}
+
+AMP_BENCHMARK(lut_8u_c1)
+{
+	std::vector<unsigned char> table(256);
+	for(int i = 0; i < 256; i++) table[i] = (unsigned char)(255 - i);
+	st.set_bytes_per_pixel(1 + 1);
+	st.run([&]() { lut_8u_c1(st.pool, st.plane_8u(0), table, st.plane_8u(1)); });
+}
+
+AMP_BENCHMARK(lut_16u_c1)
+{
+	std::vector<unsigned short> table(65536);
+	for(int i = 0; i < 65536; i++) table[i] = (unsigned short)(65535 - i);
+	st.set_bytes_per_pixel(2 + 2);
+	st.run([&]() { lut_16u_c1(st.pool, st.plane_16u(0), table, st.plane_16u(1)); });
+}
+
+AMP_BENCHMARK(scale_to_range_32f_c1)
+{
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { scale_to_range_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2), 255.0f, 0.01f); });
+}
+
+AMP_BENCHMARK(scale_by_stddev_32f_c1)
+{
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { scale_by_stddev_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), 255.0f, 3.0f); });
+}
+
+AMP_BENCHMARK(retinex_32f_c1, { 7, 15, 31 })
+{
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { retinex_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), st.plane_32f(2), st.plane_32f(3), st.arg, 0.0f); });
+}
+
+AMP_BENCHMARK(fusion_threshold_top_hat_32f_c1, { 3, 5, 9 })
+{
+	kernel_wrapper<float, 169U> k(rect_kernel(st.arg));
+	auto in = fusion::input(st.plane_32f(0));
+	st.set_bytes_per_pixel(4 + 4);
+	st.run([&]() { fusion::evaluate(st.pool, fusion::threshold(in - fusion::dilate(fusion::erode(in, k), k), 20.0f, 255.0f, cv::THRESH_BINARY), st.plane_32f(1)); });
+}
+
+// Reductions
+AMP_BENCHMARK(calc_hist_32f_c1)
+{
+	std::vector<int> hist;
+	st.set_bytes_per_pixel(4);
+	st.run([&]() { calc_hist_32f_c1(st.pool, st.plane_32f(0), hist); });
+}
+
+AMP_BENCHMARK(calc_hist_8u_c1)
+{
+	std::vector<int> hist;
+	st.set_bytes_per_pixel(1);
+	st.run([&]() { calc_hist_8u_c1(st.pool, st.plane_8u(0), hist); });
+}
+
+AMP_BENCHMARK(calc_hist_16u_c1)
+{
+	std::vector<int> hist;
+	st.set_bytes_per_pixel(2);
+	st.run([&]() { calc_hist_16u_c1(st.pool, st.plane_16u(0), hist); });
+}
+
+AMP_BENCHMARK(count_nonzero_32f_c1)
+{
+	st.set_bytes_per_pixel(4);
+	st.run([&]() { count_nonzero_32f_c1(st.pool, st.plane_32f(0)); });
+}
+
+AMP_BENCHMARK(count_nonzero_8u_c1)
+{
+	st.set_bytes_per_pixel(1);
+	st.run([&]() { count_nonzero_8u_c1(st.pool, st.plane_8u(0)); });
+}
+
+AMP_BENCHMARK(count_nonzero_16u_c1)
+{
+	st.set_bytes_per_pixel(2);
+	st.run([&]() { count_nonzero_16u_c1(st.pool, st.plane_16u(0)); });
+}
+
+AMP_BENCHMARK(max_min_value_32f_c1)
+{
+	st.set_bytes_per_pixel(4);
+	st.run([&]() { max_min_value_32f_c1(st.pool, st.plane_32f(0)); });
+}
+
+AMP_BENCHMARK(mean_std_dev_32f_c1)
+{
+	st.set_bytes_per_pixel(4);
+	st.run([&]() { mean_std_dev_32f_c1(st.pool, st.plane_32f(0)); });
+}
+
+AMP_BENCHMARK(label_binary_components_8u_c1)
+{
+	// binary mask made outside the timing, labels are written as int
+	cpu::plane<unsigned char> binary(st.rows, st.cols);
+	threshold_8u_c1(st.pool, st.plane_8u(0), binary, 128.0f, 255.0f, cv::THRESH_BINARY);
+	cpu::plane<int> labels(st.rows, st.cols);
+	std::vector<component_stats> stats;
+	st.set_bytes_per_pixel(1 + 4);
+	st.run([&]() { label_binary_components_8u_c1(st.pool, binary, labels, stats); });
+}
+
+AMP_BENCHMARK(find_best_transform_inverse)
+{
+	// a quarter-size patch of the image against 7 x 7 x 7 rotations and shifts around its true position
+	cpu::plane<float>& image = st.plane_32f(0);
+	const int templ_rows = st.rows / 4, templ_cols = st.cols / 4;
+	cpu::plane<float> templ(templ_rows, templ_cols);
+	cpu::copy<float>(st.pool, cpu::plane_view<const float>(image.view().row(st.rows / 3) + st.cols / 3, templ_rows, templ_cols, image.view().step), templ);
+	std::vector<cv::Matx23f> transforms;
+	for(int angle = -3; angle <= 3; angle++)
+	{
+		const float alpha = std::cos(angle * 0.005f), beta = std::sin(angle * 0.005f);
+		for(int dx = -3; dx <= 3; dx++)
+		{
+			for(int dy = -3; dy <= 3; dy++)
+			{
+				transforms.push_back(cv::Matx23f(alpha, beta, st.cols / 3 + dx + 0.25f, -beta, alpha, st.rows / 3 + dy + 0.25f));
+			}
+		}
+	}
+	st.set_bytes_per_pixel(4);
+	st.run([&]() { find_best_transform_inverse(st.pool, templ, image, transforms); });
+}
+
+AMP_BENCHMARK(batch_nearest_32f_c1, { 1, 8 })
+{
+	// image rows are the references, 4 of them shifted by one pixel are the inputs
+	cpu::plane<float>& refs = st.plane_32f(0);
+	cpu::plane<float> inputs(4, st.cols);
+	for(int i = 0; i < inputs.view().rows; i++)
+	{
+		std::copy(refs.view().row(i * st.rows / 4), refs.view().row(i * st.rows / 4) + st.cols - 1, inputs.view().row(i) + 1);
+	}
+	cpu::plane<int> indices(4, st.arg);
+	cpu::plane<float> dists(4, st.arg);
+	st.set_bytes_per_pixel(4);
+	st.run([&]() { batch_nearest_32f_c1(st.pool, inputs, refs, st.arg, indices, dists); });
+}
+
+AMP_BENCHMARK(fft_forward_r2c_2d)
+{
+	cpu::plane<std::complex<float>> spectrum(st.rows, cpu::fft_half_cols(st.cols));
+	st.set_bytes_per_pixel(4);
+	st.run([&]() { cpu::fft_forward_r2c_2d(st.pool, st.plane_32f(0), spectrum); });
+}
+
+AMP_BENCHMARK(fft_inverse_c2r_2d)
+{
+	cpu::plane<std::complex<float>> spectrum(st.rows, cpu::fft_half_cols(st.cols));
+	cpu::plane<float> image(st.rows, st.cols);
+	cpu::fft_forward_r2c_2d(st.pool, st.plane_32f(0), spectrum);
+	st.set_bytes_per_pixel(4);
+	st.run([&]() { cpu::fft_inverse_c2r_2d(st.pool, spectrum, image, 1.0f / (st.rows * st.cols)); });
+}
+
+AMP_BENCHMARK(convolve2d_32f_c1, { 5, 15, 31 })
+{
+	// dense arg x arg kernel, neither rank 1 nor point symmetric
+	cv::Mat kernel(st.arg, st.arg, CV_32FC1);
+	for(int i = 0; i < kernel.rows * kernel.cols; i++)
+	{
+		kernel.ptr<float>(0)[i] = float(i * 31 % 17) - 8.0f;
+	}
+	st.set_bytes_per_pixel(8);
+	st.run([&]() { convolve2d_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), kernel); });
+}
+
+AMP_BENCHMARK(convolve_auto_32f_c1, { 5, 15, 31, 63 })
+{
+	// the convolve2d_32f_c1 kernel, 31 and 63 go to FFT tiles
+	cv::Mat kernel(st.arg, st.arg, CV_32FC1);
+	for(int i = 0; i < kernel.rows * kernel.cols; i++)
+	{
+		kernel.ptr<float>(0)[i] = float(i * 31 % 17) - 8.0f;
+	}
+	// calibration stays out of the timing
+	default_conv_cost_model();
+	st.set_bytes_per_pixel(8);
+	st.run([&]() { convolve_auto_32f_c1(st.pool, st.plane_32f(0), st.plane_32f(1), kernel); });
+}
+
+int main(int argc, char* argv[])
+{
+	return bench::run_all(argc, argv);
+}
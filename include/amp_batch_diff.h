@@ -1,10 +1,27 @@
-#pragma once
+﻿#pragma once
 
+#include <cfloat>
+#include <cmath>
 #include "amp_core.h"
 #include "amp_warp_affine.h"
 
 namespace amp
 {
+	// pose transform of load_ref_images and quantized_ref_library
+	inline kernel_wrapper<float, 6U> get_euclidean_transform(float translation_x, float translation_y, float rotation)
+	{
+		kernel_wrapper<float, 6U> result;
+		float radian = float(rotation * CV_PI / 180.0);
+		result.data[0] = std::cos(radian);
+		result.data[1] = -std::sin(radian);
+		result.data[2] = translation_x;
+		result.data[3] = std::sin(radian);
+		result.data[4] = std::cos(radian);
+		result.data[5] = translation_y;
+		return result;
+	}
+
+#if AMP_HAS_CPP_AMP
 	inline void load_image_rois_32f_c1(vision_context& ctx, const cv::Mat& src_mat, const std::vector<cv::Rect> rois, array_view<float, 2> dest_array)
 	{
 		concurrency::array<float, 2> gpu_src_mat(src_mat.rows, src_mat.cols, ctx.acc_view);
@@ -37,19 +54,6 @@ namespace amp
 		}
 	}
 
-	inline kernel_wrapper<float, 6U> get_euclidean_transform(float translation_x, float translation_y, float rotation)
-	{
-		kernel_wrapper<float, 6U> result;
-		float radian = float(rotation * CV_PI / 180.0);
-		result.data[0] = std::cosf(radian);
-		result.data[1] = -std::sinf(radian);
-		result.data[2] = translation_x;
-		result.data[3] = std::sinf(radian);
-		result.data[4] = std::cosf(radian);
-		result.data[5] = translation_y;
-		return result;
-	}
-
 	inline void load_ref_images(vision_context& ctx, const std::vector<cv::Mat>& ref_images, int translation_steps = 2, int rotation_steps = 10
 		, float border_value = 255.0F, float translation_interval = 1.0f, float rotation_interval = 0.1f)
 	{
@@ -289,4 +293,452 @@ namespace amp
 			if (local_col == 0) amp::guarded_write(diff_array, concurrency::index<1>(ref_index), float(output_cache[local_row][0] + output_cache[local_row][1] + output_cache[local_row][2] + output_cache[local_row][3]));
 		});
 	}
+
+	namespace detail
+	{
+		// nearest reference order: smaller distance first, the smaller reference index on ties
+		inline bool nearest_before(float dist, int index, float other_dist, int other_index) restrict(cpu, amp)
+		{
+			return dist < other_dist || (dist == other_dist && unsigned(index) < unsigned(other_index));
+		}
+	}
+
+	// k nearest references of every input row by euclidean distance, without writing the inputs x refs matrix.
+	// Each tile takes 16 inputs and walks all references 16 at a time: ||ref||^2 - 2 input.ref is accumulated GEMM style
+	// from tile_static blocks and inserted into a top-k list kept in registers per thread, the 16 lists of an input are merged
+	// at the end and the merged k are scored again as sum((input - ref)^2).
+	// index_array and dist_array are inputs x k, ascending; slots beyond the reference count get index -1 and FLT_MAX.
+	template<int max_k = 8>
+	inline void batch_nearest_32f_c1(accelerator_view& acc_view, array_view<const float, 2> input_array, array_view<const float, 2> ref_array, int k
+		, array_view<int, 2> index_array, array_view<float, 2> dist_array)
+	{
+		static const int tile_size = 16;
+		int input_count = input_array.extent[0];
+		int ref_count = ref_array.extent[0];
+		int cols = input_array.extent[1];
+		if (k < 1 || k > max_k || ref_array.extent[1] != cols || index_array.extent != concurrency::extent<2>(input_count, k) || dist_array.extent != index_array.extent)
+		{
+			throw std::runtime_error("invalid arguments of batch_nearest_32f_c1");
+		}
+		if (input_count == 0 || ref_count == 0)
+		{
+			index_array.discard_data();
+			dist_array.discard_data();
+			concurrency::parallel_for_each(acc_view, index_array.extent, [=](concurrency::index<2> idx) restrict(amp) {
+				index_array(idx) = -1;
+				dist_array(idx) = FLT_MAX;
+			});
+			return;
+		}
+		concurrency::array<float, 1> ref_norms(std::max(ref_count, 1), acc_view);
+		concurrency::parallel_for_each(acc_view, concurrency::extent<1>(ref_count), [=, &ref_norms](concurrency::index<1> idx) restrict(amp) {
+			float sum = 0.0f;
+			for (int i = 0; i < cols; i++)
+			{
+				float value = ref_array(idx[0], i);
+				sum = direct3d::mad(value, value, sum);
+			}
+			ref_norms(idx) = sum;
+		});
+		concurrency::extent<2> ext(input_count, tile_size);
+		concurrency::parallel_for_each(acc_view, ext.tile<tile_size, tile_size>().pad(), [=, &ref_norms](concurrency::tiled_index<tile_size, tile_size> idx) restrict(amp) {
+			tile_static float input_cache[tile_size][tile_size];
+			tile_static float ref_cache[tile_size][tile_size + 1];
+			tile_static float merge_dist[tile_size][tile_size * max_k];
+			tile_static int merge_index[tile_size][tile_size * max_k];
+			int local_input = idx.local[0];
+			int lane = idx.local[1];
+			int input_index = idx.tile_origin[0] + local_input;
+			float best_dist[max_k];
+			int best_index[max_k];
+			for (int j = 0; j < max_k; j++)
+			{
+				best_dist[j] = FLT_MAX;
+				best_index[j] = -1;
+			}
+			for (int ref_start = 0; ref_start < ref_count; ref_start += tile_size)
+			{
+				float dot = 0.0f;
+				for (int i = 0; i < ROUNDUP(cols, tile_size); i += tile_size)
+				{
+					input_cache[local_input][lane] = amp::guarded_read(input_array, concurrency::index<2>(input_index, i + lane));
+					ref_cache[local_input][lane] = amp::guarded_read(ref_array, concurrency::index<2>(ref_start + local_input, i + lane));
+					idx.barrier.wait_with_tile_static_memory_fence();
+					for (int j = 0; j < tile_size; j++)
+					{
+						dot = direct3d::mad(input_cache[local_input][j], ref_cache[lane][j], dot);
+					}
+					idx.barrier.wait_with_tile_static_memory_fence();
+				}
+				int ref_index = ref_start + lane;
+				// ||input||^2 is the same for every reference and left out of the ranking
+				float dist = ref_index < ref_count ? direct3d::mad(-2.0f, dot, ref_norms(ref_index)) : FLT_MAX;
+				if (ref_index < ref_count && detail::nearest_before(dist, ref_index, best_dist[k - 1], best_index[k - 1]))
+				{
+					int j = k - 1;
+					for (; j > 0 && detail::nearest_before(dist, ref_index, best_dist[j - 1], best_index[j - 1]); j--)
+					{
+						best_dist[j] = best_dist[j - 1];
+						best_index[j] = best_index[j - 1];
+					}
+					best_dist[j] = dist;
+					best_index[j] = ref_index;
+				}
+			}
+			for (int j = 0; j < k; j++)
+			{
+				merge_dist[local_input][lane * k + j] = best_dist[j];
+				merge_index[local_input][lane * k + j] = best_index[j];
+			}
+			idx.barrier.wait_with_tile_static_memory_fence();
+			if (lane == 0)
+			{
+				for (int c = k; c < tile_size * k; c++)
+				{
+					float dist = merge_dist[local_input][c];
+					int ref_index = merge_index[local_input][c];
+					if (detail::nearest_before(dist, ref_index, best_dist[k - 1], best_index[k - 1]))
+					{
+						int j = k - 1;
+						for (; j > 0 && detail::nearest_before(dist, ref_index, best_dist[j - 1], best_index[j - 1]); j--)
+						{
+							best_dist[j] = best_dist[j - 1];
+							best_index[j] = best_index[j - 1];
+						}
+						best_dist[j] = dist;
+						best_index[j] = ref_index;
+					}
+				}
+				for (int j = 0; j < k; j++)
+				{
+					merge_index[local_input][j] = best_index[j];
+				}
+			}
+			idx.barrier.wait_with_tile_static_memory_fence();
+			// the expansion cancels badly for close images, the reported distances are summed directly
+			if (lane < k)
+			{
+				int ref_index = merge_index[local_input][lane];
+				float sum = FLT_MAX;
+				if (input_index < input_count && ref_index >= 0)
+				{
+					sum = 0.0f;
+					for (int i = 0; i < cols; i++)
+					{
+						float diff = input_array(input_index, i) - ref_array(ref_index, i);
+						sum = direct3d::mad(diff, diff, sum);
+					}
+				}
+				merge_dist[local_input][lane] = sum;
+			}
+			idx.barrier.wait_with_tile_static_memory_fence();
+			if (lane == 0 && input_index < input_count)
+			{
+				for (int j = 0; j < k; j++)
+				{
+					best_dist[j] = merge_dist[local_input][j];
+					best_index[j] = merge_index[local_input][j];
+					for (int m = j; m > 0 && detail::nearest_before(best_dist[m], best_index[m], best_dist[m - 1], best_index[m - 1]); m--)
+					{
+						float swap_dist = best_dist[m];
+						int swap_index = best_index[m];
+						best_dist[m] = best_dist[m - 1];
+						best_index[m] = best_index[m - 1];
+						best_dist[m - 1] = swap_dist;
+						best_index[m - 1] = swap_index;
+					}
+				}
+				for (int j = 0; j < k; j++)
+				{
+					index_array(input_index, j) = best_index[j];
+					dist_array(input_index, j) = best_index[j] >= 0 ? fast_math::sqrtf(best_dist[j]) : FLT_MAX;
+				}
+			}
+		});
+	}
+#endif
+
+	namespace detail
+	{
+		// nearest reference order on the CPU, see the AMP version
+		inline bool cpu_nearest_before(float dist, int index, float other_dist, int other_index)
+		{
+			return dist < other_dist || (dist == other_dist && unsigned(index) < unsigned(other_index));
+		}
+
+		// sorted insertion into a k entry list
+		inline void insert_nearest(float* dists, int* indices, int k, float dist, int index)
+		{
+			if (!cpu_nearest_before(dist, index, dists[k - 1], indices[k - 1]))
+			{
+				return;
+			}
+			int j = k - 1;
+			for (; j > 0 && cpu_nearest_before(dist, index, dists[j - 1], indices[j - 1]); j--)
+			{
+				dists[j] = dists[j - 1];
+				indices[j] = indices[j - 1];
+			}
+			dists[j] = dist;
+			indices[j] = index;
+		}
+
+		// 4 inputs x 4 references block of dot products over columns [first, last), added to dots
+		static const int nearest_block = 4;
+
+		inline void nearest_dots_scalar(const float* const* a, const float* const* b, int first, int last, float dots[4][4])
+		{
+			for (int i = 0; i < nearest_block; i++)
+			{
+				for (int r = 0; r < nearest_block; r++)
+				{
+					float sum = 0.0f;
+					for (int c = first; c < last; c++)
+					{
+						sum += a[i][c] * b[r][c];
+					}
+					dots[i][r] += sum;
+				}
+			}
+		}
+
+#if AMP_CPU_X86
+		AMP_CPU_TARGET("avx2,fma")
+		inline float horizontal_sum_avx2(__m256 v)
+		{
+			__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+			sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+			sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+			return _mm_cvtss_f32(sum);
+		}
+
+		// two inputs at a time so the 8 accumulators and 6 loads stay in the 16 ymm registers
+		AMP_CPU_TARGET("avx2,fma")
+		inline void nearest_dots_avx2(const float* const* a, const float* const* b, int first, int last, float dots[4][4])
+		{
+			int vec_last = first + (last - first) / 8 * 8;
+			for (int i = 0; i < nearest_block; i += 2)
+			{
+				__m256 acc[2][4];
+				for (int r = 0; r < 4; r++)
+				{
+					acc[0][r] = _mm256_setzero_ps();
+					acc[1][r] = _mm256_setzero_ps();
+				}
+				for (int c = first; c < vec_last; c += 8)
+				{
+					__m256 a0 = _mm256_loadu_ps(a[i] + c);
+					__m256 a1 = _mm256_loadu_ps(a[i + 1] + c);
+					for (int r = 0; r < 4; r++)
+					{
+						__m256 bv = _mm256_loadu_ps(b[r] + c);
+						acc[0][r] = _mm256_fmadd_ps(a0, bv, acc[0][r]);
+						acc[1][r] = _mm256_fmadd_ps(a1, bv, acc[1][r]);
+					}
+				}
+				for (int r = 0; r < 4; r++)
+				{
+					float sum0 = horizontal_sum_avx2(acc[0][r]);
+					float sum1 = horizontal_sum_avx2(acc[1][r]);
+					for (int c = vec_last; c < last; c++)
+					{
+						sum0 += a[i][c] * b[r][c];
+						sum1 += a[i + 1][c] * b[r][c];
+					}
+					dots[i][r] += sum0;
+					dots[i + 1][r] += sum1;
+				}
+			}
+		}
+
+#if AMP_CPU_AVX512
+		AMP_CPU_TARGET("avx512f")
+		inline void nearest_dots_avx512(const float* const* a, const float* const* b, int first, int last, float dots[4][4])
+		{
+			int vec_last = first + (last - first) / 16 * 16;
+			__m512 acc[4][4];
+			for (int i = 0; i < 4; i++)
+			{
+				for (int r = 0; r < 4; r++)
+				{
+					acc[i][r] = _mm512_setzero_ps();
+				}
+			}
+			for (int c = first; c < vec_last; c += 16)
+			{
+				__m512 bv[4];
+				for (int r = 0; r < 4; r++)
+				{
+					bv[r] = _mm512_loadu_ps(b[r] + c);
+				}
+				for (int i = 0; i < 4; i++)
+				{
+					__m512 av = _mm512_loadu_ps(a[i] + c);
+					for (int r = 0; r < 4; r++)
+					{
+						acc[i][r] = _mm512_fmadd_ps(av, bv[r], acc[i][r]);
+					}
+				}
+			}
+			for (int i = 0; i < 4; i++)
+			{
+				for (int r = 0; r < 4; r++)
+				{
+					float sum = _mm512_reduce_add_ps(acc[i][r]);
+					for (int c = vec_last; c < last; c++)
+					{
+						sum += a[i][c] * b[r][c];
+					}
+					dots[i][r] += sum;
+				}
+			}
+		}
+#endif
+#endif
+
+		inline void nearest_dots(const float* const* a, const float* const* b, int first, int last, float dots[4][4], cpu::simd_level level)
+		{
+#if AMP_CPU_X86
+#if AMP_CPU_AVX512
+			if (level >= cpu::simd_level::avx512)
+			{
+				nearest_dots_avx512(a, b, first, last, dots);
+				return;
+			}
+#endif
+			if (level >= cpu::simd_level::avx2)
+			{
+				nearest_dots_avx2(a, b, first, last, dots);
+				return;
+			}
+#endif
+			(void)level;
+			nearest_dots_scalar(a, b, first, last, dots);
+		}
+	}
+
+	// CPU version of batch_nearest_32f_c1, inputs x cols against refs x cols, any k.
+	// Reference ranges are spread over the pool; every task streams its references in blocks of 64 against 4 inputs at a time,
+	// columns in chunks of 512 so the input rows stay in L1, and keeps per-input top-k lists that are merged at the end.
+	inline void batch_nearest_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> input_array, cpu::plane_view<const float> ref_array, int k
+		, cpu::plane_view<int> index_array, cpu::plane_view<float> dist_array)
+	{
+		static const int ref_block = 64;
+		static const int col_chunk = 512;
+		const int input_count = input_array.rows;
+		const int ref_count = ref_array.rows;
+		const int cols = input_array.cols;
+		if (k < 1 || ref_array.cols != cols || index_array.rows != input_count || index_array.cols != k || dist_array.rows != input_count || dist_array.cols != k)
+		{
+			throw std::runtime_error("invalid arguments of batch_nearest_32f_c1");
+		}
+		const cpu::simd_level level = cpu::active_simd_level();
+		std::vector<float> ref_norms(ref_count);
+		pool.parallel_for(0, ref_count, 64, [&](int first, int last)
+		{
+			for (int r = first; r < last; r++)
+			{
+				const float* ref = ref_array.row(r);
+				double sum = 0.0;
+				for (int c = 0; c < cols; c++)
+				{
+					sum += double(ref[c]) * ref[c];
+				}
+				ref_norms[r] = float(sum);
+			}
+		});
+		std::vector<float> best_dist(size_t(input_count) * k, FLT_MAX);
+		std::vector<int> best_index(size_t(input_count) * k, -1);
+		std::mutex merge_mutex;
+		const int ref_block_count = DIVUP(ref_count, ref_block);
+		const int grain = std::max(1, ref_block_count / int(pool.size() * 4));
+		pool.parallel_for(0, ref_block_count, grain, [&](int first_block, int last_block)
+		{
+			std::vector<float> local_dist(size_t(input_count) * k, FLT_MAX);
+			std::vector<int> local_index(size_t(input_count) * k, -1);
+			std::vector<float> dots(detail::nearest_block * ref_block);
+			const int ref_first = first_block * ref_block;
+			const int ref_last = std::min(ref_count, last_block * ref_block);
+			for (int input_first = 0; input_first < input_count; input_first += detail::nearest_block)
+			{
+				const int inputs = std::min(detail::nearest_block, input_count - input_first);
+				const float* a[detail::nearest_block];
+				for (int i = 0; i < detail::nearest_block; i++)
+				{
+					a[i] = input_array.row(input_first + std::min(i, inputs - 1));
+				}
+				for (int block_first = ref_first; block_first < ref_last; block_first += ref_block)
+				{
+					const int refs = std::min(ref_block, ref_last - block_first);
+					std::fill(dots.begin(), dots.end(), 0.0f);
+					for (int col_first = 0; col_first < cols; col_first += col_chunk)
+					{
+						const int col_last = std::min(cols, col_first + col_chunk);
+						for (int r = 0; r < refs; r += detail::nearest_block)
+						{
+							const float* b[detail::nearest_block];
+							for (int j = 0; j < detail::nearest_block; j++)
+							{
+								b[j] = ref_array.row(block_first + std::min(r + j, refs - 1));
+							}
+							float block_dots[4][4] = {};
+							detail::nearest_dots(a, b, col_first, col_last, block_dots, level);
+							for (int i = 0; i < inputs; i++)
+							{
+								for (int j = 0; j < detail::nearest_block && r + j < refs; j++)
+								{
+									dots[i * ref_block + r + j] += block_dots[i][j];
+								}
+							}
+						}
+					}
+					// ||input||^2 is the same for every reference and left out of the ranking
+					for (int i = 0; i < inputs; i++)
+					{
+						float* dist = &local_dist[size_t(input_first + i) * k];
+						int* index = &local_index[size_t(input_first + i) * k];
+						for (int r = 0; r < refs; r++)
+						{
+							detail::insert_nearest(dist, index, k, ref_norms[block_first + r] - 2.0f * dots[i * ref_block + r], block_first + r);
+						}
+					}
+				}
+			}
+			std::lock_guard<std::mutex> lock(merge_mutex);
+			for (int i = 0; i < input_count; i++)
+			{
+				for (int j = 0; j < k && local_index[size_t(i) * k + j] >= 0; j++)
+				{
+					detail::insert_nearest(&best_dist[size_t(i) * k], &best_index[size_t(i) * k], k, local_dist[size_t(i) * k + j], local_index[size_t(i) * k + j]);
+				}
+			}
+		});
+		// the expansion cancels badly for close images, the reported distances are summed directly
+		pool.parallel_for(0, input_count, 1, [&](int first, int last)
+		{
+			for (int i = first; i < last; i++)
+			{
+				const float* input = input_array.row(i);
+				const int* index = &best_index[size_t(i) * k];
+				std::vector<float> exact_dist(k, FLT_MAX);
+				std::vector<int> exact_index(k, -1);
+				for (int j = 0; j < k && index[j] >= 0; j++)
+				{
+					const float* ref = ref_array.row(index[j]);
+					double sum = 0.0;
+					for (int c = 0; c < cols; c++)
+					{
+						double diff = double(input[c]) - ref[c];
+						sum += diff * diff;
+					}
+					detail::insert_nearest(&exact_dist[0], &exact_index[0], k, float(std::sqrt(sum)), index[j]);
+				}
+				for (int j = 0; j < k; j++)
+				{
+					index_array(i, j) = exact_index[j];
+					dist_array(i, j) = exact_dist[j];
+				}
+			}
+		});
+	}
 }
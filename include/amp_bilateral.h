@@ -1,9 +1,12 @@
 ﻿#pragma once
 
 #include "amp_core.h"
+#include "amp_max_min.h"
+#include "amp_conv_separable.h"
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 #ifdef _DEBUG
 #define MAX_BILATERAL_D 25
 #define MAX_BILATERAL_WEIGHT_SIZE 442U
@@ -70,4 +73,362 @@ namespace amp
 			}
 		});
 	}
+#endif
+
+	namespace detail
+	{
+		// Bilateral grid(Paris/Durand): pixels are splatted to cells of space_cell x space_cell pixels and color_cell values,
+		// the grid of (value sum, weight) pairs is blurred with a gaussian and sliced back with trilinear interpolation.
+		// accuracy is the number of cells per sigma, 1 is the usual setting, higher values are closer to the exact filter and slower.
+		struct bilateral_grid_geometry
+		{
+			bilateral_grid_geometry(int rows, int cols, float min_value_, float max_value, float sigma_color, float sigma_space, float accuracy)
+				: min_value(min_value_)
+			{
+				if(!(accuracy > 0.0f)) throw std::runtime_error("bilateral grid accuracy must be positive");
+				if(sigma_color <= 0.0f)
+					sigma_color = 1.0f;
+				if(sigma_space <= 0.0f)
+					sigma_space = 1.0f;
+				const float range = std::max(max_value - min_value, 0.0f);
+				space_cell = sigma_space / accuracy;
+				color_cell = sigma_color / accuracy;
+				// at most max_cells cells, finer settings coarsen the three axes alike(the exact filter is cheap for sigmas that small)
+				static const double max_cells = double(1 << 23);
+				const double cells = (rows / double(space_cell) + 2.0) * (cols / double(space_cell) + 2.0) * (range / double(color_cell) + 2.0);
+				if(cells > max_cells)
+				{
+					const float scale = float(std::cbrt(cells / max_cells));
+					space_cell *= scale;
+					color_cell *= scale;
+				}
+				grid_rows = int((rows - 1) / space_cell) + 2;
+				grid_cols = int((cols - 1) / space_cell) + 2;
+				depth = int(range / color_cell) + 2;
+				// gaussian of sigma / cell cells along every axis
+				const float blur_sigma = sigma_space / space_cell;
+				radius = std::max(1, int(std::ceil(2.0f * blur_sigma)));
+				taps.resize(2 * radius + 1);
+				float sum = 0.0f;
+				for(int i = -radius; i <= radius; i++)
+				{
+					taps[i + radius] = std::exp(-0.5f * i * i / (blur_sigma * blur_sigma));
+					sum += taps[i + radius];
+				}
+				for(size_t i = 0; i < taps.size(); i++)
+					taps[i] /= sum;
+			}
+
+			// Floats of the grid, cells are (sum, weight) pairs laid out [row][col][depth]
+			size_t size() const
+			{
+				return size_t(grid_rows) * grid_cols * depth * 2;
+			}
+
+			float min_value;
+			float space_cell;
+			float color_cell;
+			int grid_rows;
+			int grid_cols;
+			int depth;
+			int radius;
+			std::vector<float> taps;
+		};
+
+		// Cells first .. last - 1 of a line of count cells, each stride floats wide: dest = sum of taps * src shifted along the line,
+		// cells off the line are empty. Cells with every tap on the line run through the convolution spans.
+		inline void bilateral_grid_blur(const float* src, float* dest, int count, size_t stride, int first, int last, const bilateral_grid_geometry& grid
+			, cpu::simd_level level)
+		{
+			const cpu_conv_kernel k(grid.taps.data(), int(grid.taps.size()));
+			const int inner_first = std::min(last, std::max(first, grid.radius));
+			const int inner_last = std::max(inner_first, std::min(last, count - grid.radius));
+			if(inner_first < inner_last)
+			{
+				std::vector<const float*> taps(k.size);
+				for(int t = 0; t < k.size; t++)
+					taps[t] = src + (inner_first + t - grid.radius) * stride;
+				convolve_span(taps.data(), dest + inner_first * stride, int((inner_last - inner_first) * stride), k, level);
+			}
+			auto edge_cells = [&](int cell_first, int cell_last)
+			{
+				for(int i = cell_first; i < cell_last; i++)
+				{
+					float* dest_cell = dest + i * stride;
+					std::fill(dest_cell, dest_cell + stride, 0.0f);
+					for(int t = std::max(-grid.radius, -i); t <= std::min(grid.radius, count - 1 - i); t++)
+					{
+						const float w = grid.taps[t + grid.radius];
+						const float* src_cell = src + (i + t) * stride;
+						for(size_t c = 0; c < stride; c++)
+							dest_cell[c] += w * src_cell[c];
+					}
+				}
+			};
+			edge_cells(first, inner_first);
+			edge_cells(inner_last, last);
+		}
+	}
+
+#if AMP_HAS_CPP_AMP
+	inline void bilateral_grid_filter_32f_c1(accelerator_view& acc_view, buffer_pool& buffers, array_view<const float, 2> src_array, array_view<float, 2> dest_array
+		, float sigma_color, float sigma_space, float accuracy = 1.0f)
+	{
+		const int rows = src_array.get_extent()[0];
+		const int cols = src_array.get_extent()[1];
+		const std::pair<float, float> max_min = max_min_value_32f_c1(acc_view, src_array);
+		const detail::bilateral_grid_geometry grid(rows, cols, max_min.second, max_min.first, sigma_color, sigma_space, accuracy);
+		const int grid_rows = grid.grid_rows;
+		const int grid_cols = grid.grid_cols;
+		const int depth = grid.depth;
+		const int radius = grid.radius;
+		const float min_value = grid.min_value;
+		const float space_cell = grid.space_cell;
+		const float color_cell = grid.color_cell;
+		kernel_wrapper<float, 64U> taps;
+		if(grid.taps.size() > 64U) throw std::runtime_error("bilateral grid accuracy is too high");
+		std::copy(grid.taps.begin(), grid.taps.end(), taps.data);
+		buffer_pool::device_lease grid_buf = buffers.acquire_device<float>(int(grid.size()));
+		buffer_pool::device_lease blur_buf = buffers.acquire_device<float>(int(grid.size()));
+		array_view<float, 1> grid_array = grid_buf.view<float>(int(grid.size()));
+		array_view<float, 1> blur_array = blur_buf.view<float>(int(grid.size()));
+		// splat, each thread owns the depth column of one cell so the sums need no atomics
+		parallel_for_each(acc_view, concurrency::extent<2>(grid_rows, grid_cols), [=](concurrency::index<2> idx) restrict(amp)
+		{
+			const int column = (idx[0] * grid_cols + idx[1]) * depth * 2;
+			for(int z = 0; z < depth * 2; z++)
+			{
+				grid_array[column + z] = 0.0f;
+			}
+			const int r_first = direct3d::imax(0, int((idx[0] - 0.5f) * space_cell));
+			const int r_last = direct3d::imin(rows - 1, int((idx[0] + 0.5f) * space_cell) + 1);
+			const int c_first = direct3d::imax(0, int((idx[1] - 0.5f) * space_cell));
+			const int c_last = direct3d::imin(cols - 1, int((idx[1] + 0.5f) * space_cell) + 1);
+			for(int r = r_first; r <= r_last; r++)
+			{
+				if(int(r / space_cell + 0.5f) != idx[0])
+					continue;
+				for(int c = c_first; c <= c_last; c++)
+				{
+					if(int(c / space_cell + 0.5f) != idx[1])
+						continue;
+					const float value = src_array(r, c);
+					const int z = int((value - min_value) / color_cell + 0.5f);
+					grid_array[column + z * 2] += value;
+					grid_array[column + z * 2 + 1] += 1.0f;
+				}
+			}
+		});
+		// separable blur along depth, cols and rows, ping-ponging between the two grids
+		for(int axis = 2; axis >= 0; axis--)
+		{
+			array_view<float, 1> from = axis == 1 ? blur_array : grid_array;
+			array_view<float, 1> to = axis == 1 ? grid_array : blur_array;
+			const int count = axis == 0 ? grid_rows : axis == 1 ? grid_cols : depth;
+			const int stride = axis == 0 ? grid_cols * depth * 2 : axis == 1 ? depth * 2 : 2;
+			to.discard_data();
+			parallel_for_each(acc_view, concurrency::extent<3>(grid_rows, grid_cols, depth), [=](concurrency::index<3> idx) restrict(amp)
+			{
+				const int cell = ((idx[0] * grid_cols + idx[1]) * depth + idx[2]) * 2;
+				const int i = idx[axis];
+				float sum = 0.0f;
+				float weight = 0.0f;
+				for(int t = direct3d::imax(-radius, -i); t <= direct3d::imin(radius, count - 1 - i); t++)
+				{
+					sum += taps.data[t + radius] * from[cell + t * stride];
+					weight += taps.data[t + radius] * from[cell + t * stride + 1];
+				}
+				to[cell] = sum;
+				to[cell + 1] = weight;
+			});
+		}
+		// slice
+		dest_array.discard_data();
+		parallel_for_each(acc_view, dest_array.get_extent(), [=](concurrency::index<2> idx) restrict(amp)
+		{
+			const float value = src_array[idx];
+			const float fy = idx[0] / space_cell;
+			const float fx = idx[1] / space_cell;
+			const float fz = (value - min_value) / color_cell;
+			const int y0 = int(fy);
+			const int x0 = int(fx);
+			const int z0 = direct3d::imin(int(fz), depth - 2);
+			const float wy = fy - y0;
+			const float wx = fx - x0;
+			const float wz = fz - z0;
+			float sum = 0.0f;
+			float weight = 0.0f;
+			for(int i = 0; i < 8; i++)
+			{
+				const int dy = i >> 2;
+				const int dx = (i >> 1) & 1;
+				const int dz = i & 1;
+				const float w = (dy ? wy : 1.0f - wy) * (dx ? wx : 1.0f - wx) * (dz ? wz : 1.0f - wz);
+				const int cell = (((y0 + dy) * grid_cols + x0 + dx) * depth + z0 + dz) * 2;
+				sum += w * blur_array[cell];
+				weight += w * blur_array[cell + 1];
+			}
+			dest_array[idx] = weight > 0.0f ? sum / weight : value;
+		});
+	}
+
+	inline void bilateral_grid_filter_32f_c1(vision_context& ctx, array_view<const float, 2> src_array, array_view<float, 2> dest_array
+		, float sigma_color, float sigma_space, float accuracy = 1.0f)
+	{
+		bilateral_grid_filter_32f_c1(ctx.acc_view, ctx.buffers, src_array, dest_array, sigma_color, sigma_space, accuracy);
+	}
+
+	inline void bilateral_grid_filter_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array
+		, float sigma_color, float sigma_space, float accuracy = 1.0f)
+	{
+		buffer_pool buffers(acc_view);
+		bilateral_grid_filter_32f_c1(acc_view, buffers, src_array, dest_array, sigma_color, sigma_space, accuracy);
+	}
+#endif
+
+	// CPU backend
+	inline void bilateral_filter_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array, int d, float sigma_color, float sigma_space)
+	{
+		const int rows = src_array.rows;
+		const int cols = src_array.cols;
+		if(sigma_color <= 0.0f)
+			sigma_color = 1.0f;
+		if(sigma_space <= 0.0f)
+			sigma_space = 1.0f;
+		const float gauss_color_coeff = -0.5f / (sigma_color * sigma_color);
+		const float gauss_space_coeff = -0.5f / (sigma_space * sigma_space);
+		int radius = d <= 0 ? cvRound(sigma_space * 1.5f) : d / 2;
+		radius = std::max<int>(radius, 1);
+		std::vector<float> weights;
+		std::vector<int> xofs;
+		std::vector<int> yofs;
+		for(int i = -radius; i <= radius; i++)
+		{
+			for(int j = -radius; j <= radius; j++)
+			{
+				double r = std::sqrt((double)i * i + (double)j * j);
+				if(r > radius)
+					continue;
+				weights.push_back((float)std::exp(r * r * gauss_space_coeff));
+				yofs.push_back(i);
+				xofs.push_back(j);
+			}
+		}
+		const int maxk = int(weights.size());
+		cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+		{
+			std::vector<const float*> src_rows(2 * radius + 1);
+			for(int y = row_first; y < row_last; y++)
+			{
+				for(int i = -radius; i <= radius; i++)
+					src_rows[i + radius] = src_array.row(cpu::replicate(cpu::reflect101(y + i, rows), rows));
+				float* dest_row = dest_array.row(y);
+				for(int x = 0; x < cols; x++)
+				{
+					const bool inside = x >= radius && x < cols - radius;
+					const float val0 = src_rows[radius][x];
+					float sum = 0.0f;
+					float wsum = 0.0f;
+					for(int k = 0; k < maxk; k++)
+					{
+						const int c = inside ? x + xofs[k] : cpu::replicate(cpu::reflect101(x + xofs[k], cols), cols);
+						const float val = src_rows[yofs[k] + radius][c];
+						const float diff = std::fabs(val - val0);
+						const float w = weights[k] * std::exp(diff * diff * gauss_color_coeff);
+						sum += val * w;
+						wsum += w;
+					}
+					dest_row[x] = sum / wsum;
+				}
+			}
+		});
+	}
+
+	// Approximation whose cost doesn't depend on the window size, see detail::bilateral_grid_geometry
+	inline void bilateral_grid_filter_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, float sigma_color, float sigma_space, float accuracy = 1.0f)
+	{
+		const int rows = src_array.rows;
+		const int cols = src_array.cols;
+		const cpu::simd_level level = cpu::active_simd_level();
+		const std::pair<float, float> max_min = max_min_value_32f_c1(pool, src_array);
+		const detail::bilateral_grid_geometry grid(rows, cols, max_min.second, max_min.first, sigma_color, sigma_space, accuracy);
+		// depth columns are padded by radius empty cells on both ends, so the depth blur runs along whole grid rows
+		const size_t column_size = size_t(grid.depth + 2 * grid.radius) * 2;
+		const size_t row_size = grid.grid_cols * column_size;
+		std::vector<float> grid_data(grid.grid_rows * row_size);
+		std::vector<float> blur_data(grid_data.size());
+		// grid row of every pixel row, pixels land in the nearest cell
+		std::vector<int> row_cell(rows);
+		for(int r = 0; r < rows; r++)
+			row_cell[r] = int(r / grid.space_cell + 0.5f);
+		std::vector<int> col_cell(cols);
+		for(int c = 0; c < cols; c++)
+			col_cell[c] = int(c / grid.space_cell + 0.5f);
+		// splat, z and x blur run per grid row, each task owning its rows
+		pool.parallel_for(0, grid.grid_rows, [&](int grid_first, int grid_last)
+		{
+			std::fill(grid_data.begin() + grid_first * row_size, grid_data.begin() + grid_last * row_size, 0.0f);
+			const int r_first = int(std::lower_bound(row_cell.begin(), row_cell.end(), grid_first) - row_cell.begin());
+			const int r_last = int(std::lower_bound(row_cell.begin(), row_cell.end(), grid_last) - row_cell.begin());
+			for(int r = r_first; r < r_last; r++)
+			{
+				const float* src_row = src_array.row(r);
+				float* grid_row = &grid_data[row_cell[r] * row_size];
+				for(int c = 0; c < cols; c++)
+				{
+					const float value = src_row[c];
+					float* cell = grid_row + col_cell[c] * column_size + (int((value - grid.min_value) / grid.color_cell + 0.5f) + grid.radius) * 2;
+					cell[0] += value;
+					cell[1] += 1.0f;
+				}
+			}
+			const int row_cells = int(row_size / 2);
+			for(int gy = grid_first; gy < grid_last; gy++)
+			{
+				detail::bilateral_grid_blur(&grid_data[gy * row_size], &blur_data[gy * row_size], row_cells, 2, 0, row_cells, grid, level);
+				detail::bilateral_grid_blur(&blur_data[gy * row_size], &grid_data[gy * row_size], grid.grid_cols, column_size, 0, grid.grid_cols, grid, level);
+			}
+		});
+		pool.parallel_for(0, grid.grid_rows, [&](int grid_first, int grid_last)
+		{
+			detail::bilateral_grid_blur(grid_data.data(), blur_data.data(), grid.grid_rows, row_size, grid_first, grid_last, grid, level);
+		});
+		// slice
+		cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+		{
+			for(int y = row_first; y < row_last; y++)
+			{
+				const float fy = y / grid.space_cell;
+				const int y0 = int(fy);
+				const float wy = fy - y0;
+				const float* src_row = src_array.row(y);
+				float* dest_row = dest_array.row(y);
+				for(int x = 0; x < cols; x++)
+				{
+					const float value = src_row[x];
+					const float fx = x / grid.space_cell;
+					const float fz = (value - grid.min_value) / grid.color_cell;
+					const int x0 = int(fx);
+					const int z0 = std::min(int(fz), grid.depth - 2);
+					const float wx = fx - x0;
+					const float wz = fz - z0;
+					const float* cell = &blur_data[y0 * row_size + x0 * column_size + (z0 + grid.radius) * 2];
+					float sum = 0.0f;
+					float weight = 0.0f;
+					for(int i = 0; i < 8; i++)
+					{
+						const int dy = i >> 2;
+						const int dx = (i >> 1) & 1;
+						const int dz = i & 1;
+						const float w = (dy ? wy : 1.0f - wy) * (dx ? wx : 1.0f - wx) * (dz ? wz : 1.0f - wz);
+						const float* corner = cell + dy * row_size + dx * column_size + dz * 2;
+						sum += w * corner[0];
+						weight += w * corner[1];
+					}
+					dest_row[x] = weight > 0.0f ? sum / weight : value;
+				}
+			}
+		});
+	}
 }
@@ -0,0 +1,294 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "amp_cpu.h"
+
+namespace amp
+{
+	namespace detail
+	{
+		// Power of two size classes from 256 bytes, so a buffer fits any later request up to twice its size
+		inline int size_class_of(size_t bytes)
+		{
+			int size_class = 0;
+			while((size_t(256) << size_class) < bytes)
+			{
+				size_class++;
+			}
+			return size_class;
+		}
+
+		inline size_t size_class_bytes(int size_class)
+		{
+			return size_t(256) << size_class;
+		}
+
+		// Free lists of released blocks, one per size class
+		template<typename block_type>
+		class block_cache
+		{
+		public:
+			std::unique_ptr<block_type> take(int size_class)
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				if(size_class < int(free_blocks.size()) && !free_blocks[size_class].empty())
+				{
+					std::unique_ptr<block_type> block = std::move(free_blocks[size_class].back());
+					free_blocks[size_class].pop_back();
+					return block;
+				}
+				return nullptr;
+			}
+
+			void give(int size_class, std::unique_ptr<block_type> block)
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				if(size_class >= int(free_blocks.size()))
+				{
+					free_blocks.resize(size_class + 1);
+				}
+				free_blocks[size_class].push_back(std::move(block));
+			}
+
+			size_t clear()
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				size_t released = 0;
+				for(size_t size_class = 0; size_class < free_blocks.size(); size_class++)
+				{
+					released += free_blocks[size_class].size() * size_class_bytes(int(size_class));
+					free_blocks[size_class].clear();
+				}
+				return released;
+			}
+
+		private:
+			std::mutex mutex;
+			std::vector<std::vector<std::unique_ptr<block_type>>> free_blocks;
+		};
+
+		// Host block, 64-byte aligned like cpu::plane rows
+		class host_block
+		{
+		public:
+			explicit host_block(size_t bytes)
+				: storage(new unsigned char[bytes + 63])
+			{
+				data = reinterpret_cast<unsigned char*>((reinterpret_cast<std::uintptr_t>(storage.get()) + 63) & ~std::uintptr_t(63));
+			}
+
+			unsigned char* data;
+
+		private:
+			std::unique_ptr<unsigned char[]> storage;
+		};
+	}
+
+	// Size-class pool for per-call temporaries(histograms, accumulators, point lists, transform tables...).
+	// Buffers go back to the pool when their lease is destroyed and are handed out again on the next call,
+	// so steady-state frames don't allocate. Leased memory is not cleared.
+	class buffer_pool
+	{
+	public:
+		template<typename block_type>
+		class lease
+		{
+		public:
+			lease()
+				: owner(nullptr), size_class(0)
+			{
+			}
+
+			lease(lease&& other)
+				: owner(other.owner), size_class(other.size_class), block(std::move(other.block))
+			{
+				other.owner = nullptr;
+			}
+
+			lease& operator=(lease&& other)
+			{
+				if(this != &other)
+				{
+					release();
+					owner = other.owner;
+					size_class = other.size_class;
+					block = std::move(other.block);
+					other.owner = nullptr;
+				}
+				return *this;
+			}
+
+			~lease()
+			{
+				release();
+			}
+
+			lease(const lease&) = delete;
+			lease& operator=(const lease&) = delete;
+
+			size_t capacity() const
+			{
+				return block ? detail::size_class_bytes(size_class) : 0;
+			}
+
+			// Host memory as count elements of value_type
+			template<typename value_type>
+			value_type* data() const
+			{
+				return reinterpret_cast<value_type*>(block->data);
+			}
+
+			// Host memory as a rows x cols plane
+			template<typename value_type>
+			cpu::plane_view<value_type> plane(int rows, int cols) const
+			{
+				return cpu::plane_view<value_type>(data<value_type>(), rows, cols, cols);
+			}
+
+#if AMP_HAS_CPP_AMP
+			// Device memory as count elements of value_type(sizeof(value_type) must be a multiple of 4)
+			template<typename value_type>
+			concurrency::array_view<value_type, 1> view(int count) const
+			{
+				return block->template reinterpret_as<value_type>().section(0, count);
+			}
+
+			template<typename value_type>
+			concurrency::array_view<value_type, 2> view(int rows, int cols) const
+			{
+				return view<value_type>(rows * cols).view_as(concurrency::extent<2>(rows, cols));
+			}
+#endif
+
+		private:
+			friend class buffer_pool;
+
+			lease(buffer_pool* owner_, int size_class_, std::unique_ptr<block_type> block_)
+				: owner(owner_), size_class(size_class_), block(std::move(block_))
+			{
+			}
+
+			void release()
+			{
+				if(owner && block)
+				{
+					owner->give_back(size_class, std::move(block));
+				}
+				owner = nullptr;
+			}
+
+			buffer_pool* owner;
+			int size_class;
+			std::unique_ptr<block_type> block;
+		};
+
+		typedef lease<detail::host_block> host_lease;
+#if AMP_HAS_CPP_AMP
+		typedef lease<concurrency::array<unsigned int, 1>> device_lease;
+
+		explicit buffer_pool(const concurrency::accelerator_view& acc_view_)
+			: acc_view(acc_view_), allocations(0), acquisitions(0), reserved_bytes(0)
+		{
+		}
+#endif
+
+		buffer_pool()
+#if AMP_HAS_CPP_AMP
+			: acc_view(concurrency::accelerator(concurrency::accelerator::cpu_accelerator).default_view), allocations(0), acquisitions(0), reserved_bytes(0)
+#else
+			: allocations(0), acquisitions(0), reserved_bytes(0)
+#endif
+		{
+		}
+
+		buffer_pool(const buffer_pool&) = delete;
+		buffer_pool& operator=(const buffer_pool&) = delete;
+
+		host_lease acquire_host(size_t bytes)
+		{
+			int size_class = detail::size_class_of(bytes);
+			acquisitions++;
+			std::unique_ptr<detail::host_block> block = host_blocks.take(size_class);
+			if(!block)
+			{
+				block.reset(new detail::host_block(detail::size_class_bytes(size_class)));
+				count_allocation(size_class);
+			}
+			return host_lease(this, size_class, std::move(block));
+		}
+
+		template<typename value_type>
+		host_lease acquire_host(int rows, int cols)
+		{
+			return acquire_host(size_t(rows) * cols * sizeof(value_type));
+		}
+
+#if AMP_HAS_CPP_AMP
+		device_lease acquire_device(size_t bytes)
+		{
+			int size_class = detail::size_class_of(bytes);
+			acquisitions++;
+			std::unique_ptr<concurrency::array<unsigned int, 1>> block = device_blocks.take(size_class);
+			if(!block)
+			{
+				block.reset(new concurrency::array<unsigned int, 1>(int(detail::size_class_bytes(size_class) / 4), acc_view));
+				count_allocation(size_class);
+			}
+			return device_lease(this, size_class, std::move(block));
+		}
+
+		template<typename value_type>
+		device_lease acquire_device(int count)
+		{
+			static_assert(sizeof(value_type) % 4 == 0, "device buffers hold 32-bit words");
+			return acquire_device(size_t(count) * sizeof(value_type));
+		}
+#endif
+
+		// Free every buffer that isn't leased
+		void trim()
+		{
+			size_t released = host_blocks.clear();
+#if AMP_HAS_CPP_AMP
+			released += device_blocks.clear();
+#endif
+			reserved_bytes -= released;
+		}
+
+		// Underlying allocations, leases handed out and bytes held(leased + cached)
+		size_t allocation_count() const { return allocations; }
+		size_t acquire_count() const { return acquisitions; }
+		size_t bytes_reserved() const { return reserved_bytes; }
+
+	private:
+		void count_allocation(int size_class)
+		{
+			allocations++;
+			reserved_bytes += detail::size_class_bytes(size_class);
+		}
+
+		void give_back(int size_class, std::unique_ptr<detail::host_block> block)
+		{
+			host_blocks.give(size_class, std::move(block));
+		}
+
+#if AMP_HAS_CPP_AMP
+		void give_back(int size_class, std::unique_ptr<concurrency::array<unsigned int, 1>> block)
+		{
+			device_blocks.give(size_class, std::move(block));
+		}
+
+		concurrency::accelerator_view acc_view;
+		detail::block_cache<concurrency::array<unsigned int, 1>> device_blocks;
+#endif
+		detail::block_cache<detail::host_block> host_blocks;
+		std::atomic<size_t> allocations;
+		std::atomic<size_t> acquisitions;
+		std::atomic<size_t> reserved_bytes;
+	};
+}
@@ -0,0 +1,241 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "amp_cpu.h"
+
+namespace amp
+{
+	// Bytes held by the vision_context buffers, shared by every registry of a context
+	struct buffer_memory
+	{
+		buffer_memory()
+			: live_bytes(0), reserved_bytes(0), peak_bytes(0), live_buffers(0), pool_bytes(0)
+		{
+		}
+
+		// buffers currently handed out
+		size_t live_bytes;
+		// live + released buffers kept for reuse
+		size_t reserved_bytes;
+		// high-water mark of reserved_bytes, the budget one context needs on the device
+		size_t peak_bytes;
+		size_t live_buffers;
+		// per-call temporaries held by ctx.buffers
+		size_t pool_bytes;
+	};
+
+	namespace detail
+	{
+		template<typename value_type>
+		inline size_t buffer_bytes(const cpu::plane<value_type>& buffer)
+		{
+			return size_t(buffer.rows) * buffer.step * sizeof(value_type);
+		}
+
+		template<typename value_type>
+		inline size_t buffer_bytes(const std::vector<value_type>& buffer)
+		{
+			return buffer.size() * sizeof(value_type);
+		}
+
+#if AMP_HAS_CPP_AMP
+		template<typename value_type, int rank>
+		inline size_t buffer_bytes(const concurrency::array<value_type, rank>& buffer)
+		{
+			return size_t(buffer.get_extent().size()) * sizeof(value_type);
+		}
+#endif
+	}
+
+	// Buffers of one kind keyed by handle(the index returned by create) and optional name.
+	// A buffer stays at the same address for its whole life, released buffers are handed out again
+	// to the next create of the same shape. create/release must not race with other accesses.
+	template<typename buffer_type>
+	class buffer_registry
+	{
+	public:
+		explicit buffer_registry(const char* kind_, buffer_memory& usage_)
+			: kind(kind_), usage(usage_)
+		{
+		}
+
+		buffer_registry(const buffer_registry&) = delete;
+		buffer_registry& operator=(const buffer_registry&) = delete;
+
+		~buffer_registry()
+		{
+			clear();
+		}
+
+		buffer_type& operator[](int handle)
+		{
+			return *slots[handle].buffer;
+		}
+
+		const buffer_type& operator[](int handle) const
+		{
+			return *slots[handle].buffer;
+		}
+
+		// Number of handles, live or released
+		size_t size() const
+		{
+			return slots.size();
+		}
+
+		void reserve(size_t count)
+		{
+			slots.reserve(count);
+		}
+
+		// count buffers with consecutive handles, args are the buffer constructor arguments
+		template<typename... Args>
+		int create(const std::string& name, int rows, int cols, int count, const Args&... args)
+		{
+			if(count < 1) throw std::runtime_error(std::string(kind) + " buffer count must be positive");
+			if(!name.empty() && names.count(name)) throw std::runtime_error(std::string(kind) + " buffer \"" + name + "\" already exists");
+			int first = find_released(rows, cols, count);
+			if(first < 0)
+			{
+				first = int(slots.size());
+				slots.resize(slots.size() + count);
+			}
+			for(int handle = first; handle < first + count; handle++)
+			{
+				slot& s = slots[handle];
+				if(!s.buffer)
+				{
+					s.buffer.reset(new buffer_type(args...));
+					s.rows = rows;
+					s.cols = cols;
+					s.bytes = detail::buffer_bytes(*s.buffer);
+					usage.reserved_bytes += s.bytes;
+					if(usage.reserved_bytes > usage.peak_bytes) usage.peak_bytes = usage.reserved_bytes;
+				}
+				s.live = true;
+				usage.live_bytes += s.bytes;
+				usage.live_buffers++;
+			}
+			if(!name.empty())
+			{
+				names[name] = first;
+				slots[first].name = name;
+			}
+			return first;
+		}
+
+		// Give count buffers back for reuse, their content is kept until the next create
+		void release(int handle, int count = 1)
+		{
+			if(handle < 0 || handle + count > int(slots.size())) throw std::runtime_error(std::string(kind) + " buffer handle is out of range");
+			for(int i = handle; i < handle + count; i++)
+			{
+				slot& s = slots[i];
+				if(!s.live) throw std::runtime_error(std::string(kind) + " buffer is already released");
+				s.live = false;
+				usage.live_bytes -= s.bytes;
+				usage.live_buffers--;
+				if(!s.name.empty())
+				{
+					names.erase(s.name);
+					s.name.clear();
+				}
+			}
+		}
+
+		// Handle of a named buffer
+		int find(const std::string& name) const
+		{
+			std::map<std::string, int>::const_iterator it = names.find(name);
+			if(it == names.end()) throw std::runtime_error(std::string("no ") + kind + " buffer named \"" + name + "\"");
+			return it->second;
+		}
+
+		bool contains(const std::string& name) const
+		{
+			return names.count(name) != 0;
+		}
+
+		bool is_live(int handle) const
+		{
+			return handle >= 0 && handle < int(slots.size()) && slots[handle].live;
+		}
+
+		// Free the memory of released buffers, their handles can be reused by any shape
+		void trim()
+		{
+			for(size_t i = 0; i < slots.size(); i++)
+			{
+				slot& s = slots[i];
+				if(!s.live && s.buffer)
+				{
+					s.buffer.reset();
+					usage.reserved_bytes -= s.bytes;
+					s.bytes = 0;
+				}
+			}
+			while(!slots.empty() && !slots.back().live && !slots.back().buffer)
+			{
+				slots.pop_back();
+			}
+		}
+
+		void clear()
+		{
+			for(size_t i = 0; i < slots.size(); i++)
+			{
+				if(slots[i].live)
+				{
+					usage.live_bytes -= slots[i].bytes;
+					usage.live_buffers--;
+				}
+				usage.reserved_bytes -= slots[i].bytes;
+			}
+			slots.clear();
+			names.clear();
+		}
+
+	private:
+		struct slot
+		{
+			slot()
+				: rows(0), cols(0), bytes(0), live(false)
+			{
+			}
+
+			std::unique_ptr<buffer_type> buffer;
+			int rows;
+			int cols;
+			size_t bytes;
+			bool live;
+			std::string name;
+		};
+
+		// First run of count released slots that are either the same shape or empty
+		int find_released(int rows, int cols, int count) const
+		{
+			int run = 0;
+			for(int handle = 0; handle < int(slots.size()); handle++)
+			{
+				const slot& s = slots[handle];
+				bool usable = !s.live && (!s.buffer || (s.rows == rows && s.cols == cols));
+				run = usable ? run + 1 : 0;
+				if(run == count)
+				{
+					return handle - count + 1;
+				}
+			}
+			return -1;
+		}
+
+		const char* kind;
+		buffer_memory& usage;
+		std::vector<slot> slots;
+		std::map<std::string, int> names;
+	};
+}
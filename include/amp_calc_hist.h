@@ -4,6 +4,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	inline void calc_hist_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<int, 1> dest_array, int bin_size = 256, bool retain = false)
 	{
 #if OPTIMIZE_FOR_AMD || OPTIMIZE_FOR_INTEL
@@ -106,4 +107,92 @@ namespace amp
 			});
 		}
 	}
+#endif
+
+	// CPU backend, each strip fills a private histogram that is merged once
+	inline void calc_hist_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, std::vector<int>& dest_array, int bin_size = 256, bool retain = false)
+	{
+		static const int max_bin_size = 256;
+		const float bin_ratio = float(bin_size) / max_bin_size;
+		if (!retain || int(dest_array.size()) < bin_size)
+		{
+			dest_array.assign(bin_size, 0);
+		}
+		std::mutex merge_mutex;
+		cpu::parallel_for_rows(pool, src_array.rows, [&](int row_first, int row_last)
+		{
+			std::vector<int> hist(bin_size + 1, 0);
+			for (int r = row_first; r < row_last; r++)
+			{
+				const float* src_row = src_array.row(r);
+				for (int c = 0; c < src_array.cols; c++)
+				{
+					hist[std::min(std::max(int(src_row[c] * bin_ratio + 0.001f), 0), bin_size)]++;
+				}
+			}
+			std::lock_guard<std::mutex> guard(merge_mutex);
+			for (int i = 0; i < bin_size; i++)
+			{
+				dest_array[i] += hist[i];
+			}
+		});
+	}
+
+	namespace detail
+	{
+		// Integer pixels are counted into four interleaved private histograms, so repeated values
+		// don't serialize on one counter, and mapped to bins while merging
+		template<typename value_type>
+		inline void calc_hist_packed(cpu::thread_pool& pool, cpu::plane_view<const value_type> src_array, std::vector<int>& dest_array
+			, int bin_size, int max_value, bool retain)
+		{
+			const int value_count = max_value + 1;
+			if (!retain || int(dest_array.size()) < bin_size)
+			{
+				dest_array.assign(bin_size, 0);
+			}
+			std::mutex merge_mutex;
+			cpu::parallel_for_rows(pool, src_array.rows, [&](int row_first, int row_last)
+			{
+				std::vector<int> hist(size_t(value_count) * 4, 0);
+				int* hist0 = &hist[0];
+				int* hist1 = hist0 + value_count;
+				int* hist2 = hist1 + value_count;
+				int* hist3 = hist2 + value_count;
+				for (int r = row_first; r < row_last; r++)
+				{
+					const value_type* src_row = src_array.row(r);
+					int c = 0;
+					for (; c + 4 <= src_array.cols; c += 4)
+					{
+						hist0[std::min(int(src_row[c]), max_value)]++;
+						hist1[std::min(int(src_row[c + 1]), max_value)]++;
+						hist2[std::min(int(src_row[c + 2]), max_value)]++;
+						hist3[std::min(int(src_row[c + 3]), max_value)]++;
+					}
+					for (; c < src_array.cols; c++)
+					{
+						hist0[std::min(int(src_row[c]), max_value)]++;
+					}
+				}
+				std::lock_guard<std::mutex> guard(merge_mutex);
+				for (int v = 0; v < value_count; v++)
+				{
+					dest_array[int((long long)v * bin_size / value_count)] += hist0[v] + hist1[v] + hist2[v] + hist3[v];
+				}
+			});
+		}
+	}
+
+	inline void calc_hist_8u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array, std::vector<int>& dest_array, int bin_size = 256, bool retain = false)
+	{
+		detail::calc_hist_packed(pool, src_array, dest_array, bin_size, 255, retain);
+	}
+
+	// max_value is the top of the sensor range, e.g. 4095 for 12-bit data, larger pixels fall into the last bin
+	inline void calc_hist_16u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned short> src_array, std::vector<int>& dest_array, int bin_size = 256
+		, int max_value = 65535, bool retain = false)
+	{
+		detail::calc_hist_packed(pool, src_array, dest_array, bin_size, max_value, retain);
+	}
 }
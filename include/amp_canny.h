@@ -1,9 +1,15 @@
 ﻿#pragma once
 
 #include "amp_core.h"
+#include "amp_ccl.h"
 
 namespace amp
 {
+	// Hysteresis of canny_32f_c1. stack grows the strong edges through tiles, then through a global stack
+	// with one readback per round; union_find labels the candidate pixels in a fixed number of passes
+	// and keeps the components holding a strong pixel
+	enum class canny_hysteresis { stack, union_find };
+
 	// Canny edge detection(only support aperture size 3)
 	class canny_context
 	{
@@ -13,6 +19,17 @@ namespace amp
 			, dx_buf(rows_, cols_, acc_view_), dy_buf(rows_, cols_, acc_view_)
 			, mag_buf(rows_ + 2, cols_ + 2, acc_view_), map_buf(rows_ + 2, cols_ + 2, acc_view_)
 			, track_buf1(rows_ * cols_, acc_view_), track_buf2(rows_ * cols_, acc_view_), counter(1, acc_view_)
+			, own_buffers(new buffer_pool(acc_view_)), buffers(*own_buffers)
+		{
+		}
+
+		// Shares the vision_context's buffer pool for per-call temporaries(hough_circles)
+		canny_context(vision_context& vctx, int rows_, int cols_)
+			: acc_view(vctx.acc_view), dx(rows_, cols_, vctx.acc_view), dy(rows_, cols_, vctx.acc_view)
+			, dx_buf(rows_, cols_, vctx.acc_view), dy_buf(rows_, cols_, vctx.acc_view)
+			, mag_buf(rows_ + 2, cols_ + 2, vctx.acc_view), map_buf(rows_ + 2, cols_ + 2, vctx.acc_view)
+			, track_buf1(rows_ * cols_, vctx.acc_view), track_buf2(rows_ * cols_, vctx.acc_view), counter(1, vctx.acc_view)
+			, buffers(vctx.buffers)
 		{
 		}
 
@@ -22,6 +39,10 @@ namespace amp
 		concurrency::array<unsigned int, 1> track_buf1, track_buf2;
 		concurrency::array<unsigned int, 1> counter;
 		accelerator_view acc_view;
+	private:
+		std::unique_ptr<buffer_pool> own_buffers;
+	public:
+		buffer_pool& buffers;
 	};
 
 	namespace detail
@@ -392,6 +413,68 @@ namespace amp
 			}
 		}
 
+		// dx_buf holds the union-find labels(-1 off the candidates), dy_buf the flags of the roots with a strong pixel
+		inline void canny_edge_hysteresis_union_find(canny_context& ctx)
+		{
+			static const int tile_size = 32;
+			array_view<int, 2> map_buf(ctx.map_buf);
+			array_view<int, 2> label_array(ctx.dx_buf);
+			array_view<int, 2> strong_array(ctx.dy_buf);
+			label_array.discard_data();
+			strong_array.discard_data();
+			const concurrency::extent<2> ext = label_array.get_extent();
+			const int cols = ext[1];
+			// 1.every candidate is its own root
+			concurrency::parallel_for_each(ctx.acc_view, ext.tile<tile_size, tile_size>().pad(), [=](tiled_index<tile_size, tile_size> idx) restrict(amp)
+			{
+				concurrency::index<2> gidx = idx.global;
+				if (ext.contains(gidx))
+				{
+					label_array(gidx) = map_buf(gidx[0] + 1, gidx[1] + 1) != 0 ? gidx[0] * cols + gidx[1] : -1;
+					strong_array(gidx) = 0;
+				}
+			});
+			// 2.merge with the candidates left and above, the one pixel border of map_buf is never written by canny_map
+			concurrency::parallel_for_each(ctx.acc_view, ext.tile<tile_size, tile_size>().pad(), [=](tiled_index<tile_size, tile_size> idx) restrict(amp)
+			{
+				const int y = idx.global[0];
+				const int x = idx.global[1];
+				if (ext.contains(idx.global) && map_buf(y + 1, x + 1) != 0)
+				{
+					const int label = y * cols + x;
+					if (x > 0 && map_buf(y + 1, x) != 0) detail::union_roots(label_array, label, label - 1);
+					if (y > 0)
+					{
+						if (x > 0 && map_buf(y, x) != 0) detail::union_roots(label_array, label, label - cols - 1);
+						if (map_buf(y, x + 1) != 0) detail::union_roots(label_array, label, label - cols);
+						if (x + 1 < cols && map_buf(y, x + 2) != 0) detail::union_roots(label_array, label, label - cols + 1);
+					}
+				}
+			});
+			// 3.flag the roots holding a strong pixel
+			concurrency::parallel_for_each(ctx.acc_view, ext.tile<tile_size, tile_size>().pad(), [=](tiled_index<tile_size, tile_size> idx) restrict(amp)
+			{
+				const int y = idx.global[0];
+				const int x = idx.global[1];
+				if (ext.contains(idx.global) && map_buf(y + 1, x + 1) == 2)
+				{
+					const int r = detail::root(label_array, y * cols + x);
+					strong_array(r / cols, r % cols) = 1;
+				}
+			});
+			// 4.the candidates of a flagged component become edges
+			concurrency::parallel_for_each(ctx.acc_view, ext.tile<tile_size, tile_size>().pad(), [=](tiled_index<tile_size, tile_size> idx) restrict(amp)
+			{
+				const int y = idx.global[0];
+				const int x = idx.global[1];
+				if (ext.contains(idx.global) && map_buf(y + 1, x + 1) == 1)
+				{
+					const int r = detail::root(label_array, y * cols + x);
+					if (strong_array(r / cols, r % cols)) map_buf(y + 1, x + 1) = 2;
+				}
+			});
+		}
+
 		inline void canny_get_edges(canny_context& ctx, array_view<float, 2> dest_array)
 		{
 			static const int tile_size = 32;
@@ -407,7 +490,7 @@ namespace amp
 	}
 
 	inline void canny_32f_c1(canny_context& ctx, array_view<const float, 2> src_array, array_view<float, 2> dest_array
-		, float low_thresh, float high_thresh, bool l2_grad = false)
+		, float low_thresh, float high_thresh, bool l2_grad = false, canny_hysteresis hysteresis = canny_hysteresis::union_find)
 	{
 		if (low_thresh > high_thresh)
 			std::swap(low_thresh, high_thresh);
@@ -430,8 +513,15 @@ namespace amp
 		detail::canny_sobel_row_pass(ctx, src_array);
 		detail::canny_magnitude(ctx, l2_grad);
 		detail::canny_map(ctx, low_thresh, high_thresh);
-		detail::canny_edge_hysteresis_local(ctx);
-		detail::canny_edge_hysteresis_global(ctx);
+		if (hysteresis == canny_hysteresis::union_find)
+		{
+			detail::canny_edge_hysteresis_union_find(ctx);
+		}
+		else
+		{
+			detail::canny_edge_hysteresis_local(ctx);
+			detail::canny_edge_hysteresis_global(ctx);
+		}
 		detail::canny_get_edges(ctx, dest_array);
 	}
 
@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "amp_core.h"
+#include "amp_moments.h"
 
 namespace amp
 {
@@ -8,6 +9,7 @@ namespace amp
 	{
 
 		enum class component { left = 1, up = 2, right = 4, down = 8};
+#if AMP_HAS_CPP_AMP
 
 		static const int warp_size = 32;
 		static const int warp_log = 5;
@@ -212,6 +214,26 @@ namespace amp
 			changed = 1;
 		}
 
+		// Lock-free union(Playne and Hawick): the larger root is linked under the smaller one with atomic_fetch_min,
+		// when another thread relinked it first the merge goes on with its new parent, so one call always completes the union
+		inline void union_roots(array_view<int, 2> label_array, int l1, int l2) restrict(amp)
+		{
+			const int cols = label_array.get_extent()[1];
+			while (true)
+			{
+				l1 = root(label_array, l1);
+				l2 = root(label_array, l2);
+				if (l1 == l2) break;
+				const int mi = direct3d::imin(l1, l2);
+				const int ma = direct3d::imax(l1, l2);
+				const int y = ma / cols;
+				const int old = concurrency::atomic_fetch_min(&label_array(y, ma - y * cols), mi);
+				if (old == ma) break;
+				l1 = mi;
+				l2 = old;
+			}
+		}
+
 		inline void cross_merge(accelerator_view& acc_view, concurrency::extent<2> ext, const int tiles_num_y, const int tiles_num_x, int tile_size_y_, int tile_size_x_,
 			array_view<const int, 2> mask_array, array_view<int, 2> label_array, const int y_incomplete, int x_incomplete)
 		{
@@ -287,8 +309,10 @@ namespace amp
 				}
 			});
 		}
+#endif
 	}
 
+#if AMP_HAS_CPP_AMP
 	inline void compute_connectivity_mask(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<int, 2> mask_array, float lo, float hi)
 	{
 		detail::connected connected(lo, hi);
@@ -401,5 +425,301 @@ namespace amp
 		});
 		return unique_label_count;
 	}
+#endif
+
+	// CPU backend
+	namespace detail
+	{
+		// Provisional labels of one strip of rows: base, base + 1, ... in raster order of their first run,
+		// with private statistics of the runs given each label
+		struct ccl_strip
+		{
+			int row_first;
+			int row_last;
+			int base;
+			std::vector<int> first_pixel;
+			std::vector<component_stats> stats;
+			std::vector<int> final_labels;
+		};
+
+		inline int ccl_find(int* parent, int label)
+		{
+			while(parent[label] != label)
+			{
+				parent[label] = parent[parent[label]];
+				label = parent[label];
+			}
+			return label;
+		}
+
+		// The smaller label stays the root, so a root is the first label of its component in raster order
+		inline void ccl_union(int* parent, int a, int b)
+		{
+			a = ccl_find(parent, a);
+			b = ccl_find(parent, b);
+			if(a < b)
+				parent[b] = a;
+			else if(b < a)
+				parent[a] = b;
+		}
+
+		// Pixels connected through the edge bits of compute_connectivity_mask, a link exists when either pixel has it
+		struct ccl_mask_scanner
+		{
+			int background_end(int, int x) const
+			{
+				return x;
+			}
+
+			int run_end(int y, int x) const
+			{
+				const int* mask_row = mask_array.row(y);
+				for(x++; x < mask_array.cols; x++)
+				{
+					if(!(mask_row[x] & static_cast<int>(component::left)) && !(mask_row[x - 1] & static_cast<int>(component::right)))
+						break;
+				}
+				return x;
+			}
+
+			template<typename Func>
+			void connect_up(int y, int x0, int x1, const Func& func) const
+			{
+				const int* mask_row = mask_array.row(y);
+				const int* above_row = mask_array.row(y - 1);
+				for(int x = x0; x < x1; x++)
+				{
+					if((mask_row[x] & static_cast<int>(component::up)) || (above_row[x] & static_cast<int>(component::down)))
+						func(x);
+				}
+			}
+
+			cpu::plane_view<const int> mask_array;
+		};
+
+		// Nonzero pixels, 4 or 8-connected
+		struct ccl_binary_scanner
+		{
+			int background_end(int y, int x) const
+			{
+				const unsigned char* src_row = src_array.row(y);
+				while(x < src_array.cols && !src_row[x])
+					x++;
+				return x;
+			}
+
+			int run_end(int y, int x) const
+			{
+				const unsigned char* src_row = src_array.row(y);
+				while(x < src_array.cols && src_row[x])
+					x++;
+				return x;
+			}
+
+			template<typename Func>
+			void connect_up(int y, int x0, int x1, const Func& func) const
+			{
+				const unsigned char* above_row = src_array.row(y - 1);
+				const int reach = eight_connected ? 1 : 0;
+				for(int x = std::max(0, x0 - reach); x < std::min(src_array.cols, x1 + reach); x++)
+				{
+					if(above_row[x])
+						func(x);
+				}
+			}
+
+			cpu::plane_view<const unsigned char> src_array;
+			bool eight_connected;
+		};
+
+		// Run-based union-find labeling in one scan. Strips are labeled in parallel, each run either takes
+		// a label of the runs above it(merging them) or a new one, and adds itself to the statistics of that label.
+		// The strip borders are merged afterwards, then the per-label statistics are merged into their roots once,
+		// so the image is only read by the scan and written by the final relabeling.
+		// compact: labels 0 .. N - 1 in raster order, otherwise the raster index of the first pixel of the component.
+		// Background pixels are labeled -1. Returns N.
+		template<typename Scanner>
+		inline int label_runs(cpu::thread_pool& pool, const Scanner& scanner, cpu::plane_view<int> label_array, bool compact, std::vector<component_stats>* stats)
+		{
+			const int rows = label_array.rows;
+			const int cols = label_array.cols;
+			const int strip_rows = std::max(8, DIVUP(rows, pool.size() * 4));
+			std::vector<ccl_strip> strips(DIVUP(rows, strip_rows));
+			// a label has at least one pixel, so a strip never runs out of its range of labels
+			std::unique_ptr<int[]> parent_storage(new int[size_t(rows) * cols]);
+			int* parent = parent_storage.get();
+			pool.parallel_for(0, int(strips.size()), 1, [&](int strip_first, int strip_last)
+			{
+				for(int s = strip_first; s < strip_last; s++)
+				{
+					ccl_strip& strip = strips[s];
+					strip.row_first = s * strip_rows;
+					strip.row_last = std::min(rows, strip.row_first + strip_rows);
+					strip.base = strip.row_first * cols;
+					for(int y = strip.row_first; y < strip.row_last; y++)
+					{
+						int* label_row = label_array.row(y);
+						const int* above_row = y > strip.row_first ? label_array.row(y - 1) : nullptr;
+						int x = 0;
+						while(x < cols)
+						{
+							const int x0 = scanner.background_end(y, x);
+							std::fill(label_row + x, label_row + x0, -1);
+							if(x0 == cols)
+								break;
+							const int x1 = scanner.run_end(y, x0);
+							int label = -1;
+							if(above_row)
+							{
+								int last = -1;
+								scanner.connect_up(y, x0, x1, [&](int xa)
+								{
+									const int above = above_row[xa];
+									if(above == last)
+										return;
+									last = above;
+									if(label < 0)
+										label = above;
+									else
+										ccl_union(parent, label, above);
+								});
+							}
+							if(label < 0)
+							{
+								label = strip.base + int(strip.first_pixel.size());
+								parent[label] = label;
+								strip.first_pixel.push_back(y * cols + x0);
+								if(stats)
+									strip.stats.emplace_back();
+							}
+							std::fill(label_row + x0, label_row + x1, label);
+							if(stats)
+								strip.stats[label - strip.base].add_run(y, x0, x1);
+							x = x1;
+						}
+					}
+				}
+			});
+			// strip borders
+			for(size_t s = 1; s < strips.size(); s++)
+			{
+				const int y = strips[s].row_first;
+				const int* label_row = label_array.row(y);
+				const int* above_row = label_array.row(y - 1);
+				int x = 0;
+				while(x < cols)
+				{
+					const int x0 = scanner.background_end(y, x);
+					if(x0 == cols)
+						break;
+					const int x1 = scanner.run_end(y, x0);
+					scanner.connect_up(y, x0, x1, [&](int xa)
+					{
+						ccl_union(parent, label_row[x0], above_row[xa]);
+					});
+					x = x1;
+				}
+			}
+			// final labels in raster order, roots come before the labels merged into them
+			auto final_of = [&](int label)
+			{
+				const ccl_strip& strip = strips[label / cols / strip_rows];
+				return strip.final_labels[label - strip.base];
+			};
+			int count = 0;
+			if(stats)
+				stats->clear();
+			for(size_t s = 0; s < strips.size(); s++)
+			{
+				ccl_strip& strip = strips[s];
+				strip.final_labels.resize(strip.first_pixel.size());
+				for(size_t i = 0; i < strip.first_pixel.size(); i++)
+				{
+					const int root = ccl_find(parent, strip.base + int(i));
+					if(root == strip.base + int(i))
+					{
+						strip.final_labels[i] = compact ? count : strip.first_pixel[i];
+						count++;
+						if(stats)
+							stats->push_back(strip.stats[i]);
+					}
+					else
+					{
+						strip.final_labels[i] = final_of(root);
+						if(stats)
+							(*stats)[strip.final_labels[i]].merge(strip.stats[i]);
+					}
+				}
+			}
+			pool.parallel_for(0, int(strips.size()), 1, [&](int strip_first, int strip_last)
+			{
+				for(int s = strip_first; s < strip_last; s++)
+				{
+					const ccl_strip& strip = strips[s];
+					for(int y = strip.row_first; y < strip.row_last; y++)
+					{
+						int* label_row = label_array.row(y);
+						for(int x = 0; x < cols; x++)
+						{
+							if(label_row[x] >= 0)
+								label_row[x] = strip.final_labels[label_row[x] - strip.base];
+						}
+					}
+				}
+			});
+			return count;
+		}
+	}
 
+	inline void compute_connectivity_mask(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<int> mask_array, float lo, float hi)
+	{
+		const int rows = src_array.rows;
+		const int cols = src_array.cols;
+		auto connected = [=](float v1, float v2)
+		{
+			float d = v1 - v2;
+			return lo <= d && d <= hi;
+		};
+		cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+		{
+			for(int y = row_first; y < row_last; y++)
+			{
+				const float* src_row = src_array.row(y);
+				int* mask_row = mask_array.row(y);
+				for(int x = 0; x < cols; x++)
+				{
+					const float intensity = src_row[x];
+					int c = 0;
+					if(x > 0 && connected(intensity, src_row[x - 1]))
+						c |= static_cast<int>(detail::component::left);
+					if(y > 0 && connected(intensity, src_array.row(y - 1)[x]))
+						c |= static_cast<int>(detail::component::up);
+					if(x + 1 < cols && connected(intensity, src_row[x + 1]))
+						c |= static_cast<int>(detail::component::right);
+					if(y + 1 < rows && connected(intensity, src_array.row(y + 1)[x]))
+						c |= static_cast<int>(detail::component::down);
+					mask_row[x] = c;
+				}
+			}
+		});
+	}
+
+	// Labels are the raster index of the first pixel of each component, as with the AMP version
+	inline void label_components(cpu::thread_pool& pool, cpu::plane_view<const int> mask_array, cpu::plane_view<int> label_array)
+	{
+		detail::label_runs(pool, detail::ccl_mask_scanner{ mask_array }, label_array, false, nullptr);
+	}
+
+	// Labels 0 .. N - 1 in raster order with the area, bounding box and moments of every component, returns N
+	inline int label_components(cpu::thread_pool& pool, cpu::plane_view<const int> mask_array, cpu::plane_view<int> label_array, std::vector<component_stats>& stats)
+	{
+		return detail::label_runs(pool, detail::ccl_mask_scanner{ mask_array }, label_array, true, &stats);
+	}
+
+	// Components of the nonzero pixels, labeled 0 .. N - 1 in raster order with their statistics, zero pixels get -1. Returns N.
+	inline int label_binary_components_8u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array, cpu::plane_view<int> label_array
+		, std::vector<component_stats>& stats, bool eight_connected = true)
+	{
+		return detail::label_runs(pool, detail::ccl_binary_scanner{ src_array, eight_connected }, label_array, true, &stats);
+	}
 }
@@ -5,16 +5,17 @@
 
 namespace amp
 {
-	inline void initialize_pallete_32f_c3(accelerator_view& acc_view, array_view<const float, 2> src_channel1, array_view<const float, 2> src_channel2
+	inline void initialize_pallete_32f_c3(accelerator_view& acc_view, buffer_pool& buffers, array_view<const float, 2> src_channel1, array_view<const float, 2> src_channel2
 		, array_view<const float, 2> src_channel3, array_view<float_3, 2> pallete)
 	{
 		// 1.calculate max/min values for each channel
 		std::vector<float> result(6);
-		concurrency::array<float, 2> temp_array(6, src_channel1.get_extent()[1], acc_view);
+		buffer_pool::device_lease temp_buf = buffers.acquire_device<float>(6 * src_channel1.get_extent()[1]);
+		array_view<float, 2> temp_array = temp_buf.view<float>(6, src_channel1.get_extent()[1]);
 		// step1: reduce 2d to 1d
 		int src_cols = src_channel1.get_extent()[1];
 		int src_rows = src_channel1.get_extent()[0];
-		parallel_for_each(acc_view, concurrency::extent<1>(src_cols), [=, &temp_array](concurrency::index<1> idx) restrict(amp)
+		parallel_for_each(acc_view, concurrency::extent<1>(src_cols), [=](concurrency::index<1> idx) restrict(amp)
 		{
 			int global_col = idx[0];
 			float max_c1 = -FLT_MAX;
@@ -43,14 +44,15 @@ namespace amp
 			temp_array(5, global_col) = min_c3;
 		});
 		// step2: reduce 1d to single value
-		std::vector<float> cpu_temp(src_cols * 6);
-		concurrency::copy(temp_array.section(0, 0, 6, src_cols), cpu_temp.begin());
-		result[0] = *std::max_element(cpu_temp.begin(), cpu_temp.begin() + src_cols);
-		result[1] = *std::min_element(cpu_temp.begin() + src_cols, cpu_temp.begin() + src_cols * 2);
-		result[2] = *std::max_element(cpu_temp.begin() + src_cols * 2, cpu_temp.begin() + src_cols * 3);
-		result[3] = *std::min_element(cpu_temp.begin() + src_cols * 3, cpu_temp.begin() + src_cols * 4);
-		result[4] = *std::max_element(cpu_temp.begin() + src_cols * 4, cpu_temp.begin() + src_cols * 5);
-		result[5] = *std::min_element(cpu_temp.begin() + src_cols * 5, cpu_temp.end());
+		buffer_pool::host_lease cpu_temp_buf = buffers.acquire_host(sizeof(float) * src_cols * 6);
+		float* cpu_temp = cpu_temp_buf.data<float>();
+		concurrency::copy(temp_array, cpu_temp);
+		result[0] = *std::max_element(cpu_temp, cpu_temp + src_cols);
+		result[1] = *std::min_element(cpu_temp + src_cols, cpu_temp + src_cols * 2);
+		result[2] = *std::max_element(cpu_temp + src_cols * 2, cpu_temp + src_cols * 3);
+		result[3] = *std::min_element(cpu_temp + src_cols * 3, cpu_temp + src_cols * 4);
+		result[4] = *std::max_element(cpu_temp + src_cols * 4, cpu_temp + src_cols * 5);
+		result[5] = *std::min_element(cpu_temp + src_cols * 5, cpu_temp + src_cols * 6);
 		std::vector<cv::Vec3f> init_pallete;
 		int pallete_size = pallete.get_extent()[0] * pallete.get_extent()[1];
 		float step1 = (result[0] - result[1]) / (pallete_size - 1);
@@ -66,6 +68,19 @@ namespace amp
 		concurrency::copy((float_3*)&init_pallete[0], pallete);
 	}
 
+	inline void initialize_pallete_32f_c3(vision_context& ctx, array_view<const float, 2> src_channel1, array_view<const float, 2> src_channel2
+		, array_view<const float, 2> src_channel3, array_view<float_3, 2> pallete)
+	{
+		initialize_pallete_32f_c3(ctx.acc_view, ctx.buffers, src_channel1, src_channel2, src_channel3, pallete);
+	}
+
+	inline void initialize_pallete_32f_c3(accelerator_view& acc_view, array_view<const float, 2> src_channel1, array_view<const float, 2> src_channel2
+		, array_view<const float, 2> src_channel3, array_view<float_3, 2> pallete)
+	{
+		buffer_pool buffers(acc_view);
+		initialize_pallete_32f_c3(acc_view, buffers, src_channel1, src_channel2, src_channel3, pallete);
+	}
+
 	template<int array_height, int array_width>
 	inline void local_sum_up(int_4(&local_sums)[array_height][array_width], int i, int j, int x, int y, int z) restrict(amp)
 	{
@@ -1,9 +1,11 @@
 ﻿#pragma once
 
 #include "amp_core.h"
+#include "amp_conv_separable.h"
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	inline void convolve2d_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array, const kernel_wrapper<float, 169U>& wrapped_kernel)
 	{
 		assert(wrapped_kernel.rows >= 3 && wrapped_kernel.rows <= 13);
@@ -126,5 +128,58 @@ namespace amp
 		kernel_wrapper<float, 169U> wrapped_kernel(kernel);
 		convolve2d_32f_c1(acc_view, src_array, dest_array, wrapped_kernel);
 	}
+#endif
+
+	// CPU backend, any kernel size: every output span sums rows x cols taps over reflect101 padded source rows.
+	// Point symmetric kernels fold like the separable passes, the flattened kernel reads the same both ways.
+	inline void convolve2d_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array, const cv::Mat& kernel)
+	{
+		assert(kernel.channels() == 1);
+		cv::Mat kernel_32f;
+		kernel.convertTo(kernel_32f, CV_32F);
+		kernel_32f = kernel_32f.clone();
+		const int kernel_rows = kernel_32f.rows;
+		const int kernel_cols = kernel_32f.cols;
+		const detail::cpu_conv_kernel k(kernel_32f.ptr<float>(0), kernel_rows * kernel_cols);
+		const cpu::simd_level level = cpu::active_simd_level();
+		const int rows = dest_array.rows;
+		const int cols = dest_array.cols;
+		const int anchor_row = kernel_rows / 2;
+		const int anchor_col = kernel_cols / 2;
+		const int block_rows = detail::cpu_conv_block_rows;
+		const int block_cols = detail::cpu_conv_block_cols;
+		const int padded_cols = block_cols + kernel_cols - 1;
+		const int strips = DIVUP(rows, block_rows);
+		const int blocks = DIVUP(cols, block_cols);
+		pool.parallel_for(0, strips * blocks, 1, [&](int first, int last)
+		{
+			std::vector<float> padded(size_t(block_rows + kernel_rows - 1) * padded_cols);
+			std::vector<const float*> taps(kernel_rows * kernel_cols);
+			for(int t = first; t < last; t++)
+			{
+				int row_first = (t / blocks) * block_rows;
+				int row_last = std::min(rows, row_first + block_rows);
+				int col_first = (t % blocks) * block_cols;
+				int count = std::min(cols - col_first, block_cols);
+				for(int r = row_first - anchor_row; r < row_last + kernel_rows - 1 - anchor_row; r++)
+				{
+					int src_row = cpu::replicate(cpu::reflect101(r, src_array.rows), src_array.rows);
+					detail::load_padded_row(src_array.row(src_row), src_array.cols, col_first, count, anchor_col, kernel_cols
+						, &padded[size_t(r - row_first + anchor_row) * padded_cols]);
+				}
+				for(int r = row_first; r < row_last; r++)
+				{
+					for(int i = 0; i < kernel_rows; i++)
+					{
+						for(int j = 0; j < kernel_cols; j++)
+						{
+							taps[i * kernel_cols + j] = &padded[size_t(r - row_first + i) * padded_cols + j];
+						}
+					}
+					detail::convolve_span(taps.data(), dest_array.row(r) + col_first, count, k, level);
+				}
+			}
+		});
+	}
 
 }
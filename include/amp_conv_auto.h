@@ -0,0 +1,425 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include "amp_core.h"
+#include "amp_conv2d.h"
+#include "amp_conv_separable.h"
+#include "amp_cpu_fft.h"
+
+namespace amp
+{
+	// Same-size 2D correlation with reflect101 borders and the anchor at the kernel center, like convolve2d_32f_c1
+	// and convolve_separable_32f_c1. convolve_auto_32f_c1 picks the cheapest method for the image and kernel size:
+	// sample code:
+	// convolve_auto_32f_c1(pool, src, dest, kernel);
+	// conv_cost_model model = conv_cost_model::load_or_calibrate("conv_cost.txt", pool);
+	// convolve_auto_32f_c1(pool, src, dest, kernel, model);
+	enum class conv_method
+	{
+		direct,
+		separable,
+		// overlap-save over tiles, each tile one forward and one inverse transform
+		fft_tiled,
+		// one transform of the whole padded image
+		fft_whole
+	};
+
+	struct conv_plan
+	{
+		conv_method method;
+		// outputs per FFT tile and the transform size, FFT methods only
+		int tile_rows;
+		int tile_cols;
+		int fft_rows;
+		int fft_cols;
+		// predicted time in ns
+		double cost;
+	};
+
+	// Time per unit of work of each method on this machine and thread pool: a direct tap, an FFT point per log2 of the
+	// transform size, a pointwise pass (window load, spectrum product, copy out) per transformed point and the fixed
+	// cost of a tile's transforms, which makes small tiles lose to fewer large ones.
+	struct conv_cost_model
+	{
+		conv_cost_model()
+			: tap_ns(0.25), fft_ns(0.6), point_ns(2.0), tile_ns(20000.0), level(int(cpu::active_simd_level())), threads(1)
+		{
+		}
+
+		double direct_cost(int rows, int cols, int kernel_rows, int kernel_cols) const
+		{
+			return tap_ns * double(rows) * cols * kernel_rows * kernel_cols;
+		}
+
+		double separable_cost(int rows, int cols, int kernel_rows, int kernel_cols) const
+		{
+			return tap_ns * double(rows) * cols * (kernel_rows + kernel_cols) + point_ns * double(rows) * cols;
+		}
+
+		// tiles of the image, each a forward and an inverse transform, plus the kernel transform
+		double fft_cost(int rows, int cols, int tile_rows, int tile_cols, int fft_rows, int fft_cols) const
+		{
+			const double points = double(fft_rows) * fft_cols;
+			const double transform = fft_ns * points * std::log2(std::max(points, 2.0));
+			const double tiles = double(DIVUP(rows, tile_rows)) * DIVUP(cols, tile_cols);
+			return tiles * (2.0 * transform + point_ns * points + tile_ns) + transform;
+		}
+
+		// times each method on a small problem with the given pool
+		static conv_cost_model calibrate(cpu::thread_pool& pool);
+
+		bool load(const std::string& path)
+		{
+			std::ifstream file(path);
+			std::string magic;
+			int version = 0;
+			conv_cost_model model;
+			if(!(file >> magic >> version >> model.level >> model.threads >> model.tap_ns >> model.fft_ns >> model.point_ns >> model.tile_ns)
+				|| magic != "ampconv" || version != 1 || model.tap_ns <= 0.0 || model.fft_ns <= 0.0 || model.point_ns <= 0.0 || model.tile_ns < 0.0)
+			{
+				return false;
+			}
+			*this = model;
+			return true;
+		}
+
+		void save(const std::string& path) const
+		{
+			std::ofstream file(path, std::ios::trunc);
+			file.precision(9);
+			file << "ampconv 1 " << level << ' ' << threads << ' ' << tap_ns << ' ' << fft_ns << ' ' << point_ns << ' ' << tile_ns << '\n';
+			if(!file)
+			{
+				throw std::runtime_error("can't write conv cost model " + path);
+			}
+		}
+
+		// calibration done once per machine: the file is reused while the SIMD level and thread count match
+		static conv_cost_model load_or_calibrate(const std::string& path, cpu::thread_pool& pool)
+		{
+			conv_cost_model model;
+			if(model.load(path) && model.level == int(cpu::active_simd_level()) && model.threads == pool.size())
+			{
+				return model;
+			}
+			model = calibrate(pool);
+			model.save(path);
+			return model;
+		}
+
+		double tap_ns;
+		double fft_ns;
+		double point_ns;
+		double tile_ns;
+		int level;
+		int threads;
+	};
+
+	namespace detail
+	{
+		// k = col_kernel * row_kernel within a relative tolerance, from the row and column through the largest tap
+		inline bool split_rank1(const cv::Mat& kernel_32f, std::vector<float>& row_kernel, std::vector<float>& col_kernel)
+		{
+			int pivot_row = 0, pivot_col = 0;
+			float pivot = 0.0f;
+			for(int i = 0; i < kernel_32f.rows; i++)
+			{
+				for(int j = 0; j < kernel_32f.cols; j++)
+				{
+					if(std::fabs(kernel_32f.at<float>(i, j)) > std::fabs(pivot))
+					{
+						pivot = kernel_32f.at<float>(i, j);
+						pivot_row = i;
+						pivot_col = j;
+					}
+				}
+			}
+			if(pivot == 0.0f)
+			{
+				return false;
+			}
+			row_kernel.assign(kernel_32f.ptr<float>(pivot_row), kernel_32f.ptr<float>(pivot_row) + kernel_32f.cols);
+			col_kernel.resize(kernel_32f.rows);
+			for(int i = 0; i < kernel_32f.rows; i++)
+			{
+				col_kernel[i] = kernel_32f.at<float>(i, pivot_col) / pivot;
+			}
+			const float tolerance = 1e-5f * std::fabs(pivot);
+			for(int i = 0; i < kernel_32f.rows; i++)
+			{
+				for(int j = 0; j < kernel_32f.cols; j++)
+				{
+					if(std::fabs(kernel_32f.at<float>(i, j) - col_kernel[i] * row_kernel[j]) > tolerance)
+					{
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		// output tile sizes tried by the planner, the whole image is always a candidate too
+		static const int conv_fft_tiles[] = { 32, 64, 128, 256, 512, 1024 };
+
+		// Overlap-save FFT correlation: each tile_rows x tile_cols output tile transforms its reflect101 window
+		// of (tile + kernel - 1) source pixels zero-padded to fft size, multiplies by the conjugate kernel spectrum and
+		// keeps the first tile outputs of the inverse, which the circular wrap doesn't reach.
+		inline void convolve_fft_tiles(cpu::thread_pool& pool, cpu::plane_view<const float> src, cpu::plane_view<float> dest, const cv::Mat& kernel_32f
+			, const conv_plan& plan)
+		{
+			const int rows = dest.rows;
+			const int cols = dest.cols;
+			const int kernel_rows = kernel_32f.rows;
+			const int kernel_cols = kernel_32f.cols;
+			const int fft_rows = plan.fft_rows;
+			const int fft_cols = plan.fft_cols;
+			const int half_cols = cpu::fft_half_cols(fft_cols);
+			const float scale = float(1.0 / (double(fft_rows) * fft_cols));
+			cpu::plane<std::complex<float>> kernel_spectrum(fft_rows, half_cols);
+			{
+				cpu::plane<float> kernel_block(fft_rows, fft_cols);
+				for(int i = 0; i < kernel_rows; i++)
+				{
+					std::copy(kernel_32f.ptr<float>(i), kernel_32f.ptr<float>(i) + kernel_cols, kernel_block.view().row(i));
+				}
+				cpu::fft_forward_r2c_2d(pool, kernel_block, kernel_spectrum);
+			}
+			const int tiles_y = DIVUP(rows, plan.tile_rows);
+			const int tiles_x = DIVUP(cols, plan.tile_cols);
+			pool.parallel_for(0, tiles_y * tiles_x, 1, [&](int first, int last)
+			{
+				cpu::plane<float> window(fft_rows, fft_cols);
+				cpu::plane<std::complex<float>> spectrum(fft_rows, half_cols);
+				for(int t = first; t < last; t++)
+				{
+					const int row_first = (t / tiles_x) * plan.tile_rows;
+					const int col_first = (t % tiles_x) * plan.tile_cols;
+					const int count_rows = std::min(rows - row_first, plan.tile_rows);
+					const int count_cols = std::min(cols - col_first, plan.tile_cols);
+					const int window_rows = count_rows + kernel_rows - 1;
+					const int window_cols = count_cols + kernel_cols - 1;
+					cpu::plane_view<float> window_view = window.view();
+					for(int i = 0; i < fft_rows; i++)
+					{
+						float* window_row = window_view.row(i);
+						if(i < window_rows)
+						{
+							int src_row = cpu::replicate(cpu::reflect101(row_first - kernel_rows / 2 + i, src.rows), src.rows);
+							load_padded_row(src.row(src_row), src.cols, col_first, count_cols, kernel_cols / 2, kernel_cols, window_row);
+							std::fill(window_row + window_cols, window_row + fft_cols, 0.0f);
+						}
+						else
+						{
+							std::fill(window_row, window_row + fft_cols, 0.0f);
+						}
+					}
+					cpu::fft_forward_r2c_2d(pool, window, spectrum);
+					cpu::multiply_spectrums(pool, spectrum, kernel_spectrum, spectrum, true);
+					cpu::fft_inverse_c2r_2d(pool, spectrum, window, scale);
+					for(int i = 0; i < count_rows; i++)
+					{
+						std::copy(window_view.row(i), window_view.row(i) + count_cols, dest.row(row_first + i) + col_first);
+					}
+				}
+			});
+		}
+
+		// outputs_per_tile + kernel - 1 grown to a 2, 3, 5 smooth transform size, with the outputs it leaves room for
+		inline void conv_fft_size(int outputs, int total, int kernel_size, int& tile, int& fft_size)
+		{
+			tile = std::min(outputs, total);
+			fft_size = cpu::optimal_fft_size(tile + kernel_size - 1);
+			// the smooth size may leave room for more outputs at no cost
+			tile = std::min(total, fft_size - kernel_size + 1);
+		}
+	}
+
+	// cheapest method for a rows x cols image and a kernel_rows x kernel_cols kernel, separable tells whether the kernel has rank 1
+	inline conv_plan choose_convolution(const conv_cost_model& model, int rows, int cols, int kernel_rows, int kernel_cols, bool separable)
+	{
+		conv_plan best = { conv_method::direct, 0, 0, 0, 0, model.direct_cost(rows, cols, kernel_rows, kernel_cols) };
+		if(separable && kernel_rows <= 1024 && kernel_cols <= 1024)
+		{
+			double cost = model.separable_cost(rows, cols, kernel_rows, kernel_cols);
+			if(cost < best.cost)
+			{
+				best = { conv_method::separable, 0, 0, 0, 0, cost };
+			}
+		}
+		std::vector<int> tile_sizes(std::begin(detail::conv_fft_tiles), std::end(detail::conv_fft_tiles));
+		tile_sizes.push_back(std::max(rows, cols));
+		for(int tile_rows_request : tile_sizes)
+		{
+			for(int tile_cols_request : tile_sizes)
+			{
+				conv_plan plan;
+				detail::conv_fft_size(tile_rows_request, rows, kernel_rows, plan.tile_rows, plan.fft_rows);
+				detail::conv_fft_size(tile_cols_request, cols, kernel_cols, plan.tile_cols, plan.fft_cols);
+				plan.method = plan.tile_rows >= rows && plan.tile_cols >= cols ? conv_method::fft_whole : conv_method::fft_tiled;
+				plan.cost = model.fft_cost(rows, cols, plan.tile_rows, plan.tile_cols, plan.fft_rows, plan.fft_cols);
+				if(plan.cost < best.cost)
+				{
+					best = plan;
+				}
+			}
+		}
+		return best;
+	}
+
+	// runs a plan of choose_convolution
+	inline void convolve_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array, const cv::Mat& kernel
+		, const conv_plan& plan)
+	{
+		assert(kernel.channels() == 1);
+		if(src_array.rows != dest_array.rows || src_array.cols != dest_array.cols)
+		{
+			throw std::runtime_error("convolve_32f_c1 needs a destination of the source size");
+		}
+		cv::Mat kernel_32f;
+		kernel.convertTo(kernel_32f, CV_32F);
+		kernel_32f = kernel_32f.clone();
+		switch(plan.method)
+		{
+		case conv_method::direct:
+			convolve2d_32f_c1(pool, src_array, dest_array, kernel_32f);
+			break;
+		case conv_method::separable:
+			{
+				std::vector<float> row_kernel, col_kernel;
+				if(!detail::split_rank1(kernel_32f, row_kernel, col_kernel))
+				{
+					throw std::runtime_error("convolve_32f_c1: the kernel is not separable");
+				}
+				convolve_separable_32f_c1<1024U>(pool, src_array, dest_array, cpu::plane_view<float>()
+					, cv::Mat(1, int(row_kernel.size()), CV_32FC1, row_kernel.data()), cv::Mat(1, int(col_kernel.size()), CV_32FC1, col_kernel.data()));
+			}
+			break;
+		default:
+			detail::convolve_fft_tiles(pool, src_array, dest_array, kernel_32f, plan);
+			break;
+		}
+	}
+
+	// model for convolve_auto_32f_c1 without one, calibrated on the default pool at first use
+	inline const conv_cost_model& default_conv_cost_model()
+	{
+		static const conv_cost_model model = conv_cost_model::calibrate(cpu::default_thread_pool());
+		return model;
+	}
+
+	// direct, separable (rank-1 kernels), tiled or whole-image FFT, whichever the cost model predicts fastest
+	inline void convolve_auto_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array, const cv::Mat& kernel
+		, const conv_cost_model& model = default_conv_cost_model())
+	{
+		cv::Mat kernel_32f;
+		kernel.convertTo(kernel_32f, CV_32F);
+		std::vector<float> row_kernel, col_kernel;
+		const bool separable = kernel_32f.rows > 1 && kernel_32f.cols > 1 && detail::split_rank1(kernel_32f, row_kernel, col_kernel);
+		convolve_32f_c1(pool, src_array, dest_array, kernel_32f, choose_convolution(model, dest_array.rows, dest_array.cols, kernel_32f.rows, kernel_32f.cols, separable));
+	}
+
+	inline conv_cost_model conv_cost_model::calibrate(cpu::thread_pool& pool)
+	{
+		typedef std::chrono::steady_clock clock;
+		// best of a few runs, in ns
+		auto time = [](const std::function<void()>& func)
+		{
+			double best = std::numeric_limits<double>::max();
+			for(int i = 0; i < 3; i++)
+			{
+				clock::time_point start = clock::now();
+				func();
+				best = std::min(best, double(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count()));
+			}
+			return std::max(best, 1.0);
+		};
+		const int size = 256;
+		const int kernel_size = 9;
+		cpu::plane<float> src(size, size), dest(size, size);
+		for(int r = 0; r < size; r++)
+		{
+			for(int c = 0; c < size; c++)
+			{
+				src.view()(r, c) = float((r * 7 + c * 13) % 31);
+			}
+		}
+		cv::Mat kernel(kernel_size, kernel_size, CV_32FC1);
+		for(int i = 0; i < kernel_size; i++)
+		{
+			for(int j = 0; j < kernel_size; j++)
+			{
+				// not point symmetric, so the direct pass doesn't fold
+				kernel.at<float>(i, j) = float(i * kernel_size + j + 1);
+			}
+		}
+		conv_cost_model model;
+		model.level = int(cpu::active_simd_level());
+		model.threads = pool.size();
+		model.tap_ns = time([&]() { convolve2d_32f_c1(pool, src, dest, kernel); }) / (double(size) * size * kernel_size * kernel_size);
+		// a transform pair at two sizes separates the per point cost from the fixed cost
+		auto transform_pair = [&](int n)
+		{
+			cpu::plane_view<const float> block = src.view().section(0, 0, n, n);
+			cpu::plane<std::complex<float>> block_spectrum(n, cpu::fft_half_cols(n));
+			return time([&]()
+			{
+				cpu::fft_forward_r2c_2d(pool, block, block_spectrum);
+				cpu::fft_inverse_c2r_2d(pool, block_spectrum, dest.view().section(0, 0, n, n));
+			});
+		};
+		const int small_size = 32;
+		const double points = double(size) * size;
+		const double small_points = double(small_size) * small_size;
+		const double large_work = 2.0 * points * std::log2(points);
+		const double small_work = 2.0 * small_points * std::log2(small_points);
+		const double large_time = transform_pair(size);
+		const double small_time = transform_pair(small_size);
+		model.fft_ns = std::max((large_time - small_time) / (large_work - small_work), large_time / large_work * 0.1);
+		model.tile_ns = std::max(0.0, small_time - model.fft_ns * small_work);
+		cpu::plane<std::complex<float>> spectrum(size, cpu::fft_half_cols(size));
+		model.point_ns = time([&]()
+		{
+			cpu::copy<float>(pool, src, dest);
+			cpu::multiply_spectrums(pool, spectrum, spectrum, spectrum, true);
+			cpu::copy<float>(pool, dest, src);
+		}) / points;
+		return model;
+	}
+
+#if AMP_HAS_CPP_AMP
+	// Rank-1 kernels run as the two AMP separable passes and kernels up to 13 x 13 as convolve2d_32f_c1;
+	// larger ones go through the host planner and FFT engine.
+	inline void convolve_auto_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array, const cv::Mat& kernel)
+	{
+		cv::Mat kernel_32f;
+		kernel.convertTo(kernel_32f, CV_32F);
+		kernel_32f = kernel_32f.clone();
+		std::vector<float> row_kernel, col_kernel;
+		if(kernel_32f.rows > 1 && kernel_32f.cols > 1 && kernel_32f.rows <= 1024 && kernel_32f.cols <= 1024 && detail::split_rank1(kernel_32f, row_kernel, col_kernel))
+		{
+			concurrency::array<float, 2> row_temp(src_array.get_extent(), acc_view);
+			convolve_separable_32f_c1<1024U>(acc_view, src_array, dest_array, row_temp
+				, cv::Mat(1, int(row_kernel.size()), CV_32FC1, row_kernel.data()), cv::Mat(1, int(col_kernel.size()), CV_32FC1, col_kernel.data()));
+		}
+		else if(kernel_32f.rows >= 3 && kernel_32f.rows <= 13 && kernel_32f.cols >= 3 && kernel_32f.cols <= 13)
+		{
+			convolve2d_32f_c1(acc_view, src_array, dest_array, kernel_32f);
+		}
+		else
+		{
+			const int rows = src_array.get_extent()[0];
+			const int cols = src_array.get_extent()[1];
+			cpu::plane<float> host_src(rows, cols), host_dest(rows, cols);
+			std::vector<float> buffer(size_t(rows) * cols);
+			concurrency::copy(src_array, buffer.data());
+			cpu::copy<float>(cpu::default_thread_pool(), cpu::plane_view<const float>(buffer.data(), rows, cols), host_src);
+			convolve_auto_32f_c1(cpu::default_thread_pool(), host_src, host_dest, kernel_32f);
+			cpu::copy<float>(cpu::default_thread_pool(), host_dest, cpu::plane_view<float>(buffer.data(), rows, cols));
+			dest_array.discard_data();
+			concurrency::copy(buffer.data(), dest_array);
+		}
+	}
+#endif
+}
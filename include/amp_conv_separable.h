@@ -4,6 +4,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Convolve by row
 	template<unsigned int max_kernel_size>
 	inline void convolve_by_row_32f_c1(accelerator_view& acc_view, array_view<const float, 2> srcArray, array_view<float, 2> destArray, const kernel_wrapper<float, max_kernel_size>& kernel)
@@ -125,5 +126,416 @@ namespace amp
 		dest_array.discard_data();
 		convolve_by_column_32f_c1<max_kernel_size>(acc_view, row_temp_array, dest_array, wrappedColKernel);
 	}
+#endif
+
+	// CPU backend
+	namespace detail
+	{
+		// Kernel prepared for the CPU span functions, odd symmetric and antisymmetric kernels are folded
+		// so that each pair of taps costs one add/sub and one multiply
+		struct cpu_conv_kernel
+		{
+			cpu_conv_kernel(const float* data_, int size_)
+				: data(data_), size(size_), anchor(size_ / 2), sign(0.0f)
+			{
+				if(size % 2 == 1 && size > 1)
+				{
+					bool symmetric = true, antisymmetric = true;
+					for(int i = 0; i <= anchor; i++)
+					{
+						symmetric = symmetric && data[i] == data[size - 1 - i];
+						antisymmetric = antisymmetric && data[i] == -data[size - 1 - i];
+					}
+					sign = symmetric ? 1.0f : (antisymmetric ? -1.0f : 0.0f);
+				}
+			}
+
+			bool folded() const
+			{
+				return sign != 0.0f;
+			}
+
+			const float* data;
+			int size;
+			int anchor;
+			float sign;
+		};
+
+		// dest[c] = sum(k[i] * taps[i][c]) for c in [first, n)
+		// The row pass uses taps[i] = padded_row + i, the column pass taps[i] = source row i.
+		inline void convolve_span_scalar(const float* const* taps, float* dest, int first, int n, const cpu_conv_kernel& k)
+		{
+			for(int c = first; c < n; c++)
+			{
+				float sum;
+				if(k.folded())
+				{
+					sum = k.data[k.anchor] * taps[k.anchor][c];
+					for(int i = 0; i < k.anchor; i++)
+					{
+						sum += k.data[i] * (taps[i][c] + k.sign * taps[k.size - 1 - i][c]);
+					}
+				}
+				else
+				{
+					sum = 0.0f;
+					for(int i = 0; i < k.size; i++)
+					{
+						sum += k.data[i] * taps[i][c];
+					}
+				}
+				dest[c] = sum;
+			}
+		}
+
+#if AMP_CPU_X86
+		AMP_CPU_TARGET("sse4.1")
+		inline void convolve_span_sse4(const float* const* taps, float* dest, int n, const cpu_conv_kernel& k)
+		{
+			int c = 0;
+			for(; c + 8 <= n; c += 8)
+			{
+				__m128 acc0, acc1;
+				if(k.folded())
+				{
+					__m128 kc = _mm_set1_ps(k.data[k.anchor]);
+					acc0 = _mm_mul_ps(kc, _mm_loadu_ps(taps[k.anchor] + c));
+					acc1 = _mm_mul_ps(kc, _mm_loadu_ps(taps[k.anchor] + c + 4));
+					for(int i = 0; i < k.anchor; i++)
+					{
+						const float* lo = taps[i] + c;
+						const float* hi = taps[k.size - 1 - i] + c;
+						__m128 ki = _mm_set1_ps(k.data[i]);
+						__m128 p0 = k.sign > 0.0f ? _mm_add_ps(_mm_loadu_ps(lo), _mm_loadu_ps(hi)) : _mm_sub_ps(_mm_loadu_ps(lo), _mm_loadu_ps(hi));
+						__m128 p1 = k.sign > 0.0f ? _mm_add_ps(_mm_loadu_ps(lo + 4), _mm_loadu_ps(hi + 4)) : _mm_sub_ps(_mm_loadu_ps(lo + 4), _mm_loadu_ps(hi + 4));
+						acc0 = _mm_add_ps(acc0, _mm_mul_ps(ki, p0));
+						acc1 = _mm_add_ps(acc1, _mm_mul_ps(ki, p1));
+					}
+				}
+				else
+				{
+					acc0 = _mm_setzero_ps();
+					acc1 = _mm_setzero_ps();
+					for(int i = 0; i < k.size; i++)
+					{
+						__m128 ki = _mm_set1_ps(k.data[i]);
+						acc0 = _mm_add_ps(acc0, _mm_mul_ps(ki, _mm_loadu_ps(taps[i] + c)));
+						acc1 = _mm_add_ps(acc1, _mm_mul_ps(ki, _mm_loadu_ps(taps[i] + c + 4)));
+					}
+				}
+				_mm_storeu_ps(dest + c, acc0);
+				_mm_storeu_ps(dest + c + 4, acc1);
+			}
+			convolve_span_scalar(taps, dest, c, n, k);
+		}
+
+		AMP_CPU_TARGET("avx2,fma")
+		inline void convolve_span_avx2(const float* const* taps, float* dest, int n, const cpu_conv_kernel& k)
+		{
+			int c = 0;
+			for(; c + 32 <= n; c += 32)
+			{
+				__m256 acc0, acc1, acc2, acc3;
+				if(k.folded())
+				{
+					__m256 kc = _mm256_set1_ps(k.data[k.anchor]);
+					const float* center = taps[k.anchor] + c;
+					acc0 = _mm256_mul_ps(kc, _mm256_loadu_ps(center));
+					acc1 = _mm256_mul_ps(kc, _mm256_loadu_ps(center + 8));
+					acc2 = _mm256_mul_ps(kc, _mm256_loadu_ps(center + 16));
+					acc3 = _mm256_mul_ps(kc, _mm256_loadu_ps(center + 24));
+					if(k.sign > 0.0f)
+					{
+						for(int i = 0; i < k.anchor; i++)
+						{
+							const float* lo = taps[i] + c;
+							const float* hi = taps[k.size - 1 - i] + c;
+							__m256 ki = _mm256_set1_ps(k.data[i]);
+							acc0 = _mm256_fmadd_ps(ki, _mm256_add_ps(_mm256_loadu_ps(lo), _mm256_loadu_ps(hi)), acc0);
+							acc1 = _mm256_fmadd_ps(ki, _mm256_add_ps(_mm256_loadu_ps(lo + 8), _mm256_loadu_ps(hi + 8)), acc1);
+							acc2 = _mm256_fmadd_ps(ki, _mm256_add_ps(_mm256_loadu_ps(lo + 16), _mm256_loadu_ps(hi + 16)), acc2);
+							acc3 = _mm256_fmadd_ps(ki, _mm256_add_ps(_mm256_loadu_ps(lo + 24), _mm256_loadu_ps(hi + 24)), acc3);
+						}
+					}
+					else
+					{
+						for(int i = 0; i < k.anchor; i++)
+						{
+							const float* lo = taps[i] + c;
+							const float* hi = taps[k.size - 1 - i] + c;
+							__m256 ki = _mm256_set1_ps(k.data[i]);
+							acc0 = _mm256_fmadd_ps(ki, _mm256_sub_ps(_mm256_loadu_ps(lo), _mm256_loadu_ps(hi)), acc0);
+							acc1 = _mm256_fmadd_ps(ki, _mm256_sub_ps(_mm256_loadu_ps(lo + 8), _mm256_loadu_ps(hi + 8)), acc1);
+							acc2 = _mm256_fmadd_ps(ki, _mm256_sub_ps(_mm256_loadu_ps(lo + 16), _mm256_loadu_ps(hi + 16)), acc2);
+							acc3 = _mm256_fmadd_ps(ki, _mm256_sub_ps(_mm256_loadu_ps(lo + 24), _mm256_loadu_ps(hi + 24)), acc3);
+						}
+					}
+				}
+				else
+				{
+					acc0 = _mm256_setzero_ps();
+					acc1 = _mm256_setzero_ps();
+					acc2 = _mm256_setzero_ps();
+					acc3 = _mm256_setzero_ps();
+					for(int i = 0; i < k.size; i++)
+					{
+						const float* src = taps[i] + c;
+						__m256 ki = _mm256_set1_ps(k.data[i]);
+						acc0 = _mm256_fmadd_ps(ki, _mm256_loadu_ps(src), acc0);
+						acc1 = _mm256_fmadd_ps(ki, _mm256_loadu_ps(src + 8), acc1);
+						acc2 = _mm256_fmadd_ps(ki, _mm256_loadu_ps(src + 16), acc2);
+						acc3 = _mm256_fmadd_ps(ki, _mm256_loadu_ps(src + 24), acc3);
+					}
+				}
+				_mm256_storeu_ps(dest + c, acc0);
+				_mm256_storeu_ps(dest + c + 8, acc1);
+				_mm256_storeu_ps(dest + c + 16, acc2);
+				_mm256_storeu_ps(dest + c + 24, acc3);
+			}
+			for(; c + 8 <= n; c += 8)
+			{
+				__m256 acc = _mm256_setzero_ps();
+				for(int i = 0; i < k.size; i++)
+				{
+					acc = _mm256_fmadd_ps(_mm256_set1_ps(k.data[i]), _mm256_loadu_ps(taps[i] + c), acc);
+				}
+				_mm256_storeu_ps(dest + c, acc);
+			}
+			convolve_span_scalar(taps, dest, c, n, k);
+		}
+
+#if AMP_CPU_AVX512
+		AMP_CPU_TARGET("avx512f")
+		inline void convolve_span_avx512(const float* const* taps, float* dest, int n, const cpu_conv_kernel& k)
+		{
+			int c = 0;
+			for(; c + 64 <= n; c += 64)
+			{
+				__m512 acc0, acc1, acc2, acc3;
+				if(k.folded())
+				{
+					__m512 kc = _mm512_set1_ps(k.data[k.anchor]);
+					const float* center = taps[k.anchor] + c;
+					acc0 = _mm512_mul_ps(kc, _mm512_loadu_ps(center));
+					acc1 = _mm512_mul_ps(kc, _mm512_loadu_ps(center + 16));
+					acc2 = _mm512_mul_ps(kc, _mm512_loadu_ps(center + 32));
+					acc3 = _mm512_mul_ps(kc, _mm512_loadu_ps(center + 48));
+					if(k.sign > 0.0f)
+					{
+						for(int i = 0; i < k.anchor; i++)
+						{
+							const float* lo = taps[i] + c;
+							const float* hi = taps[k.size - 1 - i] + c;
+							__m512 ki = _mm512_set1_ps(k.data[i]);
+							acc0 = _mm512_fmadd_ps(ki, _mm512_add_ps(_mm512_loadu_ps(lo), _mm512_loadu_ps(hi)), acc0);
+							acc1 = _mm512_fmadd_ps(ki, _mm512_add_ps(_mm512_loadu_ps(lo + 16), _mm512_loadu_ps(hi + 16)), acc1);
+							acc2 = _mm512_fmadd_ps(ki, _mm512_add_ps(_mm512_loadu_ps(lo + 32), _mm512_loadu_ps(hi + 32)), acc2);
+							acc3 = _mm512_fmadd_ps(ki, _mm512_add_ps(_mm512_loadu_ps(lo + 48), _mm512_loadu_ps(hi + 48)), acc3);
+						}
+					}
+					else
+					{
+						for(int i = 0; i < k.anchor; i++)
+						{
+							const float* lo = taps[i] + c;
+							const float* hi = taps[k.size - 1 - i] + c;
+							__m512 ki = _mm512_set1_ps(k.data[i]);
+							acc0 = _mm512_fmadd_ps(ki, _mm512_sub_ps(_mm512_loadu_ps(lo), _mm512_loadu_ps(hi)), acc0);
+							acc1 = _mm512_fmadd_ps(ki, _mm512_sub_ps(_mm512_loadu_ps(lo + 16), _mm512_loadu_ps(hi + 16)), acc1);
+							acc2 = _mm512_fmadd_ps(ki, _mm512_sub_ps(_mm512_loadu_ps(lo + 32), _mm512_loadu_ps(hi + 32)), acc2);
+							acc3 = _mm512_fmadd_ps(ki, _mm512_sub_ps(_mm512_loadu_ps(lo + 48), _mm512_loadu_ps(hi + 48)), acc3);
+						}
+					}
+				}
+				else
+				{
+					acc0 = _mm512_setzero_ps();
+					acc1 = _mm512_setzero_ps();
+					acc2 = _mm512_setzero_ps();
+					acc3 = _mm512_setzero_ps();
+					for(int i = 0; i < k.size; i++)
+					{
+						const float* src = taps[i] + c;
+						__m512 ki = _mm512_set1_ps(k.data[i]);
+						acc0 = _mm512_fmadd_ps(ki, _mm512_loadu_ps(src), acc0);
+						acc1 = _mm512_fmadd_ps(ki, _mm512_loadu_ps(src + 16), acc1);
+						acc2 = _mm512_fmadd_ps(ki, _mm512_loadu_ps(src + 32), acc2);
+						acc3 = _mm512_fmadd_ps(ki, _mm512_loadu_ps(src + 48), acc3);
+					}
+				}
+				_mm512_storeu_ps(dest + c, acc0);
+				_mm512_storeu_ps(dest + c + 16, acc1);
+				_mm512_storeu_ps(dest + c + 32, acc2);
+				_mm512_storeu_ps(dest + c + 48, acc3);
+			}
+			for(; c + 16 <= n; c += 16)
+			{
+				__m512 acc = _mm512_setzero_ps();
+				for(int i = 0; i < k.size; i++)
+				{
+					acc = _mm512_fmadd_ps(_mm512_set1_ps(k.data[i]), _mm512_loadu_ps(taps[i] + c), acc);
+				}
+				_mm512_storeu_ps(dest + c, acc);
+			}
+			convolve_span_scalar(taps, dest, c, n, k);
+		}
+#endif
+#endif
+
+		inline void convolve_span(const float* const* taps, float* dest, int n, const cpu_conv_kernel& k, cpu::simd_level level)
+		{
+			switch(level)
+			{
+#if AMP_CPU_X86
+#if AMP_CPU_AVX512
+			case cpu::simd_level::avx512:
+				convolve_span_avx512(taps, dest, n, k);
+				break;
+#endif
+			case cpu::simd_level::avx2:
+				convolve_span_avx2(taps, dest, n, k);
+				break;
+			case cpu::simd_level::sse4:
+				convolve_span_sse4(taps, dest, n, k);
+				break;
+#endif
+			default:
+				convolve_span_scalar(taps, dest, 0, n, k);
+				break;
+			}
+		}
+
+		// Source columns [first_col - anchor, first_col + count + size - 1 - anchor) of a row with reflect101 borders
+		inline void load_padded_row(const float* src_row, int cols, int first_col, int count, int anchor, int size, float* padded)
+		{
+			int first = first_col - anchor;
+			int last = first_col + count + size - 1 - anchor;
+			int inner_first = std::max(first, 0);
+			int inner_last = std::min(last, cols);
+			for(int x = first; x < inner_first; x++)
+			{
+				padded[x - first] = src_row[cpu::replicate(cpu::reflect101(x, cols), cols)];
+			}
+			if(inner_last > inner_first)
+			{
+				std::memcpy(padded + inner_first - first, src_row + inner_first, sizeof(float) * (inner_last - inner_first));
+			}
+			for(int x = std::max(inner_last, first); x < last; x++)
+			{
+				padded[x - first] = src_row[cpu::replicate(cpu::reflect101(x, cols), cols)];
+			}
+		}
+
+		// Cache blocking of the CPU passes: a task covers cpu_conv_block_rows x cpu_conv_block_cols outputs
+		static const int cpu_conv_block_rows = 32;
+		static const int cpu_conv_block_cols = 512;
+	}
+
+	template<unsigned int max_kernel_size>
+	inline void convolve_by_row_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> srcArray, cpu::plane_view<float> destArray, const kernel_wrapper<float, max_kernel_size>& kernel)
+	{
+		const detail::cpu_conv_kernel k(kernel.data, kernel.size);
+		const cpu::simd_level level = cpu::active_simd_level();
+		const int cols = destArray.cols;
+		cpu::parallel_for_rows(pool, destArray.rows, [&](int row_first, int row_last)
+		{
+			std::vector<float> padded(cols + k.size - 1);
+			std::vector<const float*> taps(k.size);
+			for(int i = 0; i < k.size; i++)
+			{
+				taps[i] = padded.data() + i;
+			}
+			for(int r = row_first; r < row_last; r++)
+			{
+				detail::load_padded_row(srcArray.row(r), srcArray.cols, 0, cols, k.anchor, k.size, padded.data());
+				detail::convolve_span(taps.data(), destArray.row(r), cols, k, level);
+			}
+		});
+	}
+
+	template<unsigned int max_kernel_size>
+	inline void convolve_by_column_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> srcArray, cpu::plane_view<float> destArray, const kernel_wrapper<float, max_kernel_size>& kernel)
+	{
+		const detail::cpu_conv_kernel k(kernel.data, kernel.size);
+		const cpu::simd_level level = cpu::active_simd_level();
+		const int rows = destArray.rows;
+		const int cols = destArray.cols;
+		const int strips = DIVUP(rows, detail::cpu_conv_block_rows);
+		const int blocks = DIVUP(cols, detail::cpu_conv_block_cols);
+		// consecutive output rows of a block share size - 1 source rows in cache
+		pool.parallel_for(0, strips * blocks, 1, [&](int first, int last)
+		{
+			std::vector<const float*> taps(k.size);
+			for(int t = first; t < last; t++)
+			{
+				int row_first = (t / blocks) * detail::cpu_conv_block_rows;
+				int row_last = std::min(rows, row_first + detail::cpu_conv_block_rows);
+				int col_first = (t % blocks) * detail::cpu_conv_block_cols;
+				int count = std::min(cols - col_first, detail::cpu_conv_block_cols);
+				for(int r = row_first; r < row_last; r++)
+				{
+					for(int i = 0; i < k.size; i++)
+					{
+						taps[i] = srcArray.row(cpu::replicate(cpu::reflect101(r - k.anchor + i, srcArray.rows), srcArray.rows)) + col_first;
+					}
+					detail::convolve_span(taps.data(), destArray.row(r) + col_first, count, k, level);
+				}
+			}
+		});
+	}
+
+	// Both passes run per cache block, the intermediate rows stay in a block-local buffer and
+	// row_temp_array is not used by the CPU backend
+	template<unsigned int max_kernel_size = 1024U>
+	inline void convolve_separable_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, cpu::plane_view<float> row_temp_array, const cv::Mat& row_kernel_mat, const cv::Mat& col_kernel_mat)
+	{
+		(void)row_temp_array;
+		kernel_wrapper<float, max_kernel_size> wrappedRowKernel(row_kernel_mat);
+		kernel_wrapper<float, max_kernel_size> wrappedColKernel(col_kernel_mat);
+		const detail::cpu_conv_kernel row_k(wrappedRowKernel.data, wrappedRowKernel.size);
+		const detail::cpu_conv_kernel col_k(wrappedColKernel.data, wrappedColKernel.size);
+		const cpu::simd_level level = cpu::active_simd_level();
+		const int rows = dest_array.rows;
+		const int cols = dest_array.cols;
+		// taller strips amortize the size - 1 halo rows every strip recomputes
+		const int block_rows = std::max(detail::cpu_conv_block_rows, ROUNDUP(col_k.size * 2, 8));
+		const int strips = DIVUP(rows, block_rows);
+		const int blocks = DIVUP(cols, detail::cpu_conv_block_cols);
+		pool.parallel_for(0, strips * blocks, 1, [&](int first, int last)
+		{
+			std::vector<float> padded(detail::cpu_conv_block_cols + row_k.size - 1);
+			std::vector<float> buffer(size_t(block_rows + col_k.size - 1) * detail::cpu_conv_block_cols);
+			std::vector<const float*> row_taps(row_k.size);
+			std::vector<const float*> col_taps(col_k.size);
+			for(int i = 0; i < row_k.size; i++)
+			{
+				row_taps[i] = padded.data() + i;
+			}
+			for(int t = first; t < last; t++)
+			{
+				int row_first = (t / blocks) * block_rows;
+				int row_last = std::min(rows, row_first + block_rows);
+				int col_first = (t % blocks) * detail::cpu_conv_block_cols;
+				int count = std::min(cols - col_first, detail::cpu_conv_block_cols);
+				// row pass over the strip and its halo
+				for(int r = row_first - col_k.anchor; r < row_last + col_k.size - 1 - col_k.anchor; r++)
+				{
+					int src_row = cpu::replicate(cpu::reflect101(r, src_array.rows), src_array.rows);
+					detail::load_padded_row(src_array.row(src_row), src_array.cols, col_first, count, row_k.anchor, row_k.size, padded.data());
+					detail::convolve_span(row_taps.data(), &buffer[size_t(r - row_first + col_k.anchor) * detail::cpu_conv_block_cols], count, row_k, level);
+				}
+				// column pass out of the buffer
+				for(int r = row_first; r < row_last; r++)
+				{
+					for(int i = 0; i < col_k.size; i++)
+					{
+						col_taps[i] = &buffer[size_t(r - row_first + i) * detail::cpu_conv_block_cols];
+					}
+					detail::convolve_span(col_taps.data(), dest_array.row(r) + col_first, count, col_k, level);
+				}
+			}
+		});
+	}
 
 }
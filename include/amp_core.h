@@ -1,15 +1,20 @@
 ﻿#pragma once
 
 #include <cassert>
+#include <cfloat>
 #include <exception>
+#include <stdexcept>
 #include <vector>
 #include <complex>
 #include <string>
 #include <fstream>
 #include <algorithm>
 #include <numeric>
+#include <limits>
 #include <mutex>
 #include <initializer_list>
+#include "amp_cpu.h"
+#if AMP_HAS_CPP_AMP
 #include <amp.h>
 #include <amp_math.h>
 #include <amp_short_vectors.h>
@@ -18,7 +23,11 @@
 #include <d3d11.h>
 #pragma comment(lib, "d3d11.lib")
 #endif
+#endif
 #include <opencv2/core/core.hpp>
+#include "amp_image_view.h"
+#include "amp_buffer_pool.h"
+#include "amp_buffer_registry.h"
 
 #ifndef OPTIMIZE_FOR_AMD
 #define OPTIMIZE_FOR_AMD 1
@@ -42,7 +51,7 @@ namespace std
 	}
 }
 
-#ifndef _MSC_VER
+#if AMP_HAS_CPP_AMP && !defined(_MSC_VER)
 // Emulation of HLSL intrinsics
 namespace Concurrency
 {
@@ -88,6 +97,7 @@ namespace Concurrency
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	namespace direct3d = concurrency::direct3d;
 	namespace fast_math = concurrency::fast_math;
 	namespace graphics = concurrency::graphics;
@@ -270,6 +280,7 @@ namespace amp
 		destVec.resize(srcArray.get_extent().size());
 		concurrency::copy(srcArray, &destVec[0]);
 	}
+#endif
 
 	template<typename T1, typename T2 = T1>
 	inline void dump_vector(std::ostream& os, const std::vector<T1>& v, int columns)
@@ -367,6 +378,7 @@ namespace amp
 		int rows;
 	};
 
+#if AMP_HAS_CPP_AMP
 	namespace detail
 	{
 		template<typename value_type>
@@ -497,251 +509,551 @@ namespace amp
 			});
 		}
 
+		// Unpacks one 8u/16u channel of caller memory read as dwords, byte offsets follow the image_view layout
+		template<typename value_type>
+		inline void load_image_packed(accelerator_view& acc_view, array_view<const unsigned int, 1> srcArray, int pixel_bytes, int row_step, int pixel_step
+			, int channel_offset, array_view<value_type, 2> destArray, float scale)
+		{
+			static const int tile_size = 32;
+			unsigned int mask = pixel_bytes == 1 ? 0xffu : 0xffffu;
+			destArray.discard_data();
+			parallel_for_each(acc_view, destArray.get_extent().tile<tile_size, tile_size>().pad(), [=](tiled_index<tile_size, tile_size> idx) restrict(amp)
+			{
+				int src_byte_index = idx.global[0] * row_step + idx.global[1] * pixel_step * pixel_bytes + channel_offset;
+				unsigned int pix_val = guarded_read(srcArray, concurrency::index<1>(src_byte_index / 4));
+				guarded_write(destArray, idx.global, value_type(float((pix_val >> ((src_byte_index % 4) << 3)) & mask) * scale));
+			});
+		}
+
+		// row_step, pixel_step and channel_offset are in floats
+		template<typename value_type>
+		inline void load_image_32f(accelerator_view& acc_view, array_view<const float, 1> srcArray, int row_step, int pixel_step
+			, int channel_offset, array_view<value_type, 2> destArray, float scale)
+		{
+			static const int tile_size = 32;
+			destArray.discard_data();
+			parallel_for_each(acc_view, destArray.get_extent().tile<tile_size, tile_size>().pad(), [=](tiled_index<tile_size, tile_size> idx) restrict(amp)
+			{
+				int src_index = idx.global[0] * row_step + idx.global[1] * pixel_step + channel_offset;
+				guarded_write(destArray, idx.global, value_type(guarded_read(srcArray, concurrency::index<1>(src_index)) * scale));
+			});
+		}
+
+		// Only the pixels of the channel are written, the other bytes of destArray keep the caller data
+		inline void save_image_32f(accelerator_view& acc_view, array_view<const float, 2> srcArray, int row_step, int pixel_step
+			, int channel_offset, array_view<float, 1> destArray)
+		{
+			static const int tile_size = 32;
+			parallel_for_each(acc_view, srcArray.get_extent().tile<tile_size, tile_size>().pad(), [=](tiled_index<tile_size, tile_size> idx) restrict(amp)
+			{
+				int dest_index = idx.global[0] * row_step + idx.global[1] * pixel_step + channel_offset;
+				if(srcArray.get_extent().contains(idx.global))
+				{
+					destArray[dest_index] = srcArray[idx.global];
+				}
+			});
+		}
+
 	}
+#endif
+
+	// Where the kernels of a vision_context run
+	enum class execution_backend { accelerator = 0, cpu = 1 };
 
 	class vision_context
 	{
 	public:
 		// Constructor
+#if AMP_HAS_CPP_AMP
+		// max_image_mpixels is kept for compatibility, uploads read the caller memory in place.
+		// buffer_size is a hint, buffers can be created past it
 		vision_context(const accelerator_view& acc_view_, float max_image_mpixels, size_t buffer_size = 16)
-			: acc_view(acc_view_), save_load_buf(cvRound(max_image_mpixels * 1024 + 1) * 256, acc_view_)
+			: backend(execution_backend::accelerator), pool(cpu::default_thread_pool()), acc_view(acc_view_), buffers(acc_view_)
 		{
-			// Need a vector container that moves elements when storage is full
-			float2d.reserve(buffer_size);
-			float1d.reserve(buffer_size);
-			int2d.reserve(buffer_size);
-			int1d.reserve(buffer_size);
+			reserve_buffers(buffer_size);
+		}
+#endif
+
+		// CPU backend: buffers are host planes and kernels are called with ctx.pool
+		explicit vision_context(cpu::thread_pool& pool_, size_t buffer_size = 16)
+			: backend(execution_backend::cpu), pool(pool_)
+#if AMP_HAS_CPP_AMP
+			, acc_view(concurrency::accelerator(concurrency::accelerator::cpu_accelerator).default_view)
+#endif
+		{
+			reserve_buffers(buffer_size);
 		}
 
 		~vision_context()
 		{
+#if AMP_HAS_CPP_AMP
 			acc_view.wait();
+#endif
 		}
 
-		// Create/Clear operation buffers
+		// Create/Release operation buffers, the returned handle indexes float2d(host_float2d on the CPU backend).
+		// count buffers get consecutive handles, released buffers of the same shape are reused.
 		int create_float2d_buf(int rows, int cols, int count = 1)
 		{
-			size_t index = float2d.size();
-			if(index + size_t(count) > float2d.capacity()) throw std::runtime_error("float2d array is full");
-			while(count-- > 0)
-			{
-				float2d.emplace_back(rows, cols, acc_view);
-			}
-			return int(index);
+			return create_float2d_buf(std::string(), rows, cols, count);
+		}
+
+		// A named buffer can be found again with float2d_buf(name), the name refers to the first of the count buffers
+		int create_float2d_buf(const std::string& name, int rows, int cols, int count = 1)
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return float2d.create(name, rows, cols, count, rows, cols, acc_view);
+#endif
+			return host_float2d.create(name, rows, cols, count, rows, cols);
 		}
 
 		int create_float1d_buf(int cols, int count = 1)
 		{
-			size_t index = float1d.size();
-			if(index + size_t(count) > float1d.capacity()) throw std::runtime_error("float1d array is full");
-			while(count-- > 0)
-			{
-				float1d.emplace_back(cols, acc_view);
-			}
-			return int(index);
+			return create_float1d_buf(std::string(), cols, count);
+		}
+
+		int create_float1d_buf(const std::string& name, int cols, int count = 1)
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return float1d.create(name, 1, cols, count, cols, acc_view);
+#endif
+			return host_float1d.create(name, 1, cols, count, size_t(cols));
 		}
 
 		int create_int2d_buf(int rows, int cols, int count = 1)
 		{
-			size_t index = int2d.size();
-			if(index + size_t(count) > int2d.capacity()) throw std::runtime_error("int2d array is full");
-			while(count-- > 0)
-			{
-				int2d.emplace_back(rows, cols, acc_view);
-			}
-			return int(index);
+			return create_int2d_buf(std::string(), rows, cols, count);
+		}
+
+		int create_int2d_buf(const std::string& name, int rows, int cols, int count = 1)
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return int2d.create(name, rows, cols, count, rows, cols, acc_view);
+#endif
+			return host_int2d.create(name, rows, cols, count, rows, cols);
 		}
 
 		int create_int1d_buf(int cols, int count = 1)
 		{
-			size_t index = int1d.size();
-			while(count-- > 0)
-			if(index + size_t(count) > int1d.capacity()) throw std::runtime_error("int1d array is full");
-			{
-				int1d.emplace_back(cols, acc_view);
-			}
-			return int(index);
+			return create_int1d_buf(std::string(), cols, count);
+		}
+
+		int create_int1d_buf(const std::string& name, int cols, int count = 1)
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return int1d.create(name, 1, cols, count, cols, acc_view);
+#endif
+			return host_int1d.create(name, 1, cols, count, size_t(cols));
+		}
+
+		void release_float2d_buf(int handle, int count = 1)
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return float2d.release(handle, count);
+#endif
+			host_float2d.release(handle, count);
+		}
+
+		void release_float1d_buf(int handle, int count = 1)
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return float1d.release(handle, count);
+#endif
+			host_float1d.release(handle, count);
+		}
+
+		void release_int2d_buf(int handle, int count = 1)
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return int2d.release(handle, count);
+#endif
+			host_int2d.release(handle, count);
+		}
+
+		void release_int1d_buf(int handle, int count = 1)
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return int1d.release(handle, count);
+#endif
+			host_int1d.release(handle, count);
+		}
+
+		// Handle of a named buffer, throws if there is none
+		int float2d_buf(const std::string& name) const
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return float2d.find(name);
+#endif
+			return host_float2d.find(name);
+		}
+
+		int float1d_buf(const std::string& name) const
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return float1d.find(name);
+#endif
+			return host_float1d.find(name);
+		}
+
+		int int2d_buf(const std::string& name) const
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return int2d.find(name);
+#endif
+			return host_int2d.find(name);
+		}
+
+		int int1d_buf(const std::string& name) const
+		{
+#if AMP_HAS_CPP_AMP
+			if(backend == execution_backend::accelerator) return int1d.find(name);
+#endif
+			return host_int1d.find(name);
 		}
 
 		void clear_all_buf()
 		{
+#if AMP_HAS_CPP_AMP
 			float2d.clear();
 			float1d.clear();
 			int2d.clear();
 			int1d.clear();
+#endif
+			host_float2d.clear();
+			host_float1d.clear();
+			host_int2d.clear();
+			host_int1d.clear();
+			memory.peak_bytes = 0;
 		}
 
-		// OpenCV Mat upload/download support(8UC1 & 8UC3, 16UC1 & 16UC3[load only])
-		bool load_cv_mat(const cv::Mat& srcMat, array_view<float, 2> destView)
+		// Free released buffers and the cached per-call temporaries
+		void trim_buf()
+		{
+#if AMP_HAS_CPP_AMP
+			float2d.trim();
+			float1d.trim();
+			int2d.trim();
+			int1d.trim();
+#endif
+			host_float2d.trim();
+			host_float1d.trim();
+			host_int2d.trim();
+			host_int1d.trim();
+			buffers.trim();
+		}
+
+		// Live, reserved and peak bytes of the context buffers, peak_bytes + pool_bytes is what the context needs on its device
+		buffer_memory memory_usage() const
 		{
-			std::lock_guard<std::mutex> guard(save_load_mutex);
-			// check Mat type and size
-			if ((srcMat.type() != CV_8UC1 && srcMat.type() != CV_16UC1) || srcMat.rows != destView.get_extent()[0] || srcMat.cols != destView.get_extent()[1])
+			buffer_memory usage = memory;
+			usage.pool_bytes = buffers.bytes_reserved();
+			return usage;
+		}
+
+		// Caller memory upload/download for the CPU backend(8u, 16u & 32f, interleaved or planar, no staging buffer or lock)
+		bool load_image(const image_view& src, cpu::plane_view<float> destView, int channel = 0, float scale = 1.0f)
+		{
+			if(channel >= src.channels || src.rows != destView.rows || src.cols != destView.cols)
 			{
 				return false;
 			}
-			// clone if source Mat is not continuous
-			cv::Mat continousMat;
-			if(!srcMat.isContinuous())
+			detail::load_image_channel(pool, src, channel, destView, scale);
+			return true;
+		}
+
+		bool load_image(const image_view& src, cpu::plane_view<int> destView, int channel = 0, float scale = 1.0f)
+		{
+			if(channel >= src.channels || src.rows != destView.rows || src.cols != destView.cols)
 			{
-				srcMat.copyTo(continousMat);
+				return false;
 			}
-			else
+			detail::load_image_channel(pool, src, channel, destView, scale);
+			return true;
+		}
+
+		bool load_image(const image_view& src, cpu::plane_view<float> destChannel1, cpu::plane_view<float> destChannel2, cpu::plane_view<float> destChannel3, float scale = 1.0f)
+		{
+			if(src.channels < 3 || src.rows != destChannel1.rows || src.cols != destChannel1.cols)
 			{
-				continousMat = srcMat;
+				return false;
 			}
-            // check required buffer size
-			int source_dword_count = (continousMat.rows * int(continousMat.step[0]) + 3) / 4;
-			if (source_dword_count > save_load_buf.get_extent()[0])
+			detail::load_image_channel(pool, src, 0, destChannel1, scale);
+			detail::load_image_channel(pool, src, 1, destChannel2, scale);
+			detail::load_image_channel(pool, src, 2, destChannel3, scale);
+			return true;
+		}
+
+		bool save_image(cpu::plane_view<const float> srcView, const image_view& dest, int channel = 0)
+		{
+			if(channel >= dest.channels || dest.rows != srcView.rows || dest.cols != srcView.cols)
 			{
-				std::swap(save_load_buf, concurrency::array<unsigned int, 1>(ROUNDUP(source_dword_count, 64), acc_view));
+				return false;
 			}
-			// copy data to GPU
-            concurrency::copy(continousMat.ptr<unsigned int>(), continousMat.ptr<unsigned int>() + source_dword_count, save_load_buf.section(0, source_dword_count));
-            // convert data
-			if (srcMat.type() == CV_8UC1)
+			detail::save_image_channel(pool, srcView, dest, channel);
+			return true;
+		}
+
+		bool save_image(cpu::plane_view<const float> srcChannel1, cpu::plane_view<const float> srcChannel2, cpu::plane_view<const float> srcChannel3, const image_view& dest)
+		{
+			if(dest.channels < 3 || dest.rows != srcChannel1.rows || dest.cols != srcChannel1.cols)
 			{
-				detail::load_cv_mat_8u_c1<float>(acc_view, save_load_buf, continousMat.step[0], destView);
+				return false;
 			}
-			else // CV_16UC1
+			detail::save_image_channel(pool, srcChannel1, dest, 0);
+			detail::save_image_channel(pool, srcChannel2, dest, 1);
+			detail::save_image_channel(pool, srcChannel3, dest, 2);
+			return true;
+		}
+
+		// OpenCV Mat upload/download for the CPU backend(same formats as below)
+		bool load_cv_mat(const cv::Mat& srcMat, cpu::plane_view<float> destView)
+		{
+			if(srcMat.type() != CV_8UC1 && srcMat.type() != CV_16UC1)
 			{
-				detail::load_cv_mat_16u_c1<float>(acc_view, save_load_buf, continousMat.step[0], destView);
+				return false;
 			}
-			return true;
+			return load_image(image_view(srcMat), destView, 0, srcMat.depth() == CV_16U ? 255.0f / 4095.0f : 1.0f);
 		}
 
-		bool load_cv_mat(const cv::Mat& srcMat, array_view<int, 2> destView)
+		bool load_cv_mat(const cv::Mat& srcMat, cpu::plane_view<int> destView)
 		{
-			std::lock_guard<std::mutex> guard(save_load_mutex);
-			// check Mat type and size
-			if ((srcMat.type() != CV_8UC1 && srcMat.type() != CV_16UC1) || srcMat.rows != destView.get_extent()[0] || srcMat.cols != destView.get_extent()[1])
+			if(srcMat.type() != CV_8UC1 && srcMat.type() != CV_16UC1)
 			{
 				return false;
 			}
-			// clone if source Mat is not continuous
-			cv::Mat continousMat;
-			if (!srcMat.isContinuous())
+			return load_image(image_view(srcMat), destView, 0, srcMat.depth() == CV_16U ? 255.0f / 4095.0f : 1.0f);
+		}
+
+		bool save_cv_mat(cpu::plane_view<const float> srcView, cv::Mat& destMat)
+		{
+			if(destMat.type() != CV_8UC1 || destMat.rows != srcView.rows || destMat.cols != srcView.cols)
 			{
-				srcMat.copyTo(continousMat);
+				destMat = cv::Mat(srcView.rows, srcView.cols, CV_8UC1);
 			}
-			else
+			return save_image(srcView, image_view(destMat));
+		}
+
+		bool load_cv_mat(const cv::Mat& srcMat, cpu::plane_view<float> destChannel1, cpu::plane_view<float> destChannel2, cpu::plane_view<float> destChannel3)
+		{
+			if(srcMat.type() != CV_8UC3 && srcMat.type() != CV_16UC3)
 			{
-				continousMat = srcMat;
+				return false;
 			}
-			// check required buffer size
-			int source_dword_count = (continousMat.rows * int(continousMat.step[0]) + 3) / 4;
-			if (source_dword_count > save_load_buf.get_extent()[0])
+			return load_image(image_view(srcMat), destChannel1, destChannel2, destChannel3, srcMat.depth() == CV_16U ? 255.0f / 4095.0f : 1.0f);
+		}
+
+		bool save_cv_mat(cpu::plane_view<const float> srcChannel1, cpu::plane_view<const float> srcChannel2, cpu::plane_view<const float> srcChannel3, cv::Mat& destMat)
+		{
+			if(destMat.type() != CV_8UC3 || destMat.rows != srcChannel1.rows || destMat.cols != srcChannel1.cols)
 			{
-				std::swap(save_load_buf, concurrency::array<unsigned int, 1>(ROUNDUP(source_dword_count, 64), acc_view));
+				destMat = cv::Mat(srcChannel1.rows, srcChannel1.cols, CV_8UC3);
 			}
-			// copy data to GPU
-			concurrency::copy(continousMat.ptr<unsigned int>(), continousMat.ptr<unsigned int>() + source_dword_count, save_load_buf.section(0, source_dword_count));
-			// convert data
-			if (srcMat.type() == CV_8UC1)
+			return save_image(srcChannel1, srcChannel2, srcChannel3, image_view(destMat));
+		}
+#if AMP_HAS_CPP_AMP
+
+		// Caller memory upload/download(8u, 16u & 32f, interleaved or planar).
+		// Kernels read and write the caller memory through array_views, so concurrent calls need no shared staging buffer.
+		bool load_image(const image_view& src, array_view<float, 2> destView, int channel = 0, float scale = 1.0f)
+		{
+			return load_image_channel(src, channel, destView, scale);
+		}
+
+		bool load_image(const image_view& src, array_view<int, 2> destView, int channel = 0, float scale = 1.0f)
+		{
+			return load_image_channel(src, channel, destView, scale);
+		}
+
+		bool load_image(const image_view& src, array_view<float, 2> destChannel1, array_view<float, 2> destChannel2, array_view<float, 2> destChannel3, float scale = 1.0f)
+		{
+			if(src.channels < 3 || src.rows != destChannel1.get_extent()[0] || src.cols != destChannel1.get_extent()[1])
 			{
-				detail::load_cv_mat_8u_c1<int>(acc_view, save_load_buf, continousMat.step[0], destView);
+				return false;
 			}
-			else // CV_16UC1
+			if(src.depth == pixel_depth::u8 && src.channels == 3 && src.layout == pixel_layout::interleaved && src.is_dword_aligned() && scale == 1.0f)
 			{
-				detail::load_cv_mat_16u_c1<int>(acc_view, save_load_buf, continousMat.step[0], destView);
+				// one pass over the pixel triplets
+				array_view<const unsigned int, 1> srcArray(int(DIVUP(src.channel_span() + 2, 4)), reinterpret_cast<const unsigned int*>(src.planes[0]));
+				detail::load_cv_mat_8u_c3(acc_view, srcArray, int(src.row_stride), destChannel1, destChannel2, destChannel3);
+				return true;
 			}
-			return true;
+			return load_image_channel(src, 0, destChannel1, scale) && load_image_channel(src, 1, destChannel2, scale) && load_image_channel(src, 2, destChannel3, scale);
 		}
 
-		bool save_cv_mat(array_view<const float, 2> srcView, cv::Mat& destMat)
+		bool save_image(array_view<const float, 2> srcView, const image_view& dest, int channel = 0)
 		{
-			std::lock_guard<std::mutex> guard(save_load_mutex);
-			int row_step = destMat.step[0];
-			// check destMat type and size
-			if(destMat.type() != CV_8UC1 || destMat.rows != srcView.get_extent()[0] || destMat.cols != srcView.get_extent()[1] || !destMat.isContinuous())
+			if(channel >= dest.channels || dest.rows != srcView.get_extent()[0] || dest.cols != srcView.get_extent()[1])
 			{
-				// recreate
-				destMat = cv::Mat(srcView.get_extent()[0], srcView.get_extent()[1], CV_8UC1);
-				row_step = destMat.step[0];
+				return false;
+			}
+			if(dest.depth == pixel_depth::u8 && dest.pixel_step() == 1 && dest.is_continuous() && dest.is_dword_aligned())
+			{
+				// pack four pixels per dword straight into the caller memory
+				array_view<unsigned int, 1> destArray(int(dest.row_stride * dest.rows / 4), dest.ptr<unsigned int>(channel, 0));
+				detail::save_cv_mat_8u_c1(acc_view, srcView, int(dest.row_stride), destArray);
+				destArray.synchronize();
 			}
-			// convert data
-			int source_dword_count = (srcView.get_extent()[0] * row_step + 3) / 4;
-			if (source_dword_count > save_load_buf.get_extent()[0])
+			else if(dest.depth == pixel_depth::f32 && dest.is_dword_aligned())
+			{
+				int channel_offset = dest.layout == pixel_layout::interleaved ? channel : 0;
+				float* base = dest.layout == pixel_layout::interleaved ? dest.ptr<float>(0, 0) : dest.ptr<float>(channel, 0);
+				array_view<float, 1> destArray(int(DIVUP(dest.channel_span(), 4)) + channel_offset, base);
+				detail::save_image_32f(acc_view, srcView, int(dest.row_stride / 4), dest.pixel_step(), channel_offset, destArray);
+				destArray.synchronize();
+			}
+			else
 			{
-				std::swap(save_load_buf, concurrency::array<unsigned int, 1>(ROUNDUP(source_dword_count, 64), acc_view));
+				// subword layouts the kernels can't write in place are converted on the host
+				cpu::plane<float> host_plane(dest.rows, dest.cols);
+				copy_to_host(srcView, host_plane);
+				detail::save_image_channel(pool, host_plane, dest, channel);
 			}
-			array_view<unsigned int> save_load_buf_section = save_load_buf.section(0, source_dword_count);
-			detail::save_cv_mat_8u_c1(acc_view, srcView, row_step, save_load_buf_section);
-			// download to destMat
-			concurrency::copy(save_load_buf_section, (unsigned int*)destMat.data);
 			return true;
 		}
 
-		bool load_cv_mat(const cv::Mat& srcMat, array_view<float, 2> destChannel1, array_view<float, 2> destChannel2, array_view<float, 2> destChannel3)
+		bool save_image(array_view<const float, 2> srcChannel1, array_view<const float, 2> srcChannel2, array_view<const float, 2> srcChannel3, const image_view& dest)
 		{
-			std::lock_guard<std::mutex> guard(save_load_mutex);
-			// check Mat type and size
-			if ((srcMat.type() != CV_8UC3 && srcMat.type() != CV_16UC3) || srcMat.rows != destChannel1.get_extent()[0] || srcMat.cols != destChannel1.get_extent()[1])
+			if(dest.channels < 3 || dest.rows != srcChannel1.get_extent()[0] || dest.cols != srcChannel1.get_extent()[1])
 			{
 				return false;
 			}
-			// clone if source Mat is not continuous
-			cv::Mat continousMat;
-			if(!srcMat.isContinuous())
+			if(dest.depth == pixel_depth::u8 && dest.channels == 3 && dest.layout == pixel_layout::interleaved && dest.is_continuous() && dest.is_dword_aligned())
 			{
-				srcMat.copyTo(continousMat);
+				array_view<unsigned int, 1> destArray(int(dest.row_stride * dest.rows / 4), dest.ptr<unsigned int>(0, 0));
+				detail::save_cv_mat_8u_c3(acc_view, srcChannel1, srcChannel2, srcChannel3, int(dest.row_stride), destArray);
+				destArray.synchronize();
+				return true;
 			}
-			else
+			return save_image(srcChannel1, dest, 0) && save_image(srcChannel2, dest, 1) && save_image(srcChannel3, dest, 2);
+		}
+
+		// OpenCV Mat upload/download support(8UC1 & 8UC3, 16UC1 & 16UC3[load only])
+		bool load_cv_mat(const cv::Mat& srcMat, array_view<float, 2> destView)
+		{
+			if(srcMat.type() != CV_8UC1 && srcMat.type() != CV_16UC1)
 			{
-				continousMat = srcMat;
+				return false;
 			}
-			// check required buffer size
-			int source_dword_count = (continousMat.rows * int(continousMat.step[0]) + 3) / 4;
-			if(source_dword_count > save_load_buf.get_extent()[0])
+			return load_image(image_view(srcMat), destView, 0, srcMat.depth() == CV_16U ? 255.0f / 4095.0f : 1.0f);
+		}
+
+		bool load_cv_mat(const cv::Mat& srcMat, array_view<int, 2> destView)
+		{
+			if(srcMat.type() != CV_8UC1 && srcMat.type() != CV_16UC1)
 			{
-				std::swap(save_load_buf, concurrency::array<unsigned int, 1>(ROUNDUP(source_dword_count, 64), acc_view));
+				return false;
 			}
-			// copy data to GPU
-			concurrency::copy_async(continousMat.ptr<unsigned int>(), continousMat.ptr<unsigned int>() + source_dword_count, save_load_buf);
-			// convert data
-			if (srcMat.type() == CV_8UC3)
+			return load_image(image_view(srcMat), destView, 0, srcMat.depth() == CV_16U ? 255.0f / 4095.0f : 1.0f);
+		}
+
+		bool save_cv_mat(array_view<const float, 2> srcView, cv::Mat& destMat)
+		{
+			if(destMat.type() != CV_8UC1 || destMat.rows != srcView.get_extent()[0] || destMat.cols != srcView.get_extent()[1])
 			{
-				detail::load_cv_mat_8u_c3(acc_view, save_load_buf, continousMat.step[0], destChannel1, destChannel2, destChannel3);
+				destMat = cv::Mat(srcView.get_extent()[0], srcView.get_extent()[1], CV_8UC1);
 			}
-			else
+			return save_image(srcView, image_view(destMat));
+		}
+
+		bool load_cv_mat(const cv::Mat& srcMat, array_view<float, 2> destChannel1, array_view<float, 2> destChannel2, array_view<float, 2> destChannel3)
+		{
+			if(srcMat.type() != CV_8UC3 && srcMat.type() != CV_16UC3)
 			{
-				detail::load_cv_mat_16u_c3(acc_view, save_load_buf, continousMat.step[0], destChannel1, destChannel2, destChannel3);
+				return false;
 			}
-			return true;
+			return load_image(image_view(srcMat), destChannel1, destChannel2, destChannel3, srcMat.depth() == CV_16U ? 255.0f / 4095.0f : 1.0f);
 		}
 
 		bool save_cv_mat(array_view<const float, 2> srcChannel1, array_view<const float, 2> srcChannel2, array_view<const float, 2> srcChannel3, cv::Mat& destMat)
 		{
-			std::lock_guard<std::mutex> guard(save_load_mutex);
-			int row_step = destMat.step[0];
-			// check destMat type and size
-			if(destMat.type() != CV_8UC3 || destMat.rows != srcChannel1.get_extent()[0] || destMat.cols != srcChannel1.get_extent()[1] || !destMat.isContinuous())
+			if(destMat.type() != CV_8UC3 || destMat.rows != srcChannel1.get_extent()[0] || destMat.cols != srcChannel1.get_extent()[1])
 			{
-				// recreate
 				destMat = cv::Mat(srcChannel1.get_extent()[0], srcChannel1.get_extent()[1], CV_8UC3);
-				row_step = destMat.step[0];
 			}
-			// convert data
-			int source_dword_count = (srcChannel1.get_extent()[0] * row_step + 3) / 4;
-			if (source_dword_count > save_load_buf.get_extent()[0])
+			return save_image(srcChannel1, srcChannel2, srcChannel3, image_view(destMat));
+		}
+
+#endif
+
+	private:
+#if AMP_HAS_CPP_AMP
+		template<typename value_type>
+		bool load_image_channel(const image_view& src, int channel, array_view<value_type, 2> destView, float scale)
+		{
+			if(channel >= src.channels || src.rows != destView.get_extent()[0] || src.cols != destView.get_extent()[1])
+			{
+				return false;
+			}
+			if(!src.is_dword_aligned())
 			{
-				std::swap(save_load_buf, concurrency::array<unsigned int, 1>(ROUNDUP(source_dword_count, 64), acc_view));
+				// convert on the host and upload the plane
+				cpu::plane<value_type> host_plane(src.rows, src.cols);
+				detail::load_image_channel(pool, src, channel, host_plane.view(), scale);
+				array_view<const value_type, 2> host_view(src.rows, host_plane.view().step, host_plane.view().data);
+				concurrency::copy(host_view.section(0, 0, src.rows, src.cols), destView);
+				return true;
+			}
+			// interleaved channels start inside the dword of the first pixel
+			int channel_offset = src.layout == pixel_layout::interleaved ? channel * src.pixel_size() : 0;
+			const unsigned char* base = src.layout == pixel_layout::interleaved ? src.planes[0] : src.planes[channel];
+			// the last dword may cover up to 3 bytes past the final pixel, they are never used
+			int dword_count = int(DIVUP(src.channel_span() + channel_offset, 4));
+			if(src.depth == pixel_depth::f32)
+			{
+				array_view<const float, 1> srcArray(dword_count, reinterpret_cast<const float*>(base));
+				detail::load_image_32f(acc_view, srcArray, int(src.row_stride / 4), src.pixel_step(), channel_offset / 4, destView, scale);
+			}
+			else
+			{
+				array_view<const unsigned int, 1> srcArray(dword_count, reinterpret_cast<const unsigned int*>(base));
+				detail::load_image_packed(acc_view, srcArray, src.pixel_size(), int(src.row_stride), src.pixel_step(), channel_offset, destView, scale);
 			}
-			array_view<unsigned int> save_load_buf_section = save_load_buf.section(0, source_dword_count);
-			detail::save_cv_mat_8u_c3(acc_view, srcChannel1, srcChannel2, srcChannel3, row_step, save_load_buf_section);
-			// download to destMat
-			concurrency::copy(save_load_buf_section, (unsigned int*)destMat.data);
 			return true;
 		}
 
+		static void copy_to_host(array_view<const float, 2> srcView, cpu::plane<float>& host_plane)
+		{
+			cpu::plane_view<float> dest = host_plane.view();
+			array_view<float, 2> host_view(dest.rows, dest.step, dest.data);
+			concurrency::copy(srcView, host_view.section(0, 0, dest.rows, dest.cols));
+		}
+#endif
+
+		void reserve_buffers(size_t buffer_size)
+		{
+			// Handles only, buffers are allocated on create
+#if AMP_HAS_CPP_AMP
+			float2d.reserve(buffer_size);
+			float1d.reserve(buffer_size);
+			int2d.reserve(buffer_size);
+			int1d.reserve(buffer_size);
+#endif
+			host_float2d.reserve(buffer_size);
+			host_float1d.reserve(buffer_size);
+			host_int2d.reserve(buffer_size);
+			host_int1d.reserve(buffer_size);
+		}
+
+		buffer_memory memory;
+
 	public:
+		execution_backend backend;
+		cpu::thread_pool& pool;
+#if AMP_HAS_CPP_AMP
 		accelerator_view acc_view;
-		concurrency::array<unsigned int, 1> save_load_buf;
-		std::mutex save_load_mutex;
-		std::vector<concurrency::array<float, 2>> float2d;
-		std::vector<concurrency::array<float, 1>> float1d;
-		std::vector<concurrency::array<int, 2>> int2d;
-		std::vector<concurrency::array<int, 1>> int1d;
+#endif
+		// per-call temporaries, recycled across frames
+		buffer_pool buffers;
+#if AMP_HAS_CPP_AMP
+		buffer_registry<concurrency::array<float, 2>> float2d{ "float2d", memory };
+		buffer_registry<concurrency::array<float, 1>> float1d{ "float1d", memory };
+		buffer_registry<concurrency::array<int, 2>> int2d{ "int2d", memory };
+		buffer_registry<concurrency::array<int, 1>> int1d{ "int1d", memory };
+#endif
+		buffer_registry<cpu::plane<float>> host_float2d{ "float2d", memory };
+		buffer_registry<std::vector<float>> host_float1d{ "float1d", memory };
+		buffer_registry<cpu::plane<int>> host_int2d{ "int2d", memory };
+		buffer_registry<std::vector<int>> host_int1d{ "int1d", memory };
 	};
 
 }
@@ -4,18 +4,20 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Count non-zero value
-	inline int count_nonzero_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array)
+	inline int count_nonzero_32f_c1(accelerator_view& acc_view, buffer_pool& buffers, array_view<const float, 2> src_array)
 	{
 		int rows = src_array.get_extent()[0];
 		int cols = src_array.get_extent()[1];
-		concurrency::array<int, 1> gpu_count(1, acc_view);
-		concurrency::parallel_for_each(acc_view, gpu_count.get_extent(), [&gpu_count](concurrency::index<1> idx) restrict(amp)
+		buffer_pool::device_lease count_buf = buffers.acquire_device<int>(1);
+		array_view<int, 1> gpu_count = count_buf.view<int>(1);
+		concurrency::parallel_for_each(acc_view, gpu_count.get_extent(), [=](concurrency::index<1> idx) restrict(amp)
 		{
 			gpu_count(idx) = 0;
 		});
 		static const int tile_size = 64;
-		concurrency::parallel_for_each(acc_view, concurrency::extent<2>(rows, tile_size).tile<1, tile_size>().pad(), [=, &gpu_count](concurrency::tiled_index<1, tile_size> idx) restrict(amp)
+		concurrency::parallel_for_each(acc_view, concurrency::extent<2>(rows, tile_size).tile<1, tile_size>().pad(), [=](concurrency::tiled_index<1, tile_size> idx) restrict(amp)
 		{
 			tile_static int partial_count;
 			int row = idx.global[0];
@@ -37,4 +39,64 @@ namespace amp
 		concurrency::copy(gpu_count, &nonzero_count);
 		return nonzero_count;
 	}
+	inline int count_nonzero_32f_c1(vision_context& ctx, array_view<const float, 2> src_array)
+	{
+		return count_nonzero_32f_c1(ctx.acc_view, ctx.buffers, src_array);
+	}
+
+	inline int count_nonzero_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array)
+	{
+		buffer_pool buffers(acc_view);
+		return count_nonzero_32f_c1(acc_view, buffers, src_array);
+	}
+#endif
+
+	inline int count_nonzero_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array)
+	{
+		std::atomic<int> nonzero_count(0);
+		cpu::parallel_for_rows(pool, src_array.rows, [&](int row_first, int row_last)
+		{
+			int local_count = 0;
+			for (int r = row_first; r < row_last; r++)
+			{
+				const float* src_row = src_array.row(r);
+				for (int c = 0; c < src_array.cols; c++)
+				{
+					if (src_row[c] != 0.0f) local_count++;
+				}
+			}
+			nonzero_count.fetch_add(local_count);
+		});
+		return nonzero_count.load();
+	}
+
+	namespace detail
+	{
+		template<typename value_type>
+		inline int count_nonzero_packed(cpu::thread_pool& pool, cpu::plane_view<const value_type> src_array)
+		{
+			const cpu::simd_level level = cpu::active_simd_level();
+			std::atomic<int> nonzero_count(0);
+			cpu::parallel_for_rows(pool, src_array.rows, [&](int row_first, int row_last)
+			{
+				int local_count = 0;
+				for (int r = row_first; r < row_last; r++)
+				{
+					local_count += src_array.cols - cpu::count_zero_row(src_array.row(r), src_array.cols, level);
+				}
+				nonzero_count.fetch_add(local_count);
+			});
+			return nonzero_count.load();
+		}
+	}
+
+	inline int count_nonzero_8u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array)
+	{
+		return detail::count_nonzero_packed(pool, src_array);
+	}
+
+	inline int count_nonzero_16u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned short> src_array)
+	{
+		return detail::count_nonzero_packed(pool, src_array);
+	}
 }
@@ -0,0 +1,1094 @@
+﻿#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <algorithm>
+#include <type_traits>
+
+// C++ AMP is available with Visual C++ and HCC, other compilers only get the CPU backend
+#ifndef AMP_HAS_CPP_AMP
+#if defined(_MSC_VER) || defined(__HCC__) || defined(__KALMAR_CC__)
+#define AMP_HAS_CPP_AMP 1
+#else
+#define AMP_HAS_CPP_AMP 0
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define AMP_CPU_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define AMP_CPU_X86 0
+#endif
+
+// Functions using wider instruction sets than the compiler flags allow are marked with their target,
+// they are only called after the runtime check in max_simd_level()
+#if defined(__GNUC__) || defined(__clang__)
+#define AMP_CPU_TARGET(isa) __attribute__((target(isa)))
+#else
+#define AMP_CPU_TARGET(isa)
+#endif
+
+#if AMP_CPU_X86 && (defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1911))
+#define AMP_CPU_AVX512 1
+#else
+#define AMP_CPU_AVX512 0
+#endif
+
+namespace amp
+{
+	namespace cpu
+	{
+		// Instruction sets of the runtime-dispatched CPU kernels
+		enum class simd_level { scalar = 0, sse4 = 1, avx2 = 2, avx512 = 3 };
+
+		namespace detail
+		{
+#if AMP_CPU_X86
+			inline void cpuid(int info[4], int leaf, int subleaf)
+			{
+#ifdef _MSC_VER
+				__cpuidex(info, leaf, subleaf);
+#else
+				unsigned int a, b, c, d;
+				__cpuid_count(leaf, subleaf, a, b, c, d);
+				info[0] = int(a); info[1] = int(b); info[2] = int(c); info[3] = int(d);
+#endif
+			}
+
+			inline unsigned long long xgetbv0()
+			{
+#ifdef _MSC_VER
+				return _xgetbv(0);
+#else
+				unsigned int lo, hi;
+				__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+				return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+			}
+#endif
+
+			inline simd_level detect_simd_level()
+			{
+#if AMP_CPU_X86
+				int info[4];
+				cpuid(info, 0, 0);
+				int max_leaf = info[0];
+				cpuid(info, 1, 0);
+				bool sse41 = (info[2] & (1 << 19)) != 0;
+				bool fma = (info[2] & (1 << 12)) != 0;
+				bool osxsave = (info[2] & (1 << 27)) != 0;
+				if(!sse41)
+				{
+					return simd_level::scalar;
+				}
+				// the OS must save the YMM/ZMM registers
+				unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+				bool os_avx = (xcr0 & 0x6) == 0x6;
+				bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+				if(max_leaf < 7 || !os_avx || !fma)
+				{
+					return simd_level::sse4;
+				}
+				cpuid(info, 7, 0);
+				bool avx2 = (info[1] & (1 << 5)) != 0;
+				bool avx512f = (info[1] & (1 << 16)) != 0;
+				bool avx512bw = (info[1] & (1 << 30)) != 0;
+				if(AMP_CPU_AVX512 && avx2 && avx512f && avx512bw && os_avx512)
+				{
+					return simd_level::avx512;
+				}
+				return avx2 ? simd_level::avx2 : simd_level::sse4;
+#else
+				return simd_level::scalar;
+#endif
+			}
+		}
+
+		// Instruction set supported by this machine
+		inline simd_level max_simd_level()
+		{
+			static const simd_level level = detail::detect_simd_level();
+			return level;
+		}
+
+		// Upper bound for the dispatched kernels, lower it to compare code paths
+		inline simd_level& simd_level_limit()
+		{
+			static simd_level limit = simd_level::avx512;
+			return limit;
+		}
+
+		inline simd_level active_simd_level()
+		{
+			return std::min(max_simd_level(), simd_level_limit());
+		}
+
+		// AVX-512 VNNI (vpdpbusd) on top of the avx512 level, for the 8-bit dot products
+		inline bool has_avx512_vnni()
+		{
+#if AMP_CPU_X86 && AMP_CPU_AVX512
+			static const bool vnni = []()
+			{
+				int info[4];
+				detail::cpuid(info, 0, 0);
+				if(info[0] < 7)
+				{
+					return false;
+				}
+				detail::cpuid(info, 7, 0);
+				return (info[2] & (1 << 11)) != 0;
+			}();
+			return vnni && active_simd_level() >= simd_level::avx512;
+#else
+			return false;
+#endif
+		}
+
+		// Work-stealing thread pool
+		// Every worker owns a deque: it pops its own tasks LIFO and steals from the others FIFO.
+		// Threads that wait for a parallel_for help executing tasks, so nested calls are safe.
+		class thread_pool
+		{
+		public:
+			explicit thread_pool(unsigned int thread_count = 0)
+				: stopping(false), pending(0), next_queue(0)
+			{
+				if(thread_count == 0)
+				{
+					thread_count = std::max(1u, std::thread::hardware_concurrency());
+				}
+				for(unsigned int i = 0; i < thread_count; i++)
+				{
+					queues.emplace_back(new work_queue());
+				}
+				for(unsigned int i = 0; i < thread_count; i++)
+				{
+					workers.emplace_back(&thread_pool::worker_loop, this, int(i));
+				}
+			}
+
+			~thread_pool()
+			{
+				{
+					std::lock_guard<std::mutex> guard(sleep_mutex);
+					stopping = true;
+				}
+				sleep_cv.notify_all();
+				for(auto& worker : workers)
+				{
+					worker.join();
+				}
+			}
+
+			thread_pool(const thread_pool&) = delete;
+			thread_pool& operator=(const thread_pool&) = delete;
+
+			int size() const
+			{
+				return int(workers.size());
+			}
+
+			// Run func(chunk_first, chunk_last) over [first, last) in chunks of grain items and wait for all of them
+			template<typename Func>
+			void parallel_for(int first, int last, int grain, const Func& func)
+			{
+				if(last <= first)
+				{
+					return;
+				}
+				grain = std::max(grain, 1);
+				int chunk_count = (last - first + grain - 1) / grain;
+				if(chunk_count == 1)
+				{
+					func(first, last);
+					return;
+				}
+				task_group group(chunk_count);
+				std::vector<std::function<void()>> tasks;
+				tasks.reserve(chunk_count);
+				for(int c = 0; c < chunk_count; c++)
+				{
+					int chunk_first = first + c * grain;
+					int chunk_last = std::min(last, chunk_first + grain);
+					tasks.emplace_back([&func, &group, chunk_first, chunk_last]()
+					{
+						try
+						{
+							func(chunk_first, chunk_last);
+						}
+						catch(...)
+						{
+							group.set_error(std::current_exception());
+						}
+						group.remaining.fetch_sub(1, std::memory_order_acq_rel);
+					});
+				}
+				push(tasks);
+				int self = worker_index();
+				while(group.remaining.load(std::memory_order_acquire) > 0)
+				{
+					if(!run_one(self))
+					{
+						std::this_thread::yield();
+					}
+				}
+				if(group.error)
+				{
+					std::rethrow_exception(group.error);
+				}
+			}
+
+			// Split [first, last) into about 4 chunks per worker
+			template<typename Func>
+			void parallel_for(int first, int last, const Func& func)
+			{
+				parallel_for(first, last, (last - first + size() * 4 - 1) / (size() * 4), func);
+			}
+
+		private:
+			struct work_queue
+			{
+				std::mutex mutex;
+				std::deque<std::function<void()>> tasks;
+			};
+
+			struct task_group
+			{
+				explicit task_group(int count)
+					: remaining(count)
+				{
+				}
+
+				void set_error(std::exception_ptr e)
+				{
+					std::lock_guard<std::mutex> guard(error_mutex);
+					if(!error) error = e;
+				}
+
+				std::atomic<int> remaining;
+				std::mutex error_mutex;
+				std::exception_ptr error;
+			};
+
+			int worker_index() const
+			{
+				std::thread::id id = std::this_thread::get_id();
+				for(size_t i = 0; i < workers.size(); i++)
+				{
+					if(workers[i].get_id() == id) return int(i);
+				}
+				return -1;
+			}
+
+			void push(std::vector<std::function<void()>>& tasks)
+			{
+				int self = worker_index();
+				if(self >= 0)
+				{
+					// keep nested work local, idle workers will steal it
+					std::lock_guard<std::mutex> guard(queues[self]->mutex);
+					for(auto& task : tasks)
+					{
+						queues[self]->tasks.push_back(std::move(task));
+					}
+				}
+				else
+				{
+					for(auto& task : tasks)
+					{
+						work_queue& queue = *queues[next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size()];
+						std::lock_guard<std::mutex> guard(queue.mutex);
+						queue.tasks.push_back(std::move(task));
+					}
+				}
+				pending.fetch_add(int(tasks.size()), std::memory_order_release);
+				std::lock_guard<std::mutex> guard(sleep_mutex);
+				sleep_cv.notify_all();
+			}
+
+			bool run_one(int self)
+			{
+				std::function<void()> task;
+				if(self >= 0)
+				{
+					std::lock_guard<std::mutex> guard(queues[self]->mutex);
+					if(!queues[self]->tasks.empty())
+					{
+						task = std::move(queues[self]->tasks.back());
+						queues[self]->tasks.pop_back();
+					}
+				}
+				int queue_count = int(queues.size());
+				int start = self >= 0 ? self + 1 : int(next_queue.load(std::memory_order_relaxed) % queue_count);
+				for(int i = 0; !task && i < queue_count; i++)
+				{
+					work_queue& victim = *queues[(start + i) % queue_count];
+					std::lock_guard<std::mutex> guard(victim.mutex);
+					if(!victim.tasks.empty())
+					{
+						task = std::move(victim.tasks.front());
+						victim.tasks.pop_front();
+					}
+				}
+				if(!task)
+				{
+					return false;
+				}
+				pending.fetch_sub(1, std::memory_order_acq_rel);
+				task();
+				return true;
+			}
+
+			void worker_loop(int index)
+			{
+				while(true)
+				{
+					if(run_one(index))
+					{
+						continue;
+					}
+					std::unique_lock<std::mutex> lock(sleep_mutex);
+					sleep_cv.wait(lock, [this]() { return stopping || pending.load(std::memory_order_acquire) > 0; });
+					if(stopping && pending.load(std::memory_order_acquire) == 0)
+					{
+						return;
+					}
+				}
+			}
+
+			std::vector<std::unique_ptr<work_queue>> queues;
+			std::vector<std::thread> workers;
+			std::mutex sleep_mutex;
+			std::condition_variable sleep_cv;
+			bool stopping;
+			std::atomic<int> pending;
+			std::atomic<unsigned int> next_queue;
+		};
+
+		// Process-wide pool with one worker per hardware thread
+		inline thread_pool& default_thread_pool()
+		{
+			static thread_pool pool;
+			return pool;
+		}
+
+		// Row-major 2D view over host memory, step is in elements
+		template<typename value_type>
+		struct plane_view
+		{
+			plane_view()
+				: data(nullptr), rows(0), cols(0), step(0)
+			{
+			}
+
+			plane_view(value_type* data_, int rows_, int cols_, int step_ = 0)
+				: data(data_), rows(rows_), cols(cols_), step(step_ > 0 ? step_ : cols_)
+			{
+			}
+
+			// allows plane_view<float> -> plane_view<const float>
+			template<typename other_type>
+			plane_view(const plane_view<other_type>& other)
+				: data(other.data), rows(other.rows), cols(other.cols), step(other.step)
+			{
+			}
+
+			value_type* row(int r) const
+			{
+				return data + ptrdiff_t(r) * step;
+			}
+
+			value_type& operator()(int r, int c) const
+			{
+				return data[ptrdiff_t(r) * step + c];
+			}
+
+			bool contains(int r, int c) const
+			{
+				return r >= 0 && r < rows && c >= 0 && c < cols;
+			}
+
+			plane_view section(int r, int c, int rows_, int cols_) const
+			{
+				return plane_view(row(r) + c, rows_, cols_, step);
+			}
+
+			value_type* data;
+			int rows;
+			int cols;
+			int step;
+		};
+
+		// Host buffer owning a plane, rows are padded to 64 bytes
+		template<typename value_type>
+		class plane
+		{
+		public:
+			plane()
+				: rows(0), cols(0), step(0)
+			{
+			}
+
+			plane(int rows_, int cols_)
+				: rows(rows_), cols(cols_), step(int((cols_ * sizeof(value_type) + 63) / 64 * 64 / sizeof(value_type)))
+				, storage(size_t(rows_) * step)
+			{
+			}
+
+			plane_view<value_type> view()
+			{
+				return plane_view<value_type>(storage.data(), rows, cols, step);
+			}
+
+			plane_view<const value_type> view() const
+			{
+				return plane_view<const value_type>(storage.data(), rows, cols, step);
+			}
+
+			operator plane_view<value_type>()
+			{
+				return view();
+			}
+
+			operator plane_view<const value_type>() const
+			{
+				return view();
+			}
+
+			int rows;
+			int cols;
+			int step;
+
+		private:
+			std::vector<value_type> storage;
+		};
+
+		// Border handling
+		inline int reflect101(int i, int n)
+		{
+			return i < 0 ? -i : (i >= n ? n * 2 - i - 2 : i);
+		}
+
+		inline int replicate(int i, int n)
+		{
+			return i < 0 ? 0 : (i >= n ? n - 1 : i);
+		}
+
+		template<typename value_type>
+		inline typename std::remove_const<value_type>::type guarded_read(const plane_view<value_type>& A, int r, int c
+			, typename std::remove_const<value_type>::type default_value = typename std::remove_const<value_type>::type())
+		{
+			return A.contains(r, c) ? A(r, c) : default_value;
+		}
+
+		// reflected indices are clamped as well, padded tiles may reach past a whole image width
+		template<typename value_type>
+		inline typename std::remove_const<value_type>::type guarded_read_reflect101(const plane_view<value_type>& A, int r, int c)
+		{
+			return A(replicate(reflect101(r, A.rows), A.rows), replicate(reflect101(c, A.cols), A.cols));
+		}
+
+		template<typename value_type>
+		inline typename std::remove_const<value_type>::type guarded_read_replicate(const plane_view<value_type>& A, int r, int c)
+		{
+			return A(replicate(r, A.rows), replicate(c, A.cols));
+		}
+
+		template<typename value_type>
+		inline void guarded_write(const plane_view<value_type>& A, int r, int c, const value_type& val)
+		{
+			if(A.contains(r, c))
+				A(r, c) = val;
+		}
+
+		template<typename value_type>
+		inline void copy(thread_pool& pool, plane_view<const value_type> src, plane_view<value_type> dest)
+		{
+			assert(src.rows == dest.rows && src.cols == dest.cols);
+			pool.parallel_for(0, src.rows, [&](int row_first, int row_last)
+			{
+				for(int r = row_first; r < row_last; r++)
+				{
+					std::memcpy(dest.row(r), src.row(r), sizeof(value_type) * src.cols);
+				}
+			});
+		}
+
+		// Emulated tiled launch
+		// A C++ AMP tile kernel is rewritten as a function of one tile. The code between two
+		// barrier.wait() calls becomes one for_each_local() phase that runs every work item of the
+		// tile, so each phase completes for the whole tile before the next one starts. tile_static
+		// variables become locals of the tile function; per work item values that live across a
+		// barrier are kept in local arrays indexed by idx.local.
+		struct tiled_index
+		{
+			int global[2];
+			int local[2];
+			int tile[2];
+			int tile_origin[2];
+		};
+
+		template<int tile_rows, int tile_cols>
+		class tile
+		{
+		public:
+			static const int size = tile_rows * tile_cols;
+
+			tile(int tile_row, int tile_col)
+			{
+				index[0] = tile_row;
+				index[1] = tile_col;
+				origin[0] = tile_row * tile_rows;
+				origin[1] = tile_col * tile_cols;
+			}
+
+			template<typename Func>
+			void for_each_local(const Func& func) const
+			{
+				tiled_index idx;
+				idx.tile[0] = index[0];
+				idx.tile[1] = index[1];
+				idx.tile_origin[0] = origin[0];
+				idx.tile_origin[1] = origin[1];
+				for(int r = 0; r < tile_rows; r++)
+				{
+					idx.local[0] = r;
+					idx.global[0] = origin[0] + r;
+					for(int c = 0; c < tile_cols; c++)
+					{
+						idx.local[1] = c;
+						idx.global[1] = origin[1] + c;
+						func(idx);
+					}
+				}
+			}
+
+			int index[2];
+			int origin[2];
+		};
+
+		// Counterpart of parallel_for_each(acc_view, extent<2>(rows, cols).tile<tile_rows, tile_cols>().pad(), kernel)
+		template<int tile_rows, int tile_cols, typename Func>
+		inline void parallel_for_each(thread_pool& pool, int rows, int cols, const Func& kernel)
+		{
+			int tiles_y = (rows + tile_rows - 1) / tile_rows;
+			int tiles_x = (cols + tile_cols - 1) / tile_cols;
+			pool.parallel_for(0, tiles_y * tiles_x, [&](int first, int last)
+			{
+				for(int t = first; t < last; t++)
+				{
+					kernel(tile<tile_rows, tile_cols>(t / tiles_x, t % tiles_x));
+				}
+			});
+		}
+
+		// Strip-mined launch over image rows, func(row_first, row_last)
+		template<typename Func>
+		inline void parallel_for_rows(thread_pool& pool, int rows, const Func& func)
+		{
+			pool.parallel_for(0, rows, func);
+		}
+
+		// Packed 8u/16u row kernels
+		// Shared by the _8u_c1/_16u_c1 operators, one pixel is one byte or word so a vector holds 4x/2x the pixels of the float paths.
+		namespace detail
+		{
+			template<bool take_max, typename value_type>
+			inline void extremum_row_scalar(const value_type* a, const value_type* b, value_type* dest, int first, int n)
+			{
+				for(int c = first; c < n; c++)
+				{
+					dest[c] = take_max ? std::max(a[c], b[c]) : std::min(a[c], b[c]);
+				}
+			}
+
+			// type follows cv::ThresholdTypes: binary, binary_inv, trunc, tozero, tozero_inv
+			template<typename value_type>
+			inline void threshold_row_scalar(const value_type* src, value_type* dest, int first, int n, value_type thresh, value_type max_value, int type)
+			{
+				for(int c = first; c < n; c++)
+				{
+					bool above = src[c] > thresh;
+					switch(type)
+					{
+					case 1:
+						dest[c] = above ? value_type(0) : max_value;
+						break;
+					case 2:
+						dest[c] = above ? thresh : src[c];
+						break;
+					case 3:
+						dest[c] = above ? src[c] : value_type(0);
+						break;
+					case 4:
+						dest[c] = above ? value_type(0) : src[c];
+						break;
+					default:
+						dest[c] = above ? max_value : value_type(0);
+						break;
+					}
+				}
+			}
+
+			template<typename value_type>
+			inline int count_zero_row_scalar(const value_type* src, int first, int n)
+			{
+				int count = 0;
+				for(int c = first; c < n; c++)
+				{
+					count += src[c] == 0 ? 1 : 0;
+				}
+				return count;
+			}
+
+#if AMP_CPU_X86
+			template<bool take_max, typename value_type>
+			AMP_CPU_TARGET("sse4.1")
+			inline void extremum_row_sse4(const value_type* a, const value_type* b, value_type* dest, int n)
+			{
+				const int step = 16 / sizeof(value_type);
+				int c = 0;
+				for(; c + step <= n; c += step)
+				{
+					__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + c));
+					__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + c));
+					__m128i vr;
+					if(sizeof(value_type) == 1)
+						vr = take_max ? _mm_max_epu8(va, vb) : _mm_min_epu8(va, vb);
+					else
+						vr = take_max ? _mm_max_epu16(va, vb) : _mm_min_epu16(va, vb);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + c), vr);
+				}
+				extremum_row_scalar<take_max>(a, b, dest, c, n);
+			}
+
+			template<bool take_max>
+			AMP_CPU_TARGET("sse4.1")
+			inline void extremum_row_sse4(const float* a, const float* b, float* dest, int n)
+			{
+				int c = 0;
+				for(; c + 4 <= n; c += 4)
+				{
+					__m128 va = _mm_loadu_ps(a + c);
+					__m128 vb = _mm_loadu_ps(b + c);
+					_mm_storeu_ps(dest + c, take_max ? _mm_max_ps(va, vb) : _mm_min_ps(va, vb));
+				}
+				extremum_row_scalar<take_max>(a, b, dest, c, n);
+			}
+
+			template<typename value_type>
+			AMP_CPU_TARGET("sse4.1")
+			inline void threshold_row_sse4(const value_type* src, value_type* dest, int n, value_type thresh, value_type max_value, int type)
+			{
+				const int step = 16 / sizeof(value_type);
+				const __m128i vt = sizeof(value_type) == 1 ? _mm_set1_epi8(char(thresh)) : _mm_set1_epi16(short(thresh));
+				const __m128i vm = sizeof(value_type) == 1 ? _mm_set1_epi8(char(max_value)) : _mm_set1_epi16(short(max_value));
+				int c = 0;
+				for(; c + step <= n; c += step)
+				{
+					__m128i vs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + c));
+					// src <= thresh as min(src, thresh) == src, there is no unsigned compare
+					__m128i vmin = sizeof(value_type) == 1 ? _mm_min_epu8(vs, vt) : _mm_min_epu16(vs, vt);
+					__m128i below = sizeof(value_type) == 1 ? _mm_cmpeq_epi8(vmin, vs) : _mm_cmpeq_epi16(vmin, vs);
+					__m128i vr;
+					switch(type)
+					{
+					case 1: vr = _mm_and_si128(below, vm); break;
+					case 2: vr = vmin; break;
+					case 3: vr = _mm_andnot_si128(below, vs); break;
+					case 4: vr = _mm_and_si128(below, vs); break;
+					default: vr = _mm_andnot_si128(below, vm); break;
+					}
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + c), vr);
+				}
+				threshold_row_scalar(src, dest, c, n, thresh, max_value, type);
+			}
+
+			template<typename value_type>
+			AMP_CPU_TARGET("sse4.1")
+			inline int count_zero_row_sse4(const value_type* src, int n)
+			{
+				// zero lanes are counted in bytes and flushed with sad before a byte can overflow
+				const __m128i zero = _mm_setzero_si128();
+				__m128i total = _mm_setzero_si128();
+				int c = 0;
+				while(c + 16 <= n)
+				{
+					__m128i acc = _mm_setzero_si128();
+					for(int i = 0; i < 255 && c + 16 <= n; i++, c += 16)
+					{
+						const __m128i* p = reinterpret_cast<const __m128i*>(src + c);
+						__m128i z;
+						if(sizeof(value_type) == 1)
+							z = _mm_cmpeq_epi8(_mm_loadu_si128(p), zero);
+						else
+							z = _mm_packs_epi16(_mm_cmpeq_epi16(_mm_loadu_si128(p), zero), _mm_cmpeq_epi16(_mm_loadu_si128(p + 1), zero));
+						acc = _mm_sub_epi8(acc, z);
+					}
+					total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+				}
+				long long sums[2];
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(sums), total);
+				return int(sums[0] + sums[1]) + count_zero_row_scalar(src, c, n);
+			}
+
+			template<bool take_max, typename value_type>
+			AMP_CPU_TARGET("avx2")
+			inline void extremum_row_avx2(const value_type* a, const value_type* b, value_type* dest, int n)
+			{
+				const int step = 32 / sizeof(value_type);
+				int c = 0;
+				for(; c + step <= n; c += step)
+				{
+					__m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + c));
+					__m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + c));
+					__m256i vr;
+					if(sizeof(value_type) == 1)
+						vr = take_max ? _mm256_max_epu8(va, vb) : _mm256_min_epu8(va, vb);
+					else
+						vr = take_max ? _mm256_max_epu16(va, vb) : _mm256_min_epu16(va, vb);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + c), vr);
+				}
+				extremum_row_scalar<take_max>(a, b, dest, c, n);
+			}
+
+			template<bool take_max>
+			AMP_CPU_TARGET("avx2")
+			inline void extremum_row_avx2(const float* a, const float* b, float* dest, int n)
+			{
+				int c = 0;
+				for(; c + 8 <= n; c += 8)
+				{
+					__m256 va = _mm256_loadu_ps(a + c);
+					__m256 vb = _mm256_loadu_ps(b + c);
+					_mm256_storeu_ps(dest + c, take_max ? _mm256_max_ps(va, vb) : _mm256_min_ps(va, vb));
+				}
+				extremum_row_scalar<take_max>(a, b, dest, c, n);
+			}
+
+			template<typename value_type>
+			AMP_CPU_TARGET("avx2")
+			inline void threshold_row_avx2(const value_type* src, value_type* dest, int n, value_type thresh, value_type max_value, int type)
+			{
+				const int step = 32 / sizeof(value_type);
+				const __m256i vt = sizeof(value_type) == 1 ? _mm256_set1_epi8(char(thresh)) : _mm256_set1_epi16(short(thresh));
+				const __m256i vm = sizeof(value_type) == 1 ? _mm256_set1_epi8(char(max_value)) : _mm256_set1_epi16(short(max_value));
+				int c = 0;
+				for(; c + step <= n; c += step)
+				{
+					__m256i vs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + c));
+					__m256i vmin = sizeof(value_type) == 1 ? _mm256_min_epu8(vs, vt) : _mm256_min_epu16(vs, vt);
+					__m256i below = sizeof(value_type) == 1 ? _mm256_cmpeq_epi8(vmin, vs) : _mm256_cmpeq_epi16(vmin, vs);
+					__m256i vr;
+					switch(type)
+					{
+					case 1: vr = _mm256_and_si256(below, vm); break;
+					case 2: vr = vmin; break;
+					case 3: vr = _mm256_andnot_si256(below, vs); break;
+					case 4: vr = _mm256_and_si256(below, vs); break;
+					default: vr = _mm256_andnot_si256(below, vm); break;
+					}
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + c), vr);
+				}
+				threshold_row_scalar(src, dest, c, n, thresh, max_value, type);
+			}
+
+			template<typename value_type>
+			AMP_CPU_TARGET("avx2")
+			inline int count_zero_row_avx2(const value_type* src, int n)
+			{
+				const __m256i zero = _mm256_setzero_si256();
+				__m256i total = _mm256_setzero_si256();
+				int c = 0;
+				while(c + 32 <= n)
+				{
+					__m256i acc = _mm256_setzero_si256();
+					for(int i = 0; i < 255 && c + 32 <= n; i++, c += 32)
+					{
+						const __m256i* p = reinterpret_cast<const __m256i*>(src + c);
+						__m256i z;
+						if(sizeof(value_type) == 1)
+							z = _mm256_cmpeq_epi8(_mm256_loadu_si256(p), zero);
+						else // packs interleaves the 128-bit lanes, which doesn't matter for a count
+							z = _mm256_packs_epi16(_mm256_cmpeq_epi16(_mm256_loadu_si256(p), zero), _mm256_cmpeq_epi16(_mm256_loadu_si256(p + 1), zero));
+						acc = _mm256_sub_epi8(acc, z);
+					}
+					total = _mm256_add_epi64(total, _mm256_sad_epu8(acc, zero));
+				}
+				long long sums[4];
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(sums), total);
+				return int(sums[0] + sums[1] + sums[2] + sums[3]) + count_zero_row_scalar(src, c, n);
+			}
+
+#if AMP_CPU_AVX512
+			template<bool take_max, typename value_type>
+			AMP_CPU_TARGET("avx512f,avx512bw")
+			inline void extremum_row_avx512(const value_type* a, const value_type* b, value_type* dest, int n)
+			{
+				const int step = 64 / sizeof(value_type);
+				int c = 0;
+				for(; c + step <= n; c += step)
+				{
+					__m512i va = _mm512_loadu_si512(a + c);
+					__m512i vb = _mm512_loadu_si512(b + c);
+					__m512i vr;
+					if(sizeof(value_type) == 1)
+						vr = take_max ? _mm512_max_epu8(va, vb) : _mm512_min_epu8(va, vb);
+					else
+						vr = take_max ? _mm512_max_epu16(va, vb) : _mm512_min_epu16(va, vb);
+					_mm512_storeu_si512(dest + c, vr);
+				}
+				extremum_row_scalar<take_max>(a, b, dest, c, n);
+			}
+
+			template<bool take_max>
+			AMP_CPU_TARGET("avx512f,avx512bw")
+			inline void extremum_row_avx512(const float* a, const float* b, float* dest, int n)
+			{
+				int c = 0;
+				for(; c + 16 <= n; c += 16)
+				{
+					__m512 va = _mm512_loadu_ps(a + c);
+					__m512 vb = _mm512_loadu_ps(b + c);
+					_mm512_storeu_ps(dest + c, take_max ? _mm512_max_ps(va, vb) : _mm512_min_ps(va, vb));
+				}
+				extremum_row_scalar<take_max>(a, b, dest, c, n);
+			}
+
+			template<typename value_type>
+			AMP_CPU_TARGET("avx512f,avx512bw")
+			inline void threshold_row_avx512(const value_type* src, value_type* dest, int n, value_type thresh, value_type max_value, int type)
+			{
+				const int step = 64 / sizeof(value_type);
+				const __m512i vt = sizeof(value_type) == 1 ? _mm512_set1_epi8(char(thresh)) : _mm512_set1_epi16(short(thresh));
+				const __m512i vm = sizeof(value_type) == 1 ? _mm512_set1_epi8(char(max_value)) : _mm512_set1_epi16(short(max_value));
+				const __m512i zero = _mm512_setzero_si512();
+				int c = 0;
+				for(; c + step <= n; c += step)
+				{
+					__m512i vs = _mm512_loadu_si512(src + c);
+					__m512i vr;
+					if(type == 2)
+					{
+						vr = sizeof(value_type) == 1 ? _mm512_min_epu8(vs, vt) : _mm512_min_epu16(vs, vt);
+					}
+					else
+					{
+						// 64 pixel mask of src > thresh, the selected pixels are blended from src or max_value
+						__mmask64 above = sizeof(value_type) == 1 ? _mm512_cmpgt_epu8_mask(vs, vt) : __mmask64(_mm512_cmpgt_epu16_mask(vs, vt));
+						__mmask64 keep = (type == 1 || type == 4) ? ~above : above;
+						__m512i value = (type == 3 || type == 4) ? vs : vm;
+						vr = sizeof(value_type) == 1 ? _mm512_mask_blend_epi8(keep, zero, value) : _mm512_mask_blend_epi16(__mmask32(keep), zero, value);
+					}
+					_mm512_storeu_si512(dest + c, vr);
+				}
+				threshold_row_scalar(src, dest, c, n, thresh, max_value, type);
+			}
+
+			template<typename value_type>
+			AMP_CPU_TARGET("avx512f,avx512bw,popcnt")
+			inline int count_zero_row_avx512(const value_type* src, int n)
+			{
+				const int step = 64 / sizeof(value_type);
+				const __m512i zero = _mm512_setzero_si512();
+				long long count = 0;
+				int c = 0;
+				for(; c + step <= n; c += step)
+				{
+					__m512i vs = _mm512_loadu_si512(src + c);
+					unsigned long long mask = sizeof(value_type) == 1 ? _mm512_cmpeq_epi8_mask(vs, zero) : _mm512_cmpeq_epi16_mask(vs, zero);
+					count += _mm_popcnt_u32(unsigned(mask)) + _mm_popcnt_u32(unsigned(mask >> 32));
+				}
+				return int(count) + count_zero_row_scalar(src, c, n);
+			}
+#endif
+#endif
+		}
+
+		// dest = min(a, b) per pixel(8u, 16u or float), dest may alias a or b
+		template<typename value_type>
+		inline void min_row(const value_type* a, const value_type* b, value_type* dest, int n, simd_level level)
+		{
+			static_assert((sizeof(value_type) <= 2 && !std::is_signed<value_type>::value) || std::is_same<value_type, float>::value, "extremum row kernels take 8u/16u or float pixels");
+			switch(level)
+			{
+#if AMP_CPU_X86
+#if AMP_CPU_AVX512
+			case simd_level::avx512:
+				detail::extremum_row_avx512<false>(a, b, dest, n);
+				break;
+#endif
+			case simd_level::avx2:
+				detail::extremum_row_avx2<false>(a, b, dest, n);
+				break;
+			case simd_level::sse4:
+				detail::extremum_row_sse4<false>(a, b, dest, n);
+				break;
+#endif
+			default:
+				detail::extremum_row_scalar<false>(a, b, dest, 0, n);
+				break;
+			}
+		}
+
+		// dest = max(a, b) per pixel(8u, 16u or float), dest may alias a or b
+		template<typename value_type>
+		inline void max_row(const value_type* a, const value_type* b, value_type* dest, int n, simd_level level)
+		{
+			static_assert((sizeof(value_type) <= 2 && !std::is_signed<value_type>::value) || std::is_same<value_type, float>::value, "extremum row kernels take 8u/16u or float pixels");
+			switch(level)
+			{
+#if AMP_CPU_X86
+#if AMP_CPU_AVX512
+			case simd_level::avx512:
+				detail::extremum_row_avx512<true>(a, b, dest, n);
+				break;
+#endif
+			case simd_level::avx2:
+				detail::extremum_row_avx2<true>(a, b, dest, n);
+				break;
+			case simd_level::sse4:
+				detail::extremum_row_sse4<true>(a, b, dest, n);
+				break;
+#endif
+			default:
+				detail::extremum_row_scalar<true>(a, b, dest, 0, n);
+				break;
+			}
+		}
+
+		// Pixels above thresh are selected, type follows cv::ThresholdTypes(binary, binary_inv, trunc, tozero, tozero_inv)
+		template<typename value_type>
+		inline void threshold_row(const value_type* src, value_type* dest, int n, value_type thresh, value_type max_value, int type, simd_level level)
+		{
+			static_assert(sizeof(value_type) <= 2 && !std::is_signed<value_type>::value, "packed row kernels take unsigned 8u/16u pixels");
+			switch(level)
+			{
+#if AMP_CPU_X86
+#if AMP_CPU_AVX512
+			case simd_level::avx512:
+				detail::threshold_row_avx512(src, dest, n, thresh, max_value, type);
+				break;
+#endif
+			case simd_level::avx2:
+				detail::threshold_row_avx2(src, dest, n, thresh, max_value, type);
+				break;
+			case simd_level::sse4:
+				detail::threshold_row_sse4(src, dest, n, thresh, max_value, type);
+				break;
+#endif
+			default:
+				detail::threshold_row_scalar(src, dest, 0, n, thresh, max_value, type);
+				break;
+			}
+		}
+
+		template<typename value_type>
+		inline int count_zero_row(const value_type* src, int n, simd_level level)
+		{
+			static_assert(sizeof(value_type) <= 2 && !std::is_signed<value_type>::value, "packed row kernels take unsigned 8u/16u pixels");
+			switch(level)
+			{
+#if AMP_CPU_X86
+#if AMP_CPU_AVX512
+			case simd_level::avx512:
+				return detail::count_zero_row_avx512(src, n);
+#endif
+			case simd_level::avx2:
+				return detail::count_zero_row_avx2(src, n);
+			case simd_level::sse4:
+				return detail::count_zero_row_sse4(src, n);
+#endif
+			default:
+				return detail::count_zero_row_scalar(src, 0, n);
+			}
+		}
+
+		namespace detail
+		{
+			template<typename value_type>
+			inline void transpose_block_scalar(const value_type* src, size_t src_step, value_type* dest, size_t dest_step, int rows, int cols)
+			{
+				// 8x8 blocks keep the strided side within a few cache lines
+				for(int r0 = 0; r0 < rows; r0 += 8)
+				{
+					for(int c0 = 0; c0 < cols; c0 += 8)
+					{
+						const int r1 = std::min(r0 + 8, rows);
+						const int c1 = std::min(c0 + 8, cols);
+						for(int r = r0; r < r1; r++)
+						{
+							for(int c = c0; c < c1; c++)
+							{
+								dest[c * dest_step + r] = src[r * src_step + c];
+							}
+						}
+					}
+				}
+			}
+
+#if AMP_CPU_X86
+			AMP_CPU_TARGET("sse4.1")
+			inline void transpose_block_sse4(const float* src, size_t src_step, float* dest, size_t dest_step, int rows, int cols)
+			{
+				const int rows4 = rows & ~3;
+				const int cols4 = cols & ~3;
+				for(int r = 0; r < rows4; r += 4)
+				{
+					for(int c = 0; c < cols4; c += 4)
+					{
+						__m128 row0 = _mm_loadu_ps(src + r * src_step + c);
+						__m128 row1 = _mm_loadu_ps(src + (r + 1) * src_step + c);
+						__m128 row2 = _mm_loadu_ps(src + (r + 2) * src_step + c);
+						__m128 row3 = _mm_loadu_ps(src + (r + 3) * src_step + c);
+						_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+						_mm_storeu_ps(dest + c * dest_step + r, row0);
+						_mm_storeu_ps(dest + (c + 1) * dest_step + r, row1);
+						_mm_storeu_ps(dest + (c + 2) * dest_step + r, row2);
+						_mm_storeu_ps(dest + (c + 3) * dest_step + r, row3);
+					}
+				}
+				transpose_block_scalar(src + cols4, src_step, dest + cols4 * dest_step, dest_step, rows4, cols - cols4);
+				transpose_block_scalar(src + rows4 * src_step, src_step, dest + rows4, dest_step, rows - rows4, cols);
+			}
+#endif
+		}
+
+		// dest(c, r) = src(r, c) for a rows x cols block, steps are in pixels
+		template<typename value_type>
+		inline void transpose_block(const value_type* src, size_t src_step, value_type* dest, size_t dest_step, int rows, int cols, simd_level level)
+		{
+			(void)level;
+			detail::transpose_block_scalar(src, src_step, dest, dest_step, rows, cols);
+		}
+
+		inline void transpose_block(const float* src, size_t src_step, float* dest, size_t dest_step, int rows, int cols, simd_level level)
+		{
+#if AMP_CPU_X86
+			if(level >= simd_level::sse4)
+			{
+				detail::transpose_block_sse4(src, src_step, dest, dest_step, rows, cols);
+				return;
+			}
+#endif
+			(void)level;
+			detail::transpose_block_scalar(src, src_step, dest, dest_step, rows, cols);
+		}
+	}
+}
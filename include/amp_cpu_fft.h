@@ -0,0 +1,884 @@
+﻿#pragma once
+
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include "amp_cpu.h"
+
+namespace amp
+{
+	namespace cpu
+	{
+		// Native FFT engine: mixed radix 4/2/3/5 Stockham passes (other prime factors use a generic odd butterfly),
+		// batched over 16 transforms at a time so every butterfly works on contiguous lane spans.
+		// Transforms are unnormalized, ifft(fft(x)) = n x unless a scale is given.
+		// sample code:
+		// cpu::plane<std::complex<float>> spectrum(rows, cpu::fft_half_cols(cols));
+		// cpu::fft_forward_r2c_2d(pool, image, spectrum);
+		// cpu::fft_inverse_c2r_2d(pool, spectrum, image, 1.0f / (rows * cols));
+
+		// smallest 2^a 3^b 5^c >= n
+		inline int optimal_fft_size(int n)
+		{
+			int best = std::numeric_limits<int>::max();
+			for (long long p2 = 1; p2 < 2LL * std::max(n, 1); p2 *= 2)
+			{
+				for (long long p3 = p2; p3 < 2LL * std::max(n, 1); p3 *= 3)
+				{
+					for (long long p5 = p3; p5 < 2LL * std::max(n, 1); p5 *= 5)
+					{
+						if (p5 >= n && p5 < best)
+						{
+							best = int(p5);
+						}
+					}
+				}
+			}
+			return best;
+		}
+
+		// columns of the half spectrum of a real transform
+		inline int fft_half_cols(int cols)
+		{
+			return cols / 2 + 1;
+		}
+
+		namespace detail
+		{
+			// transforms per batch, the lane count of the SoA blocks
+			static const int fft_lanes = 16;
+
+			// one Stockham pass: y[q + s (r p + u)] = tw(p)^u sum_t x[q + s (p + t m)] w_r^(t u), q < s, p < m
+			struct fft_stage
+			{
+				int radix;
+				int m;
+				int s;
+				// m x (radix - 1) complex twiddles
+				std::vector<float> twiddles;
+				// radix complex roots, generic radices only
+				std::vector<float> roots;
+			};
+
+			// Butterflies over len floats of every span, x spans are x_stride apart and y spans y_stride apart
+			inline void fft_twiddle_scalar(float& re, float& im, float wr, float wi)
+			{
+				float r = re * wr - im * wi;
+				im = re * wi + im * wr;
+				re = r;
+			}
+
+			inline void fft_radix2_scalar(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				for (ptrdiff_t i = 0; i < len; i++)
+				{
+					float ar = xr[i], ai = xi[i], br = xr[i + xs], bi = xi[i + xs];
+					yr[i] = ar + br;
+					yi[i] = ai + bi;
+					float dr = ar - br, di = ai - bi;
+					fft_twiddle_scalar(dr, di, tw[0], tw[1]);
+					yr[i + ys] = dr;
+					yi[i + ys] = di;
+				}
+			}
+
+			inline void fft_radix3_scalar(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				const float half_sqrt3 = 0.866025403784438647f;
+				for (ptrdiff_t i = 0; i < len; i++)
+				{
+					float ar = xr[i], ai = xi[i];
+					float tr = xr[i + xs] + xr[i + 2 * xs], ti = xi[i + xs] + xi[i + 2 * xs];
+					float dr = xr[i + xs] - xr[i + 2 * xs], di = xi[i + xs] - xi[i + 2 * xs];
+					yr[i] = ar + tr;
+					yi[i] = ai + ti;
+					float mr = ar - 0.5f * tr, mi = ai - 0.5f * ti;
+					// -i sqrt(3) / 2 (x1 - x2)
+					float sr = half_sqrt3 * di, si = -half_sqrt3 * dr;
+					float y1r = mr + sr, y1i = mi + si, y2r = mr - sr, y2i = mi - si;
+					fft_twiddle_scalar(y1r, y1i, tw[0], tw[1]);
+					fft_twiddle_scalar(y2r, y2i, tw[2], tw[3]);
+					yr[i + ys] = y1r;
+					yi[i + ys] = y1i;
+					yr[i + 2 * ys] = y2r;
+					yi[i + 2 * ys] = y2i;
+				}
+			}
+
+			inline void fft_radix4_scalar(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				for (ptrdiff_t i = 0; i < len; i++)
+				{
+					float t0r = xr[i] + xr[i + 2 * xs], t0i = xi[i] + xi[i + 2 * xs];
+					float t1r = xr[i] - xr[i + 2 * xs], t1i = xi[i] - xi[i + 2 * xs];
+					float t2r = xr[i + xs] + xr[i + 3 * xs], t2i = xi[i + xs] + xi[i + 3 * xs];
+					// -i (x1 - x3)
+					float t3r = xi[i + xs] - xi[i + 3 * xs], t3i = xr[i + 3 * xs] - xr[i + xs];
+					float y1r = t1r + t3r, y1i = t1i + t3i, y2r = t0r - t2r, y2i = t0i - t2i, y3r = t1r - t3r, y3i = t1i - t3i;
+					yr[i] = t0r + t2r;
+					yi[i] = t0i + t2i;
+					fft_twiddle_scalar(y1r, y1i, tw[0], tw[1]);
+					fft_twiddle_scalar(y2r, y2i, tw[2], tw[3]);
+					fft_twiddle_scalar(y3r, y3i, tw[4], tw[5]);
+					yr[i + ys] = y1r;
+					yi[i + ys] = y1i;
+					yr[i + 2 * ys] = y2r;
+					yi[i + 2 * ys] = y2i;
+					yr[i + 3 * ys] = y3r;
+					yi[i + 3 * ys] = y3i;
+				}
+			}
+
+			static const float fft_c1 = 0.309016994374947424f;  // cos(2 pi / 5)
+			static const float fft_c2 = -0.809016994374947424f; // cos(4 pi / 5)
+			static const float fft_s1 = 0.951056516295153572f;  // sin(2 pi / 5)
+			static const float fft_s2 = 0.587785252292473129f;  // sin(4 pi / 5)
+
+			inline void fft_radix5_scalar(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				for (ptrdiff_t i = 0; i < len; i++)
+				{
+					float x0r = xr[i], x0i = xi[i];
+					float a1r = xr[i + xs] + xr[i + 4 * xs], a1i = xi[i + xs] + xi[i + 4 * xs];
+					float b1r = xr[i + xs] - xr[i + 4 * xs], b1i = xi[i + xs] - xi[i + 4 * xs];
+					float a2r = xr[i + 2 * xs] + xr[i + 3 * xs], a2i = xi[i + 2 * xs] + xi[i + 3 * xs];
+					float b2r = xr[i + 2 * xs] - xr[i + 3 * xs], b2i = xi[i + 2 * xs] - xi[i + 3 * xs];
+					yr[i] = x0r + a1r + a2r;
+					yi[i] = x0i + a1i + a2i;
+					float m1r = x0r + fft_c1 * a1r + fft_c2 * a2r, m1i = x0i + fft_c1 * a1i + fft_c2 * a2i;
+					float m2r = x0r + fft_c2 * a1r + fft_c1 * a2r, m2i = x0i + fft_c2 * a1i + fft_c1 * a2i;
+					// -i (s1 b1 + s2 b2) and -i (s2 b1 - s1 b2)
+					float n1r = fft_s1 * b1i + fft_s2 * b2i, n1i = -(fft_s1 * b1r + fft_s2 * b2r);
+					float n2r = fft_s2 * b1i - fft_s1 * b2i, n2i = -(fft_s2 * b1r - fft_s1 * b2r);
+					float y1r = m1r + n1r, y1i = m1i + n1i, y4r = m1r - n1r, y4i = m1i - n1i;
+					float y2r = m2r + n2r, y2i = m2i + n2i, y3r = m2r - n2r, y3i = m2i - n2i;
+					fft_twiddle_scalar(y1r, y1i, tw[0], tw[1]);
+					fft_twiddle_scalar(y2r, y2i, tw[2], tw[3]);
+					fft_twiddle_scalar(y3r, y3i, tw[4], tw[5]);
+					fft_twiddle_scalar(y4r, y4i, tw[6], tw[7]);
+					yr[i + ys] = y1r;
+					yi[i + ys] = y1i;
+					yr[i + 2 * ys] = y2r;
+					yi[i + 2 * ys] = y2i;
+					yr[i + 3 * ys] = y3r;
+					yi[i + 3 * ys] = y3i;
+					yr[i + 4 * ys] = y4r;
+					yi[i + 4 * ys] = y4i;
+				}
+			}
+
+			// any odd radix, O(radix^2) per element
+			inline void fft_radix_generic(int radix, const float* roots, const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys
+				, const float* tw, ptrdiff_t len)
+			{
+				for (ptrdiff_t i = 0; i < len; i++)
+				{
+					for (int u = 0; u < radix; u++)
+					{
+						float sr = 0.0f, si = 0.0f;
+						for (int t = 0; t < radix; t++)
+						{
+							const int k = (t * u) % radix;
+							const float ar = xr[i + t * xs], ai = xi[i + t * xs];
+							sr += ar * roots[2 * k] - ai * roots[2 * k + 1];
+							si += ar * roots[2 * k + 1] + ai * roots[2 * k];
+						}
+						if (u > 0)
+						{
+							fft_twiddle_scalar(sr, si, tw[2 * (u - 1)], tw[2 * (u - 1) + 1]);
+						}
+						yr[i + u * ys] = sr;
+						yi[i + u * ys] = si;
+					}
+				}
+			}
+
+#if AMP_CPU_X86
+			AMP_CPU_TARGET("avx2,fma")
+			inline void fft_twiddle_avx2(__m256& re, __m256& im, __m256 wr, __m256 wi)
+			{
+				__m256 r = _mm256_fmsub_ps(re, wr, _mm256_mul_ps(im, wi));
+				im = _mm256_fmadd_ps(re, wi, _mm256_mul_ps(im, wr));
+				re = r;
+			}
+
+			AMP_CPU_TARGET("avx2,fma")
+			inline void fft_radix2_avx2(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				const __m256 w1r = _mm256_set1_ps(tw[0]), w1i = _mm256_set1_ps(tw[1]);
+				ptrdiff_t i = 0;
+				for (; i + 8 <= len; i += 8)
+				{
+					__m256 ar = _mm256_loadu_ps(xr + i), ai = _mm256_loadu_ps(xi + i);
+					__m256 br = _mm256_loadu_ps(xr + i + xs), bi = _mm256_loadu_ps(xi + i + xs);
+					_mm256_storeu_ps(yr + i, _mm256_add_ps(ar, br));
+					_mm256_storeu_ps(yi + i, _mm256_add_ps(ai, bi));
+					__m256 dr = _mm256_sub_ps(ar, br), di = _mm256_sub_ps(ai, bi);
+					fft_twiddle_avx2(dr, di, w1r, w1i);
+					_mm256_storeu_ps(yr + i + ys, dr);
+					_mm256_storeu_ps(yi + i + ys, di);
+				}
+				fft_radix2_scalar(xr + i, xi + i, xs, yr + i, yi + i, ys, tw, len - i);
+			}
+
+			AMP_CPU_TARGET("avx2,fma")
+			inline void fft_radix3_avx2(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				const __m256 w1r = _mm256_set1_ps(tw[0]), w1i = _mm256_set1_ps(tw[1]), w2r = _mm256_set1_ps(tw[2]), w2i = _mm256_set1_ps(tw[3]);
+				const __m256 half = _mm256_set1_ps(0.5f), half_sqrt3 = _mm256_set1_ps(0.866025403784438647f);
+				ptrdiff_t i = 0;
+				for (; i + 8 <= len; i += 8)
+				{
+					__m256 ar = _mm256_loadu_ps(xr + i), ai = _mm256_loadu_ps(xi + i);
+					__m256 x1r = _mm256_loadu_ps(xr + i + xs), x1i = _mm256_loadu_ps(xi + i + xs);
+					__m256 x2r = _mm256_loadu_ps(xr + i + 2 * xs), x2i = _mm256_loadu_ps(xi + i + 2 * xs);
+					__m256 tr = _mm256_add_ps(x1r, x2r), ti = _mm256_add_ps(x1i, x2i);
+					__m256 sr = _mm256_mul_ps(half_sqrt3, _mm256_sub_ps(x1i, x2i)), si = _mm256_mul_ps(half_sqrt3, _mm256_sub_ps(x2r, x1r));
+					_mm256_storeu_ps(yr + i, _mm256_add_ps(ar, tr));
+					_mm256_storeu_ps(yi + i, _mm256_add_ps(ai, ti));
+					__m256 mr = _mm256_fnmadd_ps(half, tr, ar), mi = _mm256_fnmadd_ps(half, ti, ai);
+					__m256 y1r = _mm256_add_ps(mr, sr), y1i = _mm256_add_ps(mi, si), y2r = _mm256_sub_ps(mr, sr), y2i = _mm256_sub_ps(mi, si);
+					fft_twiddle_avx2(y1r, y1i, w1r, w1i);
+					fft_twiddle_avx2(y2r, y2i, w2r, w2i);
+					_mm256_storeu_ps(yr + i + ys, y1r);
+					_mm256_storeu_ps(yi + i + ys, y1i);
+					_mm256_storeu_ps(yr + i + 2 * ys, y2r);
+					_mm256_storeu_ps(yi + i + 2 * ys, y2i);
+				}
+				fft_radix3_scalar(xr + i, xi + i, xs, yr + i, yi + i, ys, tw, len - i);
+			}
+
+			AMP_CPU_TARGET("avx2,fma")
+			inline void fft_radix4_avx2(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				const __m256 w1r = _mm256_set1_ps(tw[0]), w1i = _mm256_set1_ps(tw[1]), w2r = _mm256_set1_ps(tw[2]), w2i = _mm256_set1_ps(tw[3]);
+				const __m256 w3r = _mm256_set1_ps(tw[4]), w3i = _mm256_set1_ps(tw[5]);
+				ptrdiff_t i = 0;
+				for (; i + 8 <= len; i += 8)
+				{
+					__m256 x0r = _mm256_loadu_ps(xr + i), x0i = _mm256_loadu_ps(xi + i);
+					__m256 x1r = _mm256_loadu_ps(xr + i + xs), x1i = _mm256_loadu_ps(xi + i + xs);
+					__m256 x2r = _mm256_loadu_ps(xr + i + 2 * xs), x2i = _mm256_loadu_ps(xi + i + 2 * xs);
+					__m256 x3r = _mm256_loadu_ps(xr + i + 3 * xs), x3i = _mm256_loadu_ps(xi + i + 3 * xs);
+					__m256 t0r = _mm256_add_ps(x0r, x2r), t0i = _mm256_add_ps(x0i, x2i);
+					__m256 t1r = _mm256_sub_ps(x0r, x2r), t1i = _mm256_sub_ps(x0i, x2i);
+					__m256 t2r = _mm256_add_ps(x1r, x3r), t2i = _mm256_add_ps(x1i, x3i);
+					__m256 t3r = _mm256_sub_ps(x1i, x3i), t3i = _mm256_sub_ps(x3r, x1r);
+					__m256 y1r = _mm256_add_ps(t1r, t3r), y1i = _mm256_add_ps(t1i, t3i);
+					__m256 y2r = _mm256_sub_ps(t0r, t2r), y2i = _mm256_sub_ps(t0i, t2i);
+					__m256 y3r = _mm256_sub_ps(t1r, t3r), y3i = _mm256_sub_ps(t1i, t3i);
+					_mm256_storeu_ps(yr + i, _mm256_add_ps(t0r, t2r));
+					_mm256_storeu_ps(yi + i, _mm256_add_ps(t0i, t2i));
+					fft_twiddle_avx2(y1r, y1i, w1r, w1i);
+					fft_twiddle_avx2(y2r, y2i, w2r, w2i);
+					fft_twiddle_avx2(y3r, y3i, w3r, w3i);
+					_mm256_storeu_ps(yr + i + ys, y1r);
+					_mm256_storeu_ps(yi + i + ys, y1i);
+					_mm256_storeu_ps(yr + i + 2 * ys, y2r);
+					_mm256_storeu_ps(yi + i + 2 * ys, y2i);
+					_mm256_storeu_ps(yr + i + 3 * ys, y3r);
+					_mm256_storeu_ps(yi + i + 3 * ys, y3i);
+				}
+				fft_radix4_scalar(xr + i, xi + i, xs, yr + i, yi + i, ys, tw, len - i);
+			}
+
+			AMP_CPU_TARGET("avx2,fma")
+			inline void fft_radix5_avx2(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				const __m256 w1r = _mm256_set1_ps(tw[0]), w1i = _mm256_set1_ps(tw[1]), w2r = _mm256_set1_ps(tw[2]), w2i = _mm256_set1_ps(tw[3]);
+				const __m256 w3r = _mm256_set1_ps(tw[4]), w3i = _mm256_set1_ps(tw[5]), w4r = _mm256_set1_ps(tw[6]), w4i = _mm256_set1_ps(tw[7]);
+				const __m256 c1 = _mm256_set1_ps(fft_c1), c2 = _mm256_set1_ps(fft_c2), s1 = _mm256_set1_ps(fft_s1), s2 = _mm256_set1_ps(fft_s2);
+				ptrdiff_t i = 0;
+				for (; i + 8 <= len; i += 8)
+				{
+					__m256 x0r = _mm256_loadu_ps(xr + i), x0i = _mm256_loadu_ps(xi + i);
+					__m256 x1r = _mm256_loadu_ps(xr + i + xs), x1i = _mm256_loadu_ps(xi + i + xs);
+					__m256 x2r = _mm256_loadu_ps(xr + i + 2 * xs), x2i = _mm256_loadu_ps(xi + i + 2 * xs);
+					__m256 x3r = _mm256_loadu_ps(xr + i + 3 * xs), x3i = _mm256_loadu_ps(xi + i + 3 * xs);
+					__m256 x4r = _mm256_loadu_ps(xr + i + 4 * xs), x4i = _mm256_loadu_ps(xi + i + 4 * xs);
+					__m256 a1r = _mm256_add_ps(x1r, x4r), a1i = _mm256_add_ps(x1i, x4i), b1r = _mm256_sub_ps(x1r, x4r), b1i = _mm256_sub_ps(x1i, x4i);
+					__m256 a2r = _mm256_add_ps(x2r, x3r), a2i = _mm256_add_ps(x2i, x3i), b2r = _mm256_sub_ps(x2r, x3r), b2i = _mm256_sub_ps(x2i, x3i);
+					_mm256_storeu_ps(yr + i, _mm256_add_ps(x0r, _mm256_add_ps(a1r, a2r)));
+					_mm256_storeu_ps(yi + i, _mm256_add_ps(x0i, _mm256_add_ps(a1i, a2i)));
+					__m256 m1r = _mm256_fmadd_ps(c2, a2r, _mm256_fmadd_ps(c1, a1r, x0r)), m1i = _mm256_fmadd_ps(c2, a2i, _mm256_fmadd_ps(c1, a1i, x0i));
+					__m256 m2r = _mm256_fmadd_ps(c1, a2r, _mm256_fmadd_ps(c2, a1r, x0r)), m2i = _mm256_fmadd_ps(c1, a2i, _mm256_fmadd_ps(c2, a1i, x0i));
+					__m256 n1r = _mm256_fmadd_ps(s2, b2i, _mm256_mul_ps(s1, b1i)), n1i = _mm256_fnmsub_ps(s2, b2r, _mm256_mul_ps(s1, b1r));
+					__m256 n2r = _mm256_fnmadd_ps(s1, b2i, _mm256_mul_ps(s2, b1i)), n2i = _mm256_fmsub_ps(s1, b2r, _mm256_mul_ps(s2, b1r));
+					__m256 y1r = _mm256_add_ps(m1r, n1r), y1i = _mm256_add_ps(m1i, n1i), y4r = _mm256_sub_ps(m1r, n1r), y4i = _mm256_sub_ps(m1i, n1i);
+					__m256 y2r = _mm256_add_ps(m2r, n2r), y2i = _mm256_add_ps(m2i, n2i), y3r = _mm256_sub_ps(m2r, n2r), y3i = _mm256_sub_ps(m2i, n2i);
+					fft_twiddle_avx2(y1r, y1i, w1r, w1i);
+					fft_twiddle_avx2(y2r, y2i, w2r, w2i);
+					fft_twiddle_avx2(y3r, y3i, w3r, w3i);
+					fft_twiddle_avx2(y4r, y4i, w4r, w4i);
+					_mm256_storeu_ps(yr + i + ys, y1r);
+					_mm256_storeu_ps(yi + i + ys, y1i);
+					_mm256_storeu_ps(yr + i + 2 * ys, y2r);
+					_mm256_storeu_ps(yi + i + 2 * ys, y2i);
+					_mm256_storeu_ps(yr + i + 3 * ys, y3r);
+					_mm256_storeu_ps(yi + i + 3 * ys, y3i);
+					_mm256_storeu_ps(yr + i + 4 * ys, y4r);
+					_mm256_storeu_ps(yi + i + 4 * ys, y4i);
+				}
+				fft_radix5_scalar(xr + i, xi + i, xs, yr + i, yi + i, ys, tw, len - i);
+			}
+
+#if AMP_CPU_AVX512
+			AMP_CPU_TARGET("avx512f")
+			inline void fft_twiddle_avx512(__m512& re, __m512& im, __m512 wr, __m512 wi)
+			{
+				__m512 r = _mm512_fmsub_ps(re, wr, _mm512_mul_ps(im, wi));
+				im = _mm512_fmadd_ps(re, wi, _mm512_mul_ps(im, wr));
+				re = r;
+			}
+
+			AMP_CPU_TARGET("avx512f")
+			inline void fft_radix2_avx512(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				const __m512 w1r = _mm512_set1_ps(tw[0]), w1i = _mm512_set1_ps(tw[1]);
+				ptrdiff_t i = 0;
+				for (; i + 16 <= len; i += 16)
+				{
+					__m512 ar = _mm512_loadu_ps(xr + i), ai = _mm512_loadu_ps(xi + i);
+					__m512 br = _mm512_loadu_ps(xr + i + xs), bi = _mm512_loadu_ps(xi + i + xs);
+					_mm512_storeu_ps(yr + i, _mm512_add_ps(ar, br));
+					_mm512_storeu_ps(yi + i, _mm512_add_ps(ai, bi));
+					__m512 dr = _mm512_sub_ps(ar, br), di = _mm512_sub_ps(ai, bi);
+					fft_twiddle_avx512(dr, di, w1r, w1i);
+					_mm512_storeu_ps(yr + i + ys, dr);
+					_mm512_storeu_ps(yi + i + ys, di);
+				}
+				fft_radix2_scalar(xr + i, xi + i, xs, yr + i, yi + i, ys, tw, len - i);
+			}
+
+			AMP_CPU_TARGET("avx512f")
+			inline void fft_radix3_avx512(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				const __m512 w1r = _mm512_set1_ps(tw[0]), w1i = _mm512_set1_ps(tw[1]), w2r = _mm512_set1_ps(tw[2]), w2i = _mm512_set1_ps(tw[3]);
+				const __m512 half = _mm512_set1_ps(0.5f), half_sqrt3 = _mm512_set1_ps(0.866025403784438647f);
+				ptrdiff_t i = 0;
+				for (; i + 16 <= len; i += 16)
+				{
+					__m512 ar = _mm512_loadu_ps(xr + i), ai = _mm512_loadu_ps(xi + i);
+					__m512 x1r = _mm512_loadu_ps(xr + i + xs), x1i = _mm512_loadu_ps(xi + i + xs);
+					__m512 x2r = _mm512_loadu_ps(xr + i + 2 * xs), x2i = _mm512_loadu_ps(xi + i + 2 * xs);
+					__m512 tr = _mm512_add_ps(x1r, x2r), ti = _mm512_add_ps(x1i, x2i);
+					__m512 sr = _mm512_mul_ps(half_sqrt3, _mm512_sub_ps(x1i, x2i)), si = _mm512_mul_ps(half_sqrt3, _mm512_sub_ps(x2r, x1r));
+					_mm512_storeu_ps(yr + i, _mm512_add_ps(ar, tr));
+					_mm512_storeu_ps(yi + i, _mm512_add_ps(ai, ti));
+					__m512 mr = _mm512_fnmadd_ps(half, tr, ar), mi = _mm512_fnmadd_ps(half, ti, ai);
+					__m512 y1r = _mm512_add_ps(mr, sr), y1i = _mm512_add_ps(mi, si), y2r = _mm512_sub_ps(mr, sr), y2i = _mm512_sub_ps(mi, si);
+					fft_twiddle_avx512(y1r, y1i, w1r, w1i);
+					fft_twiddle_avx512(y2r, y2i, w2r, w2i);
+					_mm512_storeu_ps(yr + i + ys, y1r);
+					_mm512_storeu_ps(yi + i + ys, y1i);
+					_mm512_storeu_ps(yr + i + 2 * ys, y2r);
+					_mm512_storeu_ps(yi + i + 2 * ys, y2i);
+				}
+				fft_radix3_scalar(xr + i, xi + i, xs, yr + i, yi + i, ys, tw, len - i);
+			}
+
+			AMP_CPU_TARGET("avx512f")
+			inline void fft_radix4_avx512(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				const __m512 w1r = _mm512_set1_ps(tw[0]), w1i = _mm512_set1_ps(tw[1]), w2r = _mm512_set1_ps(tw[2]), w2i = _mm512_set1_ps(tw[3]);
+				const __m512 w3r = _mm512_set1_ps(tw[4]), w3i = _mm512_set1_ps(tw[5]);
+				ptrdiff_t i = 0;
+				for (; i + 16 <= len; i += 16)
+				{
+					__m512 x0r = _mm512_loadu_ps(xr + i), x0i = _mm512_loadu_ps(xi + i);
+					__m512 x1r = _mm512_loadu_ps(xr + i + xs), x1i = _mm512_loadu_ps(xi + i + xs);
+					__m512 x2r = _mm512_loadu_ps(xr + i + 2 * xs), x2i = _mm512_loadu_ps(xi + i + 2 * xs);
+					__m512 x3r = _mm512_loadu_ps(xr + i + 3 * xs), x3i = _mm512_loadu_ps(xi + i + 3 * xs);
+					__m512 t0r = _mm512_add_ps(x0r, x2r), t0i = _mm512_add_ps(x0i, x2i);
+					__m512 t1r = _mm512_sub_ps(x0r, x2r), t1i = _mm512_sub_ps(x0i, x2i);
+					__m512 t2r = _mm512_add_ps(x1r, x3r), t2i = _mm512_add_ps(x1i, x3i);
+					__m512 t3r = _mm512_sub_ps(x1i, x3i), t3i = _mm512_sub_ps(x3r, x1r);
+					__m512 y1r = _mm512_add_ps(t1r, t3r), y1i = _mm512_add_ps(t1i, t3i);
+					__m512 y2r = _mm512_sub_ps(t0r, t2r), y2i = _mm512_sub_ps(t0i, t2i);
+					__m512 y3r = _mm512_sub_ps(t1r, t3r), y3i = _mm512_sub_ps(t1i, t3i);
+					_mm512_storeu_ps(yr + i, _mm512_add_ps(t0r, t2r));
+					_mm512_storeu_ps(yi + i, _mm512_add_ps(t0i, t2i));
+					fft_twiddle_avx512(y1r, y1i, w1r, w1i);
+					fft_twiddle_avx512(y2r, y2i, w2r, w2i);
+					fft_twiddle_avx512(y3r, y3i, w3r, w3i);
+					_mm512_storeu_ps(yr + i + ys, y1r);
+					_mm512_storeu_ps(yi + i + ys, y1i);
+					_mm512_storeu_ps(yr + i + 2 * ys, y2r);
+					_mm512_storeu_ps(yi + i + 2 * ys, y2i);
+					_mm512_storeu_ps(yr + i + 3 * ys, y3r);
+					_mm512_storeu_ps(yi + i + 3 * ys, y3i);
+				}
+				fft_radix4_scalar(xr + i, xi + i, xs, yr + i, yi + i, ys, tw, len - i);
+			}
+
+			AMP_CPU_TARGET("avx512f")
+			inline void fft_radix5_avx512(const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys, const float* tw, ptrdiff_t len)
+			{
+				const __m512 w1r = _mm512_set1_ps(tw[0]), w1i = _mm512_set1_ps(tw[1]), w2r = _mm512_set1_ps(tw[2]), w2i = _mm512_set1_ps(tw[3]);
+				const __m512 w3r = _mm512_set1_ps(tw[4]), w3i = _mm512_set1_ps(tw[5]), w4r = _mm512_set1_ps(tw[6]), w4i = _mm512_set1_ps(tw[7]);
+				const __m512 c1 = _mm512_set1_ps(fft_c1), c2 = _mm512_set1_ps(fft_c2), s1 = _mm512_set1_ps(fft_s1), s2 = _mm512_set1_ps(fft_s2);
+				ptrdiff_t i = 0;
+				for (; i + 16 <= len; i += 16)
+				{
+					__m512 x0r = _mm512_loadu_ps(xr + i), x0i = _mm512_loadu_ps(xi + i);
+					__m512 x1r = _mm512_loadu_ps(xr + i + xs), x1i = _mm512_loadu_ps(xi + i + xs);
+					__m512 x2r = _mm512_loadu_ps(xr + i + 2 * xs), x2i = _mm512_loadu_ps(xi + i + 2 * xs);
+					__m512 x3r = _mm512_loadu_ps(xr + i + 3 * xs), x3i = _mm512_loadu_ps(xi + i + 3 * xs);
+					__m512 x4r = _mm512_loadu_ps(xr + i + 4 * xs), x4i = _mm512_loadu_ps(xi + i + 4 * xs);
+					__m512 a1r = _mm512_add_ps(x1r, x4r), a1i = _mm512_add_ps(x1i, x4i), b1r = _mm512_sub_ps(x1r, x4r), b1i = _mm512_sub_ps(x1i, x4i);
+					__m512 a2r = _mm512_add_ps(x2r, x3r), a2i = _mm512_add_ps(x2i, x3i), b2r = _mm512_sub_ps(x2r, x3r), b2i = _mm512_sub_ps(x2i, x3i);
+					_mm512_storeu_ps(yr + i, _mm512_add_ps(x0r, _mm512_add_ps(a1r, a2r)));
+					_mm512_storeu_ps(yi + i, _mm512_add_ps(x0i, _mm512_add_ps(a1i, a2i)));
+					__m512 m1r = _mm512_fmadd_ps(c2, a2r, _mm512_fmadd_ps(c1, a1r, x0r)), m1i = _mm512_fmadd_ps(c2, a2i, _mm512_fmadd_ps(c1, a1i, x0i));
+					__m512 m2r = _mm512_fmadd_ps(c1, a2r, _mm512_fmadd_ps(c2, a1r, x0r)), m2i = _mm512_fmadd_ps(c1, a2i, _mm512_fmadd_ps(c2, a1i, x0i));
+					__m512 n1r = _mm512_fmadd_ps(s2, b2i, _mm512_mul_ps(s1, b1i)), n1i = _mm512_fnmsub_ps(s2, b2r, _mm512_mul_ps(s1, b1r));
+					__m512 n2r = _mm512_fnmadd_ps(s1, b2i, _mm512_mul_ps(s2, b1i)), n2i = _mm512_fmsub_ps(s1, b2r, _mm512_mul_ps(s2, b1r));
+					__m512 y1r = _mm512_add_ps(m1r, n1r), y1i = _mm512_add_ps(m1i, n1i), y4r = _mm512_sub_ps(m1r, n1r), y4i = _mm512_sub_ps(m1i, n1i);
+					__m512 y2r = _mm512_add_ps(m2r, n2r), y2i = _mm512_add_ps(m2i, n2i), y3r = _mm512_sub_ps(m2r, n2r), y3i = _mm512_sub_ps(m2i, n2i);
+					fft_twiddle_avx512(y1r, y1i, w1r, w1i);
+					fft_twiddle_avx512(y2r, y2i, w2r, w2i);
+					fft_twiddle_avx512(y3r, y3i, w3r, w3i);
+					fft_twiddle_avx512(y4r, y4i, w4r, w4i);
+					_mm512_storeu_ps(yr + i + ys, y1r);
+					_mm512_storeu_ps(yi + i + ys, y1i);
+					_mm512_storeu_ps(yr + i + 2 * ys, y2r);
+					_mm512_storeu_ps(yi + i + 2 * ys, y2i);
+					_mm512_storeu_ps(yr + i + 3 * ys, y3r);
+					_mm512_storeu_ps(yi + i + 3 * ys, y3i);
+					_mm512_storeu_ps(yr + i + 4 * ys, y4r);
+					_mm512_storeu_ps(yi + i + 4 * ys, y4i);
+				}
+				fft_radix5_scalar(xr + i, xi + i, xs, yr + i, yi + i, ys, tw, len - i);
+			}
+#endif
+#endif
+
+			inline void fft_butterfly(const fft_stage& stage, const float* xr, const float* xi, ptrdiff_t xs, float* yr, float* yi, ptrdiff_t ys
+				, const float* tw, ptrdiff_t len, simd_level level)
+			{
+#if AMP_CPU_X86
+#if AMP_CPU_AVX512
+				if (level >= simd_level::avx512 && len >= 16)
+				{
+					switch (stage.radix)
+					{
+					case 2: fft_radix2_avx512(xr, xi, xs, yr, yi, ys, tw, len); return;
+					case 3: fft_radix3_avx512(xr, xi, xs, yr, yi, ys, tw, len); return;
+					case 4: fft_radix4_avx512(xr, xi, xs, yr, yi, ys, tw, len); return;
+					case 5: fft_radix5_avx512(xr, xi, xs, yr, yi, ys, tw, len); return;
+					}
+				}
+#endif
+				if (level >= simd_level::avx2 && len >= 8)
+				{
+					switch (stage.radix)
+					{
+					case 2: fft_radix2_avx2(xr, xi, xs, yr, yi, ys, tw, len); return;
+					case 3: fft_radix3_avx2(xr, xi, xs, yr, yi, ys, tw, len); return;
+					case 4: fft_radix4_avx2(xr, xi, xs, yr, yi, ys, tw, len); return;
+					case 5: fft_radix5_avx2(xr, xi, xs, yr, yi, ys, tw, len); return;
+					}
+				}
+#endif
+				(void)level;
+				switch (stage.radix)
+				{
+				case 2: fft_radix2_scalar(xr, xi, xs, yr, yi, ys, tw, len); return;
+				case 3: fft_radix3_scalar(xr, xi, xs, yr, yi, ys, tw, len); return;
+				case 4: fft_radix4_scalar(xr, xi, xs, yr, yi, ys, tw, len); return;
+				case 5: fft_radix5_scalar(xr, xi, xs, yr, yi, ys, tw, len); return;
+				default: fft_radix_generic(stage.radix, stage.roots.data(), xr, xi, xs, yr, yi, ys, tw, len); return;
+				}
+			}
+		}
+
+		// Forward complex transform of one length, factored into Stockham passes with precomputed twiddles.
+		// Runs on SoA blocks: element j of transform l at re/im[j * lanes + l].
+		class fft_radix_plan
+		{
+		public:
+			explicit fft_radix_plan(int n_)
+				: n(n_)
+			{
+				if (n < 1)
+				{
+					throw std::runtime_error("fft length must be positive");
+				}
+				std::vector<int> radices;
+				int rest = n;
+				while (rest % 4 == 0)
+				{
+					radices.push_back(4);
+					rest /= 4;
+				}
+				for (int radix : { 2, 3, 5 })
+				{
+					while (rest % radix == 0)
+					{
+						radices.push_back(radix);
+						rest /= radix;
+					}
+				}
+				for (int radix = 7; rest > 1; radix += 2)
+				{
+					while (rest % radix == 0)
+					{
+						radices.push_back(radix);
+						rest /= radix;
+					}
+				}
+				const double pi = 3.14159265358979323846;
+				int s = 1;
+				for (size_t i = 0; i < radices.size(); i++)
+				{
+					detail::fft_stage stage;
+					stage.radix = radices[i];
+					stage.s = s;
+					stage.m = n / (s * stage.radix);
+					const int stage_n = n / s;
+					stage.twiddles.resize(size_t(stage.m) * (stage.radix - 1) * 2);
+					for (int p = 0; p < stage.m; p++)
+					{
+						for (int u = 1; u < stage.radix; u++)
+						{
+							const double angle = -2.0 * pi * double(p) * u / stage_n;
+							stage.twiddles[(size_t(p) * (stage.radix - 1) + u - 1) * 2] = float(std::cos(angle));
+							stage.twiddles[(size_t(p) * (stage.radix - 1) + u - 1) * 2 + 1] = float(std::sin(angle));
+						}
+					}
+					if (stage.radix > 5)
+					{
+						stage.roots.resize(size_t(stage.radix) * 2);
+						for (int k = 0; k < stage.radix; k++)
+						{
+							stage.roots[2 * k] = float(std::cos(-2.0 * pi * k / stage.radix));
+							stage.roots[2 * k + 1] = float(std::sin(-2.0 * pi * k / stage.radix));
+						}
+					}
+					stages.push_back(stage);
+					s *= stage.radix;
+				}
+			}
+
+			int size() const
+			{
+				return n;
+			}
+
+			// transform the lanes of re/im in place, work_re/work_im hold n * lanes floats each
+			void execute(float* re, float* im, float* work_re, float* work_im, int lanes, simd_level level) const
+			{
+				float* xr = re;
+				float* xi = im;
+				float* yr = work_re;
+				float* yi = work_im;
+				for (size_t i = 0; i < stages.size(); i++)
+				{
+					const detail::fft_stage& stage = stages[i];
+					const ptrdiff_t len = ptrdiff_t(stage.s) * lanes;
+					const ptrdiff_t x_stride = len * stage.m;
+					const int twiddle_count = (stage.radix - 1) * 2;
+					for (int p = 0; p < stage.m; p++)
+					{
+						const ptrdiff_t x_offset = len * p;
+						const ptrdiff_t y_offset = len * stage.radix * p;
+						detail::fft_butterfly(stage, xr + x_offset, xi + x_offset, x_stride, yr + y_offset, yi + y_offset, len
+							, &stage.twiddles[size_t(p) * twiddle_count], len, level);
+					}
+					std::swap(xr, yr);
+					std::swap(xi, yi);
+				}
+				if (xr != re)
+				{
+					std::copy(xr, xr + size_t(n) * lanes, re);
+					std::copy(xi, xi + size_t(n) * lanes, im);
+				}
+			}
+
+		private:
+			int n;
+			std::vector<detail::fft_stage> stages;
+		};
+
+		// Plans keyed by length, shared by every transform of that length. Safe to call from several threads.
+		class fft_plan_cache
+		{
+		public:
+			std::shared_ptr<const fft_radix_plan> get(int n)
+			{
+				{
+					std::lock_guard<std::mutex> guard(mutex);
+					auto it = plans.find(n);
+					if (it != plans.end())
+					{
+						return it->second;
+					}
+				}
+				std::shared_ptr<const fft_radix_plan> plan = std::make_shared<const fft_radix_plan>(n);
+				std::lock_guard<std::mutex> guard(mutex);
+				return plans.emplace(n, plan).first->second;
+			}
+
+			size_t size() const
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				return plans.size();
+			}
+
+			void clear()
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				plans.clear();
+			}
+
+		private:
+			mutable std::mutex mutex;
+			std::map<int, std::shared_ptr<const fft_radix_plan>> plans;
+		};
+
+		inline fft_plan_cache& default_fft_plan_cache()
+		{
+			static fft_plan_cache cache;
+			return cache;
+		}
+
+		namespace detail
+		{
+			// Transforms of one axis of an interleaved complex array: sequence (o, i) starts at o * outer_step + i,
+			// for o < outer and i < inner, and its elements are step apart. Batches of fft_lanes sequences run on the pool.
+			// The inverse transform is conj(fft(conj(x))), scale multiplies the result.
+			inline void fft_axis(thread_pool& pool, std::complex<float>* data, int n, ptrdiff_t step, int outer, ptrdiff_t outer_step, int inner
+				, bool inverse, float scale)
+			{
+				if (n <= 1 && scale == 1.0f)
+				{
+					return;
+				}
+				std::shared_ptr<const fft_radix_plan> plan = default_fft_plan_cache().get(n);
+				const simd_level level = active_simd_level();
+				const long long count = (long long)outer * inner;
+				const int batches = int((count + fft_lanes - 1) / fft_lanes);
+				const float sign = inverse ? -1.0f : 1.0f;
+				pool.parallel_for(0, batches, 1, [&](int first, int last)
+				{
+					std::vector<float> buffer(size_t(n) * fft_lanes * 4);
+					float* re = buffer.data();
+					float* im = re + size_t(n) * fft_lanes;
+					float* work_re = im + size_t(n) * fft_lanes;
+					float* work_im = work_re + size_t(n) * fft_lanes;
+					ptrdiff_t bases[fft_lanes];
+					for (int b = first; b < last; b++)
+					{
+						const long long t0 = (long long)b * fft_lanes;
+						const int lanes = int(std::min<long long>(fft_lanes, count - t0));
+						for (int l = 0; l < lanes; l++)
+						{
+							bases[l] = ptrdiff_t((t0 + l) / inner) * outer_step + ptrdiff_t((t0 + l) % inner);
+						}
+						for (int j = 0; j < n; j++)
+						{
+							for (int l = 0; l < lanes; l++)
+							{
+								const std::complex<float> value = data[bases[l] + j * step];
+								re[j * lanes + l] = value.real();
+								im[j * lanes + l] = sign * value.imag();
+							}
+						}
+						plan->execute(re, im, work_re, work_im, lanes, level);
+						for (int j = 0; j < n; j++)
+						{
+							for (int l = 0; l < lanes; l++)
+							{
+								data[bases[l] + j * step] = std::complex<float>(scale * re[j * lanes + l], sign * scale * im[j * lanes + l]);
+							}
+						}
+					}
+				});
+			}
+		}
+
+		// In-place complex transform over every axis of a row-major array of dims[0] x dims[1] x ...
+		inline void fft_complex_nd(thread_pool& pool, std::complex<float>* data, const int* dims, int dim_count, bool inverse, float scale = 1.0f)
+		{
+			ptrdiff_t total = 1;
+			for (int d = 0; d < dim_count; d++)
+			{
+				total *= dims[d];
+			}
+			ptrdiff_t inner = total;
+			for (int d = 0; d < dim_count; d++)
+			{
+				inner /= dims[d];
+				const int outer = int(total / (inner * dims[d]));
+				detail::fft_axis(pool, data, dims[d], inner, outer, inner * dims[d], int(inner), inverse, d + 1 == dim_count ? scale : 1.0f);
+			}
+		}
+
+		// In-place complex 2D transform of a plane
+		inline void fft_complex_2d(thread_pool& pool, plane_view<std::complex<float>> data, bool inverse, float scale = 1.0f)
+		{
+			detail::fft_axis(pool, data.data, data.cols, 1, data.rows, data.step, 1, inverse, 1.0f);
+			detail::fft_axis(pool, data.data, data.rows, data.step, 1, 0, data.cols, inverse, scale);
+		}
+
+		// Real 2D transform: half receives the rows x fft_half_cols(cols) non-redundant half of the spectrum,
+		// the rest is conj(half(-r, -c)). Two real rows are transformed as one complex row and split afterwards.
+		inline void fft_forward_r2c_2d(thread_pool& pool, plane_view<const float> src, plane_view<std::complex<float>> half, float scale = 1.0f)
+		{
+			const int rows = src.rows;
+			const int cols = src.cols;
+			const int half_cols = fft_half_cols(cols);
+			if (half.rows != rows || half.cols != half_cols)
+			{
+				throw std::runtime_error("fft_forward_r2c_2d needs a rows x (cols / 2 + 1) spectrum");
+			}
+			std::shared_ptr<const fft_radix_plan> plan = default_fft_plan_cache().get(cols);
+			const simd_level level = active_simd_level();
+			const int lanes_rows = detail::fft_lanes * 2;
+			pool.parallel_for(0, (rows + lanes_rows - 1) / lanes_rows, 1, [&](int first, int last)
+			{
+				const int lanes = detail::fft_lanes;
+				std::vector<float> buffer(size_t(cols) * lanes * 4);
+				float* re = buffer.data();
+				float* im = re + size_t(cols) * lanes;
+				float* work_re = im + size_t(cols) * lanes;
+				float* work_im = work_re + size_t(cols) * lanes;
+				for (int b = first; b < last; b++)
+				{
+					const int row0 = b * lanes_rows;
+					for (int l = 0; l < lanes; l++)
+					{
+						const int row_a = row0 + 2 * l, row_b = row_a + 1;
+						const float* a = row_a < rows ? src.row(row_a) : nullptr;
+						const float* c = row_b < rows ? src.row(row_b) : nullptr;
+						for (int j = 0; j < cols; j++)
+						{
+							re[j * lanes + l] = a ? a[j] : 0.0f;
+							im[j * lanes + l] = c ? c[j] : 0.0f;
+						}
+					}
+					plan->execute(re, im, work_re, work_im, lanes, level);
+					// A = (Z(k) + conj(Z(-k))) / 2, B = (Z(k) - conj(Z(-k))) / 2i
+					const float half_scale = 0.5f * scale;
+					for (int l = 0; l < lanes; l++)
+					{
+						const int row_a = row0 + 2 * l, row_b = row_a + 1;
+						if (row_a >= rows)
+						{
+							break;
+						}
+						std::complex<float>* a = half.row(row_a);
+						std::complex<float>* c = row_b < rows ? half.row(row_b) : nullptr;
+						for (int k = 0; k < half_cols; k++)
+						{
+							const int nk = k == 0 ? 0 : cols - k;
+							const float zr = re[k * lanes + l], zi = im[k * lanes + l];
+							const float wr = re[nk * lanes + l], wi = im[nk * lanes + l];
+							a[k] = std::complex<float>(half_scale * (zr + wr), half_scale * (zi - wi));
+							if (c)
+							{
+								c[k] = std::complex<float>(half_scale * (zi + wi), half_scale * (wr - zr));
+							}
+						}
+					}
+				}
+			});
+			detail::fft_axis(pool, half.data, rows, half.step, 1, 0, half_cols, false, 1.0f);
+		}
+
+		// Inverse of fft_forward_r2c_2d, dest is rows x cols; half is left unchanged
+		inline void fft_inverse_c2r_2d(thread_pool& pool, plane_view<const std::complex<float>> half, plane_view<float> dest, float scale = 1.0f)
+		{
+			const int rows = dest.rows;
+			const int cols = dest.cols;
+			const int half_cols = fft_half_cols(cols);
+			if (half.rows != rows || half.cols != half_cols)
+			{
+				throw std::runtime_error("fft_inverse_c2r_2d needs a rows x (cols / 2 + 1) spectrum");
+			}
+			plane<std::complex<float>> columns(rows, half_cols);
+			copy<std::complex<float>>(pool, half, columns);
+			detail::fft_axis(pool, columns.view().data, rows, columns.step, 1, 0, half_cols, true, 1.0f);
+			plane_view<const std::complex<float>> spectrum = columns.view();
+			std::shared_ptr<const fft_radix_plan> plan = default_fft_plan_cache().get(cols);
+			const simd_level level = active_simd_level();
+			const int lanes_rows = detail::fft_lanes * 2;
+			pool.parallel_for(0, (rows + lanes_rows - 1) / lanes_rows, 1, [&](int first, int last)
+			{
+				const int lanes = detail::fft_lanes;
+				std::vector<float> buffer(size_t(cols) * lanes * 4);
+				float* re = buffer.data();
+				float* im = re + size_t(cols) * lanes;
+				float* work_re = im + size_t(cols) * lanes;
+				float* work_im = work_re + size_t(cols) * lanes;
+				for (int b = first; b < last; b++)
+				{
+					const int row0 = b * lanes_rows;
+					// Z = A + i B over the full row, conjugated for the inverse
+					for (int l = 0; l < lanes; l++)
+					{
+						const int row_a = row0 + 2 * l, row_b = row_a + 1;
+						const std::complex<float>* a = row_a < rows ? spectrum.row(row_a) : nullptr;
+						const std::complex<float>* c = row_b < rows ? spectrum.row(row_b) : nullptr;
+						for (int k = 0; k < cols; k++)
+						{
+							const bool mirrored = k >= half_cols;
+							const int hk = mirrored ? cols - k : k;
+							std::complex<float> av = a ? a[hk] : std::complex<float>();
+							std::complex<float> cv = c ? c[hk] : std::complex<float>();
+							if (mirrored)
+							{
+								av = std::conj(av);
+								cv = std::conj(cv);
+							}
+							re[k * lanes + l] = av.real() - cv.imag();
+							im[k * lanes + l] = -(av.imag() + cv.real());
+						}
+					}
+					plan->execute(re, im, work_re, work_im, lanes, level);
+					for (int l = 0; l < lanes; l++)
+					{
+						const int row_a = row0 + 2 * l, row_b = row_a + 1;
+						if (row_a >= rows)
+						{
+							break;
+						}
+						float* a = dest.row(row_a);
+						float* c = row_b < rows ? dest.row(row_b) : nullptr;
+						for (int j = 0; j < cols; j++)
+						{
+							a[j] = scale * re[j * lanes + l];
+							if (c)
+							{
+								c[j] = -scale * im[j * lanes + l];
+							}
+						}
+					}
+				}
+			});
+		}
+
+		// dest = a * b, or a * conj(b) for correlation, over spectra of one size
+		inline void multiply_spectrums(thread_pool& pool, plane_view<const std::complex<float>> a, plane_view<const std::complex<float>> b
+			, plane_view<std::complex<float>> dest, bool conj_b = false)
+		{
+			pool.parallel_for(0, dest.rows, 16, [&](int first, int last)
+			{
+				for (int r = first; r < last; r++)
+				{
+					const std::complex<float>* a_row = a.row(r);
+					const std::complex<float>* b_row = b.row(r);
+					std::complex<float>* dest_row = dest.row(r);
+					for (int c = 0; c < dest.cols; c++)
+					{
+						const float ar = a_row[c].real(), ai = a_row[c].imag();
+						const float br = b_row[c].real(), bi = conj_b ? -b_row[c].imag() : b_row[c].imag();
+						dest_row[c] = std::complex<float>(ar * br - ai * bi, ar * bi + ai * br);
+					}
+				}
+			});
+		}
+	}
+}
@@ -5,6 +5,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Delete Border Components
 	inline void delete_border_components_32f_c1(accelerator_view acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array
 		, array_view<float, 2> temp_array)
@@ -28,5 +29,41 @@ namespace amp
 			}
 		});
 	}
+#endif
 
-}
\ No newline at end of file
+	inline void delete_border_components_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, cpu::plane_view<float> temp_array)
+	{
+		const int rows = src_array.rows;
+		const int cols = src_array.cols;
+		// 1.marker: the image border
+		cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+		{
+			for(int y = row_first; y < row_last; y++)
+			{
+				const float* src_row = src_array.row(y);
+				float* dest_row = dest_array.row(y);
+				const bool edge_row = y == 0 || y == rows - 1;
+				for(int x = 0; x < cols; x++)
+				{
+					dest_row[x] = (edge_row || x == 0 || x == cols - 1) ? src_row[x] : 0.0f;
+				}
+			}
+		});
+		// 2.reconstruct
+		geodesic_dilate_32f_c1(pool, dest_array, src_array, temp_array);
+		// 3.subtract
+		cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+		{
+			for(int y = row_first; y < row_last; y++)
+			{
+				const float* src_row = src_array.row(y);
+				float* dest_row = dest_array.row(y);
+				for(int x = 0; x < cols; x++)
+				{
+					dest_row[x] = src_row[x] - dest_row[x];
+				}
+			}
+		});
+	}
+}
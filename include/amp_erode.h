@@ -1,9 +1,11 @@
 ﻿#pragma once
 
 #include "amp_core.h"
+#include "amp_morph_rect.h"
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Erode
 	template<unsigned int kernel_size>
 	inline void erode_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array
@@ -320,9 +322,31 @@ namespace amp
 		}
 	}
 
+	// Rectangular structuring element of any size, the cost per pixel doesn't depend on the size
+	inline void erode_rect_32f_c1(accelerator_view& acc_view, buffer_pool& buffers, array_view<const float, 2> src_array, array_view<float, 2> dest_array
+		, array_view<float, 2> temp_array, int kernel_rows, int kernel_cols)
+	{
+		detail::morph_rect<false>(acc_view, buffers, src_array, dest_array, temp_array, kernel_rows, kernel_cols, kernel_rows / 2, kernel_cols / 2);
+	}
+
+	inline void erode_rect_32f_c1(vision_context& ctx, array_view<const float, 2> src_array, array_view<float, 2> dest_array
+		, array_view<float, 2> temp_array, int kernel_rows, int kernel_cols)
+	{
+		erode_rect_32f_c1(ctx.acc_view, ctx.buffers, src_array, dest_array, temp_array, kernel_rows, kernel_cols);
+	}
+
 	inline void erode_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array, array_view<float, 2> temp_array
 		, const cv::Mat& kernel, int iterations = 1)
 	{
+		if (kernel.rows * kernel.cols > 25 && detail::is_rect_kernel(kernel))
+		{
+			// larger than the tile_static paths, n iterations of a rectangle are one rectangle n * (size - 1) + 1 wide anchored at n * anchor
+			buffer_pool buffers(acc_view);
+			const int n = std::max(iterations, 1);
+			detail::morph_rect<false>(acc_view, buffers, src_array, dest_array, temp_array, n * (kernel.rows - 1) + 1, n * (kernel.cols - 1) + 1
+				, n * (kernel.rows / 2), n * (kernel.cols / 2));
+			return;
+		}
 		kernel_wrapper<float, 169U> wrapped_kernel(kernel);
 		if (iterations <= 1)
 		{
@@ -352,5 +376,227 @@ namespace amp
 			}
 		}
 	}
+#endif
+
+	// CPU backend
+	template<unsigned int kernel_size>
+	inline void erode_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, const kernel_wrapper<float, kernel_size>& kernel)
+	{
+		static const int tile_size = 32;
+		static const int max_1d_tile_static_size = tile_size * tile_size * 2;
+		assert((tile_size + (kernel.cols & ~1)) * (tile_size + (kernel.rows & ~1)) <= max_1d_tile_static_size);
+		const int rows = src_array.rows;
+		const int cols = src_array.cols;
+		if (!kernel.is_all_positive())
+		{
+			cpu::parallel_for_each<tile_size, tile_size>(pool, rows, cols, [&](const cpu::tile<tile_size, tile_size>& t)
+			{
+				float data[max_1d_tile_static_size];
+				const int tile_static_rows = tile_size + (kernel.rows & ~1);
+				const int tile_static_cols = tile_size + (kernel.cols & ~1);
+				const int dx = t.origin[0] - kernel.rows / 2;
+				const int dy = t.origin[1] - kernel.cols / 2;
+				for (int i = 0; i < tile_static_rows * tile_static_cols; i++)
+				{
+					data[i] = cpu::guarded_read(src_array, dx + i / tile_static_cols, dy + i % tile_static_cols, FLT_MAX);
+				}
+
+				t.for_each_local([&](const cpu::tiled_index& idx)
+				{
+					float result = FLT_MAX;
+					for (int i = 0; i < kernel.rows; i++)
+					{
+						for (int j = 0; j < kernel.cols; j++)
+						{
+							if (kernel.data[i * kernel.cols + j] > 0.0f)
+							{
+								result = std::min(result, data[(idx.local[0] + i) * tile_static_cols + idx.local[1] + j]);
+							}
+						}
+					}
+					cpu::guarded_write(dest_array, idx.global[0], idx.global[1], result);
+				});
+			});
+		}
+		else
+		{
+			detail::morph_rect<false, float>(pool, src_array, dest_array, kernel.rows, kernel.cols, kernel.rows / 2, kernel.cols / 2);
+		}
+	}
+
+	// Rectangular structuring element of any size(van Herk/Gil-Werman), the cost per pixel doesn't depend on the size
+	inline void erode_rect_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, int kernel_rows, int kernel_cols)
+	{
+		detail::morph_rect<false, float>(pool, src_array, dest_array, kernel_rows, kernel_cols, kernel_rows / 2, kernel_cols / 2);
+	}
+
+	inline void erode_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array, cpu::plane_view<float> temp_array
+		, const cv::Mat& kernel, int iterations = 1)
+	{
+		if (detail::is_rect_kernel(kernel))
+		{
+			// n iterations of a rectangle are one rectangle n * (size - 1) + 1 wide anchored at n * anchor
+			const int n = std::max(iterations, 1);
+			detail::morph_rect<false, float>(pool, src_array, dest_array, n * (kernel.rows - 1) + 1, n * (kernel.cols - 1) + 1
+				, n * (kernel.rows / 2), n * (kernel.cols / 2));
+			return;
+		}
+		kernel_wrapper<float, 169U> wrapped_kernel(kernel);
+		if (iterations <= 1)
+		{
+			erode_32f_c1(pool, src_array, dest_array, wrapped_kernel);
+		}
+		else
+		{
+			if (iterations % 2 == 0)
+			{
+				cpu::copy<float>(pool, src_array, dest_array);
+				while (iterations > 0)
+				{
+					erode_32f_c1(pool, dest_array, temp_array, wrapped_kernel);
+					erode_32f_c1(pool, temp_array, dest_array, wrapped_kernel);
+					iterations -= 2;
+				}
+			}
+			else
+			{
+				erode_32f_c1(pool, src_array, dest_array, wrapped_kernel);
+				while (--iterations > 0)
+				{
+					erode_32f_c1(pool, dest_array, temp_array, wrapped_kernel);
+					erode_32f_c1(pool, temp_array, dest_array, wrapped_kernel);
+					--iterations;
+				}
+			}
+		}
+	}
+
+	namespace detail
+	{
+		// 8u/16u erode with packed min over whole rows, pixels outside the image don't take part
+		template<typename value_type, unsigned int kernel_size>
+		inline void erode_packed(cpu::thread_pool& pool, cpu::plane_view<const value_type> src_array, cpu::plane_view<value_type> dest_array
+			, const kernel_wrapper<float, kernel_size>& kernel)
+		{
+			const value_type border = std::numeric_limits<value_type>::max();
+			const cpu::simd_level level = cpu::active_simd_level();
+			const int rows = src_array.rows;
+			const int cols = src_array.cols;
+			const int anchor_row = kernel.rows / 2;
+			const int anchor_col = kernel.cols / 2;
+			if (kernel.is_all_positive())
+			{
+				morph_rect<false, value_type>(pool, src_array, dest_array, kernel.rows, kernel.cols, kernel.rows / 2, kernel.cols / 2);
+				return;
+			}
+			cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+			{
+				// a source row with anchor_col border pixels in front, kernel column j reads padded[c + j]
+				std::vector<value_type> padded(cols + kernel.cols - 1);
+				for (int r = row_first; r < row_last; r++)
+				{
+					value_type* dest_row = dest_array.row(r);
+					std::fill(padded.begin(), padded.end(), border);
+					std::fill(dest_row, dest_row + cols, border);
+					for (int i = 0; i < kernel.rows; i++)
+					{
+						int src_row = r - anchor_row + i;
+						if (src_row < 0 || src_row >= rows)
+							continue;
+						std::copy(src_array.row(src_row), src_array.row(src_row) + cols, &padded[anchor_col]);
+						for (int j = 0; j < kernel.cols; j++)
+						{
+							if (kernel.data[i * kernel.cols + j] > 0.0f)
+							{
+								cpu::min_row(dest_row, &padded[j], dest_row, cols, level);
+							}
+						}
+					}
+				}
+			});
+		}
+
+		template<typename value_type>
+		inline void erode_packed(cpu::thread_pool& pool, cpu::plane_view<const value_type> src_array, cpu::plane_view<value_type> dest_array, cpu::plane_view<value_type> temp_array
+			, const cv::Mat& kernel, int iterations)
+		{
+			if (is_rect_kernel(kernel))
+			{
+				const int n = std::max(iterations, 1);
+				morph_rect<false, value_type>(pool, src_array, dest_array, n * (kernel.rows - 1) + 1, n * (kernel.cols - 1) + 1
+					, n * (kernel.rows / 2), n * (kernel.cols / 2));
+				return;
+			}
+			kernel_wrapper<float, 169U> wrapped_kernel(kernel);
+			if (iterations <= 1)
+			{
+				erode_packed(pool, src_array, dest_array, wrapped_kernel);
+			}
+			else
+			{
+				if (iterations % 2 == 0)
+				{
+					cpu::copy<value_type>(pool, src_array, dest_array);
+					while (iterations > 0)
+					{
+						erode_packed<value_type>(pool, dest_array, temp_array, wrapped_kernel);
+						erode_packed<value_type>(pool, temp_array, dest_array, wrapped_kernel);
+						iterations -= 2;
+					}
+				}
+				else
+				{
+					erode_packed(pool, src_array, dest_array, wrapped_kernel);
+					while (--iterations > 0)
+					{
+						erode_packed<value_type>(pool, dest_array, temp_array, wrapped_kernel);
+						erode_packed<value_type>(pool, temp_array, dest_array, wrapped_kernel);
+						--iterations;
+					}
+				}
+			}
+		}
+	}
+
+	// 8-bit and 16-bit planes, binary masks take a quarter of the float bandwidth
+	inline void erode_rect_8u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array, cpu::plane_view<unsigned char> dest_array
+		, int kernel_rows, int kernel_cols)
+	{
+		detail::morph_rect<false, unsigned char>(pool, src_array, dest_array, kernel_rows, kernel_cols, kernel_rows / 2, kernel_cols / 2);
+	}
+
+	inline void erode_rect_16u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned short> src_array, cpu::plane_view<unsigned short> dest_array
+		, int kernel_rows, int kernel_cols)
+	{
+		detail::morph_rect<false, unsigned short>(pool, src_array, dest_array, kernel_rows, kernel_cols, kernel_rows / 2, kernel_cols / 2);
+	}
+
+	template<unsigned int kernel_size>
+	inline void erode_8u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array, cpu::plane_view<unsigned char> dest_array
+		, const kernel_wrapper<float, kernel_size>& kernel)
+	{
+		detail::erode_packed(pool, src_array, dest_array, kernel);
+	}
+
+	inline void erode_8u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array, cpu::plane_view<unsigned char> dest_array, cpu::plane_view<unsigned char> temp_array
+		, const cv::Mat& kernel, int iterations = 1)
+	{
+		detail::erode_packed(pool, src_array, dest_array, temp_array, kernel, iterations);
+	}
+
+	template<unsigned int kernel_size>
+	inline void erode_16u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned short> src_array, cpu::plane_view<unsigned short> dest_array
+		, const kernel_wrapper<float, kernel_size>& kernel)
+	{
+		detail::erode_packed(pool, src_array, dest_array, kernel);
+	}
+
+	inline void erode_16u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned short> src_array, cpu::plane_view<unsigned short> dest_array, cpu::plane_view<unsigned short> temp_array
+		, const cv::Mat& kernel, int iterations = 1)
+	{
+		detail::erode_packed(pool, src_array, dest_array, temp_array, kernel, iterations);
+	}
 
 }
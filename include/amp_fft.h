@@ -2,17 +2,17 @@
 //--------------------------------------------------------------------------------------
 // File: amp_fft.h
 //
-// Header file for the C++ AMP wrapper over the Direct3D FFT API's.
+// FFT transforms over C++ AMP arrays. The transforms run on the native engine of
+// amp_cpu_fft.h, so no Direct3D FFT runtime is needed.
 //
 // Copyright (c) Microsoft Corporation. All rights reserved.
 //--------------------------------------------------------------------------------------
 
-#include <d3d11.h>
-#include <wrl\client.h>
-#include <d3dcsx.h>
-#pragma comment(lib, "d3dcsx")
 #include "amp_core.h"
+#include "amp_cpu_fft.h"
+#if AMP_HAS_CPP_AMP
 #include "amp_copy_make_border.h"
+#endif
 
 namespace amp
 {
@@ -23,13 +23,13 @@ namespace amp
 	class fft_exception : public std::exception
 	{
 	public:
-		explicit fft_exception(HRESULT error_code) throw()
+		explicit fft_exception(long error_code) throw()
 			: err_code(error_code) {}
 
-		fft_exception(const char *const& msg, HRESULT error_code) throw()
+		fft_exception(const char *const& msg, long error_code) throw()
 			: err_msg(msg), err_code(error_code) {}
 
-		fft_exception(const std::string& msg, HRESULT error_code) throw()
+		fft_exception(const std::string& msg, long error_code) throw()
 			: err_msg(msg), err_code(error_code) {}
 
 		fft_exception(const fft_exception &other) throw()
@@ -37,7 +37,7 @@ namespace amp
 
 		virtual ~fft_exception() throw() {}
 
-		HRESULT get_error_code() const throw()
+		long get_error_code() const throw()
 		{
 			return err_code;
 		}
@@ -50,285 +50,177 @@ namespace amp
 	private:
 		fft_exception &operator=(const fft_exception &);
 		std::string err_msg;
-		HRESULT err_code;
+		long err_code;
 	};
 
 	//--------------------------------------------------------------------------------------
-	// Implementation details, amp_fft.cpp contains the implementation for the functions
-	// declared in this namespace. 
+	// Implementation details
 	//--------------------------------------------------------------------------------------
 	namespace _details
 	{
+		// E_INVALIDARG, the code the Direct3D FFT used to report
+		static const long fft_invalid_arg = -2147024809L;
+
 		template <typename _Type>
-		struct dx_fft_type_helper
+		struct fft_type_helper
 		{
 			static const bool is_type_supported = false;
 		};
 
 		template <>
-		struct dx_fft_type_helper < float >
+		struct fft_type_helper < float >
 		{
 			static const bool is_type_supported = true;
+			static const bool is_complex = false;
 			typedef float precision_type;
-			static const D3DX11_FFT_DATA_TYPE dx_type = D3DX11_FFT_DATA_TYPE_REAL;
 		};
 
 		template <>
-		struct dx_fft_type_helper < std::complex<float> >
+		struct fft_type_helper < std::complex<float> >
 		{
 			static const bool is_type_supported = true;
+			static const bool is_complex = true;
 			typedef float precision_type;
-			static const D3DX11_FFT_DATA_TYPE dx_type = D3DX11_FFT_DATA_TYPE_COMPLEX;
 		};
 
+		// Scales and host transforms over row-major buffers of the whole extent.
+		// Defaults follow the Direct3D FFT: forward scale 1, inverse scale 1 / element count.
 		class fft_base
 		{
 		public:
 			void set_forward_scale(float scale)
 			{
 				if(scale == 0.0f)
-					throw fft_exception("Invalid scale value in set_forward_scale", E_INVALIDARG);
-
-				HRESULT hr = _M_pFFT->SetForwardScale(scale);
-				if(FAILED(hr)) throw fft_exception("set_forward_scale failed", hr);
+					throw fft_exception("Invalid scale value in set_forward_scale", fft_invalid_arg);
+				_M_Forward_scale = scale;
 			}
 
 			float get_forward_scale() const
 			{
-				return _M_pFFT->GetForwardScale();
+				return _M_Forward_scale;
 			}
 
 			void set_inverse_scale(float scale)
 			{
 				if(scale == 0.0f)
-					throw fft_exception("Invalid scale value in set_inverse_scale", E_INVALIDARG);
-
-				HRESULT hr = _M_pFFT->SetInverseScale(scale);
-				if(FAILED(hr)) throw fft_exception("set_inverse_scale failed", hr);
+					throw fft_exception("Invalid scale value in set_inverse_scale", fft_invalid_arg);
+				_M_Inverse_scale = scale;
 			}
 
 			float get_inverse_scale() const
 			{
-				return _M_pFFT->GetInverseScale();
+				return _M_Inverse_scale;
 			}
 
 		protected:
-			fft_base(D3DX11_FFT_DATA_TYPE _Dx_type, int _Dim, const int* _Transform_extent, const concurrency::accelerator_view& _Av, float _Forward_scale, float _Inverse_scale)
+			fft_base(int _Dim, const int* _Transform_extent, float _Forward_scale, float _Inverse_scale)
+				: _M_Dims(_Transform_extent, _Transform_extent + _Dim), _M_Total_size(1)
 			{
-				HRESULT hr = S_OK;
-
-				// Get a device context
-				IUnknown *u = concurrency::direct3d::get_device(_Av);
-				_ASSERTE(_M_pDevice.Get() == nullptr);
-				u->QueryInterface(__uuidof(ID3D11Device), reinterpret_cast<void**>(_M_pDevice.GetAddressOf()));
-				_ASSERTE(_M_pDeviceContext.Get() == nullptr);
-				_M_pDevice->GetImmediateContext(_M_pDeviceContext.GetAddressOf());
-				u->Release();
-
-				_M_dx_type = _Dx_type;
-
-				// Create an FFT interface and get buffer into
-				UINT totalElementSize = 1;
-				D3DX11_FFT_BUFFER_INFO fft_buffer_info;
+				for(int i = 0; i < _Dim; i++)
 				{
-					D3DX11_FFT_DESC fft_desc;
-					ZeroMemory(&fft_desc, sizeof(fft_desc));
-					fft_desc.NumDimensions = _Dim;
-					for(int i = 0; i < _Dim; i++)
-					{
-						totalElementSize *= _Transform_extent[i];
-						fft_desc.ElementLengths[_Dim - 1 - i] = _Transform_extent[i];
-					}
-					fft_desc.DimensionMask = (1 << _Dim) - 1;
-					fft_desc.Type = _Dx_type;
-					ZeroMemory(&fft_buffer_info, sizeof(fft_buffer_info));
-					HRESULT hr = D3DX11CreateFFT(_M_pDeviceContext.Get(), &fft_desc, 0, &fft_buffer_info, _M_pFFT.GetAddressOf());
-					if(FAILED(hr)) throw fft_exception("Failed in fft constructor", hr);
-
-					if(_Forward_scale != 0.0f)
-						set_forward_scale(_Forward_scale);
-
-					if(_Inverse_scale != 0.0f)
-						set_inverse_scale(_Inverse_scale);
-				}
-
-				// Make sure we have at least two buffers that are big enough for input/output
-				if(fft_buffer_info.NumTempBufferSizes < 2)
-				{
-					for(UINT i = fft_buffer_info.NumTempBufferSizes; i < 2; i++)
-					{
-						fft_buffer_info.NumTempBufferSizes = 0;
-					}
-					fft_buffer_info.NumTempBufferSizes = 2;
-				}
-				UINT elementFloatSize = (_Dx_type == D3DX11_FFT_DATA_TYPE_COMPLEX) ? 2 : 1;
-				_M_Total_float_size = totalElementSize * elementFloatSize;
-				for(UINT i = 0; i < 2; i++)
-				{
-					if(fft_buffer_info.TempBufferFloatSizes[i] < _M_Total_float_size)
-						fft_buffer_info.TempBufferFloatSizes[i] = _M_Total_float_size;
+					if(_Transform_extent[i] < 1)
+						throw fft_exception("Failed in fft constructor, extents must be positive", fft_invalid_arg);
+					_M_Total_size *= _Transform_extent[i];
+					// build the plans up front
+					cpu::default_fft_plan_cache().get(_Transform_extent[i]);
 				}
+				_M_Forward_scale = 1.0f;
+				_M_Inverse_scale = float(1.0 / double(_M_Total_size));
+				if(_Forward_scale != 0.0f)
+					set_forward_scale(_Forward_scale);
+				if(_Inverse_scale != 0.0f)
+					set_inverse_scale(_Inverse_scale);
+			}
 
-				ID3D11UnorderedAccessView *tempUAVs[D3DX11_FFT_MAX_TEMP_BUFFERS] = { 0 };
-				ID3D11UnorderedAccessView *precomputeUAVs[D3DX11_FFT_MAX_PRECOMPUTE_BUFFERS] = { 0 };
+			size_t total_size() const
+			{
+				return _M_Total_size;
+			}
 
-				// Allocate temp and pre-computed buffers
-				for(UINT i = 0; i < fft_buffer_info.NumTempBufferSizes; i++)
+			// full spectrum of real input. One and two dimensions go through the real transform and
+			// fill the other half of the spectrum by symmetry, three dimensions use the complex transform.
+			void base_forward(const float* input, std::complex<float>* output) const
+			{
+				cpu::thread_pool& pool = cpu::default_thread_pool();
+				if(_M_Dims.size() <= 2)
 				{
-					Microsoft::WRL::ComPtr<ID3D11Buffer> pBuffer;
-					_ASSERTE(_M_pTempUAVs[i].Get() == nullptr);
-					hr = create_raw_buffer_and_uav(fft_buffer_info.TempBufferFloatSizes[i], pBuffer.GetAddressOf(), _M_pTempUAVs[i].GetAddressOf());
-					tempUAVs[i] = _M_pTempUAVs[i].Get();
-
-					if(FAILED(hr)) goto cleanup;
+					const int rows = _M_Dims.size() == 2 ? _M_Dims[0] : 1;
+					const int cols = _M_Dims.back();
+					const int half_cols = cpu::fft_half_cols(cols);
+					cpu::plane<std::complex<float>> half(rows, half_cols);
+					cpu::fft_forward_r2c_2d(pool, cpu::plane_view<const float>(input, rows, cols), half, _M_Forward_scale);
+					cpu::plane_view<const std::complex<float>> half_view = half.view();
+					pool.parallel_for(0, rows, 16, [&](int first, int last)
+					{
+						for(int r = first; r < last; r++)
+						{
+							const std::complex<float>* half_row = half_view.row(r);
+							const std::complex<float>* mirror_row = half_view.row(r == 0 ? 0 : rows - r);
+							std::complex<float>* output_row = output + size_t(r) * cols;
+							std::copy(half_row, half_row + half_cols, output_row);
+							for(int c = half_cols; c < cols; c++)
+							{
+								output_row[c] = std::conj(mirror_row[cols - c]);
+							}
+						}
+					});
 				}
-
-				for(UINT i = 0; i < fft_buffer_info.NumPrecomputeBufferSizes; i++)
+				else
 				{
-					Microsoft::WRL::ComPtr<ID3D11Buffer> pBuffer;
-					_ASSERTE(_M_pPrecomputeUAVs[i].Get() == nullptr);
-					hr = create_raw_buffer_and_uav(fft_buffer_info.PrecomputeBufferFloatSizes[i], pBuffer.GetAddressOf(), _M_pPrecomputeUAVs[i].GetAddressOf());
-					precomputeUAVs[i] = _M_pPrecomputeUAVs[i].Get();
-
-					if(FAILED(hr)) goto cleanup;
+					std::transform(input, input + _M_Total_size, output, [](float value) { return std::complex<float>(value); });
+					cpu::fft_complex_nd(pool, output, _M_Dims.data(), int(_M_Dims.size()), false, _M_Forward_scale);
 				}
-
-				// Attach buffers and precompute
-
-				hr = _M_pFFT->AttachBuffersAndPrecompute(
-					fft_buffer_info.NumTempBufferSizes,
-					&tempUAVs[0],
-					fft_buffer_info.NumPrecomputeBufferSizes,
-					&precomputeUAVs[0]);
-				if(FAILED(hr)) goto cleanup;
-
-			cleanup:
-				if(FAILED(hr)) throw fft_exception("Failed in fft constructor", hr);
 			}
 
-			HRESULT base_transform(bool _Forward, ID3D11Buffer *pBufferIn, ID3D11Buffer *pBufferOut) const
+			// real part of the inverse transform, one and two dimensions read the non-redundant half of the spectrum
+			void base_inverse(const std::complex<float>* input, float* output) const
 			{
-				HRESULT hr = S_OK;
-
-				UINT inputFloatSize = _M_Total_float_size;
-				UINT outputFloatSize = _M_Total_float_size;
-
-				// When processing real numbers, if it is forward transform
-				// then the output is twice the size of input as it produces
-				// complex data and for inverse transform, the input is complex
-				// data and hence twice the size of the output which are real numbers
-				if(_M_dx_type != D3DX11_FFT_DATA_TYPE_COMPLEX)
-				{
-					if(_Forward) {
-						outputFloatSize *= 2;
-					}
-					else {
-						inputFloatSize *= 2;
-					}
-				}
-
-				Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> pUAVIn, pUAVOut;
-
-				hr = create_uav(inputFloatSize, pBufferIn, pUAVIn.GetAddressOf());
-				if(FAILED(hr)) goto cleanup;
-
-				hr = create_uav(outputFloatSize, pBufferOut, pUAVOut.GetAddressOf());
-				if(FAILED(hr)) goto cleanup;
-
-				// Do the transform
-				if(_Forward)
+				cpu::thread_pool& pool = cpu::default_thread_pool();
+				if(_M_Dims.size() <= 2)
 				{
-					hr = _M_pFFT->ForwardTransform(pUAVIn.Get(), pUAVOut.GetAddressOf());
+					const int rows = _M_Dims.size() == 2 ? _M_Dims[0] : 1;
+					const int cols = _M_Dims.back();
+					cpu::plane_view<const std::complex<float>> half(input, rows, cpu::fft_half_cols(cols), cols);
+					cpu::fft_inverse_c2r_2d(pool, half, cpu::plane_view<float>(output, rows, cols), _M_Inverse_scale);
 				}
 				else
 				{
-					hr = _M_pFFT->InverseTransform(pUAVIn.Get(), pUAVOut.GetAddressOf());
+					std::vector<std::complex<float>> data(input, input + _M_Total_size);
+					cpu::fft_complex_nd(pool, data.data(), _M_Dims.data(), int(_M_Dims.size()), true, _M_Inverse_scale);
+					std::transform(data.begin(), data.end(), output, [](const std::complex<float>& value) { return value.real(); });
 				}
-				if(FAILED(hr)) goto cleanup;
-
-			cleanup:
-				return hr;
 			}
 
-		private:
-			HRESULT create_raw_buffer(UINT floatSize, ID3D11Buffer **ppBuffer) const
+			void base_forward(const std::complex<float>* input, std::complex<float>* output) const
 			{
-				D3D11_BUFFER_DESC desc;
-				ZeroMemory(&desc, sizeof(desc));
-				desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
-				desc.ByteWidth = floatSize * sizeof(float);
-				desc.CPUAccessFlags = 0;
-				desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
-				desc.Usage = D3D11_USAGE_DEFAULT;
-
-				return _M_pDevice->CreateBuffer(&desc, NULL, ppBuffer);
+				std::copy(input, input + _M_Total_size, output);
+				cpu::fft_complex_nd(cpu::default_thread_pool(), output, _M_Dims.data(), int(_M_Dims.size()), false, _M_Forward_scale);
 			}
 
-			HRESULT create_uav(UINT floatSize, ID3D11Buffer *ppBuffer, ID3D11UnorderedAccessView **ppUAV) const
+			void base_inverse(const std::complex<float>* input, std::complex<float>* output) const
 			{
-				D3D11_UNORDERED_ACCESS_VIEW_DESC UAVDesc;
-				ZeroMemory(&UAVDesc, sizeof(UAVDesc));
-				UAVDesc.Format = DXGI_FORMAT_R32_TYPELESS;
-				UAVDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
-				UAVDesc.Buffer.FirstElement = 0;
-				UAVDesc.Buffer.NumElements = floatSize;
-				UAVDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
-
-				return _M_pDevice->CreateUnorderedAccessView(ppBuffer, &UAVDesc, ppUAV);
+				std::copy(input, input + _M_Total_size, output);
+				cpu::fft_complex_nd(cpu::default_thread_pool(), output, _M_Dims.data(), int(_M_Dims.size()), true, _M_Inverse_scale);
 			}
 
-			HRESULT create_raw_buffer_and_uav(UINT floatSize, ID3D11Buffer **ppBuffer, ID3D11UnorderedAccessView **ppUAV) const
-			{
-				if(!ppBuffer || !ppUAV) return E_POINTER;
-				if(*ppBuffer || *ppUAV) return E_INVALIDARG;
-
-				HRESULT hr = S_OK;
-
-				hr = create_raw_buffer(floatSize, ppBuffer);
-				if(FAILED(hr)) goto cleanup;
-
-				hr = create_uav(floatSize, *ppBuffer, ppUAV);
-				if(FAILED(hr)) goto cleanup;
-
-			cleanup:
-				if(FAILED(hr))
-				{
-					if(*ppBuffer)
-					{
-						(*ppBuffer)->Release();
-						*ppBuffer = NULL;
-					}
-					if(*ppUAV)
-					{
-						(*ppUAV)->Release();
-						*ppUAV = NULL;
-					}
-				}
-				return hr;
-			}
-
-			UINT _M_Total_float_size;
-			D3DX11_FFT_DATA_TYPE _M_dx_type;
-			Microsoft::WRL::ComPtr<ID3D11Device> _M_pDevice;
-			Microsoft::WRL::ComPtr<ID3D11DeviceContext> _M_pDeviceContext;
-			Microsoft::WRL::ComPtr<ID3DX11FFT> _M_pFFT;
-			Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> _M_pTempUAVs[D3DX11_FFT_MAX_TEMP_BUFFERS];
-			Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> _M_pPrecomputeUAVs[D3DX11_FFT_MAX_PRECOMPUTE_BUFFERS];
+		private:
+			std::vector<int> _M_Dims;
+			size_t _M_Total_size;
+			float _M_Forward_scale;
+			float _M_Inverse_scale;
 		};
 	} // namespace _details
 
+#if AMP_HAS_CPP_AMP
 	//--------------------------------------------------------------------------------------
 	// class fft.
 	//
 	// This is the class which provides the FFT transformation functionality. At this point
-	// it exposes 1d, 2d and 3d transformations over floats or std::complex<float>, although
-	// Direct3D also provides the ability to transform higher dimensions, or be more 
-	// selective about which dimensions to transform. Such an extension is left for the 
-	// future or to the interested reader...
+	// it exposes 1d, 2d and 3d transformations over floats or std::complex<float>.
 	//
 	// After creating an instance, you can use forward_transform and backward_tranform to
-	// transform your data. The constructor initializes some internal data structures, so 
-	// it's beneficial to reuse the fft object as long as possible.
+	// transform your data. The constructor builds the plans of the extent, which are cached
+	// by length and shared with every other fft of the same lengths.
 	//
 	// Note that the dimensions (extent) of the fft and the extent of all input and output 
 	// arrays must be identical. If an array is used which has a different extent, an 
@@ -337,14 +229,9 @@ namespace amp
 	// The library supports arbitrary extents but best performance can be achieved for 
 	// powers of 2, followed by numbers whose prime factors are in the set {2,3,5}.
 	//
-	// Limitations:
-	//
-	//   -- You should only allocate one fft class per accelerator_view. If you need 
-	//      additional fft classes, create additional accelerator_view's first. This is a 
-	//      limitation of the Direct3D FFT API's.
-	//
-	//   -- Class fft is not thread safe. Or more accurately, the FFT API is not thread 
-	//      safe. So again, create additional fft objects such that each thread has its own.
+	// The transform runs on the host thread pool: the input array is copied to the host and
+	// the result copied back to the output array's accelerator. Transforms of one fft object
+	// may run from several threads at once.
 	//
 	//--------------------------------------------------------------------------------------
 	template <typename _Element_type, int _Dim>
@@ -352,26 +239,26 @@ namespace amp
 	{
 	private:
 		static_assert(_Dim >= 1 && _Dim <= 3, "class fft is only available for one, two or three dimensions");
-		static_assert(_details::dx_fft_type_helper<_Element_type>::is_type_supported, "class fft only supports element types float and std::complex<float>");
+		static_assert(_details::fft_type_helper<_Element_type>::is_type_supported, "class fft only supports element types float and std::complex<float>");
 
 	public:
 		//--------------------------------------------------------------------------------------
-		// Constructor. Throws fft_exception on failure.
+		// Constructor. Throws fft_exception on failure. The accelerator_view is kept for
+		// compatibility, results land on the output array's accelerator.
 		//--------------------------------------------------------------------------------------
 		fft(
 			concurrency::extent<_Dim> _Transform_extent,
 			const concurrency::accelerator_view& _Av = concurrency::accelerator().default_view,
 			float _Forward_scale = 0.0f,
 			float _Inverse_scale = 0.0f)
-			:extent(_Transform_extent),
-			fft_base(
-			_details::dx_fft_type_helper<_Element_type>::dx_type,
+			:fft_base(
 			_Dim,
 			&_Transform_extent[0],
-			_Av,
 			_Forward_scale,
-			_Inverse_scale)
+			_Inverse_scale),
+			extent(_Transform_extent)
 		{
+			(void)_Av;
 		}
 
 		//--------------------------------------------------------------------------------------
@@ -381,7 +268,7 @@ namespace amp
 		//  -- It is permissible for the input and output arrays to be references to the same 
 		//     array.
 		//--------------------------------------------------------------------------------------
-		void forward_transform(const concurrency::array<_Element_type, _Dim>& input, concurrency::array<std::complex<typename _details::dx_fft_type_helper<_Element_type>::precision_type>, _Dim>& output) const
+		void forward_transform(const concurrency::array<_Element_type, _Dim>& input, concurrency::array<std::complex<typename _details::fft_type_helper<_Element_type>::precision_type>, _Dim>& output) const
 		{
 			transform(true, input, output);
 		}
@@ -393,7 +280,7 @@ namespace amp
 		//  -- It is permissible for the input and output arrays to be references to the same 
 		//     array.
 		//--------------------------------------------------------------------------------------
-		void inverse_transform(const concurrency::array<std::complex<typename _details::dx_fft_type_helper<_Element_type>::precision_type>, _Dim>& input, concurrency::array<_Element_type, _Dim>& output) const
+		void inverse_transform(const concurrency::array<std::complex<typename _details::fft_type_helper<_Element_type>::precision_type>, _Dim>& input, concurrency::array<_Element_type, _Dim>& output) const
 		{
 			transform(false, input, output);
 		}
@@ -409,22 +296,23 @@ namespace amp
 		void transform(bool _Forward, const concurrency::array<_Input_element_type, _Dim>& _Input, concurrency::array<_Output_element_type, _Dim>& _Output) const
 		{
 			if (_Input.get_extent() != extent)
-				throw fft_exception("The input extent in transform is invalid", E_INVALIDARG);
+				throw fft_exception("The input extent in transform is invalid", _details::fft_invalid_arg);
 
 			if (_Output.get_extent() != extent)
-				throw fft_exception("The output extent in transform is invalid", E_INVALIDARG);
-
-			HRESULT hr = S_OK;
-
-			Microsoft::WRL::ComPtr<ID3D11Buffer> pBufferIn;
-			direct3d::get_buffer(_Input)->QueryInterface(__uuidof(ID3D11Buffer), reinterpret_cast<void**>(pBufferIn.GetAddressOf()));
+				throw fft_exception("The output extent in transform is invalid", _details::fft_invalid_arg);
 
-			Microsoft::WRL::ComPtr<ID3D11Buffer> pBufferOut;
-			direct3d::get_buffer(_Output)->QueryInterface(__uuidof(ID3D11Buffer), reinterpret_cast<void**>(pBufferOut.GetAddressOf()));
-
-			hr = base_transform(_Forward, pBufferIn.Get(), pBufferOut.Get());
-
-			if (FAILED(hr)) throw fft_exception("transform failed", hr);
+			std::vector<_Input_element_type> host_input(total_size());
+			std::vector<_Output_element_type> host_output(total_size());
+			concurrency::copy(_Input, host_input.data());
+			if (_Forward)
+			{
+				base_forward(host_input.data(), host_output.data());
+			}
+			else
+			{
+				base_inverse(host_input.data(), host_output.data());
+			}
+			concurrency::copy(host_output.data(), _Output);
 		}
 	};
 
@@ -441,7 +329,7 @@ namespace amp
 
 		static concurrency::extent<2> get_dft_size(concurrency::extent<2> image_size, concurrency::extent<2> kernel_size)
 		{
-			return concurrency::extent<2>(cv::getOptimalDFTSize(image_size[0] + kernel_size[0] - 1), cv::getOptimalDFTSize(image_size[1] + kernel_size[1] - 1));
+			return concurrency::extent<2>(cpu::optimal_fft_size(image_size[0] + kernel_size[0] - 1), cpu::optimal_fft_size(image_size[1] + kernel_size[1] - 1));
 		}
 
 		concurrency::extent<2> dft_size;
@@ -565,4 +453,6 @@ namespace amp
 		convolve2d_fft_32f_c1(ctx, src_array, dest_array, gpuKernel, reuse_src, reuse_kernel);
 	}
 
+#endif
+
 } // namespace amp
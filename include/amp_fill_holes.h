@@ -1,9 +1,11 @@
 ﻿#pragma once
 
 #include "amp_core.h"
+#include "amp_reconstruction.h"
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Fill Holes
 	namespace detail
 	{
@@ -161,5 +163,42 @@ namespace amp
 			}
 		});
 	}
+#endif
 
+	// CPU backend: the zero pixels reached from the image border through 4-connected zero pixels are the background,
+	// everything else(objects and their holes) is set to 255
+	inline void fill_holes_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array)
+	{
+		const int rows = src_array.rows;
+		const int cols = src_array.cols;
+		cpu::plane<float> background(rows, cols);
+		cpu::plane_view<float> background_array = background.view();
+		cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+		{
+			for(int y = row_first; y < row_last; y++)
+			{
+				const float* src_row = src_array.row(y);
+				float* background_row = background_array.row(y);
+				float* dest_row = dest_array.row(y);
+				const bool edge_row = y == 0 || y == rows - 1;
+				for(int x = 0; x < cols; x++)
+				{
+					background_row[x] = src_row[x] == 0.0f ? 255.0f : 0.0f;
+					dest_row[x] = (edge_row || x == 0 || x == cols - 1) ? background_row[x] : 0.0f;
+				}
+			}
+		});
+		detail::reconstruct<true>(pool, dest_array, background_array, true);
+		cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+		{
+			for(int y = row_first; y < row_last; y++)
+			{
+				float* dest_row = dest_array.row(y);
+				for(int x = 0; x < cols; x++)
+				{
+					dest_row[x] = 255.0f - dest_row[x];
+				}
+			}
+		});
+	}
 }
@@ -1,20 +1,25 @@
-#pragma once
+﻿#pragma once
 
 #include "amp_core.h"
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// find the best affine transform from template image to target image
 	// brute-force search within a series of candidate transforms
-	inline std::pair<int, cv::Matx23f> find_best_transform(concurrency::accelerator_view& acc_view, concurrency::array_view<const float, 2> templ_array,
+	inline std::pair<int, cv::Matx23f> find_best_transform(concurrency::accelerator_view& acc_view, buffer_pool& buffers, concurrency::array_view<const float, 2> templ_array,
 		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
 	{
 		using namespace concurrency;
-		concurrency::array<float, 2> gpu_transforms(concurrency::extent<2>(transforms.size(), 6), acc_view);
+		int transform_count = int(transforms.size());
+		buffer_pool::device_lease transform_buf = buffers.acquire_device<float>(transform_count * 6);
+		concurrency::array_view<float, 2> gpu_transforms = transform_buf.view<float>(transform_count, 6);
 		concurrency::copy(reinterpret_cast<const float*>(&transforms[0]), gpu_transforms);
 		concurrency::array_view<const float, 2> transform_array = gpu_transforms;
-		std::vector<int> cpu_diffs(transforms.size());
-		concurrency::array_view<int, 1> gpu_diffs(int(cpu_diffs.size()), &cpu_diffs[0]);
+		buffer_pool::host_lease diff_buf = buffers.acquire_host(sizeof(int) * transform_count);
+		int* cpu_diffs = diff_buf.data<int>();
+		std::fill_n(cpu_diffs, transform_count, 0);
+		concurrency::array_view<int, 1> gpu_diffs(transform_count, cpu_diffs);
 		int src_rows = templ_array.get_extent()[0];
 		int src_cols = templ_array.get_extent()[1];
 		int dst_rows = target_array.get_extent()[0];
@@ -60,137 +65,524 @@ namespace amp
 				}
 			});
 		gpu_diffs.synchronize();
-		auto min_diff_index = std::min_element(cpu_diffs.cbegin(), cpu_diffs.cend()) - cpu_diffs.cbegin();
+		auto min_diff_index = std::min_element(cpu_diffs, cpu_diffs + transform_count) - cpu_diffs;
 		return { cpu_diffs[min_diff_index], transforms[min_diff_index] };
 	}
 
-	// find the best affine transform from template image to target image(inversed transform)
-	// brute-force search within a series of candidate transforms
-	inline std::pair<int, cv::Matx23f> find_best_transform_inverse(concurrency::accelerator_view& acc_view, concurrency::array_view<const float, 2> templ_array,
-		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
+	namespace detail
 	{
-		using namespace concurrency;
-		concurrency::array<float, 2> gpu_transforms(concurrency::extent<2>(transforms.size(), 6), acc_view);
-		concurrency::copy(reinterpret_cast<const float*>(&transforms[0]), gpu_transforms);
-		concurrency::array_view<const float, 2> transform_array = gpu_transforms;
-		std::vector<int> cpu_diffs(transforms.size());
-		concurrency::array_view<int, 1> gpu_diffs(int(cpu_diffs.size()), &cpu_diffs[0]);
-		int src_rows = templ_array.get_extent()[0];
-		int src_cols = templ_array.get_extent()[1];
-		int dst_rows = target_array.get_extent()[0];
-		int dst_cols = target_array.get_extent()[1];
-		int tr_count = gpu_transforms.get_extent()[0];
-		static const int tile_size = 16;
-		parallel_for_each(acc_view, templ_array.get_extent().tile<tile_size, tile_size>().pad(), [=](tiled_index<tile_size, tile_size> idx) restrict(amp)
-			{
-				int dx = idx.global[1];
-				int dy = idx.global[0];
-
-				float dx_f = float(dx);
-				float dy_f = float(dy);
-
-				if (dx < src_cols && dy < src_rows)
+		// difference of every candidate transform into cpu_diffs(one int per transform)
+		inline void transform_diffs_inverse(concurrency::accelerator_view& acc_view, buffer_pool& buffers, concurrency::array_view<const float, 2> templ_array,
+			concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms, int* cpu_diffs)
+		{
+			using namespace concurrency;
+			int transform_count = int(transforms.size());
+			buffer_pool::device_lease transform_buf = buffers.acquire_device<float>(transform_count * 6);
+			concurrency::array_view<float, 2> gpu_transforms = transform_buf.view<float>(transform_count, 6);
+			concurrency::copy(reinterpret_cast<const float*>(&transforms[0]), gpu_transforms);
+			concurrency::array_view<const float, 2> transform_array = gpu_transforms;
+			std::fill_n(cpu_diffs, transform_count, 0);
+			concurrency::array_view<int, 1> gpu_diffs(transform_count, cpu_diffs);
+			int src_rows = templ_array.get_extent()[0];
+			int src_cols = templ_array.get_extent()[1];
+			int dst_rows = target_array.get_extent()[0];
+			int dst_cols = target_array.get_extent()[1];
+			int tr_count = gpu_transforms.get_extent()[0];
+			static const int tile_size = 16;
+			parallel_for_each(acc_view, templ_array.get_extent().tile<tile_size, tile_size>().pad(), [=](tiled_index<tile_size, tile_size> idx) restrict(amp)
 				{
-					float src_val = templ_array(idx.global);
-					int out_diff = direct3d::imax(255 - int(src_val), int(src_val));
+					int dx = idx.global[1];
+					int dy = idx.global[0];
 
-					for (int trid = 0; trid < tr_count; trid++)
+					float dx_f = float(dx);
+					float dy_f = float(dy);
+
+					if (dx < src_cols && dy < src_rows)
 					{
-						float sx_f = direct3d::mad(transform_array(trid, 0), dx_f, direct3d::mad(transform_array(trid, 1), dy_f, transform_array(trid, 2)));
-						float sy_f = direct3d::mad(transform_array(trid, 3), dx_f, direct3d::mad(transform_array(trid, 4), dy_f, transform_array(trid, 5)));
+						float src_val = templ_array(idx.global);
+						int out_diff = direct3d::imax(255 - int(src_val), int(src_val));
 
-						int sx = int(fast_math::floorf(sx_f));
-						int sy = int(fast_math::floorf(sy_f));
+						for (int trid = 0; trid < tr_count; trid++)
+						{
+							float sx_f = direct3d::mad(transform_array(trid, 0), dx_f, direct3d::mad(transform_array(trid, 1), dy_f, transform_array(trid, 2)));
+							float sy_f = direct3d::mad(transform_array(trid, 3), dx_f, direct3d::mad(transform_array(trid, 4), dy_f, transform_array(trid, 5)));
 
-						float ax = sx_f - float(sx);
-						float ay = sy_f - float(sy);
+							int sx = int(fast_math::floorf(sx_f));
+							int sy = int(fast_math::floorf(sy_f));
 
-						bool valid_target = sx >= 0 && sx + 1 < dst_cols && sy >= 0 && sy + 1 < dst_rows;
-						if (valid_target)
-						{
-							float v0 = target_array(sy, sx);
-							float v1 = target_array(sy, sx + 1);
-							float v2 = target_array(sy + 1, sx);
-							float v3 = target_array(sy + 1, sx + 1);
-							float ax2 = 1.0f - ax, ay2 = 1.0f - ay;
-							float val = direct3d::mad(ax2, direct3d::mad(v0, ay2, v2 * ay), ax * direct3d::mad(v1, ay2, v3 * ay));
-							int diff = int(fast_math::fabsf(val - src_val));
-							concurrency::atomic_fetch_add(&gpu_diffs[trid], diff);
+							float ax = sx_f - float(sx);
+							float ay = sy_f - float(sy);
+
+							bool valid_target = sx >= 0 && sx + 1 < dst_cols && sy >= 0 && sy + 1 < dst_rows;
+							if (valid_target)
+							{
+								float v0 = target_array(sy, sx);
+								float v1 = target_array(sy, sx + 1);
+								float v2 = target_array(sy + 1, sx);
+								float v3 = target_array(sy + 1, sx + 1);
+								float ax2 = 1.0f - ax, ay2 = 1.0f - ay;
+								float val = direct3d::mad(ax2, direct3d::mad(v0, ay2, v2 * ay), ax * direct3d::mad(v1, ay2, v3 * ay));
+								int diff = int(fast_math::fabsf(val - src_val));
+								concurrency::atomic_fetch_add(&gpu_diffs[trid], diff);
+							}
+							else
+							{
+								concurrency::atomic_fetch_add(&gpu_diffs[trid], out_diff);
+							}
 						}
-						else
+					}
+				});
+			gpu_diffs.synchronize();
+		}
+
+		// sparse_templ_array: 2D N*(x,y,val) array
+		inline void transform_diffs_inverse_sparse(concurrency::accelerator_view& acc_view, buffer_pool& buffers, concurrency::array_view<const float, 2> sparse_templ_array,
+			concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms, int* cpu_diffs)
+		{
+			using namespace concurrency;
+			int transform_count = int(transforms.size());
+			buffer_pool::device_lease transform_buf = buffers.acquire_device<float>(transform_count * 6);
+			concurrency::array_view<float, 2> gpu_transforms = transform_buf.view<float>(transform_count, 6);
+			concurrency::copy(reinterpret_cast<const float*>(&transforms[0]), gpu_transforms);
+			concurrency::array_view<const float, 2> transform_array = gpu_transforms;
+			std::fill_n(cpu_diffs, transform_count, 0);
+			concurrency::array_view<int, 1> gpu_diffs(transform_count, cpu_diffs);
+			int src_count = sparse_templ_array.get_extent()[0];
+			int dst_rows = target_array.get_extent()[0];
+			int dst_cols = target_array.get_extent()[1];
+			int tr_count = gpu_transforms.get_extent()[0];
+			static const int tile_size = 256;
+			extent<1> ext(src_count);
+			parallel_for_each(acc_view, ext.tile<tile_size>().pad(), [=](tiled_index<tile_size> idx) restrict(amp)
+				{
+					int index = idx.global[0];
+
+					if (index < src_count)
+					{
+						float dx_f = sparse_templ_array(index, 0);
+						float dy_f = sparse_templ_array(index, 1);
+						float src_val = sparse_templ_array(index, 2);
+
+						int out_diff = direct3d::imax(255 - int(src_val), int(src_val));
+
+						for (int trid = 0; trid < tr_count; trid++)
 						{
-							concurrency::atomic_fetch_add(&gpu_diffs[trid], out_diff);
+							float sx_f = direct3d::mad(transform_array(trid, 0), dx_f, direct3d::mad(transform_array(trid, 1), dy_f, transform_array(trid, 2)));
+							float sy_f = direct3d::mad(transform_array(trid, 3), dx_f, direct3d::mad(transform_array(trid, 4), dy_f, transform_array(trid, 5)));
+
+							int sx = int(fast_math::floorf(sx_f));
+							int sy = int(fast_math::floorf(sy_f));
+
+							float ax = sx_f - float(sx);
+							float ay = sy_f - float(sy);
+
+							bool valid_target = sx >= 0 && sx + 1 < dst_cols && sy >= 0 && sy + 1 < dst_rows;
+							if (valid_target)
+							{
+								float v0 = target_array(sy, sx);
+								float v1 = target_array(sy, sx + 1);
+								float v2 = target_array(sy + 1, sx);
+								float v3 = target_array(sy + 1, sx + 1);
+								float ax2 = 1.0f - ax, ay2 = 1.0f - ay;
+								float val = direct3d::mad(ax2, direct3d::mad(v0, ay2, v2 * ay), ax * direct3d::mad(v1, ay2, v3 * ay));
+								int diff = int(fast_math::fabsf(val - src_val));
+								concurrency::atomic_fetch_add(&gpu_diffs[trid], diff);
+							}
+							else
+							{
+								concurrency::atomic_fetch_add(&gpu_diffs[trid], out_diff);
+							}
 						}
 					}
-				}
-			});
-		gpu_diffs.synchronize();
-		auto min_diff_index = std::min_element(cpu_diffs.cbegin(), cpu_diffs.cend()) - cpu_diffs.cbegin();
+				});
+			gpu_diffs.synchronize();
+		}
+	}
+
+	// find the best affine transform from template image to target image(inversed transform)
+	// brute-force search within a series of candidate transforms
+	inline std::pair<int, cv::Matx23f> find_best_transform_inverse(concurrency::accelerator_view& acc_view, buffer_pool& buffers, concurrency::array_view<const float, 2> templ_array,
+		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		buffer_pool::host_lease diff_buf = buffers.acquire_host(sizeof(int) * transforms.size());
+		int* cpu_diffs = diff_buf.data<int>();
+		detail::transform_diffs_inverse(acc_view, buffers, templ_array, target_array, transforms, cpu_diffs);
+		auto min_diff_index = std::min_element(cpu_diffs, cpu_diffs + transforms.size()) - cpu_diffs;
 		return { cpu_diffs[min_diff_index], transforms[min_diff_index] };
 	}
 
 	// find the best affine transform from template image's selected edge points to target image(inversed transform)
 	// brute-force search within a series of candidate transforms
 	// sparse_templ_array: 2D N*(x,y,val) array
+	inline std::pair<int, cv::Matx23f> find_best_transform_inverse_sparse(concurrency::accelerator_view& acc_view, buffer_pool& buffers, concurrency::array_view<const float, 2> sparse_templ_array,
+		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		buffer_pool::host_lease diff_buf = buffers.acquire_host(sizeof(int) * transforms.size());
+		int* cpu_diffs = diff_buf.data<int>();
+		detail::transform_diffs_inverse_sparse(acc_view, buffers, sparse_templ_array, target_array, transforms, cpu_diffs);
+		auto min_diff_index = std::min_element(cpu_diffs, cpu_diffs + transforms.size()) - cpu_diffs;
+		return { cpu_diffs[min_diff_index], transforms[min_diff_index] };
+	}
+
+	inline std::pair<int, cv::Matx23f> find_best_transform(vision_context& ctx, concurrency::array_view<const float, 2> templ_array,
+		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		return find_best_transform(ctx.acc_view, ctx.buffers, templ_array, target_array, transforms);
+	}
+
+	inline std::pair<int, cv::Matx23f> find_best_transform(concurrency::accelerator_view& acc_view, concurrency::array_view<const float, 2> templ_array,
+		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		buffer_pool buffers(acc_view);
+		return find_best_transform(acc_view, buffers, templ_array, target_array, transforms);
+	}
+
+	inline std::pair<int, cv::Matx23f> find_best_transform_inverse(vision_context& ctx, concurrency::array_view<const float, 2> templ_array,
+		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		return find_best_transform_inverse(ctx.acc_view, ctx.buffers, templ_array, target_array, transforms);
+	}
+
+	inline std::pair<int, cv::Matx23f> find_best_transform_inverse(concurrency::accelerator_view& acc_view, concurrency::array_view<const float, 2> templ_array,
+		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		buffer_pool buffers(acc_view);
+		return find_best_transform_inverse(acc_view, buffers, templ_array, target_array, transforms);
+	}
+
+	inline std::pair<int, cv::Matx23f> find_best_transform_inverse_sparse(vision_context& ctx, concurrency::array_view<const float, 2> sparse_templ_array,
+		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		return find_best_transform_inverse_sparse(ctx.acc_view, ctx.buffers, sparse_templ_array, target_array, transforms);
+	}
+
 	inline std::pair<int, cv::Matx23f> find_best_transform_inverse_sparse(concurrency::accelerator_view& acc_view, concurrency::array_view<const float, 2> sparse_templ_array,
 		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
 	{
-		using namespace concurrency;
-		concurrency::array<float, 2> gpu_transforms(concurrency::extent<2>(transforms.size(), 6), acc_view);
-		concurrency::copy(reinterpret_cast<const float*>(&transforms[0]), gpu_transforms);
-		concurrency::array_view<const float, 2> transform_array = gpu_transforms;
-		std::vector<int> cpu_diffs(transforms.size());
-		concurrency::array_view<int, 1> gpu_diffs(int(cpu_diffs.size()), &cpu_diffs[0]);
-		int src_count = sparse_templ_array.get_extent()[0];
-		int dst_rows = target_array.get_extent()[0];
-		int dst_cols = target_array.get_extent()[1];
-		int tr_count = gpu_transforms.get_extent()[0];
-		static const int tile_size = 256;
-		extent<1> ext(src_count);
-		parallel_for_each(acc_view, ext.tile<tile_size>().pad(), [=](tiled_index<tile_size> idx) restrict(amp)
+		buffer_pool buffers(acc_view);
+		return find_best_transform_inverse_sparse(acc_view, buffers, sparse_templ_array, target_array, transforms);
+	}
+
+	// difference of every candidate transform(inversed transform), for callers that refine several hypotheses at once
+	inline std::vector<int> find_transform_diffs_inverse(vision_context& ctx, concurrency::array_view<const float, 2> templ_array,
+		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		std::vector<int> diffs(transforms.size());
+		detail::transform_diffs_inverse(ctx.acc_view, ctx.buffers, templ_array, target_array, transforms, diffs.data());
+		return diffs;
+	}
+
+	inline std::vector<int> find_transform_diffs_inverse_sparse(vision_context& ctx, concurrency::array_view<const float, 2> sparse_templ_array,
+		concurrency::array_view<const float, 2> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		std::vector<int> diffs(transforms.size());
+		detail::transform_diffs_inverse_sparse(ctx.acc_view, ctx.buffers, sparse_templ_array, target_array, transforms, diffs.data());
+		return diffs;
+	}
+#endif
+
+	// CPU backend: candidates are scored in groups of 8(16 with AVX-512) transforms, one per vector lane, each lane keeps its own
+	// sum instead of an atomic per pixel. Sums only grow, so a group is dropped as soon as all its partial sums exceed the best
+	// complete score(successive elimination); the best candidate always completes, its score is the exact float sum.
+	namespace detail
+	{
+		// Points compared with the sampled image: (x, y) are the coordinates the transforms map,
+		// outside is the difference counted when a transform maps the point out of the image
+		struct transform_points
+		{
+			std::vector<float> x, y, value, outside;
+
+			int size() const
 			{
-				int index = idx.global[0];
+				return int(x.size());
+			}
 
-				if (index < src_count)
+			void push_back(float x_, float y_, float value_, float outside_)
+			{
+				x.push_back(x_);
+				y.push_back(y_);
+				value.push_back(value_);
+				outside.push_back(outside_);
+			}
+		};
+
+		// Every pixel of image, out of range samples count outside_diff(value) when penalize_outside is set, nothing otherwise
+		inline transform_points image_transform_points(cpu::plane_view<const float> image, bool penalize_outside)
+		{
+			transform_points points;
+			size_t count = size_t(image.rows) * image.cols;
+			points.x.reserve(count);
+			points.y.reserve(count);
+			points.value.reserve(count);
+			points.outside.reserve(count);
+			for(int r = 0; r < image.rows; r++)
+			{
+				const float* row = image.row(r);
+				for(int c = 0; c < image.cols; c++)
 				{
-					float dx_f = sparse_templ_array(index, 0);
-					float dy_f = sparse_templ_array(index, 1);
-					float src_val = sparse_templ_array(index, 2);
+					points.push_back(float(c), float(r), row[c], penalize_outside ? std::max(255.0f - row[c], row[c]) : 0.0f);
+				}
+			}
+			return points;
+		}
 
-					int out_diff = direct3d::imax(255 - int(src_val), int(src_val));
+		// Up to 16 transforms as 6 rows of 16 coefficients
+		struct transform_group
+		{
+			float coef[6][16];
+		};
 
-					for (int trid = 0; trid < tr_count; trid++)
+		// Sampled image and the lanes of one group
+		struct transform_sampler
+		{
+			const float* data;
+			int step;
+			int rows;
+			int cols;
+		};
+
+		// Sum over points [first, last) of |bilinear sample - value| for each of lanes transforms.
+		// The vector versions use fused multiply-adds in the order of the accelerator's mad, so their sums can differ in the last bits.
+		inline void transform_sad_scalar(const transform_group& group, int lanes, const transform_points& points, int first, int last
+			, const transform_sampler& image, float* sums)
+		{
+			const float max_x = float(image.cols - 1);
+			const float max_y = float(image.rows - 1);
+			for(int lane = 0; lane < lanes; lane++)
+			{
+				const float a = group.coef[0][lane], b = group.coef[1][lane], c = group.coef[2][lane];
+				const float d = group.coef[3][lane], e = group.coef[4][lane], f = group.coef[5][lane];
+				float acc = 0.0f;
+				for(int i = first; i < last; i++)
+				{
+					const float x = points.x[i], y = points.y[i];
+					const float sx_f = a * x + (b * y + c);
+					const float sy_f = d * x + (e * y + f);
+					const float fx = std::floor(sx_f);
+					const float fy = std::floor(sy_f);
+					if(fx >= 0.0f && fx < max_x && fy >= 0.0f && fy < max_y)
 					{
-						float sx_f = direct3d::mad(transform_array(trid, 0), dx_f, direct3d::mad(transform_array(trid, 1), dy_f, transform_array(trid, 2)));
-						float sy_f = direct3d::mad(transform_array(trid, 3), dx_f, direct3d::mad(transform_array(trid, 4), dy_f, transform_array(trid, 5)));
+						const float* p = image.data + int(fy) * image.step + int(fx);
+						const float ax = sx_f - fx, ay = sy_f - fy;
+						const float ax2 = 1.0f - ax, ay2 = 1.0f - ay;
+						const float val = ax2 * (p[0] * ay2 + p[image.step] * ay) + ax * (p[1] * ay2 + p[image.step + 1] * ay);
+						acc += std::fabs(val - points.value[i]);
+					}
+					else
+					{
+						acc += points.outside[i];
+					}
+				}
+				sums[lane] = acc;
+			}
+		}
 
-						int sx = int(fast_math::floorf(sx_f));
-						int sy = int(fast_math::floorf(sy_f));
+#if AMP_CPU_X86
+		AMP_CPU_TARGET("avx2,fma")
+		inline void transform_sad_avx2(const transform_group& group, const transform_points& points, int first, int last
+			, const transform_sampler& image, float* sums)
+		{
+			const __m256 a = _mm256_loadu_ps(group.coef[0]), b = _mm256_loadu_ps(group.coef[1]), c = _mm256_loadu_ps(group.coef[2]);
+			const __m256 d = _mm256_loadu_ps(group.coef[3]), e = _mm256_loadu_ps(group.coef[4]), f = _mm256_loadu_ps(group.coef[5]);
+			const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+			const __m256 max_x = _mm256_set1_ps(float(image.cols - 1)), max_y = _mm256_set1_ps(float(image.rows - 1));
+			const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+			const __m256i step = _mm256_set1_epi32(image.step);
+			__m256 acc = _mm256_setzero_ps();
+			for(int i = first; i < last; i++)
+			{
+				const __m256 x = _mm256_set1_ps(points.x[i]), y = _mm256_set1_ps(points.y[i]);
+				const __m256 sx_f = _mm256_fmadd_ps(a, x, _mm256_fmadd_ps(b, y, c));
+				const __m256 sy_f = _mm256_fmadd_ps(d, x, _mm256_fmadd_ps(e, y, f));
+				const __m256 fx = _mm256_floor_ps(sx_f);
+				const __m256 fy = _mm256_floor_ps(sy_f);
+				const __m256 valid = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(fx, zero, _CMP_GE_OQ), _mm256_cmp_ps(fx, max_x, _CMP_LT_OQ))
+					, _mm256_and_ps(_mm256_cmp_ps(fy, zero, _CMP_GE_OQ), _mm256_cmp_ps(fy, max_y, _CMP_LT_OQ)));
+				// out of range lanes read the first pixel and are replaced by outside
+				const __m256i index = _mm256_and_si256(_mm256_castps_si256(valid)
+					, _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(fy), step), _mm256_cvttps_epi32(fx)));
+				const __m256 v0 = _mm256_i32gather_ps(image.data, index, 4);
+				const __m256 v1 = _mm256_i32gather_ps(image.data + 1, index, 4);
+				const __m256 v2 = _mm256_i32gather_ps(image.data + image.step, index, 4);
+				const __m256 v3 = _mm256_i32gather_ps(image.data + image.step + 1, index, 4);
+				const __m256 ax = _mm256_sub_ps(sx_f, fx), ay = _mm256_sub_ps(sy_f, fy);
+				const __m256 ax2 = _mm256_sub_ps(one, ax), ay2 = _mm256_sub_ps(one, ay);
+				const __m256 val = _mm256_fmadd_ps(ax2, _mm256_fmadd_ps(v0, ay2, _mm256_mul_ps(v2, ay)), _mm256_mul_ps(ax, _mm256_fmadd_ps(v1, ay2, _mm256_mul_ps(v3, ay))));
+				const __m256 diff = _mm256_and_ps(_mm256_sub_ps(val, _mm256_set1_ps(points.value[i])), abs_mask);
+				acc = _mm256_add_ps(acc, _mm256_blendv_ps(_mm256_set1_ps(points.outside[i]), diff, valid));
+			}
+			_mm256_storeu_ps(sums, acc);
+		}
 
-						float ax = sx_f - float(sx);
-						float ay = sy_f - float(sy);
+#if AMP_CPU_AVX512
+		AMP_CPU_TARGET("avx512f")
+		inline void transform_sad_avx512(const transform_group& group, const transform_points& points, int first, int last
+			, const transform_sampler& image, float* sums)
+		{
+			const __m512 a = _mm512_loadu_ps(group.coef[0]), b = _mm512_loadu_ps(group.coef[1]), c = _mm512_loadu_ps(group.coef[2]);
+			const __m512 d = _mm512_loadu_ps(group.coef[3]), e = _mm512_loadu_ps(group.coef[4]), f = _mm512_loadu_ps(group.coef[5]);
+			const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f);
+			const __m512 max_x = _mm512_set1_ps(float(image.cols - 1)), max_y = _mm512_set1_ps(float(image.rows - 1));
+			const __m512i abs_mask = _mm512_set1_epi32(0x7fffffff);
+			const __m512i step = _mm512_set1_epi32(image.step);
+			__m512 acc = _mm512_setzero_ps();
+			for(int i = first; i < last; i++)
+			{
+				const __m512 x = _mm512_set1_ps(points.x[i]), y = _mm512_set1_ps(points.y[i]);
+				const __m512 sx_f = _mm512_fmadd_ps(a, x, _mm512_fmadd_ps(b, y, c));
+				const __m512 sy_f = _mm512_fmadd_ps(d, x, _mm512_fmadd_ps(e, y, f));
+				const __m512 fx = _mm512_roundscale_ps(sx_f, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+				const __m512 fy = _mm512_roundscale_ps(sy_f, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+				const __mmask16 valid = _mm512_cmp_ps_mask(fx, zero, _CMP_GE_OQ) & _mm512_cmp_ps_mask(fx, max_x, _CMP_LT_OQ)
+					& _mm512_cmp_ps_mask(fy, zero, _CMP_GE_OQ) & _mm512_cmp_ps_mask(fy, max_y, _CMP_LT_OQ);
+				const __m512i index = _mm512_maskz_add_epi32(valid, _mm512_mullo_epi32(_mm512_cvttps_epi32(fy), step), _mm512_cvttps_epi32(fx));
+				const __m512 v0 = _mm512_i32gather_ps(index, image.data, 4);
+				const __m512 v1 = _mm512_i32gather_ps(index, image.data + 1, 4);
+				const __m512 v2 = _mm512_i32gather_ps(index, image.data + image.step, 4);
+				const __m512 v3 = _mm512_i32gather_ps(index, image.data + image.step + 1, 4);
+				const __m512 ax = _mm512_sub_ps(sx_f, fx), ay = _mm512_sub_ps(sy_f, fy);
+				const __m512 ax2 = _mm512_sub_ps(one, ax), ay2 = _mm512_sub_ps(one, ay);
+				const __m512 val = _mm512_fmadd_ps(ax2, _mm512_fmadd_ps(v0, ay2, _mm512_mul_ps(v2, ay)), _mm512_mul_ps(ax, _mm512_fmadd_ps(v1, ay2, _mm512_mul_ps(v3, ay))));
+				const __m512 diff = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(_mm512_sub_ps(val, _mm512_set1_ps(points.value[i]))), abs_mask));
+				acc = _mm512_add_ps(acc, _mm512_mask_blend_ps(valid, _mm512_set1_ps(points.outside[i]), diff));
+			}
+			_mm512_storeu_ps(sums, acc);
+		}
+#endif
+#endif
 
-						bool valid_target = sx >= 0 && sx + 1 < dst_cols && sy >= 0 && sy + 1 < dst_rows;
-						if (valid_target)
-						{
-							float v0 = target_array(sy, sx);
-							float v1 = target_array(sy, sx + 1);
-							float v2 = target_array(sy + 1, sx);
-							float v3 = target_array(sy + 1, sx + 1);
-							float ax2 = 1.0f - ax, ay2 = 1.0f - ay;
-							float val = direct3d::mad(ax2, direct3d::mad(v0, ay2, v2 * ay), ax * direct3d::mad(v1, ay2, v3 * ay));
-							int diff = int(fast_math::fabsf(val - src_val));
-							concurrency::atomic_fetch_add(&gpu_diffs[trid], diff);
-						}
-						else
-						{
-							concurrency::atomic_fetch_add(&gpu_diffs[trid], out_diff);
-						}
+		// Lanes of one group for the SIMD level
+		inline int transform_group_lanes(cpu::simd_level level)
+		{
+			return level == cpu::simd_level::avx512 ? 16 : 8;
+		}
+
+		inline void transform_sad(const transform_group& group, int lanes, const transform_points& points, int first, int last
+			, const transform_sampler& image, float* sums, cpu::simd_level level)
+		{
+			switch(level)
+			{
+#if AMP_CPU_X86
+#if AMP_CPU_AVX512
+			case cpu::simd_level::avx512:
+				transform_sad_avx512(group, points, first, last, image, sums);
+				return;
+#endif
+			case cpu::simd_level::avx2:
+				transform_sad_avx2(group, points, first, last, image, sums);
+				return;
+#endif
+			default:
+				transform_sad_scalar(group, lanes, points, first, last, image, sums);
+			}
+		}
+
+		// Lower *best to value
+		inline void atomic_min(std::atomic<double>& best, double value)
+		{
+			double current = best.load(std::memory_order_relaxed);
+			while(value < current && !best.compare_exchange_weak(current, value, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		// Index and score of the best transform, the first one on ties like the accelerator version
+		inline std::pair<int, float> find_best_transform_index(cpu::thread_pool& pool, const transform_points& points
+			, cpu::plane_view<const float> image, const std::vector<cv::Matx23f>& transforms)
+		{
+			if(transforms.empty()) throw std::runtime_error("find_best_transform needs at least one candidate transform");
+			const cpu::simd_level level = image.rows >= 2 && image.cols >= 2 ? cpu::active_simd_level() : cpu::simd_level::scalar;
+			const int lanes = transform_group_lanes(level);
+			const int transform_count = int(transforms.size());
+			const int group_count = DIVUP(transform_count, lanes);
+			// partial sums are checked against the best score every block of points
+			const int block = 128;
+			const transform_sampler sampler = { image.data, int(image.step), image.rows, image.cols };
+			// lanes past the last transform repeat it
+			std::vector<transform_group> groups(group_count);
+			for(int g = 0; g < group_count; g++)
+			{
+				for(int lane = 0; lane < 16; lane++)
+				{
+					const cv::Matx23f& transform = transforms[std::min(g * lanes + lane, transform_count - 1)];
+					for(int k = 0; k < 6; k++)
+					{
+						groups[g].coef[k][lane] = transform(k / 3, k % 3);
+					}
+				}
+			}
+			std::vector<double> scores(size_t(group_count) * lanes, std::numeric_limits<double>::infinity());
+			std::atomic<double> best(std::numeric_limits<double>::infinity());
+			auto score_group = [&](int g, bool bounded)
+			{
+				double sums[16] = {};
+				float block_sums[16];
+				for(int first = 0; first < points.size(); first += block)
+				{
+					transform_sad(groups[g], lanes, points, first, std::min(first + block, points.size()), sampler, block_sums, level);
+					bool all_worse = bounded;
+					const double bound = best.load(std::memory_order_relaxed);
+					for(int lane = 0; lane < lanes; lane++)
+					{
+						sums[lane] += block_sums[lane];
+						all_worse = all_worse && sums[lane] > bound;
 					}
+					if(all_worse)
+						return;
+				}
+				double group_best = sums[0];
+				for(int lane = 0; lane < lanes; lane++)
+				{
+					scores[size_t(g) * lanes + lane] = sums[lane];
+					group_best = std::min(group_best, sums[lane]);
+				}
+				atomic_min(best, group_best);
+			};
+			// the candidates are laid out around the current estimate, the middle group sets a tight bound first
+			const int seed_group = group_count / 2;
+			score_group(seed_group, false);
+			pool.parallel_for(0, group_count, 1, [&](int group_first, int group_last)
+			{
+				for(int g = group_first; g < group_last; g++)
+				{
+					if(g != seed_group)
+						score_group(g, true);
 				}
 			});
-		gpu_diffs.synchronize();
-		auto min_diff_index = std::min_element(cpu_diffs.cbegin(), cpu_diffs.cend()) - cpu_diffs.cbegin();
-		return { cpu_diffs[min_diff_index], transforms[min_diff_index] };
+			const int best_index = int(std::min_element(scores.begin(), scores.begin() + transform_count) - scores.begin());
+			return { best_index, float(scores[best_index]) };
+		}
+	}
+
+	// find the best affine transform from template image to target image
+	// the score is the sum of absolute differences over the target pixels that map into the template
+	inline std::pair<float, cv::Matx23f> find_best_transform(cpu::thread_pool& pool, cpu::plane_view<const float> templ_array,
+		cpu::plane_view<const float> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		std::pair<int, float> best = detail::find_best_transform_index(pool, detail::image_transform_points(target_array, false), templ_array, transforms);
+		return { best.second, transforms[best.first] };
+	}
+
+	// find the best affine transform from template image to target image(inversed transform)
+	// template pixels mapped out of the target count the largest possible difference
+	inline std::pair<float, cv::Matx23f> find_best_transform_inverse(cpu::thread_pool& pool, cpu::plane_view<const float> templ_array,
+		cpu::plane_view<const float> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		std::pair<int, float> best = detail::find_best_transform_index(pool, detail::image_transform_points(templ_array, true), target_array, transforms);
+		return { best.second, transforms[best.first] };
+	}
+
+	// sparse_templ_array: 2D N*(x,y,val) array
+	inline std::pair<float, cv::Matx23f> find_best_transform_inverse_sparse(cpu::thread_pool& pool, cpu::plane_view<const float> sparse_templ_array,
+		cpu::plane_view<const float> target_array, const std::vector<cv::Matx23f>& transforms)
+	{
+		detail::transform_points points;
+		for(int i = 0; i < sparse_templ_array.rows; i++)
+		{
+			const float* point = sparse_templ_array.row(i);
+			points.push_back(point[0], point[1], point[2], std::max(255.0f - point[2], point[2]));
+		}
+		std::pair<int, float> best = detail::find_best_transform_index(pool, points, target_array, transforms);
+		return { best.second, transforms[best.first] };
 	}
 }
@@ -0,0 +1,596 @@
+﻿#pragma once
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include "amp_core.h"
+#include "amp_conv_separable.h"
+#include "amp_morph_rect.h"
+
+namespace amp
+{
+	// Operator fusion for the CPU backend
+	// A chain of pointwise and stencil operators is written as one expression, e.g.
+	//   fusion::evaluate(pool, fusion::input(src) - fusion::dilate(fusion::erode(fusion::input(src), k), k), dest);
+	// and runs as a single pass over the image. Nodes produce one row at a time: pointwise nodes transform
+	// the rows of their operands, stencil nodes keep the last kernel-height rows of their operand in a ring,
+	// so intermediates never leave the cache and no temporary planes are written.
+	// The destination may alias an input only when no stencil reads that input.
+	namespace fusion
+	{
+		// Base of every node, lets the operators below accept expressions only
+		template<typename derived_type>
+		struct expr
+		{
+			const derived_type& self() const
+			{
+				return static_cast<const derived_type&>(*this);
+			}
+		};
+
+		// Nodes implement
+		//   int rows() const, int cols() const
+		//   state make_state() const            per strip scratch, one per worker
+		//   const float* eval_row(state&, int r) const
+		// The returned row is valid until the next eval_row() call with the same state.
+		class input_node : public expr<input_node>
+		{
+		public:
+			struct state
+			{
+			};
+
+			explicit input_node(cpu::plane_view<const float> view_)
+				: view(view_)
+			{
+			}
+
+			int rows() const { return view.rows; }
+			int cols() const { return view.cols; }
+
+			state make_state() const
+			{
+				return state();
+			}
+
+			const float* eval_row(state&, int r) const
+			{
+				return view.row(r);
+			}
+
+		private:
+			cpu::plane_view<const float> view;
+		};
+
+		inline input_node input(cpu::plane_view<const float> view)
+		{
+			return input_node(view);
+		}
+
+		// Constant image
+		class constant_node : public expr<constant_node>
+		{
+		public:
+			struct state
+			{
+				std::vector<float> row;
+			};
+
+			constant_node(int rows_, int cols_, float value_)
+				: rows_count(rows_), cols_count(cols_), value(value_)
+			{
+			}
+
+			int rows() const { return rows_count; }
+			int cols() const { return cols_count; }
+
+			state make_state() const
+			{
+				state s;
+				s.row.assign(cols_count, value);
+				return s;
+			}
+
+			const float* eval_row(state& s, int) const
+			{
+				return s.row.data();
+			}
+
+		private:
+			int rows_count;
+			int cols_count;
+			float value;
+		};
+
+		inline constant_node constant(int rows, int cols, float value)
+		{
+			return constant_node(rows, cols, value);
+		}
+
+		// func(value) per pixel
+		template<typename child_type, typename func_type>
+		class map_node : public expr<map_node<child_type, func_type>>
+		{
+		public:
+			struct state
+			{
+				typename child_type::state child;
+				std::vector<float> row;
+			};
+
+			map_node(const child_type& child_, const func_type& func_)
+				: child(child_), func(func_)
+			{
+			}
+
+			int rows() const { return child.rows(); }
+			int cols() const { return child.cols(); }
+
+			state make_state() const
+			{
+				state s;
+				s.child = child.make_state();
+				s.row.resize(cols());
+				return s;
+			}
+
+			const float* eval_row(state& s, int r) const
+			{
+				const float* src = child.eval_row(s.child, r);
+				float* dest = s.row.data();
+				const int n = cols();
+				for(int c = 0; c < n; c++)
+				{
+					dest[c] = func(src[c]);
+				}
+				return dest;
+			}
+
+		private:
+			child_type child;
+			func_type func;
+		};
+
+		// func(left, right) per pixel
+		template<typename left_type, typename right_type, typename func_type>
+		class zip_node : public expr<zip_node<left_type, right_type, func_type>>
+		{
+		public:
+			struct state
+			{
+				typename left_type::state left;
+				typename right_type::state right;
+				std::vector<float> row;
+			};
+
+			zip_node(const left_type& left_, const right_type& right_, const func_type& func_)
+				: left(left_), right(right_), func(func_)
+			{
+				assert(left.rows() == right.rows() && left.cols() == right.cols());
+			}
+
+			int rows() const { return left.rows(); }
+			int cols() const { return left.cols(); }
+
+			state make_state() const
+			{
+				state s;
+				s.left = left.make_state();
+				s.right = right.make_state();
+				s.row.resize(cols());
+				return s;
+			}
+
+			const float* eval_row(state& s, int r) const
+			{
+				const float* src1 = left.eval_row(s.left, r);
+				const float* src2 = right.eval_row(s.right, r);
+				float* dest = s.row.data();
+				const int n = cols();
+				for(int c = 0; c < n; c++)
+				{
+					dest[c] = func(src1[c], src2[c]);
+				}
+				return dest;
+			}
+
+		private:
+			left_type left;
+			right_type right;
+			func_type func;
+		};
+
+		// Erosion(take_max = false) or dilation of an expression with the rules of erode_32f_c1/dilate_32f_c1:
+		// kernel cells > 0 take part and pixels outside the image are ignored.
+		// Rectangular kernels produce band_rows output rows at a time through detail::morph_rect_rows,
+		// other kernels one row at a time from a ring of operand rows.
+		template<typename child_type, bool take_max>
+		class morph_node : public expr<morph_node<child_type, take_max>>
+		{
+		public:
+			struct state
+			{
+				typename child_type::state child;
+				std::vector<std::vector<float>> ring;
+				std::vector<int> ring_row;
+				std::vector<float> row;
+				// operand rows [band_src_first, band_src_last) and the output rows [band_first, band_last) computed from them
+				std::vector<float> band_src;
+				std::vector<float> band_dest;
+				detail::morph_rect_scratch<float> scratch;
+				int band_src_first;
+				int band_src_last;
+				int band_first;
+				int band_last;
+			};
+
+			template<unsigned int kernel_size>
+			morph_node(const child_type& child_, const kernel_wrapper<float, kernel_size>& kernel)
+				: child(child_), kernel_rows(kernel.rows), kernel_cols(kernel.cols), mask(kernel.data, kernel.data + kernel.size)
+				, rectangular(kernel.is_all_positive())
+			{
+			}
+
+			// Full kernel_rows x kernel_cols rectangle, any size
+			morph_node(const child_type& child_, int kernel_rows_, int kernel_cols_)
+				: child(child_), kernel_rows(kernel_rows_), kernel_cols(kernel_cols_), rectangular(true)
+			{
+			}
+
+			int rows() const { return child.rows(); }
+			int cols() const { return child.cols(); }
+
+			state make_state() const
+			{
+				state s;
+				s.child = child.make_state();
+				s.band_src_first = 0;
+				s.band_src_last = 0;
+				s.band_first = 0;
+				s.band_last = 0;
+				if(rectangular)
+				{
+					s.band_src.resize(size_t(band_rows + kernel_rows - 1) * cols());
+					s.band_dest.resize(s.band_src.size());
+				}
+				else
+				{
+					s.ring.assign(kernel_rows, std::vector<float>(cols() + kernel_cols - 1, identity()));
+					s.ring_row.assign(kernel_rows, -1);
+					s.row.resize(cols());
+				}
+				return s;
+			}
+
+			const float* eval_row(state& s, int r) const
+			{
+				const int n = cols();
+				const int anchor_row = kernel_rows / 2;
+				if(rectangular)
+				{
+					if(r < s.band_first || r >= s.band_last)
+					{
+						// operand rows of the band plus the window halo, rows outside the image are left to morph_rect_rows.
+						// The halo rows the previous band already holds are moved, not asked again: a stencil child
+						// would recompute its own band to go back over them.
+						const int src_first = std::max(0, r - anchor_row);
+						const int src_last = std::min(rows(), r + band_rows - anchor_row + kernel_rows - 1);
+						int kept_last = src_first;
+						if(src_first >= s.band_src_first && src_first < s.band_src_last)
+						{
+							kept_last = std::min(s.band_src_last, src_last);
+							std::copy(&s.band_src[size_t(src_first - s.band_src_first) * n], &s.band_src[size_t(kept_last - s.band_src_first) * n], s.band_src.begin());
+						}
+						for(int i = kept_last; i < src_last; i++)
+						{
+							const float* src = child.eval_row(s.child, i);
+							std::copy(src, src + n, &s.band_src[size_t(i - src_first) * n]);
+						}
+						s.band_first = r;
+						s.band_last = std::min(rows(), r + band_rows);
+						s.band_src_first = src_first;
+						s.band_src_last = src_last;
+						const int band_src_rows = src_last - src_first;
+						detail::morph_rect_rows<take_max, float>(cpu::plane_view<const float>(s.band_src.data(), band_src_rows, n)
+							, cpu::plane_view<float>(s.band_dest.data(), band_src_rows, n), kernel_rows, kernel_cols, anchor_row, kernel_cols / 2
+							, s.band_first - s.band_src_first, s.band_last - s.band_src_first, s.scratch);
+					}
+					return &s.band_dest[size_t(r - s.band_src_first) * n];
+				}
+				const int row_first = std::max(0, r - anchor_row);
+				const int row_last = std::min(rows(), r - anchor_row + kernel_rows);
+				float* dest = s.row.data();
+				std::fill(s.row.begin(), s.row.end(), identity());
+				for(int i = row_first; i < row_last; i++)
+				{
+					const float* src = fetch(s, i);
+					const int ki = i - (r - anchor_row);
+					for(int j = 0; j < kernel_cols; j++)
+					{
+						if(mask[ki * kernel_cols + j] > 0.0f)
+						{
+							for(int c = 0; c < n; c++)
+							{
+								dest[c] = apply(dest[c], src[c + j]);
+							}
+						}
+					}
+				}
+				return dest;
+			}
+
+		private:
+			static float identity()
+			{
+				return take_max ? -FLT_MAX : FLT_MAX;
+			}
+
+			static float apply(float a, float b)
+			{
+				return take_max ? std::max(a, b) : std::min(a, b);
+			}
+
+			// operand row i with kernel_cols / 2 identity pixels in front, computed once per strip
+			const float* fetch(state& s, int i) const
+			{
+				int slot = i % kernel_rows;
+				if(s.ring_row[slot] != i)
+				{
+					const float* src = child.eval_row(s.child, i);
+					std::copy(src, src + cols(), s.ring[slot].begin() + kernel_cols / 2);
+					s.ring_row[slot] = i;
+				}
+				return s.ring[slot].data();
+			}
+
+			static const int band_rows = 16;
+
+			child_type child;
+			int kernel_rows;
+			int kernel_cols;
+			std::vector<float> mask;
+			bool rectangular;
+		};
+
+		// Separable convolution of an expression with reflect101 borders, using the SIMD spans of convolve_separable_32f_c1
+		template<typename child_type>
+		class separable_node : public expr<separable_node<child_type>>
+		{
+		public:
+			struct state
+			{
+				typename child_type::state child;
+				std::vector<std::vector<float>> ring;
+				std::vector<int> ring_row;
+				std::vector<const float*> taps;
+				std::vector<float> line;
+				std::vector<float> row;
+			};
+
+			separable_node(const child_type& child_, const std::vector<float>& row_kernel_, const std::vector<float>& col_kernel_)
+				: child(child_), row_kernel(row_kernel_), col_kernel(col_kernel_)
+			{
+			}
+
+			int rows() const { return child.rows(); }
+			int cols() const { return child.cols(); }
+
+			state make_state() const
+			{
+				state s;
+				s.child = child.make_state();
+				s.ring.assign(col_kernel.size(), std::vector<float>(cols() + row_kernel.size() - 1));
+				s.ring_row.assign(col_kernel.size(), -1);
+				s.taps.resize(std::max(row_kernel.size(), col_kernel.size()));
+				s.line.resize(cols() + row_kernel.size() - 1);
+				s.row.resize(cols());
+				return s;
+			}
+
+			const float* eval_row(state& s, int r) const
+			{
+				const detail::cpu_conv_kernel row_k(row_kernel.data(), int(row_kernel.size()));
+				const detail::cpu_conv_kernel col_k(col_kernel.data(), int(col_kernel.size()));
+				const cpu::simd_level level = cpu::active_simd_level();
+				// column pass over padded rows, then row pass over the padded line
+				for(int i = 0; i < col_k.size; i++)
+				{
+					s.taps[i] = fetch(s, cpu::replicate(cpu::reflect101(r - col_k.anchor + i, rows()), rows()), row_k);
+				}
+				detail::convolve_span(s.taps.data(), s.line.data(), int(s.line.size()), col_k, level);
+				for(int j = 0; j < row_k.size; j++)
+				{
+					s.taps[j] = s.line.data() + j;
+				}
+				detail::convolve_span(s.taps.data(), s.row.data(), cols(), row_k, level);
+				return s.row.data();
+			}
+
+		private:
+			// the rows a window maps to are consecutive, so ring slots never collide within one output row
+			const float* fetch(state& s, int i, const detail::cpu_conv_kernel& row_k) const
+			{
+				int slot = i % int(col_kernel.size());
+				if(s.ring_row[slot] != i)
+				{
+					detail::load_padded_row(child.eval_row(s.child, i), cols(), 0, cols(), row_k.anchor, row_k.size, s.ring[slot].data());
+					s.ring_row[slot] = i;
+				}
+				return s.ring[slot].data();
+			}
+
+			child_type child;
+			std::vector<float> row_kernel;
+			std::vector<float> col_kernel;
+		};
+
+		namespace ops
+		{
+			struct add { float operator()(float a, float b) const { return a + b; } };
+			struct subtract { float operator()(float a, float b) const { return a - b; } };
+			struct multiply { float operator()(float a, float b) const { return a * b; } };
+			struct divide { float operator()(float a, float b) const { return a / b; } };
+			struct minimum { float operator()(float a, float b) const { return std::min(a, b); } };
+			struct maximum { float operator()(float a, float b) const { return std::max(a, b); } };
+
+			// alpha * v + beta, also used for the scalar forms of + - * /
+			struct scale
+			{
+				float alpha, beta;
+				float operator()(float v) const { return v * alpha + beta; }
+			};
+
+			struct divide_scalar
+			{
+				float numerator;
+				float operator()(float v) const { return numerator / v; }
+			};
+
+			struct log { float operator()(float v) const { return std::log(v); } };
+			struct abs { float operator()(float v) const { return std::fabs(v); } };
+
+			struct threshold
+			{
+				float thresh, max_value;
+				int type;
+				float operator()(float v) const
+				{
+					switch(type)
+					{
+					case cv::THRESH_BINARY_INV: return v > thresh ? 0.0f : max_value;
+					case cv::THRESH_TRUNC: return v > thresh ? thresh : v;
+					case cv::THRESH_TOZERO: return v > thresh ? v : 0.0f;
+					case cv::THRESH_TOZERO_INV: return v > thresh ? 0.0f : v;
+					default: return v > thresh ? max_value : 0.0f;
+					}
+				}
+			};
+
+			// indices are clamped like lut_32f_c1, the table must outlive the evaluation
+			struct lut
+			{
+				const float* table;
+				int size;
+				float operator()(float v) const { return table[cpu::replicate(int(v), size)]; }
+			};
+		}
+
+		template<typename child_type, typename func_type>
+		inline map_node<child_type, func_type> map(const expr<child_type>& e, const func_type& func)
+		{
+			return map_node<child_type, func_type>(e.self(), func);
+		}
+
+		template<typename left_type, typename right_type, typename func_type>
+		inline zip_node<left_type, right_type, func_type> zip(const expr<left_type>& l, const expr<right_type>& r, const func_type& func)
+		{
+			return zip_node<left_type, right_type, func_type>(l.self(), r.self(), func);
+		}
+
+		template<typename L, typename R>
+		inline zip_node<L, R, ops::add> operator+(const expr<L>& l, const expr<R>& r) { return zip(l, r, ops::add()); }
+		template<typename L, typename R>
+		inline zip_node<L, R, ops::subtract> operator-(const expr<L>& l, const expr<R>& r) { return zip(l, r, ops::subtract()); }
+		template<typename L, typename R>
+		inline zip_node<L, R, ops::multiply> operator*(const expr<L>& l, const expr<R>& r) { return zip(l, r, ops::multiply()); }
+		template<typename L, typename R>
+		inline zip_node<L, R, ops::divide> operator/(const expr<L>& l, const expr<R>& r) { return zip(l, r, ops::divide()); }
+		template<typename L, typename R>
+		inline zip_node<L, R, ops::minimum> min(const expr<L>& l, const expr<R>& r) { return zip(l, r, ops::minimum()); }
+		template<typename L, typename R>
+		inline zip_node<L, R, ops::maximum> max(const expr<L>& l, const expr<R>& r) { return zip(l, r, ops::maximum()); }
+
+		template<typename E>
+		inline map_node<E, ops::scale> operator+(const expr<E>& e, float v) { return map(e, ops::scale{ 1.0f, v }); }
+		template<typename E>
+		inline map_node<E, ops::scale> operator+(float v, const expr<E>& e) { return map(e, ops::scale{ 1.0f, v }); }
+		template<typename E>
+		inline map_node<E, ops::scale> operator-(const expr<E>& e, float v) { return map(e, ops::scale{ 1.0f, -v }); }
+		template<typename E>
+		inline map_node<E, ops::scale> operator-(float v, const expr<E>& e) { return map(e, ops::scale{ -1.0f, v }); }
+		template<typename E>
+		inline map_node<E, ops::scale> operator*(const expr<E>& e, float v) { return map(e, ops::scale{ v, 0.0f }); }
+		template<typename E>
+		inline map_node<E, ops::scale> operator*(float v, const expr<E>& e) { return map(e, ops::scale{ v, 0.0f }); }
+		template<typename E>
+		inline map_node<E, ops::scale> operator/(const expr<E>& e, float v) { return map(e, ops::scale{ 1.0f / v, 0.0f }); }
+		template<typename E>
+		inline map_node<E, ops::divide_scalar> operator/(float v, const expr<E>& e) { return map(e, ops::divide_scalar{ v }); }
+
+		template<typename E>
+		inline map_node<E, ops::scale> scale(const expr<E>& e, float alpha, float beta = 0.0f) { return map(e, ops::scale{ alpha, beta }); }
+		template<typename E>
+		inline map_node<E, ops::log> log(const expr<E>& e) { return map(e, ops::log()); }
+		template<typename E>
+		inline map_node<E, ops::abs> abs(const expr<E>& e) { return map(e, ops::abs()); }
+		template<typename E>
+		inline map_node<E, ops::threshold> threshold(const expr<E>& e, float thresh, float max_value, int type)
+		{
+			return map(e, ops::threshold{ thresh, max_value, type });
+		}
+		template<typename E>
+		inline map_node<E, ops::lut> lut(const expr<E>& e, const std::vector<float>& table)
+		{
+			return map(e, ops::lut{ table.data(), int(table.size()) });
+		}
+
+		template<typename E, unsigned int kernel_size>
+		inline morph_node<E, false> erode(const expr<E>& e, const kernel_wrapper<float, kernel_size>& kernel)
+		{
+			return morph_node<E, false>(e.self(), kernel);
+		}
+
+		template<typename E, unsigned int kernel_size>
+		inline morph_node<E, true> dilate(const expr<E>& e, const kernel_wrapper<float, kernel_size>& kernel)
+		{
+			return morph_node<E, true>(e.self(), kernel);
+		}
+
+		// Rectangular structuring element of any size, as erode_rect_32f_c1/dilate_rect_32f_c1
+		template<typename E>
+		inline morph_node<E, false> erode(const expr<E>& e, int kernel_rows, int kernel_cols)
+		{
+			return morph_node<E, false>(e.self(), kernel_rows, kernel_cols);
+		}
+
+		template<typename E>
+		inline morph_node<E, true> dilate(const expr<E>& e, int kernel_rows, int kernel_cols)
+		{
+			return morph_node<E, true>(e.self(), kernel_rows, kernel_cols);
+		}
+
+		template<typename E>
+		inline separable_node<E> convolve_separable(const expr<E>& e, const std::vector<float>& row_kernel, const std::vector<float>& col_kernel)
+		{
+			return separable_node<E>(e.self(), row_kernel, col_kernel);
+		}
+
+		// Same kernel as gaussian_filter_32f_c1
+		template<typename E>
+		inline separable_node<E> gaussian(const expr<E>& e, int ksize, float sigma)
+		{
+			if(ksize <= 0 && sigma > 0.0f)
+			{
+				ksize = cvRound(sigma * 6 + 1) | 1;
+			}
+			cv::Mat k = cv::getGaussianKernel(ksize, sigma, CV_32F);
+			std::vector<float> kernel(k.ptr<float>(), k.ptr<float>() + ksize);
+			return separable_node<E>(e.self(), kernel, kernel);
+		}
+
+		// Runs the whole expression in one pass, every strip of rows gets its own node state
+		template<typename expr_type>
+		inline void evaluate(cpu::thread_pool& pool, const expr<expr_type>& e, cpu::plane_view<float> dest_array)
+		{
+			const expr_type& root = e.self();
+			assert(root.rows() == dest_array.rows && root.cols() == dest_array.cols);
+			cpu::parallel_for_rows(pool, dest_array.rows, [&](int row_first, int row_last)
+			{
+				typename expr_type::state s = root.make_state();
+				for(int r = row_first; r < row_last; r++)
+				{
+					const float* src = root.eval_row(s, r);
+					std::memcpy(dest_array.row(r), src, sizeof(float) * dest_array.cols);
+				}
+			});
+		}
+	}
+}
@@ -6,6 +6,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Gaussian Blur Filter
 	inline void gaussian_filter_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array, array_view<float, 2> row_temp_array
 		, int ksize, float sigma)
@@ -17,7 +18,20 @@ namespace amp
 		cv::Mat k = cv::getGaussianKernel(ksize, sigma, CV_32F);
 		convolve_separable_32f_c1(acc_view, src_array, dest_array, row_temp_array, k, k);
 	}
+#endif
 
+	inline void gaussian_filter_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array, cpu::plane_view<float> row_temp_array
+		, int ksize, float sigma)
+	{
+		if(ksize <= 0 && sigma > 0.0f)
+		{
+			ksize = cvRound(sigma * 6 + 1) | 1;
+		}
+		cv::Mat k = cv::getGaussianKernel(ksize, sigma, CV_32F);
+		convolve_separable_32f_c1(pool, src_array, dest_array, row_temp_array, k, k);
+	}
+
+#if AMP_HAS_CPP_AMP
 	// Recursive Gaussian Blur Filter
 	inline float iir_kernel(float in, float out_1, float out_2, float out_3, const float* coefs) restrict(amp)
 	{
@@ -265,5 +279,6 @@ namespace amp
 			}
 		});
 	}
+#endif
 
 }
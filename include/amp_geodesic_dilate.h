@@ -1,9 +1,11 @@
 ﻿#pragma once
 
 #include "amp_core.h"
+#include "amp_reconstruction.h"
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Functors
 	class dilate_4_connective
 	{
@@ -553,4 +555,19 @@ namespace amp
 			geodesic_dilate_32f_c1<dilate_8_connective>(acc_view, dest_array, mask_array, temp_array, max_iter);
 		}
 	}
+#endif
+
+	// CPU backend, max_iter = 0 reconstructs completely(raster scans + queue), otherwise runs max_iter elementary geodesic dilations
+	inline void geodesic_dilate_32f_c1(cpu::thread_pool& pool, cpu::plane_view<float> dest_array, cpu::plane_view<const float> mask_array
+		, cpu::plane_view<float> temp_array, int max_iter = 0, bool connective_4 = false)
+	{
+		detail::geodesic_reconstruct<true>(pool, dest_array, mask_array, temp_array, max_iter, connective_4);
+	}
+
+	inline void geodesic_dilate_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, cpu::plane_view<const float> mask_array, cpu::plane_view<float> temp_array, int max_iter = 0, bool connective_4 = false)
+	{
+		cpu::copy<float>(pool, src_array, dest_array);
+		geodesic_dilate_32f_c1(pool, dest_array, mask_array, temp_array, max_iter, connective_4);
+	}
 }
@@ -17,19 +17,22 @@ namespace amp
 		}
 		
 		// 2.Build edge point list
-		int pt_count = count_nonzero_32f_c1(ctx.acc_view, edges_array);
+		int pt_count = count_nonzero_32f_c1(ctx.acc_view, ctx.buffers, edges_array);
 		if (pt_count == 0) return 0;
 		static const int pt_pixels_per_wi = 16;
 		static const int tile_size = 32;
 		static const int tile_static_size = tile_size * pt_pixels_per_wi;
-		concurrency::array<int_2, 1> pt_list(pt_count, ctx.acc_view);
-		concurrency::array<int, 1> global_offset(3, ctx.acc_view);
+		// temporaries come from the context's pool and go back when the leases end
+		buffer_pool::device_lease pt_buf = ctx.buffers.acquire_device<int_2>(pt_count);
+		buffer_pool::device_lease offset_buf = ctx.buffers.acquire_device<int>(3);
+		array_view<int_2, 1> pt_list = pt_buf.view<int_2>(pt_count);
+		array_view<int, 1> global_offset = offset_buf.view<int>(3);
 		concurrency::extent<2> ext_pt_list(edges_array.get_extent()[0], DIVUP(edges_array.get_extent()[1], pt_pixels_per_wi));
-		parallel_for_each(ctx.acc_view, concurrency::extent<1>(3), [&global_offset](concurrency::index<1> idx) restrict(amp)
+		parallel_for_each(ctx.acc_view, concurrency::extent<1>(3), [=](concurrency::index<1> idx) restrict(amp)
 		{
 			global_offset(idx) = 0;
 		});
-		parallel_for_each(ctx.acc_view, ext_pt_list.tile<1, tile_size>().pad(), [=, &global_offset, &pt_list](tiled_index<1, tile_size> idx) restrict(amp)
+		parallel_for_each(ctx.acc_view, ext_pt_list.tile<1, tile_size>().pad(), [=](tiled_index<1, tile_size> idx) restrict(amp)
 		{
 			tile_static int_2 local_pt_list[tile_static_size];
 			tile_static int local_idx;
@@ -74,8 +77,16 @@ namespace amp
 		const float idp = 1.0f / dp;
 		const int height = edges_array.get_extent()[0];
 		const int width = edges_array.get_extent()[1];
-		concurrency::array<int, 2> accum(cvCeil(edges_array.get_extent()[0] * idp) + 2, cvCeil(edges_array.get_extent()[1] * idp) + 2, ctx.acc_view);
-		parallel_for_each(ctx.acc_view, pt_list.get_extent().tile<tile_size_1d>().pad(), [=, &accum, &pt_list](const tiled_index<tile_size_1d> idx) restrict(amp)
+		const int accum_rows = cvCeil(edges_array.get_extent()[0] * idp) + 2;
+		const int accum_cols = cvCeil(edges_array.get_extent()[1] * idp) + 2;
+		buffer_pool::device_lease accum_buf = ctx.buffers.acquire_device<int>(accum_rows * accum_cols);
+		array_view<int, 2> accum = accum_buf.view<int>(accum_rows, accum_cols);
+		// pooled memory keeps the votes of the previous call
+		parallel_for_each(ctx.acc_view, accum.get_extent(), [=](concurrency::index<2> idx) restrict(amp)
+		{
+			accum(idx) = 0;
+		});
+		parallel_for_each(ctx.acc_view, pt_list.get_extent().tile<tile_size_1d>().pad(), [=](const tiled_index<tile_size_1d> idx) restrict(amp)
 		{
 			const int SHIFT = 10;
 			const int ONE = 1 << SHIFT;
@@ -127,8 +138,9 @@ namespace amp
 		});
 
 		// 4.Build circle center list
-		concurrency::array<int_2, 1> center_list(edges_array.get_extent().size(), ctx.acc_view);
-		concurrency::parallel_for_each(ctx.acc_view, accum.get_extent().tile<tile_size, tile_size>().pad(), [=, &accum, &center_list, &global_offset](tiled_index<tile_size, tile_size> idx) restrict(amp) {
+		buffer_pool::device_lease center_buf = ctx.buffers.acquire_device<int_2>(int(edges_array.get_extent().size()));
+		array_view<int_2, 1> center_list = center_buf.view<int_2>(int(edges_array.get_extent().size()));
+		concurrency::parallel_for_each(ctx.acc_view, accum.get_extent().tile<tile_size, tile_size>().pad(), [=](tiled_index<tile_size, tile_size> idx) restrict(amp) {
 			const int x = idx.global[1];
 			const int y = idx.global[0];
 
@@ -238,7 +250,7 @@ namespace amp
 		concurrency::extent<1> radius_ext(center_count * radius_tile_size);
 		const int hist_size = maxRadius - minRadius + 1;
 		assert(hist_size + 2 <= max_hist_size);
-		concurrency::parallel_for_each(ctx.acc_view, radius_ext.tile<radius_tile_size>().pad(), [=, &pt_list, &center_list, &global_offset](tiled_index<radius_tile_size> idx) restrict(amp) {
+		concurrency::parallel_for_each(ctx.acc_view, radius_ext.tile<radius_tile_size>().pad(), [=](tiled_index<radius_tile_size> idx) restrict(amp) {
 			tile_static int smem[max_hist_size];
 			int lid = idx.local[0];
 			for (int i = lid; i < hist_size + 2; i += idx.tile_dim0)
@@ -9,7 +9,7 @@ namespace amp
 	// Note on min_theta and max_theta params
 	// To detect horizontal lines within +/- delta range: min_theta = CV_PI / 2.0 - delta; max_theta = CV_PI / 2.0 + delta
 	// TO detect vertical lines within +/- delta range: min_theta = CV_PI - delta; max_theta = delta
-	inline int hough_lines_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float_3, 1> lines, float rho, float theta, int threshold, float min_theta, float max_theta)
+	inline int hough_lines_32f_c1(accelerator_view& acc_view, buffer_pool& buffers, array_view<const float, 2> src_array, array_view<float_3, 1> lines, float rho, float theta, int threshold, float min_theta, float max_theta)
 	{
 		// check parameters
 		assert(max_theta >= 0.0f && max_theta <= float(CV_PI));
@@ -17,19 +17,22 @@ namespace amp
 		assert(rho > 0.0f && theta > 0.0f);
 
 		// make point list
-		int pt_count = count_nonzero_32f_c1(acc_view, src_array);
+		int pt_count = count_nonzero_32f_c1(acc_view, buffers, src_array);
 		if(pt_count == 0) return 0;
 		static const int pt_pixels_per_wi = 16;
 		static const int tile_size = 32;
 		static const int tile_static_size = tile_size * pt_pixels_per_wi;
-		concurrency::array<float_2, 1> pt_list(pt_count, acc_view);
-		concurrency::array<int, 1> global_offset(2, acc_view);
+		// temporaries come from the pool and go back when the leases end
+		buffer_pool::device_lease pt_buf = buffers.acquire_device<float_2>(pt_count);
+		buffer_pool::device_lease offset_buf = buffers.acquire_device<int>(2);
+		array_view<float_2, 1> pt_list = pt_buf.view<float_2>(pt_count);
+		array_view<int, 1> global_offset = offset_buf.view<int>(2);
 		concurrency::extent<2> ext_pt_list(src_array.get_extent()[0], DIVUP(src_array.get_extent()[1], pt_pixels_per_wi));
-		parallel_for_each(acc_view, concurrency::extent<1>(2), [&global_offset](concurrency::index<1> idx) restrict(amp)
+		parallel_for_each(acc_view, concurrency::extent<1>(2), [=](concurrency::index<1> idx) restrict(amp)
 		{
 			global_offset(idx) = 0;
 		});
-		parallel_for_each(acc_view, ext_pt_list.tile<1, tile_size>().pad(), [=, &global_offset, &pt_list](tiled_index<1, tile_size> idx) restrict(amp)
+		parallel_for_each(acc_view, ext_pt_list.tile<1, tile_size>().pad(), [=](tiled_index<1, tile_size> idx) restrict(amp)
 		{
 			tile_static float_2 local_pt_list[tile_static_size];
 			tile_static int local_idx;
@@ -70,17 +73,18 @@ namespace amp
 		// accumulate(use global memory)
 		int numangle = max_theta > min_theta ? cvRound((max_theta - min_theta) / theta) : cvRound((max_theta + CV_PI - min_theta) / theta);
 		int numrho = cvRound(((src_array.get_extent()[0] + src_array.get_extent()[1]) * 2 + 1) / rho);
-		concurrency::array<int, 2> accum(numangle + 2, numrho + 2, acc_view);
+		buffer_pool::device_lease accum_buf = buffers.acquire_device<int>((numangle + 2) * (numrho + 2));
+		array_view<int, 2> accum = accum_buf.view<int>(numangle + 2, numrho + 2);
 		float irho = (float)(1 / rho);
 		size_t local_memory_needed = (numrho + 2)*sizeof(int);
 
-		parallel_for_each(acc_view, accum.get_extent(), [&accum](concurrency::index<2> idx) restrict(amp)
+		parallel_for_each(acc_view, accum.get_extent(), [=](concurrency::index<2> idx) restrict(amp)
 		{
 			accum(idx) = 0;
 		});
 		int acc_wg_size = std::min(pt_count, 1024);
 		float cv_pi_f = float(CV_PI);
-		parallel_for_each(acc_view, concurrency::extent<2>(numangle, acc_wg_size), [=, &accum, &pt_list](concurrency::index<2> idx) restrict(amp)
+		parallel_for_each(acc_view, concurrency::extent<2>(numangle, acc_wg_size), [=](concurrency::index<2> idx) restrict(amp)
 		{
 			int theta_idx = idx[0];
 			int count_idx = idx[1];
@@ -102,7 +106,7 @@ namespace amp
 		static const int getline_pixels_per_wi = 8;
 		int max_lines = lines.get_extent()[0];
 		concurrency::extent<2> getline_ext(numangle, (numrho + getline_pixels_per_wi - 1) / getline_pixels_per_wi);
-		parallel_for_each(acc_view, getline_ext, [=, &accum, &global_offset](concurrency::index<2> idx) restrict(amp)
+		parallel_for_each(acc_view, getline_ext, [=](concurrency::index<2> idx) restrict(amp)
 		{
 			int x0 = idx[1];
 			int y = idx[0];
@@ -127,4 +131,15 @@ namespace amp
 		concurrency::copy(global_offset.section(1, 1), &lines_count);
 		return std::min(lines_count, max_lines);
 	}
+
+	inline int hough_lines_32f_c1(vision_context& ctx, array_view<const float, 2> src_array, array_view<float_3, 1> lines, float rho, float theta, int threshold, float min_theta, float max_theta)
+	{
+		return hough_lines_32f_c1(ctx.acc_view, ctx.buffers, src_array, lines, rho, theta, threshold, min_theta, max_theta);
+	}
+
+	inline int hough_lines_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float_3, 1> lines, float rho, float theta, int threshold, float min_theta, float max_theta)
+	{
+		buffer_pool buffers(acc_view);
+		return hough_lines_32f_c1(acc_view, buffers, src_array, lines, rho, theta, threshold, min_theta, max_theta);
+	}
 }
@@ -0,0 +1,229 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <initializer_list>
+#include <algorithm>
+#include "amp_cpu.h"
+#include <opencv2/core/core.hpp>
+
+namespace amp
+{
+	enum class pixel_depth { u8 = 0, u16 = 1, f32 = 2 };
+	enum class pixel_layout { interleaved = 0, planar = 1 };
+
+	inline int pixel_depth_size(pixel_depth depth)
+	{
+		return depth == pixel_depth::u8 ? 1 : (depth == pixel_depth::u16 ? 2 : 4);
+	}
+
+	// Non-owning view of an image in caller memory.
+	// Interleaved images have one pointer with the channels side by side, planar images have one pointer per channel.
+	// row_stride is in bytes and shared by all planes, 0 means tightly packed rows.
+	class image_view
+	{
+	public:
+		static const int max_channels = 4;
+
+		image_view()
+			: rows(0), cols(0), channels(0), depth(pixel_depth::u8), layout(pixel_layout::interleaved), row_stride(0)
+		{
+			std::fill(planes, planes + max_channels, nullptr);
+		}
+
+		image_view(void* data, int rows_, int cols_, pixel_depth depth_, int channels_ = 1, size_t row_stride_ = 0)
+			: rows(rows_), cols(cols_), channels(channels_), depth(depth_), layout(pixel_layout::interleaved)
+			, row_stride(row_stride_ > 0 ? row_stride_ : size_t(cols_) * channels_ * pixel_depth_size(depth_))
+		{
+			if(channels_ < 1 || channels_ > max_channels) throw std::runtime_error("image_view supports 1 to 4 channels");
+			std::fill(planes, planes + max_channels, nullptr);
+			planes[0] = static_cast<unsigned char*>(data);
+		}
+
+		image_view(std::initializer_list<void*> planes_, int rows_, int cols_, pixel_depth depth_, size_t row_stride_ = 0)
+			: rows(rows_), cols(cols_), channels(int(planes_.size())), depth(depth_), layout(pixel_layout::planar)
+			, row_stride(row_stride_ > 0 ? row_stride_ : size_t(cols_) * pixel_depth_size(depth_))
+		{
+			if(channels < 1 || channels > max_channels) throw std::runtime_error("image_view supports 1 to 4 channels");
+			std::fill(planes, planes + max_channels, nullptr);
+			std::transform(planes_.begin(), planes_.end(), planes, [](void* p) { return static_cast<unsigned char*>(p); });
+		}
+
+		// Views the Mat memory, the Mat has to outlive the view
+		explicit image_view(const cv::Mat& mat)
+			: image_view(mat.data, mat.rows, mat.cols, depth_of(mat), mat.channels(), mat.step[0])
+		{
+		}
+
+		int pixel_size() const
+		{
+			return pixel_depth_size(depth);
+		}
+
+		// distance between neighbouring pixels of one channel, in elements
+		int pixel_step() const
+		{
+			return layout == pixel_layout::interleaved ? channels : 1;
+		}
+
+		template<typename value_type>
+		value_type* ptr(int channel, int row) const
+		{
+			unsigned char* base = layout == pixel_layout::planar ? planes[channel] : planes[0] + channel * pixel_size();
+			return reinterpret_cast<value_type*>(base + row_stride * size_t(row));
+		}
+
+		// One channel as a plane CPU kernels consume without a copy, needs a planar or single channel image
+		template<typename value_type>
+		cpu::plane_view<value_type> plane(int channel = 0) const
+		{
+			assert(sizeof(value_type) == size_t(pixel_size()) && pixel_step() == 1 && row_stride % sizeof(value_type) == 0);
+			return cpu::plane_view<value_type>(ptr<value_type>(channel, 0), rows, cols, int(row_stride / sizeof(value_type)));
+		}
+
+		// Bytes of one channel from its first pixel to the end of its last pixel
+		size_t channel_span() const
+		{
+			return rows > 0 ? row_stride * size_t(rows - 1) + size_t((cols - 1) * pixel_step() + 1) * pixel_size() : 0;
+		}
+
+		// Accelerators read the memory as dwords, this holds when every plane and row starts on a dword
+		bool is_dword_aligned() const
+		{
+			for(int i = 0; i < (layout == pixel_layout::planar ? channels : 1); i++)
+			{
+				if(reinterpret_cast<std::uintptr_t>(planes[i]) % 4 != 0) return false;
+			}
+			return row_stride % 4 == 0;
+		}
+
+		bool is_continuous() const
+		{
+			return row_stride == size_t(cols) * pixel_step() * pixel_size();
+		}
+
+		static pixel_depth depth_of(const cv::Mat& mat)
+		{
+			switch(mat.depth())
+			{
+			case CV_8U:
+				return pixel_depth::u8;
+			case CV_16U:
+				return pixel_depth::u16;
+			case CV_32F:
+				return pixel_depth::f32;
+			default:
+				throw std::runtime_error("image_view supports CV_8U, CV_16U and CV_32F");
+			}
+		}
+
+		unsigned char* planes[max_channels];
+		int rows;
+		int cols;
+		int channels;
+		pixel_depth depth;
+		pixel_layout layout;
+		size_t row_stride;
+	};
+
+	namespace detail
+	{
+		inline unsigned char saturate_to_8u(float f)
+		{
+			return (unsigned char)(std::min(std::max(f, 0.0f), 255.0f) + 0.5f);
+		}
+
+		inline unsigned short saturate_to_16u(float f)
+		{
+			return (unsigned short)(std::min(std::max(f, 0.0f), 65535.0f) + 0.5f);
+		}
+
+		template<typename src_type, typename value_type>
+		inline void convert_row(const src_type* src, int src_step, value_type* dest, int cols, float scale)
+		{
+			if(scale == 1.0f)
+			{
+				for(int c = 0; c < cols; c++)
+				{
+					dest[c] = value_type(src[c * src_step]);
+				}
+			}
+			else
+			{
+				for(int c = 0; c < cols; c++)
+				{
+					dest[c] = value_type(float(src[c * src_step]) * scale);
+				}
+			}
+		}
+
+		// Converts one channel of the image into a plane on the CPU, rows are read in place
+		template<typename value_type>
+		inline void load_image_channel(cpu::thread_pool& pool, const image_view& src, int channel, cpu::plane_view<value_type> destView, float scale = 1.0f)
+		{
+			const int pixel_step = src.pixel_step();
+			cpu::parallel_for_rows(pool, destView.rows, [&](int row_first, int row_last)
+			{
+				for(int r = row_first; r < row_last; r++)
+				{
+					switch(src.depth)
+					{
+					case pixel_depth::u8:
+						convert_row(src.ptr<const unsigned char>(channel, r), pixel_step, destView.row(r), destView.cols, scale);
+						break;
+					case pixel_depth::u16:
+						convert_row(src.ptr<const unsigned short>(channel, r), pixel_step, destView.row(r), destView.cols, scale);
+						break;
+					case pixel_depth::f32:
+						convert_row(src.ptr<const float>(channel, r), pixel_step, destView.row(r), destView.cols, scale);
+						break;
+					}
+				}
+			});
+		}
+
+		// Writes a plane into one channel of the image on the CPU, integer depths saturate
+		inline void save_image_channel(cpu::thread_pool& pool, cpu::plane_view<const float> srcView, const image_view& dest, int channel)
+		{
+			const int pixel_step = dest.pixel_step();
+			cpu::parallel_for_rows(pool, srcView.rows, [&](int row_first, int row_last)
+			{
+				for(int r = row_first; r < row_last; r++)
+				{
+					const float* src_row = srcView.row(r);
+					switch(dest.depth)
+					{
+					case pixel_depth::u8:
+						{
+							unsigned char* dest_row = dest.ptr<unsigned char>(channel, r);
+							for(int c = 0; c < srcView.cols; c++)
+							{
+								dest_row[c * pixel_step] = saturate_to_8u(src_row[c]);
+							}
+						}
+						break;
+					case pixel_depth::u16:
+						{
+							unsigned short* dest_row = dest.ptr<unsigned short>(channel, r);
+							for(int c = 0; c < srcView.cols; c++)
+							{
+								dest_row[c * pixel_step] = saturate_to_16u(src_row[c]);
+							}
+						}
+						break;
+					case pixel_depth::f32:
+						{
+							float* dest_row = dest.ptr<float>(channel, r);
+							for(int c = 0; c < srcView.cols; c++)
+							{
+								dest_row[c * pixel_step] = src_row[c];
+							}
+						}
+						break;
+					}
+				}
+			});
+		}
+	}
+}
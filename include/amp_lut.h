@@ -4,6 +4,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Look-up Table
 	template<typename source_t>
 	inline void lut_32f_c1(accelerator_view& acc_view, array_view<source_t, 2> src_array, array_view<const float, 1> lut, array_view<float, 2> dest_array)
@@ -17,4 +18,67 @@ namespace amp
 			guarded_write(dest_array, idx.global, lut(index));
 		});
 	}
+#endif
+
+	template<typename source_t>
+	inline void lut_32f_c1(cpu::thread_pool& pool, cpu::plane_view<source_t> src_array, const std::vector<float>& lut, cpu::plane_view<float> dest_array)
+	{
+		int lut_max = int(lut.size()) - 1;
+		cpu::parallel_for_rows(pool, dest_array.rows, [&](int row_first, int row_last)
+		{
+			for(int r = row_first; r < row_last; r++)
+			{
+				const source_t* src_row = src_array.row(r);
+				float* dest_row = dest_array.row(r);
+				for(int c = 0; c < dest_array.cols; c++)
+				{
+					dest_row[c] = lut[cpu::replicate(int(src_row[c]), lut_max + 1)];
+				}
+			}
+		});
+	}
+
+	namespace detail
+	{
+		// Table lookups stay scalar, there is no byte gather below AVX-512 VBMI
+		template<typename value_type>
+		inline void lut_packed(cpu::thread_pool& pool, cpu::plane_view<const value_type> src_array, const std::vector<value_type>& lut, cpu::plane_view<value_type> dest_array)
+		{
+			int lut_max = int(lut.size()) - 1;
+			cpu::parallel_for_rows(pool, dest_array.rows, [&](int row_first, int row_last)
+			{
+				for(int r = row_first; r < row_last; r++)
+				{
+					const value_type* src_row = src_array.row(r);
+					value_type* dest_row = dest_array.row(r);
+					int c = 0;
+					for(; c + 4 <= dest_array.cols; c += 4)
+					{
+						value_type v0 = lut[std::min(int(src_row[c]), lut_max)];
+						value_type v1 = lut[std::min(int(src_row[c + 1]), lut_max)];
+						value_type v2 = lut[std::min(int(src_row[c + 2]), lut_max)];
+						value_type v3 = lut[std::min(int(src_row[c + 3]), lut_max)];
+						dest_row[c] = v0;
+						dest_row[c + 1] = v1;
+						dest_row[c + 2] = v2;
+						dest_row[c + 3] = v3;
+					}
+					for(; c < dest_array.cols; c++)
+					{
+						dest_row[c] = lut[std::min(int(src_row[c]), lut_max)];
+					}
+				}
+			});
+		}
+	}
+
+	inline void lut_8u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array, const std::vector<unsigned char>& lut, cpu::plane_view<unsigned char> dest_array)
+	{
+		detail::lut_packed(pool, src_array, lut, dest_array);
+	}
+
+	inline void lut_16u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned short> src_array, const std::vector<unsigned short>& lut, cpu::plane_view<unsigned short> dest_array)
+	{
+		detail::lut_packed(pool, src_array, lut, dest_array);
+	}
 }
@@ -4,6 +4,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Max and Mean value
 	inline std::pair<float, float> max_min_value_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> temp_array)
 	{
@@ -118,5 +119,30 @@ namespace amp
 		result.second = *std::min_element(cpu_temp.begin() + src_cols, cpu_temp.end());
 		return result;
 	}
+#endif
 
+	// CPU backend
+	inline std::pair<float, float> max_min_value_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array)
+	{
+		std::pair<float, float> result(-FLT_MAX, FLT_MAX);
+		std::mutex merge_mutex;
+		cpu::parallel_for_rows(pool, src_array.rows, [&](int row_first, int row_last)
+		{
+			float max_value = -FLT_MAX;
+			float min_value = FLT_MAX;
+			for(int r = row_first; r < row_last; r++)
+			{
+				const float* src_row = src_array.row(r);
+				for(int c = 0; c < src_array.cols; c++)
+				{
+					max_value = std::max(max_value, src_row[c]);
+					min_value = std::min(min_value, src_row[c]);
+				}
+			}
+			std::lock_guard<std::mutex> guard(merge_mutex);
+			result.first = std::max(result.first, max_value);
+			result.second = std::min(result.second, min_value);
+		});
+		return result;
+	}
 }
@@ -4,6 +4,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	inline std::pair<float, float> mean_std_dev_32f_c1(accelerator_view& acc_view, array_view<const float, 2> srcArray)
 	{
 		static const int tile_size = 1024;
@@ -79,5 +80,32 @@ namespace amp
 		float stddev = std::sqrtf(std::max<float>(std::accumulate(cpu_part_sqsum.begin(), cpu_part_sqsum.end(), 0.0f) / float(total) - mean * mean, 0.0f));
 		return std::pair<float, float>(mean, stddev);
 	}
+#endif
 
+	// CPU backend, strips accumulate in double before merging
+	inline std::pair<float, float> mean_std_dev_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> srcArray)
+	{
+		double sum = 0.0, sqsum = 0.0;
+		std::mutex merge_mutex;
+		cpu::parallel_for_rows(pool, srcArray.rows, [&](int row_first, int row_last)
+		{
+			double part_sum = 0.0, part_sqsum = 0.0;
+			for(int r = row_first; r < row_last; r++)
+			{
+				const float* src_row = srcArray.row(r);
+				for(int c = 0; c < srcArray.cols; c++)
+				{
+					part_sum += src_row[c];
+					part_sqsum += double(src_row[c]) * src_row[c];
+				}
+			}
+			std::lock_guard<std::mutex> guard(merge_mutex);
+			sum += part_sum;
+			sqsum += part_sqsum;
+		});
+		double total = double(srcArray.rows) * srcArray.cols;
+		double mean = sum / total;
+		double stddev = std::sqrt(std::max(sqsum / total - mean * mean, 0.0));
+		return std::pair<float, float>(float(mean), float(stddev));
+	}
 }
@@ -4,6 +4,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// 3x3 Median Filter
 #define median_op(a,b) {mid=a; a=fminf(a,b); b=fmaxf(mid,b);}
 	inline void median_filter_3x3_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array)
@@ -101,5 +102,405 @@ namespace amp
 		});
 	}
 #undef median_op
+#endif
 
+	// CPU backend
+	namespace detail
+	{
+		inline int median_border_index(int i, int n)
+		{
+			return cpu::replicate(cpu::reflect101(i, n), n);
+		}
+
+		// Compare-exchange pairs of the networks above, the first of a pair gets the min
+		inline const unsigned char (*median_network(int ksize, int& pair_count))[2]
+		{
+			static const unsigned char network_3x3[][2] =
+			{
+				{ 1, 2 }, { 4, 5 }, { 7, 8 }, { 0, 1 }, { 3, 4 }, { 6, 7 }, { 1, 2 }, { 4, 5 }, { 7, 8 }, { 0, 3 },
+				{ 5, 8 }, { 4, 7 }, { 3, 6 }, { 1, 4 }, { 2, 5 }, { 4, 7 }, { 4, 2 }, { 6, 4 }, { 4, 2 }
+			};
+			static const unsigned char network_5x5[][2] =
+			{
+				{ 1, 2 }, { 0, 1 }, { 1, 2 }, { 4, 5 }, { 3, 4 }, { 4, 5 }, { 0, 3 }, { 2, 5 }, { 2, 3 }, { 1, 4 },
+				{ 1, 2 }, { 3, 4 }, { 7, 8 }, { 6, 7 }, { 7, 8 }, { 10, 11 }, { 9, 10 }, { 10, 11 }, { 6, 9 }, { 8, 11 },
+				{ 8, 9 }, { 7, 10 }, { 7, 8 }, { 9, 10 }, { 0, 6 }, { 4, 10 }, { 4, 6 }, { 2, 8 }, { 2, 4 }, { 6, 8 },
+				{ 1, 7 }, { 5, 11 }, { 5, 7 }, { 3, 9 }, { 3, 5 }, { 7, 9 }, { 1, 2 }, { 3, 4 }, { 5, 6 }, { 7, 8 },
+				{ 9, 10 }, { 13, 14 }, { 12, 13 }, { 13, 14 }, { 16, 17 }, { 15, 16 }, { 16, 17 }, { 12, 15 }, { 14, 17 }, { 14, 15 },
+				{ 13, 16 }, { 13, 14 }, { 15, 16 }, { 19, 20 }, { 18, 19 }, { 19, 20 }, { 21, 22 }, { 23, 24 }, { 21, 23 }, { 22, 24 },
+				{ 22, 23 }, { 18, 21 }, { 20, 23 }, { 20, 21 }, { 19, 22 }, { 22, 24 }, { 19, 20 }, { 21, 22 }, { 23, 24 }, { 12, 18 },
+				{ 16, 22 }, { 16, 18 }, { 14, 20 }, { 20, 24 }, { 14, 16 }, { 18, 20 }, { 22, 24 }, { 13, 19 }, { 17, 23 }, { 17, 19 },
+				{ 15, 21 }, { 15, 17 }, { 19, 21 }, { 13, 14 }, { 15, 16 }, { 17, 18 }, { 19, 20 }, { 21, 22 }, { 23, 24 }, { 0, 12 },
+				{ 8, 20 }, { 8, 12 }, { 4, 16 }, { 16, 24 }, { 12, 16 }, { 2, 14 }, { 10, 22 }, { 10, 14 }, { 6, 18 }, { 6, 10 },
+				{ 10, 12 }, { 1, 13 }, { 9, 21 }, { 9, 13 }, { 5, 17 }, { 13, 17 }, { 3, 15 }, { 11, 23 }, { 11, 15 }, { 7, 19 },
+				{ 7, 11 }, { 11, 13 }, { 11, 12 }
+			};
+			pair_count = ksize == 3 ? int(sizeof(network_3x3) / sizeof(network_3x3[0])) : int(sizeof(network_5x5) / sizeof(network_5x5[0]));
+			return ksize == 3 ? network_3x3 : network_5x5;
+		}
+
+		// The 3x3/5x5 networks run on line chunks, one line per window pixel, so every compare-exchange is a vector min/max
+		template<typename value_type>
+		inline void median_network_filter(cpu::thread_pool& pool, cpu::plane_view<const value_type> src_array, cpu::plane_view<value_type> dest_array, int ksize)
+		{
+			static const int chunk_cols = 256;
+			int pair_count = 0;
+			const unsigned char (*pairs)[2] = median_network(ksize, pair_count);
+			const cpu::simd_level level = cpu::active_simd_level();
+			const int rows = src_array.rows;
+			const int cols = src_array.cols;
+			const int radius = ksize / 2;
+			const int window = ksize * ksize;
+			cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+			{
+				// one line per window pixel and a spare taking the max of a compare-exchange
+				std::vector<value_type> storage(size_t(window + 1) * chunk_cols);
+				std::vector<value_type*> lines(window);
+				for(int r = row_first; r < row_last; r++)
+				{
+					for(int c0 = 0; c0 < cols; c0 += chunk_cols)
+					{
+						const int n = std::min(chunk_cols, cols - c0);
+						for(int i = 0; i < window; i++)
+						{
+							value_type* line = &storage[size_t(i) * chunk_cols];
+							const value_type* src_row = src_array.row(median_border_index(r - radius + i / ksize, rows));
+							const int offset = c0 + i % ksize - radius;
+							const int inner_first = std::min(n, std::max(0, -offset));
+							const int inner_last = std::max(inner_first, std::min(n, cols - offset));
+							for(int c = 0; c < inner_first; c++)
+								line[c] = src_row[median_border_index(offset + c, cols)];
+							std::copy(src_row + offset + inner_first, src_row + offset + inner_last, line + inner_first);
+							for(int c = inner_last; c < n; c++)
+								line[c] = src_row[median_border_index(offset + c, cols)];
+							lines[i] = line;
+						}
+						value_type* spare = &storage[size_t(window) * chunk_cols];
+						for(int k = 0; k < pair_count; k++)
+						{
+							value_type*& a = lines[pairs[k][0]];
+							value_type*& b = lines[pairs[k][1]];
+							cpu::max_row(a, b, spare, n, level);
+							cpu::min_row(a, b, a, n, level);
+							std::swap(b, spare);
+						}
+						std::copy(lines[window / 2], lines[window / 2] + n, dest_array.row(r) + c0);
+					}
+				}
+			});
+		}
+
+		// 16-bin histograms: hist += enter - leave
+		inline void median_add_bins_scalar(unsigned short* hist, const unsigned short* enter, const unsigned short* leave)
+		{
+			for(int i = 0; i < 16; i++)
+				hist[i] = (unsigned short)(hist[i] + enter[i] - leave[i]);
+		}
+
+		// Bin holding the rank-th(0-based) sample, below grows by the samples of the bins before it
+		inline int median_find_bin_scalar(const unsigned short* hist, int rank, int& below)
+		{
+			int bin = 0;
+			while(below + hist[bin] <= rank)
+			{
+				below += hist[bin];
+				bin++;
+			}
+			return bin;
+		}
+
+#if AMP_CPU_X86
+		AMP_CPU_TARGET("sse4.1")
+		inline void median_add_bins_sse4(unsigned short* hist, const unsigned short* enter, const unsigned short* leave)
+		{
+			for(int i = 0; i < 16; i += 8)
+			{
+				__m128i vh = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hist + i));
+				vh = _mm_add_epi16(vh, _mm_loadu_si128(reinterpret_cast<const __m128i*>(enter + i)));
+				vh = _mm_sub_epi16(vh, _mm_loadu_si128(reinterpret_cast<const __m128i*>(leave + i)));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(hist + i), vh);
+			}
+		}
+
+		// The bin is the number of running sums at or below rank - below, without a data dependent branch per bin
+		AMP_CPU_TARGET("sse4.1")
+		inline int median_find_bin_sse4(const unsigned short* hist, int rank, int& below)
+		{
+			__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hist));
+			__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hist + 8));
+			lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 2));
+			hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 2));
+			lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 4));
+			hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 4));
+			lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 8));
+			hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 8));
+			hi = _mm_add_epi16(hi, _mm_shuffle_epi32(_mm_shufflehi_epi16(lo, 0xff), 0xff));
+			// running sums are at most 255 * 255, so they compare as unsigned: sum <= target as min(sum, target) == sum
+			const __m128i target = _mm_set1_epi16(short(rank - below));
+			const __m128i lo_in = _mm_cmpeq_epi16(_mm_min_epu16(lo, target), lo);
+			const __m128i hi_in = _mm_cmpeq_epi16(_mm_min_epu16(hi, target), hi);
+			const __m128i counts = _mm_sad_epu8(_mm_sub_epi8(_mm_setzero_si128(), _mm_packs_epi16(lo_in, hi_in)), _mm_setzero_si128());
+			const int bin = _mm_cvtsi128_si32(counts) + _mm_extract_epi16(counts, 4);
+			if(bin > 0)
+			{
+				unsigned short sums[16];
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(sums), lo);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(sums + 8), hi);
+				below += sums[bin - 1];
+			}
+			return bin;
+		}
+#endif
+
+		inline void median_add_bins(unsigned short* hist, const unsigned short* enter, const unsigned short* leave, cpu::simd_level level)
+		{
+#if AMP_CPU_X86
+			if(level != cpu::simd_level::scalar)
+			{
+				median_add_bins_sse4(hist, enter, leave);
+				return;
+			}
+#endif
+			(void)level;
+			median_add_bins_scalar(hist, enter, leave);
+		}
+
+		inline int median_find_bin(const unsigned short* hist, int rank, int& below, cpu::simd_level level)
+		{
+#if AMP_CPU_X86
+			if(level != cpu::simd_level::scalar)
+				return median_find_bin_sse4(hist, rank, below);
+#endif
+			(void)level;
+			return median_find_bin_scalar(hist, rank, below);
+		}
+
+		// Window histogram of 8-bit keys over a band of rows(Perreault-Hebert).
+		// Every column keeps a coarse(high nibble) and a fine histogram, updated by one row in and one row out per output row.
+		// Sliding the window one column adds/subtracts one coarse column histogram, and the fine window histogram is only
+		// brought up to date for the coarse bin holding the wanted rank, so the cost per pixel doesn't depend on ksize.
+		class median_key_histogram
+		{
+		public:
+			median_key_histogram(int cols_, int ksize_, cpu::simd_level level_)
+				: cols(cols_), ksize(ksize_), radius(ksize_ / 2), level(level_), column_coarse(size_t(cols_) * 16), column_fine(size_t(cols_) * 256)
+			{
+				std::fill(zero, zero + 16, 0);
+			}
+
+			void add(int col, unsigned int key, int delta)
+			{
+				column_coarse[size_t(col) * 16 + (key >> 4)] += delta;
+				// fine histograms of one coarse bin are adjacent across columns
+				column_fine[(size_t(key >> 4) * cols + col) * 16 + (key & 15)] += delta;
+			}
+
+			// Window over columns -radius .. radius
+			void start_row()
+			{
+				std::fill(coarse, coarse + 16, 0);
+				for(int i = -radius; i <= radius; i++)
+					median_add_bins(coarse, &column_coarse[size_t(median_border_index(i, cols)) * 16], zero, level);
+				std::fill(fine_end, fine_end + 16, std::numeric_limits<int>::min() / 2);
+			}
+
+			// Window over columns x - radius .. x + radius, called for x = 1, 2, ...
+			void slide(int x)
+			{
+				const unsigned short* enter = &column_coarse[size_t(median_border_index(x + radius, cols)) * 16];
+				const unsigned short* leave = &column_coarse[size_t(median_border_index(x - radius - 1, cols)) * 16];
+				median_add_bins(coarse, enter, leave, level);
+			}
+
+			// Key of the rank-th(0-based) sample of the window at x, below = number of samples under that key
+			unsigned int find(int x, int rank, int& below)
+			{
+				below = 0;
+				const int b = median_find_bin(coarse, rank, below, level);
+				unsigned short* hist = fine[b];
+				if(fine_end[b] <= x - radius)
+				{
+					// nothing in common with the window, rebuild
+					std::fill(hist, hist + 16, 0);
+					for(int p = x - radius; p <= x + radius; p++)
+						median_add_bins(hist, fine_column(b, p), zero, level);
+				}
+				else
+				{
+					for(int p = fine_end[b]; p <= x + radius; p++)
+						median_add_bins(hist, fine_column(b, p), fine_column(b, p - ksize), level);
+				}
+				fine_end[b] = x + radius + 1;
+				return unsigned(b * 16 + median_find_bin(hist, rank, below, level));
+			}
+
+		private:
+			const unsigned short* fine_column(int b, int p) const
+			{
+				return &column_fine[(size_t(b) * cols + median_border_index(p, cols)) * 16];
+			}
+
+			int cols;
+			int ksize;
+			int radius;
+			cpu::simd_level level;
+			std::vector<unsigned short> column_coarse;
+			std::vector<unsigned short> column_fine;
+			unsigned short coarse[16];
+			unsigned short fine[16][16];
+			// fine[b] holds columns fine_end[b] - ksize .. fine_end[b] - 1
+			int fine_end[16];
+			unsigned short zero[16];
+		};
+
+		// Each band starts by filling the column histograms with ksize rows, so bands are kept several windows tall
+		template<typename Func>
+		inline void median_row_bands(cpu::thread_pool& pool, int rows, int ksize, const Func& func)
+		{
+			const int band_rows = std::max(4 * ksize, (rows + pool.size() * 2 - 1) / (pool.size() * 2));
+			pool.parallel_for(0, rows, band_rows, func);
+		}
+
+		inline void median_histogram_8u(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array, cpu::plane_view<unsigned char> dest_array, int ksize)
+		{
+			const int rows = src_array.rows;
+			const int cols = src_array.cols;
+			const int radius = ksize / 2;
+			const int rank = ksize * ksize / 2;
+			const cpu::simd_level level = cpu::active_simd_level();
+			median_row_bands(pool, rows, ksize, [&](int row_first, int row_last)
+			{
+				median_key_histogram hist(cols, ksize, level);
+				auto add_row = [&](int r, int delta)
+				{
+					const unsigned char* src_row = src_array.row(median_border_index(r, rows));
+					for(int c = 0; c < cols; c++)
+						hist.add(c, src_row[c], delta);
+				};
+				for(int i = -radius; i <= radius; i++)
+					add_row(row_first + i, 1);
+				for(int r = row_first; r < row_last; r++)
+				{
+					if(r > row_first)
+					{
+						add_row(r - radius - 1, -1);
+						add_row(r + radius, 1);
+					}
+					unsigned char* dest_row = dest_array.row(r);
+					hist.start_row();
+					for(int x = 0; x < cols; x++)
+					{
+						if(x > 0)
+							hist.slide(x);
+						int below;
+						dest_row[x] = (unsigned char)hist.find(x, rank, below);
+					}
+				}
+			});
+		}
+
+		// Fine column histograms of 16-bit values would take 128 KB per column, so the column histograms only cover
+		// the high byte. The low-byte histograms of every high byte are kept for the window of the current row and
+		// updated from the ksize pixels of the columns entering and leaving it.
+		inline void median_histogram_16u(cpu::thread_pool& pool, cpu::plane_view<const unsigned short> src_array, cpu::plane_view<unsigned short> dest_array, int ksize)
+		{
+			const int rows = src_array.rows;
+			const int cols = src_array.cols;
+			const int radius = ksize / 2;
+			const int rank = ksize * ksize / 2;
+			const cpu::simd_level level = cpu::active_simd_level();
+			median_row_bands(pool, rows, ksize, [&](int row_first, int row_last)
+			{
+				median_key_histogram hist(cols, ksize, level);
+				// [high][low] and [high][low >> 4]
+				std::vector<unsigned short> low(256 * 256);
+				std::vector<unsigned short> low_groups(256 * 16);
+				std::vector<const unsigned short*> window_rows(ksize);
+				auto add_row = [&](int r, int delta)
+				{
+					const unsigned short* src_row = src_array.row(median_border_index(r, rows));
+					for(int c = 0; c < cols; c++)
+						hist.add(c, src_row[c] >> 8, delta);
+				};
+				auto add_column = [&](int p, int delta)
+				{
+					const int col = median_border_index(p, cols);
+					for(int i = 0; i < ksize; i++)
+					{
+						const unsigned int value = window_rows[i][col];
+						low[value] += delta;
+						low_groups[value >> 4] += delta;
+					}
+				};
+				for(int i = -radius; i <= radius; i++)
+					add_row(row_first + i, 1);
+				for(int r = row_first; r < row_last; r++)
+				{
+					if(r > row_first)
+					{
+						add_row(r - radius - 1, -1);
+						add_row(r + radius, 1);
+					}
+					for(int i = 0; i < ksize; i++)
+						window_rows[i] = src_array.row(median_border_index(r - radius + i, rows));
+					unsigned short* dest_row = dest_array.row(r);
+					hist.start_row();
+					for(int p = -radius; p <= radius; p++)
+						add_column(p, 1);
+					for(int x = 0; x < cols; x++)
+					{
+						if(x > 0)
+						{
+							hist.slide(x);
+							add_column(x + radius, 1);
+							add_column(x - radius - 1, -1);
+						}
+						int below;
+						const unsigned int high = hist.find(x, rank, below);
+						// scalar reads, vector loads would stall on the scattered stores just above
+						const int g = median_find_bin_scalar(&low_groups[high * 16], rank, below);
+						const int f = median_find_bin_scalar(&low[high * 256 + g * 16], rank, below);
+						dest_row[x] = (unsigned short)((high << 8) | unsigned(g * 16 + f));
+					}
+					// back to empty for the next row
+					for(int p = cols - 1 - radius; p <= cols - 1 + radius; p++)
+						add_column(p, -1);
+				}
+			});
+		}
+	}
+
+	inline void median_filter_3x3_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array)
+	{
+		detail::median_network_filter(pool, src_array, dest_array, 3);
+	}
+
+	inline void median_filter_5x5_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array)
+	{
+		detail::median_network_filter(pool, src_array, dest_array, 5);
+	}
+
+	// Odd ksize up to 255. 3x3 and 5x5 run the sorting networks, larger windows the histogram median
+	// whose cost per pixel doesn't grow with ksize
+	inline void median_filter_8u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array, cpu::plane_view<unsigned char> dest_array, int ksize)
+	{
+		if(ksize < 1 || ksize % 2 == 0 || ksize > 255) throw std::runtime_error("median ksize must be odd and at most 255");
+		if(ksize == 1)
+			cpu::copy<unsigned char>(pool, src_array, dest_array);
+		else if(ksize <= 5)
+			detail::median_network_filter(pool, src_array, dest_array, ksize);
+		else
+			detail::median_histogram_8u(pool, src_array, dest_array, ksize);
+	}
+
+	inline void median_filter_16u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned short> src_array, cpu::plane_view<unsigned short> dest_array, int ksize)
+	{
+		if(ksize < 1 || ksize % 2 == 0 || ksize > 255) throw std::runtime_error("median ksize must be odd and at most 255");
+		if(ksize == 1)
+			cpu::copy<unsigned short>(pool, src_array, dest_array);
+		else if(ksize <= 5)
+			detail::median_network_filter(pool, src_array, dest_array, ksize);
+		else
+			detail::median_histogram_16u(pool, src_array, dest_array, ksize);
+	}
 }
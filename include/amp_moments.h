@@ -1,16 +1,50 @@
 ﻿#pragma once
 
+#include <cstdint>
+#include <limits>
 #include "amp_core.h"
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
+	// 64-bit unsigned sum kept as two words, C++ AMP has neither 64-bit integers nor 64-bit atomics
+	struct wide_sum
+	{
+		unsigned int lo, hi;
+
+		void clear() restrict(amp, cpu)
+		{
+			lo = 0; hi = 0;
+		}
+
+		// The thread whose add wraps lo carries into hi
+		void atomic_add(unsigned int value) restrict(amp)
+		{
+			unsigned int old = concurrency::atomic_fetch_add(&lo, value);
+			if(old + value < old)
+				concurrency::atomic_fetch_inc(&hi);
+		}
+
+		float to_float() const restrict(amp, cpu)
+		{
+			return float(hi) * 4294967296.0f + float(lo);
+		}
+
+		unsigned long long value() const
+		{
+			return (static_cast<unsigned long long>(hi) << 32) | lo;
+		}
+	};
+
 	struct moments
 	{
-		unsigned int m00, m01, m10, m02, m11, m20;
+		unsigned int m00;
+		// sums of y, x, y * y, x * y and x * x overflow 32 bits on large blobs
+		wide_sum m01, m10, m02, m11, m20;
 
 		void clear() restrict(amp, cpu)
 		{
-			m00 = 0; m01 = 0; m10 = 0; m02 = 0; m11 = 0; m20 = 0;
+			m00 = 0; m01.clear(); m10.clear(); m02.clear(); m11.clear(); m20.clear();
 		}
 	};
 
@@ -29,12 +63,83 @@ namespace amp
 				unsigned int y = idx.global[0];
 				unsigned int x = idx.global[1];
 				concurrency::atomic_fetch_inc(&gm.m00);
-				concurrency::atomic_fetch_add(&gm.m01, y);
-				concurrency::atomic_fetch_add(&gm.m10, x);
-				concurrency::atomic_fetch_add(&gm.m02, y * y);
-				concurrency::atomic_fetch_add(&gm.m11, x * y);
-				concurrency::atomic_fetch_add(&gm.m20, x * x);
+				gm.m01.atomic_add(y);
+				gm.m10.atomic_add(x);
+				gm.m02.atomic_add(y * y);
+				gm.m11.atomic_add(x * y);
+				gm.m20.atomic_add(x * x);
 			}
 		});
 	}
+#endif
+
+	// Statistics of one connected component, gathered run by run while labeling. x is the column, y the row.
+	struct component_stats
+	{
+		component_stats()
+			: area(0), min_x(std::numeric_limits<int>::max()), min_y(std::numeric_limits<int>::max()), max_x(-1), max_y(-1)
+			, sum_x(0), sum_y(0), sum_xx(0), sum_xy(0), sum_yy(0)
+		{
+		}
+
+		// Pixels x0 .. x1 - 1 of row y
+		void add_run(int y, int x0, int x1)
+		{
+			const uint64_t n = uint64_t(x1 - x0);
+			// sums of x and x * x over the run in closed form
+			const uint64_t run_x = (uint64_t(x0) + uint64_t(x1 - 1)) * n / 2;
+			const uint64_t run_xx = square_sum(x1 - 1) - square_sum(x0 - 1);
+			area += n;
+			min_x = std::min(min_x, x0);
+			max_x = std::max(max_x, x1 - 1);
+			min_y = std::min(min_y, y);
+			max_y = std::max(max_y, y);
+			sum_x += run_x;
+			sum_y += n * uint64_t(y);
+			sum_xx += run_xx;
+			sum_xy += run_x * uint64_t(y);
+			sum_yy += n * uint64_t(y) * uint64_t(y);
+		}
+
+		void merge(const component_stats& other)
+		{
+			area += other.area;
+			min_x = std::min(min_x, other.min_x);
+			min_y = std::min(min_y, other.min_y);
+			max_x = std::max(max_x, other.max_x);
+			max_y = std::max(max_y, other.max_y);
+			sum_x += other.sum_x;
+			sum_y += other.sum_y;
+			sum_xx += other.sum_xx;
+			sum_xy += other.sum_xy;
+			sum_yy += other.sum_yy;
+		}
+
+		cv::Rect bounding_box() const
+		{
+			return cv::Rect(min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
+		}
+
+		cv::Point2d centroid() const
+		{
+			return cv::Point2d(double(sum_x) / double(area), double(sum_y) / double(area));
+		}
+
+		// Raw moments in cv::Moments order(m00, m10, m01, m20, m11, m02), the third order ones are left at zero
+		cv::Moments raw_moments() const
+		{
+			return cv::Moments(double(area), double(sum_x), double(sum_y), double(sum_xx), double(sum_xy), double(sum_yy), 0.0, 0.0, 0.0, 0.0);
+		}
+
+		uint64_t area;
+		int min_x, min_y, max_x, max_y;
+		uint64_t sum_x, sum_y, sum_xx, sum_xy, sum_yy;
+
+	private:
+		// 0^2 + 1^2 + ... + k^2
+		static uint64_t square_sum(int k)
+		{
+			return k < 0 ? 0 : uint64_t(k) * uint64_t(k + 1) * uint64_t(2 * k + 1) / 6;
+		}
+	};
 }
@@ -3,10 +3,12 @@
 #include "amp_core.h"
 #include "amp_erode.h"
 #include "amp_dilate.h"
+#include "amp_fusion.h"
 
 namespace amp
 {
 	enum class morph_gradient_type { combined, internal, external };
+#if AMP_HAS_CPP_AMP
 	inline void morph_gradient_32f_c1(accelerator_view acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array
 		, array_view<float, 2> temp_array, const cv::Mat& kernel, morph_gradient_type type = morph_gradient_type::combined)
 	{
@@ -50,4 +52,45 @@ namespace amp
 			});
 		}
 	}
+#endif
+
+	// Every gradient type is a single fused pass, erode and dilate share the source rows
+	// (rectangles of any size, masked kernels up to 169 cells)
+	inline void morph_gradient_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, cpu::plane_view<float> temp_array, const cv::Mat& kernel, morph_gradient_type type = morph_gradient_type::combined)
+	{
+		(void)temp_array;
+		if(detail::is_rect_kernel(kernel))
+		{
+			auto in = fusion::input(src_array);
+			if(type == morph_gradient_type::combined)
+			{
+				fusion::evaluate(pool, fusion::dilate(in, kernel.rows, kernel.cols) - fusion::erode(in, kernel.rows, kernel.cols), dest_array);
+			}
+			else if(type == morph_gradient_type::external)
+			{
+				fusion::evaluate(pool, fusion::dilate(in, kernel.rows, kernel.cols) - in, dest_array);
+			}
+			else if(type == morph_gradient_type::internal)
+			{
+				fusion::evaluate(pool, in - fusion::erode(in, kernel.rows, kernel.cols), dest_array);
+			}
+			return;
+		}
+		if(kernel.rows * kernel.cols > 169) throw std::runtime_error("morph_gradient_32f_c1 supports masked kernels up to 169 cells");
+		kernel_wrapper<float, 169U> wrapped_kernel(kernel);
+		auto in = fusion::input(src_array);
+		if(type == morph_gradient_type::combined)
+		{
+			fusion::evaluate(pool, fusion::dilate(in, wrapped_kernel) - fusion::erode(in, wrapped_kernel), dest_array);
+		}
+		else if(type == morph_gradient_type::external)
+		{
+			fusion::evaluate(pool, fusion::dilate(in, wrapped_kernel) - in, dest_array);
+		}
+		else if(type == morph_gradient_type::internal)
+		{
+			fusion::evaluate(pool, in - fusion::erode(in, wrapped_kernel), dest_array);
+		}
+	}
 }
@@ -0,0 +1,278 @@
+﻿#pragma once
+
+#include "amp_core.h"
+
+namespace amp
+{
+	// Rectangular erode/dilate of any size(van Herk/Gil-Werman).
+	// Each direction splits the lines into blocks of k, keeps the prefix(g) and suffix(h) extremum inside every block,
+	// and the extremum over lines i .. i + k - 1 is extremum(h[i], g[i + k - 1]): 3 comparisons per pixel per direction whatever k is.
+	namespace detail
+	{
+#if AMP_HAS_CPP_AMP
+		// One direction over an image, g/h are line-padded by k - 1: vertical ? (rows + k - 1) x cols : rows x (cols + k - 1)
+		template<bool take_max, bool vertical>
+		inline void morph_rect_pass(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array
+			, array_view<float, 2> g, array_view<float, 2> h, int k, int anchor)
+		{
+			const float border = take_max ? -FLT_MAX : FLT_MAX;
+			const int lines = vertical ? src_array.get_extent()[0] : src_array.get_extent()[1];
+			const int length = lines + k - 1;
+			const int block_count = DIVUP(length, k);
+			const int other = vertical ? src_array.get_extent()[1] : src_array.get_extent()[0];
+			concurrency::parallel_for_each(acc_view, concurrency::extent<2>(block_count, other), [=](concurrency::index<2> idx) restrict(amp)
+			{
+				const int first = idx[0] * k;
+				const int last = direct3d::imin(first + k, length);
+				float acc = border;
+				for(int j = first; j < last; j++)
+				{
+					const int line = j - anchor;
+					float value = (line >= 0 && line < lines) ? src_array[vertical ? concurrency::index<2>(line, idx[1]) : concurrency::index<2>(idx[1], line)] : border;
+					acc = take_max ? fast_math::fmaxf(acc, value) : fast_math::fminf(acc, value);
+					g[vertical ? concurrency::index<2>(j, idx[1]) : concurrency::index<2>(idx[1], j)] = acc;
+				}
+				acc = border;
+				for(int j = last - 1; j >= first; j--)
+				{
+					const int line = j - anchor;
+					float value = (line >= 0 && line < lines) ? src_array[vertical ? concurrency::index<2>(line, idx[1]) : concurrency::index<2>(idx[1], line)] : border;
+					acc = take_max ? fast_math::fmaxf(acc, value) : fast_math::fminf(acc, value);
+					h[vertical ? concurrency::index<2>(j, idx[1]) : concurrency::index<2>(idx[1], j)] = acc;
+				}
+			});
+			dest_array.discard_data();
+			concurrency::parallel_for_each(acc_view, dest_array.get_extent(), [=](concurrency::index<2> idx) restrict(amp)
+			{
+				const concurrency::index<2> far_idx = vertical ? concurrency::index<2>(idx[0] + k - 1, idx[1]) : concurrency::index<2>(idx[0], idx[1] + k - 1);
+				dest_array[idx] = take_max ? fast_math::fmaxf(h[idx], g[far_idx]) : fast_math::fminf(h[idx], g[far_idx]);
+			});
+		}
+
+		template<bool take_max>
+		inline void morph_rect(accelerator_view& acc_view, buffer_pool& buffers, array_view<const float, 2> src_array, array_view<float, 2> dest_array
+			, array_view<float, 2> temp_array, int kernel_rows, int kernel_cols, int anchor_row, int anchor_col)
+		{
+			const int rows = src_array.get_extent()[0];
+			const int cols = src_array.get_extent()[1];
+			const int padded_rows = rows + kernel_rows - 1;
+			const int padded_cols = cols + kernel_cols - 1;
+			const int padded_size = std::max(padded_rows * cols, rows * padded_cols);
+			buffer_pool::device_lease g_buf = buffers.acquire_device<float>(padded_size);
+			buffer_pool::device_lease h_buf = buffers.acquire_device<float>(padded_size);
+			morph_rect_pass<take_max, true>(acc_view, src_array, temp_array, g_buf.view<float>(padded_rows, cols), h_buf.view<float>(padded_rows, cols), kernel_rows, anchor_row);
+			morph_rect_pass<take_max, false>(acc_view, temp_array, dest_array, g_buf.view<float>(rows, padded_cols), h_buf.view<float>(rows, padded_cols), kernel_cols, anchor_col);
+		}
+#endif
+
+		template<bool take_max, typename value_type>
+		inline void extremum_row(const value_type* a, const value_type* b, value_type* dest, int n, cpu::simd_level level)
+		{
+			if(take_max)
+				cpu::max_row(a, b, dest, n, level);
+			else
+				cpu::min_row(a, b, dest, n, level);
+		}
+
+		// dest_line(i) = extremum of src_line(i) .. src_line(i + k - 1) for i in [0, count), lines are n pixels.
+		// g/h hold count + k - 1 lines.
+		template<bool take_max, typename value_type, typename SrcLine, typename DestLine>
+		inline void running_extremum(const SrcLine& src_line, const DestLine& dest_line, int count, int k, int n
+			, value_type* g, value_type* h, cpu::simd_level level)
+		{
+			const int length = count + k - 1;
+			for(int first = 0; first < length; first += k)
+			{
+				const int last = std::min(first + k, length);
+				std::copy(src_line(first), src_line(first) + n, g + size_t(first) * n);
+				for(int j = first + 1; j < last; j++)
+				{
+					extremum_row<take_max>(g + size_t(j - 1) * n, src_line(j), g + size_t(j) * n, n, level);
+				}
+				// suffixes are only read for the first count lines
+				if(first >= count)
+					continue;
+				std::copy(src_line(last - 1), src_line(last - 1) + n, h + size_t(last - 1) * n);
+				for(int j = last - 2; j >= first; j--)
+				{
+					extremum_row<take_max>(h + size_t(j + 1) * n, src_line(j), h + size_t(j) * n, n, level);
+				}
+			}
+			for(int i = 0; i < count; i++)
+			{
+				extremum_row<take_max>(h + size_t(i) * n, g + size_t(i + k - 1) * n, dest_line(i), n, level);
+			}
+		}
+
+		// Pixels outside the image don't take part, the anchor is the kernel pixel over the output pixel.
+		// The vertical pass runs over column chunks of a band of rows, the horizontal pass over groups of rows
+		// held transposed so the vector lanes run across rows.
+		// Line buffers of morph_rect_rows, kept by the caller so repeated calls on small bands(fusion::morph_node) don't reallocate
+		template<typename value_type>
+		struct morph_rect_scratch
+		{
+			std::vector<value_type> g, h, vert;
+			std::vector<value_type> line_src, line_g, line_h, line_dest;
+		};
+
+		template<typename value_type>
+		inline value_type* grow_scratch(std::vector<value_type>& buffer, size_t size)
+		{
+			if(buffer.size() < size)
+				buffer.resize(size);
+			return buffer.data();
+		}
+
+		// Output rows [row_first, row_last) of one strip
+		template<bool take_max, typename value_type>
+		inline void morph_rect_rows(cpu::plane_view<const value_type> src_array, cpu::plane_view<value_type> dest_array
+			, int kernel_rows, int kernel_cols, int anchor_row, int anchor_col, int row_first, int row_last, morph_rect_scratch<value_type>& scratch)
+		{
+			const value_type border = take_max ? std::numeric_limits<value_type>::lowest() : std::numeric_limits<value_type>::max();
+			const cpu::simd_level level = cpu::active_simd_level();
+			const int rows = src_array.rows;
+			const int cols = src_array.cols;
+			const int chunk_cols = 1024 / int(sizeof(value_type));
+			const int lanes = 64 / int(sizeof(value_type));
+			const int band_rows = std::max(64, 2 * kernel_rows);
+			const int run_cols = std::max(256, 2 * kernel_cols);
+			// narrow rows are cheaper as kernel_cols shifted extrema over a padded row than through the transposes
+			const int vector_pixels = (level == cpu::simd_level::avx512 ? 64 : level == cpu::simd_level::avx2 ? 32 : level == cpu::simd_level::sse4 ? 16 : 1) / int(sizeof(value_type));
+			const bool shifted_rows = kernel_cols <= 2 * std::max(vector_pixels, 1);
+			const int band = std::min(band_rows, row_last - row_first);
+			std::vector<value_type> border_line(chunk_cols, border);
+			value_type* g = nullptr;
+			value_type* h = nullptr;
+			value_type* vert = nullptr;
+			if(kernel_rows > 1)
+			{
+				g = grow_scratch(scratch.g, size_t(band + kernel_rows - 1) * chunk_cols);
+				h = grow_scratch(scratch.h, size_t(band + kernel_rows - 1) * chunk_cols);
+				if(kernel_cols > 1)
+					vert = grow_scratch(scratch.vert, size_t(band) * cols);
+			}
+			std::vector<value_type> padded;
+			value_type* line_src = nullptr;
+			value_type* line_g = nullptr;
+			value_type* line_h = nullptr;
+			value_type* line_dest = nullptr;
+			if(kernel_cols > 1 && shifted_rows)
+			{
+				padded.assign(size_t(cols + kernel_cols - 1), border);
+			}
+			else if(kernel_cols > 1)
+			{
+				// every use fills the border and the transposed rows, lanes past the last row are never read back
+				const size_t line_size = size_t(run_cols + kernel_cols - 1) * lanes;
+				line_src = grow_scratch(scratch.line_src, line_size);
+				line_g = grow_scratch(scratch.line_g, line_size);
+				line_h = grow_scratch(scratch.line_h, line_size);
+				line_dest = grow_scratch(scratch.line_dest, size_t(run_cols) * lanes);
+			}
+			for(int r0 = row_first; r0 < row_last; r0 += band)
+			{
+				const int count = std::min(band, row_last - r0);
+				// rows after the vertical pass, kept in dest when there is no horizontal pass
+				auto vert_line = [&](int i) -> value_type*
+				{
+					return kernel_cols == 1 ? dest_array.row(r0 + i) : &vert[size_t(i) * cols];
+				};
+				if(kernel_rows > 1)
+				{
+					for(int c0 = 0; c0 < cols; c0 += chunk_cols)
+					{
+						const int n = std::min(chunk_cols, cols - c0);
+						running_extremum<take_max>([&](int j) -> const value_type*
+						{
+							const int r = r0 - anchor_row + j;
+							return (r >= 0 && r < rows) ? src_array.row(r) + c0 : border_line.data();
+						}, [&](int i)
+						{
+							return vert_line(i) + c0;
+						}, count, kernel_rows, n, g, h, level);
+					}
+				}
+				if(kernel_cols == 1)
+				{
+					if(kernel_rows == 1)
+					{
+						for(int i = 0; i < count; i++)
+							std::copy(src_array.row(r0 + i), src_array.row(r0 + i) + cols, dest_array.row(r0 + i));
+					}
+					continue;
+				}
+				const value_type* hsrc = kernel_rows == 1 ? src_array.row(r0) : vert;
+				const size_t hsrc_step = kernel_rows == 1 ? size_t(src_array.step) : size_t(cols);
+				if(shifted_rows)
+				{
+					for(int i = 0; i < count; i++)
+					{
+						const value_type* src_row = hsrc + i * hsrc_step;
+						value_type* dest_row = dest_array.row(r0 + i);
+						std::copy(src_row, src_row + cols, &padded[anchor_col]);
+						std::copy(padded.begin(), padded.begin() + cols, dest_row);
+						for(int j = 1; j < kernel_cols; j++)
+						{
+							extremum_row<take_max>(dest_row, &padded[j], dest_row, cols, level);
+						}
+					}
+					continue;
+				}
+				// horizontal pass on groups of lanes rows, transposed in and out of the line buffers
+				for(int lane0 = 0; lane0 < count; lane0 += lanes)
+				{
+					const int lane_count = std::min(lanes, count - lane0);
+					for(int c0 = 0; c0 < cols; c0 += run_cols)
+					{
+						const int n_out = std::min(run_cols, cols - c0);
+						const int length = n_out + kernel_cols - 1;
+						const int c_first = std::max(0, c0 - anchor_col);
+						const int c_last = std::min(cols, c0 - anchor_col + length);
+						const int j_first = c_first - (c0 - anchor_col);
+						const int j_last = j_first + (c_last - c_first);
+						std::fill(line_src, line_src + size_t(j_first) * lanes, border);
+						std::fill(line_src + size_t(j_last) * lanes, line_src + size_t(length) * lanes, border);
+						cpu::transpose_block(hsrc + lane0 * hsrc_step + c_first, hsrc_step, &line_src[size_t(j_first) * lanes], size_t(lanes)
+							, lane_count, c_last - c_first, level);
+						running_extremum<take_max>([&](int j) -> const value_type*
+						{
+							return &line_src[size_t(j) * lanes];
+						}, [&](int i)
+						{
+							return &line_dest[size_t(i) * lanes];
+						}, n_out, kernel_cols, lanes, line_g, line_h, level);
+						cpu::transpose_block(line_dest, size_t(lanes), dest_array.row(r0 + lane0) + c0, size_t(dest_array.step), n_out, lane_count, level);
+					}
+				}
+			}
+		}
+
+		template<bool take_max, typename value_type>
+		inline void morph_rect(cpu::thread_pool& pool, cpu::plane_view<const value_type> src_array, cpu::plane_view<value_type> dest_array
+			, int kernel_rows, int kernel_cols, int anchor_row, int anchor_col)
+		{
+			cpu::parallel_for_rows(pool, src_array.rows, [&](int row_first, int row_last)
+			{
+				morph_rect_scratch<value_type> scratch;
+				morph_rect_rows<take_max, value_type>(src_array, dest_array, kernel_rows, kernel_cols, anchor_row, anchor_col, row_first, row_last, scratch);
+			});
+		}
+
+		// Structuring elements with every element set run through morph_rect
+		inline bool is_rect_kernel(const cv::Mat& kernel)
+		{
+			cv::Mat kernel_32f;
+			kernel.convertTo(kernel_32f, CV_32FC1);
+			for(int r = 0; r < kernel_32f.rows; r++)
+			{
+				const float* kernel_row = kernel_32f.ptr<float>(r);
+				for(int c = 0; c < kernel_32f.cols; c++)
+				{
+					if(!(kernel_row[c] > 0.0f))
+						return false;
+				}
+			}
+			return kernel_32f.rows > 0 && kernel_32f.cols > 0;
+		}
+	}
+}
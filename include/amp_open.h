@@ -6,6 +6,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Open
 	inline void open_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array, array_view<float, 2> temp_array
 		, const cv::Mat& kernel, int iterations = 1)
@@ -13,4 +14,26 @@ namespace amp
 		erode_32f_c1(acc_view, src_array, temp_array, dest_array, kernel, iterations);
 		dilate_32f_c1(acc_view, temp_array, dest_array, temp_array, kernel, iterations);
 	}
+#endif
+
+	inline void open_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array, cpu::plane_view<float> temp_array
+		, const cv::Mat& kernel, int iterations = 1)
+	{
+		erode_32f_c1(pool, src_array, temp_array, dest_array, kernel, iterations);
+		dilate_32f_c1(pool, temp_array, dest_array, temp_array, kernel, iterations);
+	}
+
+	inline void open_8u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array, cpu::plane_view<unsigned char> dest_array, cpu::plane_view<unsigned char> temp_array
+		, const cv::Mat& kernel, int iterations = 1)
+	{
+		erode_8u_c1(pool, src_array, temp_array, dest_array, kernel, iterations);
+		dilate_8u_c1(pool, temp_array, dest_array, temp_array, kernel, iterations);
+	}
+
+	inline void open_16u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned short> src_array, cpu::plane_view<unsigned short> dest_array, cpu::plane_view<unsigned short> temp_array
+		, const cv::Mat& kernel, int iterations = 1)
+	{
+		erode_16u_c1(pool, src_array, temp_array, dest_array, kernel, iterations);
+		dilate_16u_c1(pool, temp_array, dest_array, temp_array, kernel, iterations);
+	}
 }
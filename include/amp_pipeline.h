@@ -0,0 +1,296 @@
+﻿#pragma once
+
+#include <functional>
+#include <future>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include "amp_core.h"
+
+namespace amp
+{
+	// One frame owned by the pipeline between submit and completion
+	struct pipeline_frame
+	{
+		size_t sequence;
+		// first float2d/host_float2d buffer of the frame slot, the slot owns buffers_per_frame buffers
+		int buffer;
+		// src channels are uploaded to buffer, buffer + 1, ...
+		int input;
+		// dest channels are downloaded from output, output + 1, ..., compute may move it
+		int output;
+		image_view src;
+		image_view dest;
+	};
+
+	// Upload, compute and download run on their own threads with frames handed over through a ring of slots,
+	// so while frame i computes, frame i + 1 uploads and frame i - 1 downloads.
+	// Stage functions share ctx.pool(CPU backend) or the ctx.acc_view queue(AMP backend).
+	class frame_pipeline
+	{
+	public:
+		typedef std::function<void(vision_context& ctx, pipeline_frame& frame)> compute_function;
+		typedef std::function<void(const pipeline_frame& frame, std::exception_ptr error)> completion_function;
+
+		// in_flight >= 2 frame slots, each slot creates buffers_per_frame rows x cols float buffers in ctx
+		frame_pipeline(vision_context& ctx_, int rows_, int cols_, int buffers_per_frame_, compute_function compute_
+			, int in_flight = 3, float load_scale_ = 1.0f)
+			: ctx(ctx_), rows(rows_), cols(cols_), buffers_per_frame(buffers_per_frame_), load_scale(load_scale_)
+			, compute(std::move(compute_)), next_sequence(0), pending(0), stopping(false)
+		{
+			if(in_flight < 2) throw std::runtime_error("frame_pipeline needs at least 2 frames in flight");
+			if(buffers_per_frame < 1) throw std::runtime_error("frame_pipeline needs at least 1 buffer per frame");
+			slots.resize(in_flight);
+			for(int i = 0; i < in_flight; i++)
+			{
+				slots[i].frame.buffer = ctx.create_float2d_buf(rows, cols, buffers_per_frame);
+				free_slots.push_back(i);
+			}
+			upload_thread = std::thread(&frame_pipeline::stage_loop, this, std::ref(upload_queue), &frame_pipeline::upload);
+			compute_thread = std::thread(&frame_pipeline::stage_loop, this, std::ref(compute_queue), &frame_pipeline::run_compute);
+			download_thread = std::thread(&frame_pipeline::stage_loop, this, std::ref(download_queue), &frame_pipeline::download);
+		}
+
+		~frame_pipeline()
+		{
+			wait_all();
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				stopping = true;
+			}
+			upload_queue.cv.notify_all();
+			compute_queue.cv.notify_all();
+			download_queue.cv.notify_all();
+			upload_thread.join();
+			compute_thread.join();
+			download_thread.join();
+			// return the frame slots to ctx so a long-lived context can reuse them
+			for(auto& s : slots)
+			{
+				ctx.release_float2d_buf(s.frame.buffer, buffers_per_frame);
+			}
+		}
+
+		frame_pipeline(const frame_pipeline&) = delete;
+		frame_pipeline& operator=(const frame_pipeline&) = delete;
+
+		// Queue a frame, blocks while all slots are in flight.
+		// src and dest must stay valid until the future is ready.
+		std::future<void> submit(const image_view& src, const image_view& dest)
+		{
+			int index = acquire_slot(src, dest);
+			std::future<void> result = slots[index].promise.get_future();
+			push(upload_queue, index);
+			return result;
+		}
+
+		// Same as above, on_complete runs on the download thread
+		void submit(const image_view& src, const image_view& dest, completion_function on_complete)
+		{
+			int index = acquire_slot(src, dest);
+			slots[index].on_complete = std::move(on_complete);
+			push(upload_queue, index);
+		}
+
+		// Block until every submitted frame has completed
+		void wait_all()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			slot_cv.wait(lock, [this]() { return pending == 0; });
+		}
+
+		int frames_in_flight() const
+		{
+			return int(slots.size());
+		}
+
+	private:
+		struct slot
+		{
+			pipeline_frame frame;
+			std::promise<void> promise;
+			completion_function on_complete;
+			std::exception_ptr error;
+		};
+
+		struct stage_queue
+		{
+			std::deque<int> items;
+			std::condition_variable cv;
+		};
+
+		typedef void (frame_pipeline::*stage_function)(pipeline_frame& frame);
+
+		int acquire_slot(const image_view& src, const image_view& dest)
+		{
+			if(src.rows != rows || src.cols != cols || dest.rows != rows || dest.cols != cols)
+			{
+				throw std::runtime_error("frame size doesn't match the pipeline");
+			}
+			if(src.channels > buffers_per_frame || dest.channels > buffers_per_frame)
+			{
+				throw std::runtime_error("frame has more channels than buffers per frame");
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			slot_cv.wait(lock, [this]() { return !free_slots.empty(); });
+			int index = free_slots.front();
+			free_slots.pop_front();
+			pending++;
+			slot& s = slots[index];
+			s.frame.sequence = next_sequence++;
+			s.frame.input = s.frame.buffer;
+			s.frame.output = s.frame.buffer;
+			s.frame.src = src;
+			s.frame.dest = dest;
+			s.promise = std::promise<void>();
+			s.on_complete = nullptr;
+			s.error = nullptr;
+			return index;
+		}
+
+		void push(stage_queue& queue, int index)
+		{
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				queue.items.push_back(index);
+			}
+			queue.cv.notify_one();
+		}
+
+		void stage_loop(stage_queue& queue, stage_function func)
+		{
+			for(;;)
+			{
+				int index;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					queue.cv.wait(lock, [&]() { return stopping || !queue.items.empty(); });
+					if(queue.items.empty())
+					{
+						return;
+					}
+					index = queue.items.front();
+					queue.items.pop_front();
+				}
+				slot& s = slots[index];
+				// a failed frame skips the remaining stages but still completes in order
+				if(!s.error)
+				{
+					try
+					{
+						(this->*func)(s.frame);
+					}
+					catch(...)
+					{
+						s.error = std::current_exception();
+					}
+				}
+				if(&queue == &upload_queue)
+				{
+					push(compute_queue, index);
+				}
+				else if(&queue == &compute_queue)
+				{
+					push(download_queue, index);
+				}
+				else
+				{
+					complete(index);
+				}
+			}
+		}
+
+		void upload(pipeline_frame& frame)
+		{
+			bool loaded = true;
+			for(int ch = 0; ch < frame.src.channels; ch++)
+			{
+#if AMP_HAS_CPP_AMP
+				if(ctx.backend == execution_backend::accelerator)
+				{
+					loaded = loaded && ctx.load_image(frame.src, ctx.float2d[frame.input + ch], ch, load_scale);
+					continue;
+				}
+#endif
+				loaded = loaded && ctx.load_image(frame.src, ctx.host_float2d[frame.input + ch].view(), ch, load_scale);
+			}
+			if(!loaded) throw std::runtime_error("frame upload failed");
+		}
+
+		void run_compute(pipeline_frame& frame)
+		{
+			compute(ctx, frame);
+			if(frame.output < frame.buffer || frame.output + frame.dest.channels > frame.buffer + buffers_per_frame)
+			{
+				throw std::runtime_error("frame output is outside the frame slot");
+			}
+		}
+
+		void download(pipeline_frame& frame)
+		{
+			bool saved = true;
+			for(int ch = 0; ch < frame.dest.channels; ch++)
+			{
+#if AMP_HAS_CPP_AMP
+				if(ctx.backend == execution_backend::accelerator)
+				{
+					// synchronizes on this frame's kernels only, later frames keep queuing
+					saved = saved && ctx.save_image(ctx.float2d[frame.output + ch], frame.dest, ch);
+					continue;
+				}
+#endif
+				saved = saved && ctx.save_image(ctx.host_float2d[frame.output + ch].view(), frame.dest, ch);
+			}
+			if(!saved) throw std::runtime_error("frame download failed");
+		}
+
+		void complete(int index)
+		{
+			slot& s = slots[index];
+			if(s.on_complete)
+			{
+				try
+				{
+					s.on_complete(s.frame, s.error);
+				}
+				catch(...)
+				{
+				}
+			}
+			else if(s.error)
+			{
+				s.promise.set_exception(s.error);
+			}
+			else
+			{
+				s.promise.set_value();
+			}
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				free_slots.push_back(index);
+				pending--;
+			}
+			slot_cv.notify_all();
+		}
+
+		vision_context& ctx;
+		int rows;
+		int cols;
+		int buffers_per_frame;
+		float load_scale;
+		compute_function compute;
+		std::vector<slot> slots;
+		std::deque<int> free_slots;
+		size_t next_sequence;
+		int pending;
+		bool stopping;
+		std::mutex mutex;
+		std::condition_variable slot_cv;
+		stage_queue upload_queue;
+		stage_queue compute_queue;
+		stage_queue download_queue;
+		std::thread upload_thread;
+		std::thread compute_thread;
+		std::thread download_thread;
+	};
+}
@@ -2,9 +2,11 @@
 
 #include "amp_core.h"
 #include "amp_geodesic_dilate.h"
+#include "amp_thining.h"
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	namespace detail
 	{
 		inline void pruning_thinning_32f_c1(accelerator_view acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array)
@@ -146,4 +148,79 @@ namespace amp
 			});
 		}
 	}
+#endif
+
+	// CPU backend
+	namespace detail
+	{
+		// 255 on the end points of src, 0 elsewhere
+		inline void pruning_hit_or_miss_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array)
+		{
+			const unsigned char* endpoint = thinning_luts().endpoint;
+			const int rows = src_array.rows;
+			const int cols = src_array.cols;
+			cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+			{
+				// three rows of foreground flags padded with the outside(foreground)
+				std::vector<unsigned char> window(size_t(cols + 2) * 3, 1);
+				const int step = cols + 2;
+				for(int y = row_first; y < row_last; y++)
+				{
+					for(int i = 0; i < 3; i++)
+					{
+						const int r = y - 1 + i;
+						unsigned char* window_row = &window[i * step + 1];
+						if(r < 0 || r >= rows)
+						{
+							std::fill(window_row, window_row + cols, 1);
+							continue;
+						}
+						const float* src_row = src_array.row(r);
+						for(int x = 0; x < cols; x++)
+							window_row[x] = src_row[x] > 0.0f;
+					}
+					float* dest_row = dest_array.row(y);
+					for(int x = 0; x < cols; x++)
+					{
+						const unsigned char* p = &window[step + x + 1];
+						dest_row[x] = *p && endpoint[neighborhood_code(p, step)] ? 255.0f : 0.0f;
+					}
+				}
+			});
+		}
+	}
+
+	inline void pruning_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, cpu::plane_view<float> temp_array1, cpu::plane_view<float> temp_array2, int max_thinning_iter, int max_dilate_iter = 0)
+	{
+		// 1.thinning, the end points are removed max_thinning_iter times(at least twice when even, like the AMP version)
+		const int passes = max_thinning_iter % 2 == 1 ? max_thinning_iter : std::max(max_thinning_iter, 2);
+		detail::thinning_worklist work(pool, src_array, 1);
+		for(int i = 0; i < passes; i++)
+		{
+			if(work.pass(pool, detail::thinning_luts().endpoint, 0) == 0)
+				break;
+		}
+		work.write(pool, src_array, dest_array);
+		// 2.find endpoints in thinned image
+		if(max_dilate_iter == 0)
+		{
+			max_dilate_iter = max_thinning_iter + 1;
+		}
+		if(max_dilate_iter > 0)
+		{
+			detail::pruning_hit_or_miss_32f_c1(pool, dest_array, temp_array1);
+			// 3.reconstruction on endpoints
+			geodesic_dilate_32f_c1(pool, temp_array1, temp_array2, src_array, temp_array1, max_dilate_iter);
+			// 4.merge results
+			const int cols = dest_array.cols;
+			cpu::parallel_for_rows(pool, dest_array.rows, [&](int row_first, int row_last)
+			{
+				for(int y = row_first; y < row_last; y++)
+				{
+					cpu::max_row(dest_array.row(y), temp_array2.row(y), dest_array.row(y), cols, cpu::active_simd_level());
+				}
+			});
+		}
+	}
 }
@@ -0,0 +1,317 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include "amp_core.h"
+#include "amp_morph_rect.h"
+
+namespace amp
+{
+	// Morphological reconstruction on the CPU(Vincent's hybrid algorithm).
+	// A raster and an anti-raster scan carry the marker along most paths, then the pixels that can still raise(lower)
+	// a neighbor go into a FIFO that is drained until nothing changes, so the cost doesn't grow with the path lengths.
+	// The image is split into strips that are scanned and drained in parallel, values crossing a strip border
+	// are handed to the neighbor strip between rounds.
+	namespace detail
+	{
+		// take_max: reconstruction by dilation(marker <= mask), otherwise by erosion(marker >= mask)
+		template<bool take_max>
+		struct reconstruction_order
+		{
+			// a is further along the propagation than b
+			static bool beyond(float a, float b)
+			{
+				return take_max ? a > b : a < b;
+			}
+
+			static float extend(float a, float b)
+			{
+				return take_max ? std::max(a, b) : std::min(a, b);
+			}
+
+			static float limit(float value, float mask)
+			{
+				return take_max ? std::min(value, mask) : std::max(value, mask);
+			}
+		};
+
+		struct reconstruction_strip
+		{
+			int row_first;
+			int row_last;
+			// raster indices of the FIFO
+			std::vector<int> queue;
+			// (column, value) offered to the row above/below the strip
+			std::vector<std::pair<int, float>> to_above;
+			std::vector<std::pair<int, float>> to_below;
+		};
+
+		// dest[x] = extremum of the neighbors of column x in an adjacent row
+		template<bool take_max>
+		inline void reconstruction_adjacent_row(const float* src_row, float* dest_row, int cols, bool connective_4, cpu::simd_level level)
+		{
+			std::copy(src_row, src_row + cols, dest_row);
+			if(!connective_4 && cols > 1)
+			{
+				extremum_row<take_max>(dest_row + 1, src_row, dest_row + 1, cols - 1, level);
+				extremum_row<take_max>(dest_row, src_row + 1, dest_row, cols - 1, level);
+			}
+		}
+
+		// Forward and backward scans of one strip, neighbors outside the strip are left to the border exchange
+		template<bool take_max>
+		inline void reconstruction_scan(reconstruction_strip& strip, cpu::plane_view<float> marker_array, cpu::plane_view<const float> mask_array
+			, bool connective_4, float* line, cpu::simd_level level)
+		{
+			typedef reconstruction_order<take_max> order;
+			const int cols = marker_array.cols;
+			for(int y = strip.row_first; y < strip.row_last; y++)
+			{
+				float* marker_row = marker_array.row(y);
+				const float* mask_row = mask_array.row(y);
+				if(y > strip.row_first)
+				{
+					reconstruction_adjacent_row<take_max>(marker_array.row(y - 1), line, cols, connective_4, level);
+					extremum_row<take_max>(marker_row, line, marker_row, cols, level);
+				}
+				marker_row[0] = order::limit(marker_row[0], mask_row[0]);
+				for(int x = 1; x < cols; x++)
+				{
+					marker_row[x] = order::limit(order::extend(marker_row[x], marker_row[x - 1]), mask_row[x]);
+				}
+			}
+			for(int y = strip.row_last - 1; y >= strip.row_first; y--)
+			{
+				float* marker_row = marker_array.row(y);
+				const float* mask_row = mask_array.row(y);
+				const bool has_below = y + 1 < strip.row_last;
+				if(has_below)
+				{
+					reconstruction_adjacent_row<take_max>(marker_array.row(y + 1), line, cols, connective_4, level);
+					extremum_row<take_max>(marker_row, line, marker_row, cols, level);
+				}
+				marker_row[cols - 1] = order::limit(marker_row[cols - 1], mask_row[cols - 1]);
+				for(int x = cols - 2; x >= 0; x--)
+				{
+					marker_row[x] = order::limit(order::extend(marker_row[x], marker_row[x + 1]), mask_row[x]);
+				}
+				// the pixels that can still propagate to a neighbor scanned before them
+				const float* below_marker = has_below ? marker_array.row(y + 1) : nullptr;
+				const float* below_mask = has_below ? mask_array.row(y + 1) : nullptr;
+				const int reach = connective_4 ? 0 : 1;
+				for(int x = 0; x < cols; x++)
+				{
+					const float value = marker_row[x];
+					bool propagates = x + 1 < cols && order::beyond(value, marker_row[x + 1]) && order::beyond(mask_row[x + 1], marker_row[x + 1]);
+					for(int q = std::max(0, x - reach); has_below && !propagates && q <= std::min(cols - 1, x + reach); q++)
+					{
+						propagates = order::beyond(value, below_marker[q]) && order::beyond(below_mask[q], below_marker[q]);
+					}
+					if(propagates)
+						strip.queue.push_back(y * cols + x);
+				}
+			}
+		}
+
+		// Offer a value to a pixel of an adjacent strip
+		inline void reconstruction_offer(reconstruction_strip& strip, int y, int x, float value)
+		{
+			if(y < strip.row_first)
+				strip.to_above.push_back(std::make_pair(x, value));
+			else
+				strip.to_below.push_back(std::make_pair(x, value));
+		}
+
+		template<bool take_max>
+		inline void reconstruction_receive(reconstruction_strip& strip, const std::vector<std::pair<int, float>>& offers, int y
+			, cpu::plane_view<float> marker_array, cpu::plane_view<const float> mask_array)
+		{
+			typedef reconstruction_order<take_max> order;
+			float* marker_row = marker_array.row(y);
+			const float* mask_row = mask_array.row(y);
+			for(size_t i = 0; i < offers.size(); i++)
+			{
+				const int x = offers[i].first;
+				const float value = order::limit(offers[i].second, mask_row[x]);
+				if(order::beyond(value, marker_row[x]))
+				{
+					marker_row[x] = value;
+					strip.queue.push_back(y * marker_array.cols + x);
+				}
+			}
+		}
+
+		template<bool take_max>
+		inline void reconstruction_drain(reconstruction_strip& strip, cpu::plane_view<float> marker_array, cpu::plane_view<const float> mask_array, bool connective_4)
+		{
+			typedef reconstruction_order<take_max> order;
+			static const int offsets_8[8][2] = { { -1, -1 }, { -1, 0 }, { -1, 1 }, { 0, -1 }, { 0, 1 }, { 1, -1 }, { 1, 0 }, { 1, 1 } };
+			static const int offsets_4[4][2] = { { -1, 0 }, { 0, -1 }, { 0, 1 }, { 1, 0 } };
+			const int (*offsets)[2] = connective_4 ? offsets_4 : offsets_8;
+			const int offset_count = connective_4 ? 4 : 8;
+			const int rows = marker_array.rows;
+			const int cols = marker_array.cols;
+			for(size_t head = 0; head < strip.queue.size(); head++)
+			{
+				const int y = strip.queue[head] / cols;
+				const int x = strip.queue[head] - y * cols;
+				const float value = marker_array.row(y)[x];
+				for(int i = 0; i < offset_count; i++)
+				{
+					const int qy = y + offsets[i][0];
+					const int qx = x + offsets[i][1];
+					if(qy < 0 || qy >= rows || qx < 0 || qx >= cols)
+						continue;
+					if(qy < strip.row_first || qy >= strip.row_last)
+					{
+						reconstruction_offer(strip, qy, qx, value);
+						continue;
+					}
+					float& q = marker_array.row(qy)[qx];
+					const float q_mask = mask_array.row(qy)[qx];
+					if(order::beyond(value, q) && q != q_mask)
+					{
+						q = order::limit(value, q_mask);
+						strip.queue.push_back(qy * cols + qx);
+					}
+				}
+			}
+			strip.queue.clear();
+		}
+
+		// Reconstruct marker_array under mask_array in place, the marker has to be under(above) the mask
+		template<bool take_max>
+		inline void reconstruct(cpu::thread_pool& pool, cpu::plane_view<float> marker_array, cpu::plane_view<const float> mask_array, bool connective_4)
+		{
+			const cpu::simd_level level = cpu::active_simd_level();
+			const int rows = marker_array.rows;
+			const int cols = marker_array.cols;
+			if(rows == 0 || cols == 0)
+				return;
+			// few strips: every strip border adds exchange rounds
+			const int strip_count = std::max(1, std::min(pool.size(), rows / 32));
+			std::vector<reconstruction_strip> strips(strip_count);
+			pool.parallel_for(0, strip_count, 1, [&](int strip_first, int strip_last)
+			{
+				std::vector<float> line(cols);
+				for(int s = strip_first; s < strip_last; s++)
+				{
+					reconstruction_strip& strip = strips[s];
+					strip.row_first = int(int64_t(rows) * s / strip_count);
+					strip.row_last = int(int64_t(rows) * (s + 1) / strip_count);
+					reconstruction_scan<take_max>(strip, marker_array, mask_array, connective_4, line.data(), level);
+					// the border rows are offered whole to the neighbor strips
+					if(s > 0)
+					{
+						reconstruction_adjacent_row<take_max>(marker_array.row(strip.row_first), line.data(), cols, connective_4, level);
+						for(int x = 0; x < cols; x++)
+							strip.to_above.push_back(std::make_pair(x, line[x]));
+					}
+					if(s + 1 < strip_count)
+					{
+						reconstruction_adjacent_row<take_max>(marker_array.row(strip.row_last - 1), line.data(), cols, connective_4, level);
+						for(int x = 0; x < cols; x++)
+							strip.to_below.push_back(std::make_pair(x, line[x]));
+					}
+				}
+			});
+			while(true)
+			{
+				pool.parallel_for(0, strip_count, 1, [&](int strip_first, int strip_last)
+				{
+					for(int s = strip_first; s < strip_last; s++)
+					{
+						reconstruction_strip& strip = strips[s];
+						if(s > 0)
+							reconstruction_receive<take_max>(strip, strips[s - 1].to_below, strip.row_first, marker_array, mask_array);
+						if(s + 1 < strip_count)
+							reconstruction_receive<take_max>(strip, strips[s + 1].to_above, strip.row_last - 1, marker_array, mask_array);
+					}
+				});
+				bool pending = false;
+				for(int s = 0; s < strip_count; s++)
+				{
+					pending = pending || !strips[s].queue.empty();
+				}
+				if(!pending)
+					break;
+				pool.parallel_for(0, strip_count, 1, [&](int strip_first, int strip_last)
+				{
+					for(int s = strip_first; s < strip_last; s++)
+					{
+						strips[s].to_above.clear();
+						strips[s].to_below.clear();
+						reconstruction_drain<take_max>(strips[s], marker_array, mask_array, connective_4);
+					}
+				});
+			}
+		}
+
+		// One elementary geodesic dilation(erosion), returns whether any pixel changed
+		template<bool take_max>
+		inline bool geodesic_step(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+			, cpu::plane_view<const float> mask_array, bool connective_4)
+		{
+			const cpu::simd_level level = cpu::active_simd_level();
+			const int rows = src_array.rows;
+			const int cols = src_array.cols;
+			std::vector<char> row_changed(rows, 0);
+			cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+			{
+				std::vector<float> column(cols);
+				for(int y = row_first; y < row_last; y++)
+				{
+					const float* src_row = src_array.row(y);
+					float* dest_row = dest_array.row(y);
+					// extremum over the rows of the neighborhood, then over the columns
+					const float* center = connective_4 ? src_row : column.data();
+					std::copy(src_row, src_row + cols, column.begin());
+					if(y > 0)
+						extremum_row<take_max>(column.data(), src_array.row(y - 1), column.data(), cols, level);
+					if(y + 1 < rows)
+						extremum_row<take_max>(column.data(), src_array.row(y + 1), column.data(), cols, level);
+					std::copy(column.begin(), column.end(), dest_row);
+					if(cols > 1)
+					{
+						extremum_row<take_max>(dest_row + 1, center, dest_row + 1, cols - 1, level);
+						extremum_row<take_max>(dest_row, center + 1, dest_row, cols - 1, level);
+					}
+					extremum_row<!take_max>(dest_row, mask_array.row(y), dest_row, cols, level);
+					row_changed[y] = std::memcmp(dest_row, src_row, cols * sizeof(float)) != 0;
+				}
+			});
+			return std::find(row_changed.begin(), row_changed.end(), char(1)) != row_changed.end();
+		}
+
+		// max_iter = 0 reconstructs completely, otherwise runs at most max_iter elementary steps(stopping when nothing changes)
+		template<bool take_max>
+		inline void geodesic_reconstruct(cpu::thread_pool& pool, cpu::plane_view<float> dest_array, cpu::plane_view<const float> mask_array
+			, cpu::plane_view<float> temp_array, int max_iter, bool connective_4)
+		{
+			if(max_iter == 0)
+			{
+				// the first elementary step brings the marker under the mask, so a marker above it
+				// spreads its value to the neighbors once like with the iterated steps
+				geodesic_step<take_max>(pool, dest_array, temp_array, mask_array, connective_4);
+				reconstruct<take_max>(pool, temp_array, mask_array, connective_4);
+				cpu::copy<float>(pool, temp_array, dest_array);
+				return;
+			}
+			int i = 0;
+			while(true)
+			{
+				const bool changed = geodesic_step<take_max>(pool, dest_array, temp_array, mask_array, connective_4);
+				if(++i == max_iter || !changed)
+				{
+					cpu::copy<float>(pool, temp_array, dest_array);
+					break;
+				}
+				if(!geodesic_step<take_max>(pool, temp_array, dest_array, mask_array, connective_4) || ++i == max_iter)
+				{
+					break;
+				}
+			}
+		}
+	}
+}
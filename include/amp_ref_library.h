@@ -0,0 +1,701 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <memory>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "amp_batch_diff.h"
+#include "amp_template_model.h"
+
+namespace amp
+{
+	namespace detail
+	{
+		// Library file header, followed by the pose table and the 64-byte aligned code rows
+		struct ref_library_header
+		{
+			char magic[8];
+			uint32_t version;
+			int32_t image_count;
+			int32_t image_rows;
+			int32_t image_cols;
+			int32_t translation_steps;
+			int32_t rotation_steps;
+			float border_value;
+			float translation_interval;
+			float rotation_interval;
+			int32_t code_step;
+			uint64_t pose_offset;
+			uint64_t code_offset;
+			uint64_t key;
+			uint64_t byte_size;
+			// hash of everything after the header
+			uint64_t checksum;
+			uint8_t reserved[40];
+		};
+
+		static_assert(sizeof(ref_library_header) == 128, "reference library header must be packed");
+
+		static const char ref_library_magic[8] = { 'A', 'M', 'P', 'R', 'E', 'F', 'S', '\0' };
+		static const uint32_t ref_library_version = 1;
+	}
+
+	// Augmented reference poses of load_ref_images kept on the host as int8 codes after mean removal:
+	// pose pixel ~= mean + scale * code, code in [-127, 127], one mean and scale per pose.
+	// A pose costs 1 byte per pixel instead of 4, poses are the rows of codes() padded to 64 bytes.
+	// Pose order follows load_ref_images: image, then x shift, y shift, rotation.
+	// The library is one block laid out as its file, so load() maps it and scores from the mapping; copies share the block.
+	// sample code:
+	// amp::ref_library_cache libraries("refs");
+	// std::shared_ptr<const amp::quantized_ref_library> refs = libraries.get(ref_images, 2, 10);
+	// amp::batch_nearest_32f_c1(pool, inputs, *refs, 5, indices, distances);
+	class quantized_ref_library
+	{
+	public:
+		struct pose_info
+		{
+			float mean;
+			float scale;
+			// sum and sum of squares of the codes, for the distance expansion
+			int64_t code_sum;
+			int64_t code_sq_sum;
+		};
+
+		static_assert(sizeof(pose_info) == 24, "pose records must be packed");
+
+		quantized_ref_library()
+			: bytes(nullptr), byte_count(0), poses(nullptr)
+		{
+			std::memset(&header, 0, sizeof(header));
+		}
+
+		// ref_images are 8-bit or float single channel images of one size
+		quantized_ref_library(const std::vector<cv::Mat>& ref_images, int translation_steps = 2, int rotation_steps = 10
+			, float border_value = 255.0f, float translation_interval = 1.0f, float rotation_interval = 0.1f, cpu::thread_pool& pool = cpu::default_thread_pool())
+			: quantized_ref_library()
+		{
+			if (ref_images.empty() || translation_steps < 0 || rotation_steps < 0)
+			{
+				throw std::runtime_error("quantized_ref_library needs reference images and non-negative step counts");
+			}
+			const cv::Size size = ref_images[0].size();
+			std::vector<cv::Mat> images_32f(ref_images.size());
+			for (size_t i = 0; i < ref_images.size(); i++)
+			{
+				if (ref_images[i].size() != size || ref_images[i].channels() != 1)
+				{
+					throw std::runtime_error("quantized_ref_library needs single channel reference images of one size");
+				}
+				ref_images[i].convertTo(images_32f[i], CV_32F);
+			}
+			const int translation_count = translation_steps * 2 + 1;
+			const int rotation_count = rotation_steps * 2 + 1;
+			const int per_image = translation_count * translation_count * rotation_count;
+			const int pose_count = int(ref_images.size()) * per_image;
+			const int pixel_count = size.width * size.height;
+
+			detail::ref_library_header file_header;
+			std::memset(&file_header, 0, sizeof(file_header));
+			std::memcpy(file_header.magic, detail::ref_library_magic, sizeof(file_header.magic));
+			file_header.version = detail::ref_library_version;
+			file_header.image_count = int32_t(ref_images.size());
+			file_header.image_rows = size.height;
+			file_header.image_cols = size.width;
+			file_header.translation_steps = translation_steps;
+			file_header.rotation_steps = rotation_steps;
+			file_header.border_value = border_value;
+			file_header.translation_interval = translation_interval;
+			file_header.rotation_interval = rotation_interval;
+			file_header.code_step = int32_t(align_offset(size_t(pixel_count)));
+			file_header.pose_offset = sizeof(file_header);
+			file_header.code_offset = align_offset(file_header.pose_offset + sizeof(pose_info) * size_t(pose_count));
+			file_header.byte_size = file_header.code_offset + uint64_t(file_header.code_step) * uint64_t(pose_count);
+			file_header.key = key_of(ref_images, translation_steps, rotation_steps, border_value, translation_interval, rotation_interval);
+
+			std::shared_ptr<std::vector<unsigned char>> owned = std::make_shared<std::vector<unsigned char>>(size_t(file_header.byte_size), 0);
+			unsigned char* data = owned->data();
+			pose_info* pose_table = reinterpret_cast<pose_info*>(data + file_header.pose_offset);
+			pool.parallel_for(0, pose_count, 1, [&](int first, int last)
+			{
+				cv::Mat pose(size, CV_32FC1);
+				for (int p = first; p < last; p++)
+				{
+					int index = p % per_image;
+					int jx = index / (rotation_count * translation_count) - translation_steps;
+					int jy = index / rotation_count % translation_count - translation_steps;
+					int k = index % rotation_count - rotation_steps;
+					kernel_wrapper<float, 6U> M = get_euclidean_transform(float(jx) * translation_interval, float(jy) * translation_interval, float(k) * rotation_interval);
+					cv::Matx23f transform(M.data[0], M.data[1], M.data[2], M.data[3], M.data[4], M.data[5]);
+					cv::warpAffine(images_32f[p / per_image], pose, cv::Mat(transform), size, cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(border_value));
+					pose_table[p] = quantize(pose, reinterpret_cast<signed char*>(data + file_header.code_offset + size_t(p) * file_header.code_step));
+				}
+			});
+			file_header.checksum = detail::hash_bytes(data + sizeof(file_header), size_t(file_header.byte_size) - sizeof(file_header));
+			std::memcpy(data, &file_header, sizeof(file_header));
+			attach(data, size_t(file_header.byte_size), "built reference library");
+			storage = owned;
+		}
+
+		// Reference images plus every parameter that changes the poses
+		static uint64_t key_of(const std::vector<cv::Mat>& ref_images, int translation_steps = 2, int rotation_steps = 10
+			, float border_value = 255.0f, float translation_interval = 1.0f, float rotation_interval = 0.1f)
+		{
+			const int32_t params[3] = { int32_t(detail::ref_library_version), int32_t(translation_steps), int32_t(rotation_steps) };
+			const float float_params[3] = { border_value, translation_interval, rotation_interval };
+			uint64_t hash = detail::hash_bytes(params, sizeof(params));
+			hash = detail::hash_bytes(float_params, sizeof(float_params), hash);
+			for (size_t i = 0; i < ref_images.size(); i++)
+			{
+				const cv::Mat& image = ref_images[i];
+				const int32_t shape[3] = { int32_t(image.rows), int32_t(image.cols), int32_t(image.type()) };
+				hash = detail::hash_bytes(shape, sizeof(shape), hash);
+				for (int r = 0; r < image.rows; r++)
+				{
+					hash = detail::hash_bytes(image.ptr<unsigned char>(r), size_t(image.cols) * image.elemSize(), hash);
+				}
+			}
+			return hash;
+		}
+
+		// Map a library file, throws if it isn't a complete library of this version
+		static quantized_ref_library load(const std::string& path)
+		{
+			std::shared_ptr<detail::mapped_file> mapping_ = std::make_shared<detail::mapped_file>(path);
+			quantized_ref_library library;
+			library.attach(mapping_->data(), mapping_->size(), path);
+			library.mapping = mapping_;
+			return library;
+		}
+
+		// Write to a temporary file and rename it over path, so readers never see a partial library
+		void save(const std::string& path) const
+		{
+			const std::string temp_path = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+			FILE* file = std::fopen(temp_path.c_str(), "wb");
+			if (!file)
+			{
+				throw std::runtime_error("can't create " + temp_path);
+			}
+			bool written = std::fwrite(bytes, 1, byte_count, file) == byte_count;
+			written = std::fclose(file) == 0 && written;
+			if (written)
+			{
+				std::remove(path.c_str());
+				written = std::rename(temp_path.c_str(), path.c_str()) == 0;
+			}
+			if (!written)
+			{
+				std::remove(temp_path.c_str());
+				throw std::runtime_error("can't write " + path);
+			}
+		}
+
+		int pose_count() const
+		{
+			return header.image_count * poses_per_image();
+		}
+
+		int image_count() const
+		{
+			return header.image_count;
+		}
+
+		int poses_per_image() const
+		{
+			return (header.translation_steps * 2 + 1) * (header.translation_steps * 2 + 1) * (header.rotation_steps * 2 + 1);
+		}
+
+		cv::Size image_size() const
+		{
+			return cv::Size(header.image_cols, header.image_rows);
+		}
+
+		// pixels per pose, the column count of batch_diff inputs
+		int pixels() const
+		{
+			return header.image_cols * header.image_rows;
+		}
+
+		int translation_steps() const { return header.translation_steps; }
+		int rotation_steps() const { return header.rotation_steps; }
+		float border_value() const { return header.border_value; }
+		float translation_interval() const { return header.translation_interval; }
+		float rotation_interval() const { return header.rotation_interval; }
+		uint64_t key() const { return header.key; }
+		bool is_mapped() const { return bool(mapping); }
+
+		cpu::plane_view<const signed char> codes() const
+		{
+			return cpu::plane_view<const signed char>(reinterpret_cast<const signed char*>(bytes + header.code_offset), pose_count(), pixels(), header.code_step);
+		}
+
+		const pose_info& pose(int index) const
+		{
+			return poses[index];
+		}
+
+		// bytes of the whole library, as saved
+		size_t byte_size() const
+		{
+			return byte_count;
+		}
+
+		// float image of one pose
+		cv::Mat dequantize(int index) const
+		{
+			cv::Mat result(image_size(), CV_32FC1);
+			const signed char* code = codes().row(index);
+			float* dest = result.ptr<float>(0);
+			for (int i = 0; i < pixels(); i++)
+			{
+				dest[i] = poses[index].mean + poses[index].scale * float(code[i]);
+			}
+			return result;
+		}
+
+	private:
+		static size_t align_offset(size_t offset)
+		{
+			return (offset + 63) & ~size_t(63);
+		}
+
+		static pose_info quantize(const cv::Mat& pose, signed char* code)
+		{
+			const float* src = pose.ptr<float>(0);
+			const int n = pose.rows * pose.cols;
+			double sum = 0.0;
+			for (int i = 0; i < n; i++)
+			{
+				sum += src[i];
+			}
+			pose_info info;
+			info.mean = float(sum / n);
+			float max_abs = 0.0f;
+			for (int i = 0; i < n; i++)
+			{
+				max_abs = std::max(max_abs, std::fabs(src[i] - info.mean));
+			}
+			info.scale = max_abs / 127.0f;
+			const float inv_scale = max_abs > 0.0f ? 127.0f / max_abs : 0.0f;
+			info.code_sum = 0;
+			info.code_sq_sum = 0;
+			for (int i = 0; i < n; i++)
+			{
+				int value = std::min(127, std::max(-127, int(std::lround((src[i] - info.mean) * inv_scale))));
+				code[i] = (signed char)value;
+				info.code_sum += value;
+				info.code_sq_sum += value * value;
+			}
+			return info;
+		}
+
+		// Validate the layout and take the header, what names the source in errors
+		void attach(const unsigned char* data, size_t size, const std::string& what)
+		{
+			const std::string error = "invalid reference library: " + what;
+			if (size < sizeof(header))
+			{
+				throw std::runtime_error(error);
+			}
+			std::memcpy(&header, data, sizeof(header));
+			if (std::memcmp(header.magic, detail::ref_library_magic, sizeof(header.magic)) != 0)
+			{
+				throw std::runtime_error(error);
+			}
+			if (header.version != detail::ref_library_version)
+			{
+				throw std::runtime_error("unsupported reference library version: " + what);
+			}
+			if (header.byte_size != size || header.image_count < 1 || header.image_rows < 1 || header.image_cols < 1
+				|| header.translation_steps < 0 || header.rotation_steps < 0 || header.code_step < header.image_rows * header.image_cols
+				|| header.pose_offset != sizeof(header) || header.code_offset % 64 != 0 || header.code_step % 64 != 0)
+			{
+				throw std::runtime_error(error);
+			}
+			const uint64_t pose_count_ = uint64_t(header.image_count) * uint64_t(poses_per_image());
+			if (header.code_offset < header.pose_offset + pose_count_ * sizeof(pose_info) || header.code_offset + pose_count_ * uint64_t(header.code_step) != size)
+			{
+				throw std::runtime_error(error);
+			}
+			if (detail::hash_bytes(data + sizeof(header), size - sizeof(header)) != header.checksum)
+			{
+				throw std::runtime_error("reference library checksum mismatch: " + what);
+			}
+			bytes = data;
+			byte_count = size;
+			poses = reinterpret_cast<const pose_info*>(data + header.pose_offset);
+		}
+
+		detail::ref_library_header header;
+		const unsigned char* bytes;
+		size_t byte_count;
+		const pose_info* poses;
+		// one of them owns bytes
+		std::shared_ptr<std::vector<unsigned char>> storage;
+		std::shared_ptr<detail::mapped_file> mapping;
+	};
+
+	// Libraries keyed by reference image hash plus pose parameters. With a directory, libraries are also kept there as
+	// <key>.ampr files and mapped on the next run instead of warped again. Safe to call from several threads.
+	class ref_library_cache
+	{
+	public:
+		ref_library_cache()
+			: cache("", ".ampr")
+		{
+		}
+
+		explicit ref_library_cache(const std::string& directory_)
+			: cache(directory_, ".ampr")
+		{
+		}
+
+		ref_library_cache(const ref_library_cache&) = delete;
+		ref_library_cache& operator=(const ref_library_cache&) = delete;
+
+		std::shared_ptr<const quantized_ref_library> get(const std::vector<cv::Mat>& ref_images, int translation_steps = 2, int rotation_steps = 10
+			, float border_value = 255.0f, float translation_interval = 1.0f, float rotation_interval = 0.1f)
+		{
+			uint64_t key = quantized_ref_library::key_of(ref_images, translation_steps, rotation_steps, border_value, translation_interval, rotation_interval);
+			return cache.find_or_build(key, [&]()
+			{
+				return quantized_ref_library(ref_images, translation_steps, rotation_steps, border_value, translation_interval, rotation_interval);
+			});
+		}
+
+		// Libraries held in memory
+		size_t size() const
+		{
+			return cache.size();
+		}
+
+		// Drop the libraries held in memory, the files stay
+		void clear()
+		{
+			cache.clear();
+		}
+
+		std::string path_of(uint64_t key) const
+		{
+			return cache.path_of(key);
+		}
+
+	private:
+		detail::model_file_cache<quantized_ref_library> cache;
+	};
+
+#if AMP_HAS_CPP_AMP
+	// load_ref_images from a library: ctx.float2d[i] gets the dequantized poses of image i, no warps are run
+	inline void load_ref_images(vision_context& ctx, const quantized_ref_library& refs)
+	{
+		const int per_image = refs.poses_per_image();
+		const cv::Size size = refs.image_size();
+		for (int i = 0; i < refs.image_count(); i++)
+		{
+			concurrency::array_view<float, 3> gpu_result_image = ctx.float2d[i].view_as<3>(concurrency::extent<3>(per_image, size.height, size.width));
+			for (int p = 0; p < per_image; p++)
+			{
+				ctx.load_cv_mat(refs.dequantize(i * per_image + p), gpu_result_image[p]);
+			}
+			gpu_result_image.synchronize();
+		}
+	}
+#endif
+
+	namespace detail
+	{
+		// inputs quantized to uint8 with a per-row offset and scale: pixel ~= offset + scale * code, code in [0, 255]
+		struct quantized_inputs
+		{
+			cpu::plane<unsigned char> codes;
+			std::vector<float> offset;
+			std::vector<float> scale;
+			std::vector<long long> code_sum;
+			std::vector<long long> code_sq_sum;
+		};
+
+		inline void quantize_inputs(cpu::thread_pool& pool, cpu::plane_view<const float> input_array, quantized_inputs& inputs)
+		{
+			const int rows = input_array.rows;
+			const int cols = input_array.cols;
+			inputs.codes = cpu::plane<unsigned char>(rows, cols);
+			inputs.offset.assign(rows, 0.0f);
+			inputs.scale.assign(rows, 0.0f);
+			inputs.code_sum.assign(rows, 0);
+			inputs.code_sq_sum.assign(rows, 0);
+			cpu::plane_view<unsigned char> codes = inputs.codes.view();
+			pool.parallel_for(0, rows, 1, [&](int first, int last)
+			{
+				for (int r = first; r < last; r++)
+				{
+					const float* src = input_array.row(r);
+					unsigned char* code = codes.row(r);
+					float lo = cols > 0 ? src[0] : 0.0f, hi = lo;
+					for (int c = 1; c < cols; c++)
+					{
+						lo = std::min(lo, src[c]);
+						hi = std::max(hi, src[c]);
+					}
+					const float scale = (hi - lo) / 255.0f;
+					const float inv_scale = hi > lo ? 255.0f / (hi - lo) : 0.0f;
+					long long sum = 0, sq_sum = 0;
+					for (int c = 0; c < cols; c++)
+					{
+						int value = std::min(255, std::max(0, int(std::lround((src[c] - lo) * inv_scale))));
+						code[c] = (unsigned char)value;
+						sum += value;
+						sq_sum += value * value;
+					}
+					inputs.offset[r] = lo;
+					inputs.scale[r] = scale;
+					inputs.code_sum[r] = sum;
+					inputs.code_sq_sum[r] = sq_sum;
+				}
+			});
+		}
+
+		// uint8 input against 4 int8 poses, dots over [first, last) added to dots.
+		// Partial sums stay in int32 for at most quantized_dot_chunk columns.
+		static const int quantized_dot_chunk = 1 << 16;
+
+		inline void quantized_dots_scalar(const unsigned char* u, const signed char* const* q, int first, int last, long long dots[4])
+		{
+			for (int r = 0; r < 4; r++)
+			{
+				int sum = 0;
+				for (int c = first; c < last; c++)
+				{
+					sum += int(u[c]) * int(q[r][c]);
+				}
+				dots[r] += sum;
+			}
+		}
+
+#if AMP_CPU_X86
+		// pmaddubsw saturates full range u8 x s8 pairs, both sides are widened to int16 for pmaddwd instead
+		AMP_CPU_TARGET("avx2")
+		inline void quantized_dots_avx2(const unsigned char* u, const signed char* const* q, int first, int last, long long dots[4])
+		{
+			int vec_last = first + (last - first) / 32 * 32;
+			__m256i acc[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+			for (int c = first; c < vec_last; c += 32)
+			{
+				__m256i uv = _mm256_loadu_si256((const __m256i*)(u + c));
+				__m256i u_lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(uv));
+				__m256i u_hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(uv, 1));
+				for (int r = 0; r < 4; r++)
+				{
+					__m256i qv = _mm256_loadu_si256((const __m256i*)(q[r] + c));
+					__m256i q_lo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(qv));
+					__m256i q_hi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(qv, 1));
+					acc[r] = _mm256_add_epi32(acc[r], _mm256_add_epi32(_mm256_madd_epi16(u_lo, q_lo), _mm256_madd_epi16(u_hi, q_hi)));
+				}
+			}
+			for (int r = 0; r < 4; r++)
+			{
+				__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc[r]), _mm256_extracti128_si256(acc[r], 1));
+				sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+				sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+				dots[r] += _mm_cvtsi128_si32(sum);
+			}
+			quantized_dots_scalar(u, q, vec_last, last, dots);
+		}
+
+#if AMP_CPU_AVX512
+		AMP_CPU_TARGET("avx512f,avx512bw")
+		inline void quantized_dots_avx512(const unsigned char* u, const signed char* const* q, int first, int last, long long dots[4])
+		{
+			int vec_last = first + (last - first) / 32 * 32;
+			__m512i acc[4] = { _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512() };
+			for (int c = first; c < vec_last; c += 32)
+			{
+				__m512i uv = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(u + c)));
+				for (int r = 0; r < 4; r++)
+				{
+					__m512i qv = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i*)(q[r] + c)));
+					acc[r] = _mm512_add_epi32(acc[r], _mm512_madd_epi16(uv, qv));
+				}
+			}
+			for (int r = 0; r < 4; r++)
+			{
+				dots[r] += _mm512_reduce_add_epi32(acc[r]);
+			}
+			quantized_dots_scalar(u, q, vec_last, last, dots);
+		}
+
+		// vpdpbusd multiplies u8 by s8 and adds groups of 4 into int32 without intermediate saturation
+		AMP_CPU_TARGET("avx512f,avx512bw,avx512vnni")
+		inline void quantized_dots_vnni(const unsigned char* u, const signed char* const* q, int first, int last, long long dots[4])
+		{
+			int vec_last = first + (last - first) / 64 * 64;
+			__m512i acc[4] = { _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512() };
+			for (int c = first; c < vec_last; c += 64)
+			{
+				__m512i uv = _mm512_loadu_si512((const void*)(u + c));
+				for (int r = 0; r < 4; r++)
+				{
+					acc[r] = _mm512_dpbusd_epi32(acc[r], uv, _mm512_loadu_si512((const void*)(q[r] + c)));
+				}
+			}
+			for (int r = 0; r < 4; r++)
+			{
+				dots[r] += _mm512_reduce_add_epi32(acc[r]);
+			}
+			quantized_dots_scalar(u, q, vec_last, last, dots);
+		}
+#endif
+#endif
+
+		inline void quantized_dots(const unsigned char* u, const signed char* const* q, int n, long long dots[4], cpu::simd_level level, bool vnni)
+		{
+			dots[0] = dots[1] = dots[2] = dots[3] = 0;
+			for (int first = 0; first < n; first += quantized_dot_chunk)
+			{
+				int last = std::min(n, first + quantized_dot_chunk);
+#if AMP_CPU_X86
+#if AMP_CPU_AVX512
+				if (vnni)
+				{
+					quantized_dots_vnni(u, q, first, last, dots);
+					continue;
+				}
+				if (level >= cpu::simd_level::avx512)
+				{
+					quantized_dots_avx512(u, q, first, last, dots);
+					continue;
+				}
+#endif
+				if (level >= cpu::simd_level::avx2)
+				{
+					quantized_dots_avx2(u, q, first, last, dots);
+					continue;
+				}
+#endif
+				(void)level;
+				(void)vnni;
+				quantized_dots_scalar(u, q, first, last, dots);
+			}
+		}
+
+		// squared distances of input row i to poses [pose_first, pose_last), from
+		// sum((a + xs u - s q)^2) with a = input offset - pose mean, expanded over the integer sums
+		inline void quantized_distances(const quantized_inputs& inputs, int i, const quantized_ref_library& refs, int pose_first, int pose_last, double* dist2
+			, cpu::simd_level level, bool vnni)
+		{
+			const int n = refs.pixels();
+			const cpu::plane_view<const signed char> codes = refs.codes();
+			const unsigned char* u = inputs.codes.view().row(i);
+			const double xs = inputs.scale[i];
+			const double u_sum = double(inputs.code_sum[i]);
+			const double u_sq_sum = double(inputs.code_sq_sum[i]);
+			for (int p = pose_first; p < pose_last; p += 4)
+			{
+				const int count = std::min(4, pose_last - p);
+				const signed char* q[4];
+				for (int j = 0; j < 4; j++)
+				{
+					q[j] = codes.row(p + std::min(j, count - 1));
+				}
+				long long dots[4];
+				quantized_dots(u, q, n, dots, level, vnni);
+				for (int j = 0; j < count; j++)
+				{
+					const quantized_ref_library::pose_info& pose = refs.pose(p + j);
+					const double a = double(inputs.offset[i]) - pose.mean;
+					const double s = pose.scale;
+					double d = n * a * a + xs * xs * u_sq_sum + s * s * double(pose.code_sq_sum) + 2.0 * a * xs * u_sum
+						- 2.0 * a * s * double(pose.code_sum) - 2.0 * xs * s * double(dots[j]);
+					dist2[p + j - pose_first] = std::max(0.0, d);
+				}
+			}
+		}
+	}
+
+	// inputs x poses euclidean distances against a quantized library, the CPU counterpart of batch_diff_32f_c1 on load_ref_images.
+	// Input rows are quantized to uint8 once, every distance is one integer dot product.
+	inline void batch_diff_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> input_array, const quantized_ref_library& refs, cpu::plane_view<float> diff_array)
+	{
+		if (input_array.cols != refs.pixels() || diff_array.rows != input_array.rows || diff_array.cols != refs.pose_count())
+		{
+			throw std::runtime_error("invalid arguments of batch_diff_32f_c1");
+		}
+		detail::quantized_inputs inputs;
+		detail::quantize_inputs(pool, input_array, inputs);
+		const cpu::simd_level level = cpu::active_simd_level();
+		const bool vnni = cpu::has_avx512_vnni();
+		static const int pose_block = 64;
+		pool.parallel_for(0, DIVUP(refs.pose_count(), pose_block), 1, [&](int first, int last)
+		{
+			double dist2[pose_block];
+			for (int b = first; b < last; b++)
+			{
+				const int pose_first = b * pose_block;
+				const int pose_last = std::min(refs.pose_count(), pose_first + pose_block);
+				for (int i = 0; i < input_array.rows; i++)
+				{
+					detail::quantized_distances(inputs, i, refs, pose_first, pose_last, dist2, level, vnni);
+					float* dest = diff_array.row(i);
+					for (int p = pose_first; p < pose_last; p++)
+					{
+						dest[p] = float(std::sqrt(dist2[p - pose_first]));
+					}
+				}
+			}
+		});
+	}
+
+	// k nearest poses of every input row, see batch_nearest_32f_c1; distances are those of the quantized poses
+	inline void batch_nearest_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> input_array, const quantized_ref_library& refs, int k
+		, cpu::plane_view<int> index_array, cpu::plane_view<float> dist_array)
+	{
+		const int input_count = input_array.rows;
+		if (k < 1 || input_array.cols != refs.pixels() || index_array.rows != input_count || index_array.cols != k || dist_array.rows != input_count || dist_array.cols != k)
+		{
+			throw std::runtime_error("invalid arguments of batch_nearest_32f_c1");
+		}
+		detail::quantized_inputs inputs;
+		detail::quantize_inputs(pool, input_array, inputs);
+		const cpu::simd_level level = cpu::active_simd_level();
+		const bool vnni = cpu::has_avx512_vnni();
+		static const int pose_block = 64;
+		std::vector<float> best_dist(size_t(input_count) * k, FLT_MAX);
+		std::vector<int> best_index(size_t(input_count) * k, -1);
+		std::mutex merge_mutex;
+		const int block_count = DIVUP(refs.pose_count(), pose_block);
+		pool.parallel_for(0, block_count, std::max(1, block_count / int(pool.size() * 4)), [&](int first, int last)
+		{
+			std::vector<float> local_dist(size_t(input_count) * k, FLT_MAX);
+			std::vector<int> local_index(size_t(input_count) * k, -1);
+			double dist2[pose_block];
+			for (int b = first; b < last; b++)
+			{
+				const int pose_first = b * pose_block;
+				const int pose_last = std::min(refs.pose_count(), pose_first + pose_block);
+				for (int i = 0; i < input_count; i++)
+				{
+					detail::quantized_distances(inputs, i, refs, pose_first, pose_last, dist2, level, vnni);
+					for (int p = pose_first; p < pose_last; p++)
+					{
+						detail::insert_nearest(&local_dist[size_t(i) * k], &local_index[size_t(i) * k], k, float(std::sqrt(dist2[p - pose_first])), p);
+					}
+				}
+			}
+			std::lock_guard<std::mutex> lock(merge_mutex);
+			for (int i = 0; i < input_count; i++)
+			{
+				for (int j = 0; j < k && local_index[size_t(i) * k + j] >= 0; j++)
+				{
+					detail::insert_nearest(&best_dist[size_t(i) * k], &best_index[size_t(i) * k], k, local_dist[size_t(i) * k + j], local_index[size_t(i) * k + j]);
+				}
+			}
+		});
+		for (int i = 0; i < input_count; i++)
+		{
+			for (int j = 0; j < k; j++)
+			{
+				index_array(i, j) = best_index[size_t(i) * k + j];
+				dist_array(i, j) = best_dist[size_t(i) * k + j];
+			}
+		}
+	}
+}
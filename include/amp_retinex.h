@@ -3,11 +3,13 @@
 #include "amp_core.h"
 #include "amp_gaussian.h"
 #include "amp_scale.h"
+#include "amp_fusion.h"
 
 namespace amp
 {
 	// Retinex Filter
 	enum class retinex_rescale_method { no_rescale = 0, simple_balance, mean_stddev_balance };
+#if AMP_HAS_CPP_AMP
 	inline void retinex_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array
 		, array_view<float, 2> temp_array1, array_view<float, 2> temp_array2, int ksize, float sigma
 		, retinex_rescale_method rescale_method = retinex_rescale_method::simple_balance, float rescale_param = 0.01f)
@@ -172,5 +174,69 @@ namespace amp
 			}
 		}
 	}
+#endif
 
+	inline void retinex_rescale_32f_c1(cpu::thread_pool& pool, cpu::plane_view<float> dest_array, cpu::plane_view<float> temp_array
+		, retinex_rescale_method rescale_method, float rescale_param)
+	{
+		switch(rescale_method)
+		{
+		case retinex_rescale_method::simple_balance:
+			scale_to_range_32f_c1(pool, dest_array, temp_array, 255.0f, rescale_param);
+			break;
+		case retinex_rescale_method::mean_stddev_balance:
+			scale_by_stddev_32f_c1(pool, dest_array, 255.0f, rescale_param);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// +1, blur, log and subtract run as one fused pass, only the rescale reads dest again
+	inline void retinex_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, cpu::plane_view<float> temp_array1, cpu::plane_view<float> temp_array2, int ksize, float sigma
+		, retinex_rescale_method rescale_method = retinex_rescale_method::simple_balance, float rescale_param = 0.01f)
+	{
+		(void)temp_array2;
+		auto in = fusion::input(src_array) + 1.0f;
+		fusion::evaluate(pool, fusion::log(in) - fusion::log(fusion::gaussian(in, ksize, sigma)), dest_array);
+		retinex_rescale_32f_c1(pool, dest_array, temp_array1, rescale_method, rescale_param);
+	}
+
+	// The blurs cascade like the AMP version, each one ping-pongs between the temp arrays
+	inline void retinex_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, cpu::plane_view<float> temp_array1, cpu::plane_view<float> temp_array2
+		, const std::vector<int>& ksizes, const std::vector<float>& sigmas, const std::vector<float>& weights
+		, retinex_rescale_method rescale_method = retinex_rescale_method::simple_balance, float rescale_param = 0.01f)
+	{
+		assert(ksizes.size() == sigmas.size() && ksizes.size() == weights.size());
+		std::vector<float> normal_weights(weights.size());
+		float total_weights = std::accumulate(weights.begin(), weights.end(), 0.0f);
+		if(total_weights > 1.0f + FLT_EPSILON)
+		{
+			std::transform(weights.begin(), weights.end(), normal_weights.begin(), [=](float w) -> float { return w / total_weights; });
+		}
+		else
+		{
+			std::copy(weights.begin(), weights.end(), normal_weights.begin());
+		}
+		auto in = fusion::input(src_array) + 1.0f;
+		fusion::evaluate(pool, fusion::log(in), dest_array);
+		cpu::plane_view<float> blurred = temp_array1;
+		cpu::plane_view<float> spare = temp_array2;
+		for(size_t i = 0; i < weights.size(); i++)
+		{
+			if(i == 0)
+			{
+				fusion::evaluate(pool, fusion::gaussian(in, ksizes[i], sigmas[i]), blurred);
+			}
+			else
+			{
+				fusion::evaluate(pool, fusion::gaussian(fusion::input(spare), ksizes[i], sigmas[i]), blurred);
+			}
+			fusion::evaluate(pool, fusion::input(dest_array) - fusion::log(fusion::input(blurred)) * normal_weights[i], dest_array);
+			std::swap(blurred, spare);
+		}
+		retinex_rescale_32f_c1(pool, dest_array, blurred, rescale_method, rescale_param);
+	}
 }
@@ -0,0 +1,285 @@
+﻿#pragma once
+
+#include <cmath>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "amp_core.h"
+#include "amp_cpu_fft.h"
+
+namespace amp
+{
+	// one instance found by a template search, transform maps template to target coordinates
+	struct template_match
+	{
+		cv::Matx23f transform;
+		float score;
+	};
+
+	namespace detail
+	{
+		// template center in target coordinates
+		inline cv::Point2f match_center(const cv::Matx23f& transform, cv::Size templ_size)
+		{
+			float cx = float(templ_size.width) / 2.0f;
+			float cy = float(templ_size.height) / 2.0f;
+			return cv::Point2f(transform(0, 0) * cx + transform(0, 1) * cy + transform(0, 2), transform(1, 0) * cx + transform(1, 1) * cy + transform(1, 2));
+		}
+
+		// greedy non-maximum suppression: best score first, a match whose center is closer than radius to a kept one is dropped
+		inline void suppress_non_maxima(std::vector<template_match>& matches, cv::Size templ_size, float radius, size_t max_count)
+		{
+			std::stable_sort(matches.begin(), matches.end(), [](const template_match& a, const template_match& b) { return a.score > b.score; });
+			std::vector<template_match> kept;
+			std::vector<cv::Point2f> kept_centers;
+			for (size_t i = 0; i < matches.size() && kept.size() < max_count; i++)
+			{
+				cv::Point2f center = match_center(matches[i].transform, templ_size);
+				bool suppressed = false;
+				for (size_t k = 0; k < kept_centers.size() && !suppressed; k++)
+				{
+					float dx = center.x - kept_centers[k].x;
+					float dy = center.y - kept_centers[k].y;
+					suppressed = dx * dx + dy * dy < radius * radius;
+				}
+				if (!suppressed)
+				{
+					kept.push_back(matches[i]);
+					kept_centers.push_back(center);
+				}
+			}
+			matches.swap(kept);
+		}
+
+		// angle_prec steps over the whole turn, for a first guess of the target angle
+		inline std::vector<double> guess_angles(double angle_prec)
+		{
+			int angle_step = cvRound(180.0 / angle_prec);
+			std::vector<double> angles;
+			for (int i = -angle_step; i <= angle_step; i++)
+			{
+				angles.push_back(i * angle_prec);
+			}
+			return angles;
+		}
+
+		// steps that move the template border by about one pixel, from min_angle to max_angle
+		inline std::vector<double> coarse_angles(cv::Size templ_size, double min_angle, double max_angle)
+		{
+			double angle_prec = std::asin(1.0 / std::max(templ_size.height, templ_size.width)) * 180.0 / CV_PI;
+			double mean_angle = (min_angle + max_angle) / 2.0;
+			int min_angle_step = cvRound((mean_angle - min_angle) / angle_prec);
+			int max_angle_step = cvRound((max_angle - mean_angle) / angle_prec);
+			std::vector<double> angles;
+			for (int i = -min_angle_step; i <= max_angle_step; i++)
+			{
+				angles.push_back(mean_angle + i * angle_prec);
+			}
+			return angles;
+		}
+	}
+
+	// TM_CCORR_NORMED search of a template rotated by a list of angles in targets of one size.
+	// The rotated templates and their masks are transformed once; a search transforms the target and its square once,
+	// then each angle costs two spectrum products and inverse transforms, run in parallel on the thread pool.
+	// Transforms use the real-input half spectra of amp_cpu_fft.h.
+	// The normalization sums the squared target under the rotated template's footprint, so every angle is scored on the same area.
+	// Angles follow get_best_transform_by_match_templ: the angle the target is rotated by to line up with the template.
+	class rotation_correlator
+	{
+	public:
+		// best position at one angle
+		struct peak
+		{
+			template_match match;
+			int angle_index;
+		};
+
+		rotation_correlator(const cv::Mat& templ, cv::Size target_size_, const std::vector<double>& angles_, cpu::thread_pool& pool_ = cpu::default_thread_pool())
+			: pool(pool_), templ_size(templ.size()), target_size(target_size_), angles(angles_), rotations(angles_.size())
+		{
+			if (templ.empty() || angles.empty())
+			{
+				throw std::runtime_error("rotation_correlator needs a template and at least one angle");
+			}
+			dft_size = cv::Size(cpu::optimal_fft_size(target_size.width), cpu::optimal_fft_size(target_size.height));
+			cv::Mat templ_32f, ones(templ.size(), CV_32FC1, cv::Scalar(1.0));
+			templ.convertTo(templ_32f, CV_32F);
+			pool.parallel_for(0, int(angles.size()), 1, [&](int first, int last)
+			{
+				for (int i = first; i < last; i++)
+				{
+					rotate(templ_32f, ones, angles[i], rotations[i]);
+				}
+			});
+		}
+
+		cv::Size get_target_size() const
+		{
+			return target_size;
+		}
+
+		const std::vector<double>& get_angles() const
+		{
+			return angles;
+		}
+
+		// up to max_peaks positions per angle, peaks closer than half the rotated template are one.
+		// Angles whose rotated template doesn't fit in the target have none.
+		std::vector<peak> search(const cv::Mat& target, int max_peaks = 1) const
+		{
+			if (target.size() != target_size)
+			{
+				throw std::runtime_error("target size mismatch in rotation_correlator::search");
+			}
+			cv::Mat padded(dft_size, CV_32FC1, cv::Scalar(0.0)), padded_sq;
+			cv::Mat target_roi = padded(cv::Rect(0, 0, target.cols, target.rows));
+			target.convertTo(target_roi, CV_32F);
+			padded_sq = padded.mul(padded);
+			cpu::plane<std::complex<float>> target_spectrum = spectrum_of(padded), target_sq_spectrum = spectrum_of(padded_sq);
+			std::vector<std::vector<peak>> angle_peaks(angles.size());
+			pool.parallel_for(0, int(angles.size()), 1, [&](int first, int last)
+			{
+				for (int i = first; i < last; i++)
+				{
+					search_angle(target_spectrum, target_sq_spectrum, i, max_peaks, angle_peaks[i]);
+				}
+			});
+			std::vector<peak> peaks;
+			for (size_t i = 0; i < angle_peaks.size(); i++)
+			{
+				peaks.insert(peaks.end(), angle_peaks[i].begin(), angle_peaks[i].end());
+			}
+			return peaks;
+		}
+
+		// best peak over every angle, the first angle on ties
+		peak best(const cv::Mat& target) const
+		{
+			std::vector<peak> peaks = search(target, 1);
+			if (peaks.empty())
+			{
+				throw std::runtime_error("template doesn't fit in the target at any angle");
+			}
+			size_t best_index = 0;
+			for (size_t i = 1; i < peaks.size(); i++)
+			{
+				if (peaks[i].match.score > peaks[best_index].match.score)
+				{
+					best_index = i;
+				}
+			}
+			return peaks[best_index];
+		}
+
+	private:
+		struct rotation
+		{
+			// template to rotated box
+			cv::Matx23f box_transform;
+			cv::Size box_size;
+			cpu::plane<std::complex<float>> templ_spectrum;
+			cpu::plane<std::complex<float>> mask_spectrum;
+			double templ_energy;
+		};
+
+		void rotate(const cv::Mat& templ_32f, const cv::Mat& ones, double angle, rotation& r) const
+		{
+			cv::Point2f templ_center(templ_32f.cols / 2.0f, templ_32f.rows / 2.0f);
+			// the template seen in the target is rotated back by angle
+			cv::Matx23f box_transform = cv::getRotationMatrix2D(templ_center, -angle, 1.0);
+			double alpha = std::fabs(box_transform(0, 0)), beta = std::fabs(box_transform(0, 1));
+			r.box_size = cv::Size(std::max(1, int(std::ceil(alpha * templ_32f.cols + beta * templ_32f.rows - 1e-6)))
+				, std::max(1, int(std::ceil(beta * templ_32f.cols + alpha * templ_32f.rows - 1e-6))));
+			box_transform(0, 2) += r.box_size.width / 2.0f - templ_center.x;
+			box_transform(1, 2) += r.box_size.height / 2.0f - templ_center.y;
+			r.box_transform = box_transform;
+			r.templ_energy = 0.0;
+			if (r.box_size.width > target_size.width || r.box_size.height > target_size.height)
+			{
+				return;
+			}
+			cv::Mat padded(dft_size, CV_32FC1, cv::Scalar(0.0)), padded_mask(dft_size, CV_32FC1, cv::Scalar(0.0));
+			cv::Mat box = padded(cv::Rect(0, 0, r.box_size.width, r.box_size.height));
+			cv::Mat mask_box = padded_mask(cv::Rect(0, 0, r.box_size.width, r.box_size.height));
+			cv::warpAffine(templ_32f, box, cv::Mat(box_transform), r.box_size, cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(0.0));
+			cv::warpAffine(ones, mask_box, cv::Mat(box_transform), r.box_size, cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0.0));
+			r.templ_energy = box.dot(box);
+			r.templ_spectrum = spectrum_of(padded);
+			r.mask_spectrum = spectrum_of(padded_mask);
+		}
+
+		// half spectrum of a dft_size CV_32FC1 image
+		cpu::plane<std::complex<float>> spectrum_of(const cv::Mat& padded) const
+		{
+			cpu::plane<std::complex<float>> spectrum(dft_size.height, cpu::fft_half_cols(dft_size.width));
+			cpu::fft_forward_r2c_2d(pool, cpu::plane_view<const float>(padded.ptr<float>(0), padded.rows, padded.cols, int(padded.step1())), spectrum);
+			return spectrum;
+		}
+
+		// inverse transform of spectrum * conj(filter_spectrum), scaled
+		void correlate(const cpu::plane<std::complex<float>>& spectrum, const cpu::plane<std::complex<float>>& filter_spectrum
+			, cpu::plane<std::complex<float>>& product, cpu::plane<float>& result) const
+		{
+			cpu::multiply_spectrums(pool, spectrum, filter_spectrum, product, true);
+			cpu::fft_inverse_c2r_2d(pool, product, result, float(1.0 / (double(dft_size.width) * dft_size.height)));
+		}
+
+		void search_angle(const cpu::plane<std::complex<float>>& target_spectrum, const cpu::plane<std::complex<float>>& target_sq_spectrum, int index
+			, int max_peaks, std::vector<peak>& peaks) const
+		{
+			const rotation& r = rotations[index];
+			if (r.templ_spectrum.rows == 0 || r.templ_energy <= 0.0)
+			{
+				return;
+			}
+			cpu::plane<std::complex<float>> product(dft_size.height, cpu::fft_half_cols(dft_size.width));
+			cpu::plane<float> corr(dft_size.height, dft_size.width), window_energy(dft_size.height, dft_size.width);
+			correlate(target_spectrum, r.templ_spectrum, product, corr);
+			correlate(target_sq_spectrum, r.mask_spectrum, product, window_energy);
+			// positions where the whole box lies in the target
+			const int result_rows = target_size.height - r.box_size.height + 1;
+			const int result_cols = target_size.width - r.box_size.width + 1;
+			cv::Mat result(result_rows, result_cols, CV_32FC1);
+			const double energy_floor = r.templ_energy * 1e-12;
+			for (int y = 0; y < result_rows; y++)
+			{
+				const float* corr_row = corr.view().row(y);
+				const float* energy_row = window_energy.view().row(y);
+				float* result_row = result.ptr<float>(y);
+				for (int x = 0; x < result_cols; x++)
+				{
+					double energy = r.templ_energy * double(energy_row[x]);
+					result_row[x] = energy > energy_floor ? float(double(corr_row[x]) / std::sqrt(energy)) : 0.0f;
+				}
+			}
+			const int suppress_cols = std::max(1, r.box_size.width / 2);
+			const int suppress_rows = std::max(1, r.box_size.height / 2);
+			for (int n = 0; n < max_peaks; n++)
+			{
+				cv::Point poMin, poMax;
+				double dmin, dmax;
+				cv::minMaxLoc(result, &dmin, &dmax, &poMin, &poMax);
+				if (dmax <= 0.0)
+				{
+					break;
+				}
+				peak p;
+				p.match.transform = r.box_transform;
+				p.match.transform(0, 2) += float(poMax.x);
+				p.match.transform(1, 2) += float(poMax.y);
+				p.match.score = float(dmax);
+				p.angle_index = index;
+				peaks.push_back(p);
+				int x0 = std::max(0, poMax.x - suppress_cols), x1 = std::min(result.cols, poMax.x + suppress_cols + 1);
+				int y0 = std::max(0, poMax.y - suppress_rows), y1 = std::min(result.rows, poMax.y + suppress_rows + 1);
+				result(cv::Rect(x0, y0, x1 - x0, y1 - y0)).setTo(cv::Scalar(0.0));
+			}
+		}
+
+		cpu::thread_pool& pool;
+		cv::Size templ_size;
+		cv::Size target_size;
+		cv::Size dft_size;
+		std::vector<double> angles;
+		std::vector<rotation> rotations;
+	};
+}
@@ -4,9 +4,11 @@
 #include "amp_max_min.h"
 #include "amp_mean_stddev.h"
 #include "amp_calc_hist.h"
+#include "amp_fusion.h"
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Scaling
 	inline void scale_to_range_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array, array_view<float, 2> temp_array, float gain = 255.0f, float saturation = 0.0f)
 	{
@@ -327,5 +329,73 @@ namespace amp
 			guarded_write(src_dest_array, idx.global, src_value * alpha + beta);
 		});
 	}
+#endif
 
+	// CPU backend, the pointwise passes run through fusion::evaluate
+	inline void scale_to_range_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array, cpu::plane_view<float> temp_array, float gain = 255.0f, float saturation = 0.0f)
+	{
+		std::pair<float, float> max_min = max_min_value_32f_c1(pool, src_array);
+		if(max_min.first == max_min.second)
+		{
+			// fill 0.0f
+			fusion::evaluate(pool, fusion::constant(src_array.rows, src_array.cols, 0.0f), dest_array);
+			return;
+		}
+		// scale
+		float alpha = gain / (max_min.first - max_min.second);
+		float beta = max_min.second * gain / (max_min.second - max_min.first);
+		int ignore_count = cvRound(double(src_array.rows) * src_array.cols * saturation);
+		if(ignore_count > 0)
+		{
+			// saturate ignore_count pixels at both ends, found on the histogram of the scaled image
+			fusion::evaluate(pool, fusion::scale(fusion::input(src_array), alpha, beta), temp_array);
+			std::vector<int> hist;
+			calc_hist_32f_c1(pool, temp_array, hist, cvRound(gain));
+			int sum_low = 0;
+			int sum_high = 0;
+			auto it_low = std::find_if(hist.begin(), hist.end(), [ignore_count, &sum_low](int cnt) -> bool
+			{
+				sum_low += cnt;
+				return sum_low > ignore_count;
+			});
+			auto it_high = std::find_if(hist.rbegin(), hist.rend(), [ignore_count, &sum_high](int cnt) -> bool
+			{
+				sum_high += cnt;
+				return sum_high > ignore_count;
+			});
+			float new_min = (float(it_low - hist.begin()) - beta) / alpha;
+			float new_max = ((gain - float(it_high - hist.rbegin())) - beta) / alpha;
+			alpha = gain / (new_max - new_min);
+			beta = new_min * gain / (new_min - new_max);
+		}
+		fusion::evaluate(pool, fusion::scale(fusion::input(src_array), alpha, beta), dest_array);
+	}
+
+	inline void scale_to_range_32f_c1(cpu::thread_pool& pool, cpu::plane_view<float> src_dest_array, cpu::plane_view<float> temp_array, float gain = 255.0f, float saturation = 0.0f)
+	{
+		scale_to_range_32f_c1(pool, cpu::plane_view<const float>(src_dest_array), src_dest_array, temp_array, gain, saturation);
+	}
+
+	inline void scale_by_stddev_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array, float gain = 255.0f, float dynamic = 3.0f)
+	{
+		std::pair<float, float> mean_stddev = mean_std_dev_32f_c1(pool, src_array);
+		float mean_val = mean_stddev.first;
+		float stddev_val = mean_stddev.second;
+		float max_val = mean_val + dynamic * stddev_val;
+		float min_val = mean_val - dynamic * stddev_val;
+		if(max_val <= min_val)
+		{
+			// fill with mean value
+			fusion::evaluate(pool, fusion::constant(src_array.rows, src_array.cols, mean_val), dest_array);
+			return;
+		}
+		float alpha = gain / (max_val - min_val);
+		float beta = min_val * gain / (min_val - max_val);
+		fusion::evaluate(pool, fusion::scale(fusion::input(src_array), alpha, beta), dest_array);
+	}
+
+	inline void scale_by_stddev_32f_c1(cpu::thread_pool& pool, cpu::plane_view<float> src_dest_array, float gain = 255.0f, float dynamic = 3.0f)
+	{
+		scale_by_stddev_32f_c1(pool, cpu::plane_view<const float>(src_dest_array), src_dest_array, gain, dynamic);
+	}
 }
@@ -305,34 +305,40 @@ namespace amp
 		});
 	}
 
-	inline void enforce_superpixels_connectivity(accelerator_view& acc_view, array_view<float, 2> superpixel_array
+	inline void enforce_superpixels_connectivity(accelerator_view& acc_view, buffer_pool& buffers, array_view<float, 2> superpixel_array
 		, array_view<int, 2> mask_array, array_view<int, 2> label_array, unsigned int area_thresh)
 	{
 		// 1st pass, merge into nearst cluster by centroid
 		compute_connectivity_mask(acc_view, superpixel_array, mask_array, -0.5f, 0.5f);
 		label_components(acc_view, mask_array, label_array);
 		int blob_count = reorder_labels<3072U>(acc_view, label_array);
-		concurrency::array<amp::moments, 1> moments_array(blob_count, acc_view);
-		concurrency::array<float, 1> gpu_lut(blob_count, acc_view);
+		// per-blob tables come from the pool, the views keep this call's sizes
+		buffer_pool::device_lease moments_buf = buffers.acquire_device<amp::moments>(blob_count);
+		buffer_pool::device_lease lut_buf = buffers.acquire_device<float>(blob_count);
+		buffer_pool::device_lease large_buf = buffers.acquire_device<float_3>(blob_count);
+		buffer_pool::device_lease small_buf = buffers.acquire_device<float_3>(blob_count);
+		buffer_pool::device_lease count_buf = buffers.acquire_device<int>(2);
+		array_view<amp::moments, 1> moments_array = moments_buf.view<amp::moments>(blob_count);
+		array_view<float, 1> gpu_lut = lut_buf.view<float>(blob_count);
+		array_view<float_3, 1> large_labels = large_buf.view<float_3>(blob_count);
+		array_view<float_3, 1> small_labels = small_buf.view<float_3>(blob_count);
+		array_view<int, 1> label_count = count_buf.view<int>(2);
 		calc_moments(acc_view, label_array, moments_array);
-		concurrency::array<float_3, 1> large_labels(blob_count, acc_view);
-		concurrency::array<float_3, 1> small_labels(blob_count, acc_view);
-		concurrency::array<int, 1> label_count(2, acc_view);
-		concurrency::parallel_for_each(acc_view, gpu_lut.get_extent(), [&label_count, &gpu_lut](concurrency::index<1> idx) restrict(amp)
+		concurrency::parallel_for_each(acc_view, gpu_lut.get_extent(), [=](concurrency::index<1> idx) restrict(amp)
 		{
 			if (idx[0] < 2) label_count[idx[0]] = 0;
 			gpu_lut(idx) = float(idx[0]);
 		});
-		concurrency::parallel_for_each(acc_view, moments_array.get_extent(), [=, &label_count, &moments_array, &large_labels, &small_labels](concurrency::index<1> idx) restrict(amp)
+		concurrency::parallel_for_each(acc_view, moments_array.get_extent(), [=](concurrency::index<1> idx) restrict(amp)
 		{
 			const amp::moments& m = moments_array(idx);
 			if (m.m00 >= area_thresh)
 			{
-				large_labels[concurrency::atomic_fetch_inc(&label_count[0])] = float_3(float(idx[0]), float(m.m10) / float(m.m00), float(m.m01) / float(m.m00));
+				large_labels[concurrency::atomic_fetch_inc(&label_count[0])] = float_3(float(idx[0]), m.m10.to_float() / float(m.m00), m.m01.to_float() / float(m.m00));
 			}
 			else
 			{
-				small_labels[concurrency::atomic_fetch_inc(&label_count[1])] = float_3(float(idx[0]), float(m.m10) / float(m.m00), float(m.m01) / float(m.m00));
+				small_labels[concurrency::atomic_fetch_inc(&label_count[1])] = float_3(float(idx[0]), m.m10.to_float() / float(m.m00), m.m01.to_float() / float(m.m00));
 			}
 		});
 		std::vector<int> cpu_label_count(2);
@@ -341,7 +347,7 @@ namespace amp
 		int small_label_count = cpu_label_count[1];
 		if(small_label_count > 0)
 		{
-			concurrency::parallel_for_each(acc_view, concurrency::extent<1>(small_label_count), [=, &gpu_lut, &small_labels, &large_labels](concurrency::index<1> idx) restrict(amp)
+			concurrency::parallel_for_each(acc_view, concurrency::extent<1>(small_label_count), [=](concurrency::index<1> idx) restrict(amp)
 			{
 				float min_dist = FLT_MAX;
 				float min_dist_label = -1.0f;
@@ -367,13 +373,15 @@ namespace amp
 			label_components(acc_view, mask_array, label_array);
 			blob_count = reorder_labels(acc_view, label_array);
 			calc_moments(acc_view, label_array, moments_array);
-			concurrency::array<int, 1> label_flags(blob_count, acc_view);
-			concurrency::array<int, 1> label_flags2(blob_count, acc_view);
-			concurrency::parallel_for_each(acc_view, gpu_lut.get_extent(), [&gpu_lut](concurrency::index<1> idx) restrict(amp)
+			buffer_pool::device_lease flags_buf = buffers.acquire_device<int>(blob_count);
+			buffer_pool::device_lease flags2_buf = buffers.acquire_device<int>(blob_count);
+			array_view<int, 1> label_flags = flags_buf.view<int>(blob_count);
+			array_view<int, 1> label_flags2 = flags2_buf.view<int>(blob_count);
+			concurrency::parallel_for_each(acc_view, gpu_lut.get_extent(), [=](concurrency::index<1> idx) restrict(amp)
 			{
 				gpu_lut(idx) = float(idx[0]);
 			});
-			concurrency::parallel_for_each(acc_view, concurrency::extent<1>(blob_count), [=, &moments_array, &label_flags, &label_flags2](concurrency::index<1> idx) restrict(amp)
+			concurrency::parallel_for_each(acc_view, concurrency::extent<1>(blob_count), [=](concurrency::index<1> idx) restrict(amp)
 			{
 				const amp::moments& m = moments_array(idx);
 				int flag = m.m00 >= area_thresh ? 1 : 0;
@@ -389,7 +397,7 @@ namespace amp
 			do
 			{
 				label_changed[0] = 0;
-				concurrency::parallel_for_each(acc_view, label_array.get_extent().tile<tile_size, tile_size>().pad(), [label_array, label_changed, &label_flags, &gpu_lut](tiled_index<tile_size, tile_size> idx) restrict(amp) {
+				concurrency::parallel_for_each(acc_view, label_array.get_extent().tile<tile_size, tile_size>().pad(), [label_array, label_changed, label_flags, gpu_lut](tiled_index<tile_size, tile_size> idx) restrict(amp) {
 					tile_static int data[tile_size + 2][tile_size + 2];
 					int row = idx.global[0];
 					int col = idx.global[1];
@@ -425,7 +433,7 @@ namespace amp
 					}
 				});
 			} while(label_changed[0] != 0);
-			concurrency::parallel_for_each(acc_view, concurrency::extent<1>(blob_count), [=, &label_flags2, &gpu_lut](concurrency::index<1> idx) restrict(amp)
+			concurrency::parallel_for_each(acc_view, concurrency::extent<1>(blob_count), [=](concurrency::index<1> idx) restrict(amp)
 			{
 				int label = idx[0];
 				int mapped_label = int(gpu_lut(idx));
@@ -442,6 +450,19 @@ namespace amp
 		}
 	}
 
+	inline void enforce_superpixels_connectivity(vision_context& ctx, array_view<float, 2> superpixel_array
+		, array_view<int, 2> mask_array, array_view<int, 2> label_array, unsigned int area_thresh)
+	{
+		enforce_superpixels_connectivity(ctx.acc_view, ctx.buffers, superpixel_array, mask_array, label_array, area_thresh);
+	}
+
+	inline void enforce_superpixels_connectivity(accelerator_view& acc_view, array_view<float, 2> superpixel_array
+		, array_view<int, 2> mask_array, array_view<int, 2> label_array, unsigned int area_thresh)
+	{
+		buffer_pool buffers(acc_view);
+		enforce_superpixels_connectivity(acc_view, buffers, superpixel_array, mask_array, label_array, area_thresh);
+	}
+
 	inline void draw_superpixels_boundary_32f_c3(accelerator_view& acc_view, array_view<float, 2> dest_channel1, array_view<float, 2> dest_channel2
 		, array_view<float, 2> dest_channel3, array_view<const float, 2> superpixel_array)
 	{
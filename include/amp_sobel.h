@@ -6,6 +6,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Sobel Filter
 	template<unsigned int max_kernel_size = 1024U>
 	inline void sobel_filter_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array, array_view<float, 2> row_temp_array
@@ -15,4 +16,14 @@ namespace amp
 		cv::getDerivKernels(kx, ky, dx, dy, ksize, false, CV_32F);
 		convolve_separable_32f_c1<max_kernel_size>(acc_view, src_array, dest_array, row_temp_array, kx, ky);
 	}
+#endif
+
+	template<unsigned int max_kernel_size = 1024U>
+	inline void sobel_filter_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array, cpu::plane_view<float> row_temp_array
+		, int dx, int dy, int ksize)
+	{
+		cv::Mat kx, ky;
+		cv::getDerivKernels(kx, ky, dx, dy, ksize, false, CV_32F);
+		convolve_separable_32f_c1<max_kernel_size>(pool, src_array, dest_array, row_temp_array, kx, ky);
+	}
 }
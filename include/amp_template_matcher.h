@@ -1,6 +1,8 @@
-#pragma once
+﻿#pragma once
 
 #include "amp_find_best_transform.h"
+#include "amp_template_model.h"
+#include "amp_rotation_search.h"
 
 namespace amp
 {
@@ -11,125 +13,160 @@ namespace amp
 	// cv::Mat target = cv::imread("target.png", cv::IMREAD_GRAYSCALE);
 	// amp::dense_template_matcher matcher(acc_view, templ, target.size(), 4);
 	// cv::Matx23f best_affine_transform = matcher.match(target);
+	// pyramids can also be built once and mapped from disk afterwards, see amp_template_model.h
 
 	// find target angle in very low precision
 	inline double guess_target_angle(const cv::Mat& templ, const cv::Mat& target, double angle_prec = 7.5)
 	{
-		int angle_step = cvRound(180.0 / angle_prec);
-		std::vector<double> scores(angle_step * 2 + 1);
-		std::vector<cv::Point> score_poses(angle_step * 2 + 1);
-		cv::Point2f target_center(target.cols / 2.0f, target.rows / 2.0f);
-#ifdef __TBB_parallel_for_H
-		tbb::parallel_for(-angle_step, angle_step + 1, [&](int i)
-			{
-				double angle = i * angle_prec;
-				cv::Mat rot = cv::getRotationMatrix2D(target_center, angle, 1.0);
-				cv::Mat warppedTarget, result;
-				cv::warpAffine(target, warppedTarget, rot, target.size(), cv::INTER_LINEAR);
-				cv::matchTemplate(warppedTarget, templ, result, cv::TM_CCORR_NORMED);
-				cv::Point poMin, poMax;
-				double dmin, dmax;
-				cv::minMaxLoc(result, &dmin, &dmax, &poMin, &poMax);
-				scores[i + angle_step] = dmax;
-				score_poses[i + angle_step] = poMax;
-			});
-#else
-		for (int i = -angle_step; i <= angle_step; i++)
-		{
-			double angle = i * angle_prec;
-			cv::Mat rot = cv::getRotationMatrix2D(target_center, angle, 1.0);
-			cv::Mat warppedTarget, result;
-			cv::warpAffine(target, warppedTarget, rot, target.size(), cv::INTER_LINEAR);
-			cv::matchTemplate(warppedTarget, templ, result, cv::TM_CCORR_NORMED);
-			cv::Point poMin, poMax;
-			double dmin, dmax;
-			cv::minMaxLoc(result, &dmin, &dmax, &poMin, &poMax);
-			scores[i + angle_step] = dmax;
-			score_poses[i + angle_step] = poMax;
-		}
-#endif
-		size_t best_score_index = std::max_element(scores.cbegin(), scores.cend()) - scores.cbegin();
-		double best_angle = (int(best_score_index) - angle_step) * angle_prec;
-		return best_angle;
+		rotation_correlator search(templ, target.size(), detail::guess_angles(angle_prec));
+		return search.get_angles()[search.best(target).angle_index];
 	}
 
 	// find initial target position in low precision
-	cv::Matx23f get_best_transform_by_match_templ(const cv::Mat& templ, const cv::Mat& target, double min_angle, double max_angle)
+	inline cv::Matx23f get_best_transform_by_match_templ(const cv::Mat& templ, const cv::Mat& target, double min_angle, double max_angle)
+	{
+		rotation_correlator search(templ, target.size(), detail::coarse_angles(templ.size(), min_angle, max_angle));
+		return search.best(target).match.transform;
+	}
+
+	namespace detail
 	{
-		double angle_prec = std::asin(1.0 / std::max(templ.rows, templ.cols)) * 180.0 / CV_PI;
-		double mean_angle = (min_angle + max_angle) / 2.0;
-		int min_angle_step = cvRound((mean_angle - min_angle) / angle_prec);
-		int max_angle_step = cvRound((max_angle - mean_angle) / angle_prec);
-		std::vector<double> scores(min_angle_step + max_angle_step + 1);
-		std::vector<cv::Point> score_poses(min_angle_step + max_angle_step + 1);
-		cv::Point2f target_center(target.cols / 2.0f, target.rows / 2.0f);
-		cv::Point2f templ_center(templ.cols / 2.0f, templ.rows / 2.0f);
-#ifdef __TBB_parallel_for_H
-		tbb::parallel_for(-min_angle_step, max_angle_step + 1, [&](int i)
+		// candidate transforms around current_transform on one pyramid level: rotations that move the template border by
+		// about level_precision pixels, translations in steps of level_precision
+		inline void append_refine_transforms(std::vector<cv::Matx23f>& transforms, const cv::Matx23f& current_transform, cv::Size templ_size, float level_precision)
+		{
+			float templ_length = float(std::max(templ_size.width, templ_size.height));
+			float angle_precision = float(std::asinf(level_precision / templ_length) * 180.0 / CV_PI);
+			int angle_step = std::max(3, cvRound(1.0f / level_precision) + 1);
+			int xy_step = std::max(3, cvRound(1.0f / level_precision) + 1);
+			float current_angle = float(std::atan2f(current_transform(0, 1), current_transform(0, 0)) * 180.0 / CV_PI);
+			cv::Point2f templ_center(float(templ_size.width) / 2.0f, float(templ_size.height) / 2.0f);
+			cv::Matx23f current_rot_matrix = cv::getRotationMatrix2D(templ_center, current_angle, 1.0);
+			for (int angle = -angle_step; angle <= angle_step; angle++)
 			{
-				double angle = mean_angle + i * angle_prec;
-				cv::Mat rot = cv::getRotationMatrix2D(target_center, angle, 1.0);
-				cv::Mat warppedTarget, result;
-				cv::warpAffine(target, warppedTarget, rot, target.size(), cv::INTER_LINEAR);
-				cv::matchTemplate(warppedTarget, templ, result, cv::TM_CCORR_NORMED);
-				cv::Point poMin, poMax;
-				double dmin, dmax;
-				cv::minMaxLoc(result, &dmin, &dmax, &poMin, &poMax);
-				scores[i + min_angle_step] = dmax;
-				score_poses[i + min_angle_step] = poMax;
-			});
-#else
-		for (int i = -min_angle_step; i <= max_angle_step; i++)
+				float angle0 = current_angle + angle * angle_precision;
+				cv::Matx23f rot_matrix = cv::getRotationMatrix2D(templ_center, angle0, 1.0);
+				float alpha = rot_matrix(0, 0);
+				float beta = rot_matrix(0, 1);
+				cv::Point2f init_loc(current_transform(0, 2) + rot_matrix(0, 2) - current_rot_matrix(0, 2), current_transform(1, 2) + rot_matrix(1, 2) - current_rot_matrix(1, 2));
+				for (int x_delta = -xy_step; x_delta <= xy_step; x_delta++)
+				{
+					for (int y_delta = -xy_step; y_delta <= xy_step; y_delta++)
+					{
+						cv::Matx23f transform(alpha, beta, float(init_loc.x + x_delta * level_precision), -beta, alpha, float(init_loc.y + y_delta * level_precision));
+						transforms.push_back(transform);
+					}
+				}
+			}
+		}
+
+		// multi-instance version of get_best_transform_by_match_templ: up to max_count peaks of every angle,
+		// merged across angles by non-maximum suppression, scores are TM_CCORR_NORMED
+		inline std::vector<template_match> find_coarse_matches(const rotation_correlator& search, const cv::Mat& target, cv::Size templ_size, int max_count)
 		{
-			double angle = mean_angle + i * angle_prec;
-			cv::Mat rot = cv::getRotationMatrix2D(target_center, angle, 1.0);
-			cv::Mat warppedTarget, result;
-			cv::warpAffine(target, warppedTarget, rot, target.size(), cv::INTER_LINEAR);
-			cv::matchTemplate(warppedTarget, templ, result, cv::TM_CCORR_NORMED);
-			cv::Point poMin, poMax;
-			double dmin, dmax;
-			cv::minMaxLoc(result, &dmin, &dmax, &poMin, &poMax);
-			scores[i + min_angle_step] = dmax;
-			score_poses[i + min_angle_step] = poMax;
+			std::vector<rotation_correlator::peak> peaks = search.search(target, max_count);
+			std::vector<template_match> matches(peaks.size());
+			for (size_t i = 0; i < peaks.size(); i++)
+			{
+				matches[i] = peaks[i].match;
+			}
+			suppress_non_maxima(matches, templ_size, float(std::min(templ_size.width, templ_size.height)) / 2.0f, size_t(max_count));
+			return matches;
+		}
+
+		// correlators of the coarsest level, built on first use and kept while the angle range stays the same
+		class coarse_search_cache
+		{
+		public:
+			const rotation_correlator& guess(const cv::Mat& templ, cv::Size target_size)
+			{
+				if (!guess_search)
+				{
+					guess_search.reset(new rotation_correlator(templ, target_size, guess_angles(7.5)));
+				}
+				return *guess_search;
+			}
+
+			const rotation_correlator& range(const cv::Mat& templ, cv::Size target_size, double min_angle, double max_angle)
+			{
+				if (!range_search || min_angle != range_min_angle || max_angle != range_max_angle)
+				{
+					range_search.reset(new rotation_correlator(templ, target_size, coarse_angles(templ.size(), min_angle, max_angle)));
+					range_min_angle = min_angle;
+					range_max_angle = max_angle;
+				}
+				return *range_search;
+			}
+
+		private:
+			std::unique_ptr<rotation_correlator> guess_search;
+			std::unique_ptr<rotation_correlator> range_search;
+			double range_min_angle = 0.0;
+			double range_max_angle = 0.0;
+		};
+
+		// refine every hypothesis on one level in a single batched launch, keep the best candidate of each
+		// and merge hypotheses that converged to the same instance
+		template<typename Diffs>
+		inline void refine_matches(std::vector<template_match>& hypotheses, cv::Size level_templ_size, float level_precision, float max_diff
+			, float min_score, size_t max_count, Diffs diffs_of)
+		{
+			std::vector<cv::Matx23f> transforms;
+			std::vector<size_t> firsts(hypotheses.size() + 1, 0);
+			for (size_t i = 0; i < hypotheses.size(); i++)
+			{
+				hypotheses[i].transform(0, 2) *= 2.0f;
+				hypotheses[i].transform(1, 2) *= 2.0f;
+				detail::append_refine_transforms(transforms, hypotheses[i].transform, level_templ_size, level_precision);
+				firsts[i + 1] = transforms.size();
+			}
+			std::vector<int> diffs = diffs_of(transforms);
+			std::vector<template_match> refined;
+			for (size_t i = 0; i < hypotheses.size(); i++)
+			{
+				size_t best = std::min_element(diffs.begin() + firsts[i], diffs.begin() + firsts[i + 1]) - diffs.begin();
+				template_match match;
+				match.transform = transforms[best];
+				match.score = 1.0f - float(diffs[best]) / max_diff;
+				if (match.score >= min_score)
+				{
+					refined.push_back(match);
+				}
+			}
+			suppress_non_maxima(refined, level_templ_size, float(std::min(level_templ_size.width, level_templ_size.height)) / 2.0f, max_count);
+			hypotheses.swap(refined);
 		}
-#endif
-		size_t best_score_index = std::max_element(scores.cbegin(), scores.cend()) - scores.cbegin();
-		double best_angle = mean_angle + (int(best_score_index) - min_angle_step) * angle_prec;
-		cv::Matx23f best_transform = cv::getRotationMatrix2D(target_center, best_angle, 1.0);
-		cv::Matx23f best_transform_inversed;
-		cv::invertAffineTransform(best_transform, best_transform_inversed);
-		best_transform_inversed(0, 2) += float(score_poses[best_score_index].x * best_transform_inversed(0, 0) + score_poses[best_score_index].y * best_transform_inversed(0, 1));
-		best_transform_inversed(1, 2) += float(score_poses[best_score_index].x * best_transform_inversed(1, 0) + score_poses[best_score_index].y * best_transform_inversed(1, 1));
-		return best_transform_inversed;
 	}
 
 	class dense_template_matcher
 	{
 	public:
 		dense_template_matcher(const accelerator_view& acc_view_, const cv::Mat& templ_, cv::Size target_size_, int levels_ = 4)
-			: vctx(acc_view_, float(target_size_.width * target_size_.height) / 1000000.0f, size_t(levels_) * 2), target_size(target_size_), levels(levels_)
+			: dense_template_matcher(acc_view_, template_model::build_dense(templ_, levels_), target_size_)
+		{
+		}
+
+		// Upload a prebuilt(or mapped) pyramid, see template_model_cache
+		dense_template_matcher(const accelerator_view& acc_view_, const template_model& model, cv::Size target_size_)
+			: vctx(acc_view_, float(target_size_.width * target_size_.height) / 1000000.0f, size_t(model.levels()) * 2), target_size(target_size_), levels(model.levels())
 		{
+			if (model.kind() != template_model_kind::dense)
+			{
+				throw std::runtime_error("dense_template_matcher needs a dense template model");
+			}
 			for (int level = 0; level < levels; level++)
 			{
 				int scale = 1 << level;
+				cv::Mat scaled_templ = model.image(level);
 				if (level + 1 != levels)
 				{
-					cv::Mat scaled_templ;
-					if (scale > 1)
-					{
-						cv::resize(templ_, scaled_templ, cv::Size(templ_.cols / scale, templ_.rows / scale), 0.0, 0.0, cv::INTER_LINEAR);
-					}
-					else
-					{
-						scaled_templ = templ_;
-					}
 					int templ_index = vctx.create_float2d_buf(scaled_templ.rows, scaled_templ.cols); // for template
 					vctx.load_cv_mat(scaled_templ, vctx.float2d[templ_index]);
 					vctx.create_float2d_buf(target_size_.height / scale, target_size_.width / scale); // for target
 				}
 				else
 				{
-					cv::resize(templ_, init_templ, cv::Size(templ_.cols / scale, templ_.rows / scale), 0.0, 0.0, cv::INTER_LINEAR);
+					init_templ = scaled_templ.clone();
 				}
 			}
 		}
@@ -146,11 +183,12 @@ namespace amp
 			cv::resize(target, init_target, cv::Size(target.cols / scale, target.rows / scale), 0.0, 0.0, cv::INTER_LINEAR);
 			if (use_init_guess)
 			{
-				double init_angle = guess_target_angle(init_templ, init_target, 7.5);
+				const rotation_correlator& guess_search = coarse_searches.guess(init_templ, init_target.size());
+				double init_angle = guess_search.get_angles()[guess_search.best(init_target).angle_index];
 				min_angle = init_angle - 5.0;
 				max_angle = init_angle + 5.0;
 			}
-			cv::Matx23f current_transform = get_best_transform_by_match_templ(init_templ, init_target, min_angle, max_angle);
+			cv::Matx23f current_transform = coarse_searches.range(init_templ, init_target.size(), min_angle, max_angle).best(init_target).match.transform;
 			do
 			{
 				level--;
@@ -164,38 +202,59 @@ namespace amp
 				cv::resize(target, scaled_target, cv::Size(vctx.float2d[target_index].extent[1], vctx.float2d[target_index].extent[0]), 0.0, 0.0, cv::INTER_LINEAR);
 				vctx.load_cv_mat(scaled_target, vctx.float2d[target_index]);
 				std::vector<cv::Matx23f> transforms;
-				float templ_length = float(std::max(vctx.float2d[templ_index].extent[0], vctx.float2d[templ_index].extent[1]));
-				float angle_precision = float(std::asinf(level_precision / templ_length) * 180.0 / CV_PI);
-				int angle_step = std::max(3, cvRound(1.0f / level_precision) + 1);
-				int xy_step = std::max(3, cvRound(1.0f / level_precision) + 1);
-				float current_angle = float(std::atan2f(current_transform(0, 1), current_transform(0, 0)) * 180.0 / CV_PI);
-				cv::Point2f templ_center(vctx.float2d[templ_index].extent[1] / 2.0f, vctx.float2d[templ_index].extent[0] / 2.0f);
-				cv::Matx23f current_rot_matrix = cv::getRotationMatrix2D(templ_center, current_angle, 1.0);
-				for (int angle = -angle_step; angle <= angle_step; angle++)
-				{
-					float angle0 = current_angle + angle * angle_precision;
-					cv::Matx23f rot_matrix = cv::getRotationMatrix2D(templ_center, angle0, 1.0);
-					float alpha = rot_matrix(0, 0);
-					float beta = rot_matrix(0, 1);
-					cv::Point2f init_loc(current_transform(0, 2) + rot_matrix(0, 2) - current_rot_matrix(0, 2), current_transform(1, 2) + rot_matrix(1, 2) - current_rot_matrix(1, 2));
-					for (int x_delta = -xy_step; x_delta <= xy_step; x_delta++)
-					{
-						for (int y_delta = -xy_step; y_delta <= xy_step; y_delta++)
-						{
-							cv::Matx23f transform(alpha, beta, float(init_loc.x + x_delta * level_precision), -beta, alpha, float(init_loc.y + y_delta * level_precision));
-							transforms.push_back(transform);
-						}
-					}
-				}
-				auto [score, best_transform] = amp::find_best_transform_inverse(vctx.acc_view, vctx.float2d[templ_index], vctx.float2d[target_index], transforms);
+				detail::append_refine_transforms(transforms, current_transform, cv::Size(vctx.float2d[templ_index].extent[1], vctx.float2d[templ_index].extent[0]), level_precision);
+				auto [score, best_transform] = amp::find_best_transform_inverse(vctx, vctx.float2d[templ_index], vctx.float2d[target_index], transforms);
 				current_transform = best_transform;
 			} while (level > 0);
 			return current_transform;
 		}
 
+		// every instance scoring at least min_score(at most max_instances, best first). A few coarse peaks per wanted instance
+		// are kept as hypotheses, each level refines all of them in one find_transform_diffs_inverse launch
+		std::vector<template_match> match_all(const cv::Mat& target, float min_score, int max_instances, float precision = 1.0f, double min_angle = -5.0, double max_angle = 5.0)
+		{
+			if (target.size() != target_size)
+			{
+				throw std::runtime_error("target size mismatch in dense_template_matcher::match_all");
+			}
+			if (levels < 2)
+			{
+				throw std::runtime_error("match_all needs at least 2 pyramid levels");
+			}
+			if (max_instances <= 0)
+			{
+				return std::vector<template_match>();
+			}
+			int level = levels - 1;
+			int scale = 1 << level;
+			size_t hypothesis_count = size_t(std::max(4 * max_instances, 8));
+			cv::Mat init_target;
+			cv::resize(target, init_target, cv::Size(target.cols / scale, target.rows / scale), 0.0, 0.0, cv::INTER_LINEAR);
+			std::vector<template_match> hypotheses = detail::find_coarse_matches(coarse_searches.range(init_templ, init_target.size(), min_angle, max_angle)
+				, init_target, init_templ.size(), int(hypothesis_count));
+			while (level > 0 && !hypotheses.empty())
+			{
+				level--;
+				float level_precision = level == 0 ? precision : std::fmaxf(1.0f, precision);
+				int templ_index = level * 2;
+				int target_index = level * 2 + 1;
+				cv::Mat scaled_target;
+				cv::resize(target, scaled_target, cv::Size(vctx.float2d[target_index].extent[1], vctx.float2d[target_index].extent[0]), 0.0, 0.0, cv::INTER_LINEAR);
+				vctx.load_cv_mat(scaled_target, vctx.float2d[target_index]);
+				cv::Size level_templ_size(vctx.float2d[templ_index].extent[1], vctx.float2d[templ_index].extent[0]);
+				detail::refine_matches(hypotheses, level_templ_size, level_precision, 255.0f * float(level_templ_size.area())
+					, level == 0 ? min_score : -FLT_MAX, level == 0 ? size_t(max_instances) : hypothesis_count, [&](const std::vector<cv::Matx23f>& transforms)
+				{
+					return amp::find_transform_diffs_inverse(vctx, vctx.float2d[templ_index], vctx.float2d[target_index], transforms);
+				});
+			}
+			return hypotheses;
+		}
+
 	private:
 		amp::vision_context vctx;
 		cv::Mat init_templ;
+		detail::coarse_search_cache coarse_searches;
 		cv::Size target_size;
 		int levels;
 	};
@@ -204,62 +263,38 @@ namespace amp
 	{
 	public:
 		sparse_template_matcher(const accelerator_view& acc_view_, const cv::Mat& templ_, cv::Size target_size_, double templ_sobel_thresh, int templ_dilation = 0, int levels_ = 4)
-			: vctx(acc_view_, float(target_size_.width* target_size_.height) / 1000000.0f, size_t(levels_) * 2), target_size(target_size_), levels(levels_)
+			: sparse_template_matcher(acc_view_, template_model::build_sparse(templ_, templ_sobel_thresh, templ_dilation, levels_), target_size_)
 		{
-			templ_size = templ_.size();
+		}
+
+		// Upload a prebuilt(or mapped) pyramid, see template_model_cache
+		sparse_template_matcher(const accelerator_view& acc_view_, const template_model& model, cv::Size target_size_)
+			: vctx(acc_view_, float(target_size_.width* target_size_.height) / 1000000.0f, size_t(model.levels()) * 2), templ_size(model.templ_size()), target_size(target_size_), levels(model.levels())
+		{
+			if (model.kind() != template_model_kind::sparse)
+			{
+				throw std::runtime_error("sparse_template_matcher needs a sparse template model");
+			}
 			for (int level = 0; level < levels; level++)
 			{
 				int scale = 1 << level;
 				if (level + 1 != levels)
 				{
-					cv::Mat scaled_templ;
-					if (scale > 1)
-					{
-						cv::resize(templ_, scaled_templ, cv::Size(templ_.cols / scale, templ_.rows / scale), 0.0, 0.0, cv::INTER_LINEAR);
-					}
-					else
-					{
-						scaled_templ = templ_;
-					}
-
-					cv::Mat grad = calculate_sobel(scaled_templ);
-					cv::Mat grad_bin;
-					cv::threshold(grad, grad_bin, templ_sobel_thresh, 255.0, cv::THRESH_BINARY);
-					if (templ_dilation != 0)
-					{
-						cv::dilate(grad_bin, grad_bin, cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(3, 3)));
-					}
-					std::vector<cv::Point> edge_points;
-					cv::findNonZero(grad_bin, edge_points);
-					std::vector<cv::Vec3f> edge_values(edge_points.size());
-					std::transform(edge_points.cbegin(), edge_points.cend(), edge_values.begin(), [&scaled_templ](cv::Point pt) {
-						cv::Vec3f value;
-						value[0] = float(pt.x);
-						value[1] = float(pt.y);
-						value[2] = float(scaled_templ.at<uchar>(pt));
-						return value;
-					});
-					int templ_index = vctx.create_float2d_buf(edge_values.size(), 3); // for template
-					concurrency::copy((const float*)&edge_values[0], vctx.float2d[templ_index]);
+					const float* edge_values = model.edge_points(level);
+					int templ_index = vctx.create_float2d_buf(model.edge_count(level), 3); // for template
+					concurrency::copy(edge_values, vctx.float2d[templ_index]);
 					vctx.create_float2d_buf(target_size_.height / scale, target_size_.width / scale); // for target
 				}
 				else
 				{
-					cv::resize(templ_, init_templ, cv::Size(templ_.cols / scale, templ_.rows / scale), 0.0, 0.0, cv::INTER_LINEAR);
+					init_templ = model.image(level).clone();
 				}
 			}
 		}
 
 		cv::Mat calculate_sobel(const cv::Mat& src)
 		{
-			cv::Mat grad, grad_x, grad_y;
-			cv::Mat scaled_grad_x, scaled_grad_y;
-			cv::Sobel(src, grad_x, CV_32F, 1, 0, 5, 1, 0, cv::BORDER_DEFAULT);
-			grad_x = cv::abs(grad_x);
-			cv::Sobel(src, grad_y, CV_32F, 0, 1, 5, 1, 0, cv::BORDER_DEFAULT);
-			grad_y = cv::abs(grad_y);
-			cv::addWeighted(grad_x, 0.05, grad_y, 0.05, 0, grad);
-			return grad;
+			return detail::template_edge_strength(src);
 		}
 
 		cv::Matx23f match(const cv::Mat& target, float precision = 1.0f, double min_angle = -5.0, double max_angle = 5.0, bool use_init_guess = false)
@@ -274,11 +309,12 @@ namespace amp
 			cv::resize(target, init_target, cv::Size(target.cols / scale, target.rows / scale), 0.0, 0.0, cv::INTER_LINEAR);
 			if (use_init_guess)
 			{
-				double init_angle = guess_target_angle(init_templ, init_target, 7.5);
+				const rotation_correlator& guess_search = coarse_searches.guess(init_templ, init_target.size());
+				double init_angle = guess_search.get_angles()[guess_search.best(init_target).angle_index];
 				min_angle = init_angle - 5.0;
 				max_angle = init_angle + 5.0;
 			}
-			cv::Matx23f current_transform = get_best_transform_by_match_templ(init_templ, init_target, min_angle, max_angle);
+			cv::Matx23f current_transform = coarse_searches.range(init_templ, init_target.size(), min_angle, max_angle).best(init_target).match.transform;
 			do
 			{
 				level--;
@@ -293,38 +329,59 @@ namespace amp
 				cv::resize(target, scaled_target, cv::Size(vctx.float2d[target_index].extent[1], vctx.float2d[target_index].extent[0]), 0.0, 0.0, cv::INTER_LINEAR);
 				vctx.load_cv_mat(scaled_target, vctx.float2d[target_index]);
 				std::vector<cv::Matx23f> transforms;
-				float templ_length = float(std::max(current_templ_size.width, current_templ_size.height));
-				float angle_precision = float(std::asinf(level_precision / templ_length) * 180.0 / CV_PI);
-				int angle_step = std::max(3, cvRound(1.0f / level_precision) + 1);
-				int xy_step = std::max(3, cvRound(1.0f / level_precision) + 1);
-				float current_angle = float(std::atan2f(current_transform(0, 1), current_transform(0, 0)) * 180.0 / CV_PI);
-				cv::Point2f templ_center(float(current_templ_size.width) / 2.0f, float(current_templ_size.height) / 2.0f);
-				cv::Matx23f current_rot_matrix = cv::getRotationMatrix2D(templ_center, current_angle, 1.0);
-				for (int angle = -angle_step; angle <= angle_step; angle++)
-				{
-					float angle0 = current_angle + angle * angle_precision;
-					cv::Matx23f rot_matrix = cv::getRotationMatrix2D(templ_center, angle0, 1.0);
-					float alpha = rot_matrix(0, 0);
-					float beta = rot_matrix(0, 1);
-					cv::Point2f init_loc(current_transform(0, 2) + rot_matrix(0, 2) - current_rot_matrix(0, 2), current_transform(1, 2) + rot_matrix(1, 2) - current_rot_matrix(1, 2));
-					for (int x_delta = -xy_step; x_delta <= xy_step; x_delta++)
-					{
-						for (int y_delta = -xy_step; y_delta <= xy_step; y_delta++)
-						{
-							cv::Matx23f transform(alpha, beta, float(init_loc.x + x_delta * level_precision), -beta, alpha, float(init_loc.y + y_delta * level_precision));
-							transforms.push_back(transform);
-						}
-					}
-				}
-				auto [score, best_transform] = amp::find_best_transform_inverse_sparse(vctx.acc_view, vctx.float2d[templ_index], vctx.float2d[target_index], transforms);
+				detail::append_refine_transforms(transforms, current_transform, current_templ_size, level_precision);
+				auto [score, best_transform] = amp::find_best_transform_inverse_sparse(vctx, vctx.float2d[templ_index], vctx.float2d[target_index], transforms);
 				current_transform = best_transform;
 			} while (level > 0);
 			return current_transform;
 		}
 
+		// every instance scoring at least min_score(at most max_instances, best first). A few coarse peaks per wanted instance
+		// are kept as hypotheses, each level refines all of them in one find_transform_diffs_inverse_sparse launch
+		std::vector<template_match> match_all(const cv::Mat& target, float min_score, int max_instances, float precision = 1.0f, double min_angle = -5.0, double max_angle = 5.0)
+		{
+			if (target.size() != target_size)
+			{
+				throw std::runtime_error("target size mismatch in sparse_template_matcher::match_all");
+			}
+			if (levels < 2)
+			{
+				throw std::runtime_error("match_all needs at least 2 pyramid levels");
+			}
+			if (max_instances <= 0)
+			{
+				return std::vector<template_match>();
+			}
+			int level = levels - 1;
+			int scale = 1 << level;
+			size_t hypothesis_count = size_t(std::max(4 * max_instances, 8));
+			cv::Mat init_target;
+			cv::resize(target, init_target, cv::Size(target.cols / scale, target.rows / scale), 0.0, 0.0, cv::INTER_LINEAR);
+			std::vector<template_match> hypotheses = detail::find_coarse_matches(coarse_searches.range(init_templ, init_target.size(), min_angle, max_angle)
+				, init_target, init_templ.size(), int(hypothesis_count));
+			while (level > 0 && !hypotheses.empty())
+			{
+				level--;
+				float level_precision = level == 0 ? precision : std::fmaxf(1.0f, precision);
+				int templ_index = level * 2;
+				int target_index = level * 2 + 1;
+				cv::Mat scaled_target;
+				cv::resize(target, scaled_target, cv::Size(vctx.float2d[target_index].extent[1], vctx.float2d[target_index].extent[0]), 0.0, 0.0, cv::INTER_LINEAR);
+				vctx.load_cv_mat(scaled_target, vctx.float2d[target_index]);
+				cv::Size level_templ_size = templ_size / (1 << level);
+				detail::refine_matches(hypotheses, level_templ_size, level_precision, 255.0f * float(vctx.float2d[templ_index].extent[0])
+					, level == 0 ? min_score : -FLT_MAX, level == 0 ? size_t(max_instances) : hypothesis_count, [&](const std::vector<cv::Matx23f>& transforms)
+				{
+					return amp::find_transform_diffs_inverse_sparse(vctx, vctx.float2d[templ_index], vctx.float2d[target_index], transforms);
+				});
+			}
+			return hypotheses;
+		}
+
 	private:
 		amp::vision_context vctx;
 		cv::Mat init_templ;
+		detail::coarse_search_cache coarse_searches;
 		cv::Size templ_size;
 		cv::Size target_size;
 		int levels;
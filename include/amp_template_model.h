@@ -0,0 +1,562 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "amp_core.h"
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace amp
+{
+	// Template pyramids of dense_template_matcher/sparse_template_matcher, built once and kept as a binary model file.
+	// The file is laid out the way the matchers read it(8-bit level images, (x, y, value) float edge lists),
+	// so a loaded model is a read-only file mapping that the matchers upload from without any processing.
+	// sample code:
+	// amp::template_model_cache models("models");
+	// amp::sparse_template_matcher matcher(acc_view, *models.sparse(templ, 50.0), target.size());
+
+	enum class template_model_kind { dense = 0, sparse = 1 };
+
+	namespace detail
+	{
+		// FNV-1a over 64-bit words, the shift folds the high bits back so every input bit reaches the low bits
+		inline uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+		{
+			const uint64_t prime = 1099511628211ull;
+			const unsigned char* p = static_cast<const unsigned char*>(data);
+			for(; size >= 8; p += 8, size -= 8)
+			{
+				uint64_t word;
+				std::memcpy(&word, p, 8);
+				hash = (hash ^ word) * prime;
+				hash ^= hash >> 32;
+			}
+			for(; size > 0; p++, size--)
+			{
+				hash = (hash ^ *p) * prime;
+			}
+			return hash;
+		}
+
+		// Read-only mapping of a whole file
+		class mapped_file
+		{
+		public:
+			explicit mapped_file(const std::string& path)
+				: bytes(nullptr), byte_size(0)
+			{
+#ifdef _WIN32
+				HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+				if(file == INVALID_HANDLE_VALUE) throw std::runtime_error("can't open " + path);
+				LARGE_INTEGER file_size;
+				if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+				{
+					CloseHandle(file);
+					throw std::runtime_error("can't map " + path);
+				}
+				HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				CloseHandle(file);
+				if(!mapping) throw std::runtime_error("can't map " + path);
+				// the view keeps the mapping alive
+				bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				CloseHandle(mapping);
+				if(!bytes) throw std::runtime_error("can't map " + path);
+				byte_size = size_t(file_size.QuadPart);
+#else
+				int fd = ::open(path.c_str(), O_RDONLY);
+				if(fd < 0) throw std::runtime_error("can't open " + path);
+				struct stat file_stat;
+				if(::fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+				{
+					::close(fd);
+					throw std::runtime_error("can't map " + path);
+				}
+				void* address = ::mmap(nullptr, size_t(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+				::close(fd);
+				if(address == MAP_FAILED) throw std::runtime_error("can't map " + path);
+				bytes = static_cast<const unsigned char*>(address);
+				byte_size = size_t(file_stat.st_size);
+#endif
+			}
+
+			mapped_file(const mapped_file&) = delete;
+			mapped_file& operator=(const mapped_file&) = delete;
+
+			~mapped_file()
+			{
+#ifdef _WIN32
+				UnmapViewOfFile(bytes);
+#else
+				::munmap(const_cast<unsigned char*>(bytes), byte_size);
+#endif
+			}
+
+			const unsigned char* data() const { return bytes; }
+			size_t size() const { return byte_size; }
+
+		private:
+			const unsigned char* bytes;
+			size_t byte_size;
+		};
+
+		// File header, followed by one template_model_level per level and the 64-byte aligned level data
+		struct template_model_header
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t kind;
+			int32_t levels;
+			int32_t templ_rows;
+			int32_t templ_cols;
+			int32_t dilation;
+			double sobel_thresh;
+			uint64_t key;
+			uint64_t byte_size;
+			// hash of everything after the header
+			uint64_t checksum;
+		};
+
+		struct template_model_level
+		{
+			// 8-bit image, 0 x 0 on the sparse levels that only keep edge points
+			int32_t rows;
+			int32_t cols;
+			int32_t edge_count;
+			int32_t reserved;
+			uint64_t image_offset;
+			uint64_t edge_offset;
+		};
+
+		static_assert(sizeof(template_model_header) == 64 && sizeof(template_model_level) == 32, "template model records must be packed");
+
+		static const char template_model_magic[8] = { 'A', 'M', 'P', 'T', 'M', 'P', 'L', '\0' };
+		static const uint32_t template_model_version = 1;
+
+		// Gradient magnitude the sparse matcher thresholds into edge points
+		inline cv::Mat template_edge_strength(const cv::Mat& src)
+		{
+			cv::Mat grad, grad_x, grad_y;
+			cv::Sobel(src, grad_x, CV_32F, 1, 0, 5, 1, 0, cv::BORDER_DEFAULT);
+			grad_x = cv::abs(grad_x);
+			cv::Sobel(src, grad_y, CV_32F, 0, 1, 5, 1, 0, cv::BORDER_DEFAULT);
+			grad_y = cv::abs(grad_y);
+			cv::addWeighted(grad_x, 0.05, grad_y, 0.05, 0, grad);
+			return grad;
+		}
+
+		// Level n of the matcher pyramid is the template shrunk 2^n times
+		inline cv::Mat template_level_image(const cv::Mat& templ, int level)
+		{
+			int scale = 1 << level;
+			if(scale == 1)
+			{
+				return templ;
+			}
+			cv::Mat scaled_templ;
+			cv::resize(templ, scaled_templ, cv::Size(templ.cols / scale, templ.rows / scale), 0.0, 0.0, cv::INTER_LINEAR);
+			return scaled_templ;
+		}
+
+		// Template pixels plus every parameter that changes the model
+		inline uint64_t template_model_key(const cv::Mat& templ, template_model_kind kind, int levels, double sobel_thresh, int dilation)
+		{
+			if(templ.type() != CV_8UC1) throw std::runtime_error("template models need an 8UC1 template");
+			const int32_t params[5] = { int32_t(template_model_version), int32_t(kind), int32_t(levels), int32_t(templ.rows), int32_t(templ.cols) };
+			uint64_t hash = hash_bytes(params, sizeof(params));
+			if(kind == template_model_kind::sparse)
+			{
+				const double sparse_params[2] = { sobel_thresh, double(dilation) };
+				hash = hash_bytes(sparse_params, sizeof(sparse_params), hash);
+			}
+			for(int r = 0; r < templ.rows; r++)
+			{
+				hash = hash_bytes(templ.ptr<unsigned char>(r), size_t(templ.cols), hash);
+			}
+			return hash;
+		}
+	}
+
+	// Pyramid of one template: the 8-bit image of every level the matcher reads pixels from(all levels for dense models,
+	// the coarsest one for sparse models) and the edge points of the other sparse levels.
+	// Copies share the same memory, either built in place or mapped from a file.
+	class template_model
+	{
+	public:
+		static template_model build_dense(const cv::Mat& templ, int levels = 4)
+		{
+			return build(templ, template_model_kind::dense, levels, 0.0, 0);
+		}
+
+		static template_model build_sparse(const cv::Mat& templ, double sobel_thresh, int dilation = 0, int levels = 4)
+		{
+			return build(templ, template_model_kind::sparse, levels, sobel_thresh, dilation);
+		}
+
+		static uint64_t dense_key(const cv::Mat& templ, int levels = 4)
+		{
+			return detail::template_model_key(templ, template_model_kind::dense, levels, 0.0, 0);
+		}
+
+		static uint64_t sparse_key(const cv::Mat& templ, double sobel_thresh, int dilation = 0, int levels = 4)
+		{
+			return detail::template_model_key(templ, template_model_kind::sparse, levels, sobel_thresh, dilation);
+		}
+
+		// Map a model file, throws if it isn't a complete model of this version
+		static template_model load(const std::string& path)
+		{
+			std::shared_ptr<detail::mapped_file> mapping = std::make_shared<detail::mapped_file>(path);
+			template_model model;
+			model.attach(mapping->data(), mapping->size(), path);
+			model.mapping = mapping;
+			return model;
+		}
+
+		// Write to a temporary file and rename it over path, so readers never see a partial model
+		void save(const std::string& path) const
+		{
+			const std::string temp_path = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+			FILE* file = std::fopen(temp_path.c_str(), "wb");
+			if(!file) throw std::runtime_error("can't create " + temp_path);
+			bool written = std::fwrite(bytes, 1, byte_count, file) == byte_count;
+			written = std::fclose(file) == 0 && written;
+			if(written)
+			{
+				std::remove(path.c_str());
+				written = std::rename(temp_path.c_str(), path.c_str()) == 0;
+			}
+			if(!written)
+			{
+				std::remove(temp_path.c_str());
+				throw std::runtime_error("can't write " + path);
+			}
+		}
+
+		template_model_kind kind() const { return template_model_kind(header.kind); }
+		int levels() const { return header.levels; }
+		cv::Size templ_size() const { return cv::Size(header.templ_cols, header.templ_rows); }
+		double sobel_thresh() const { return header.sobel_thresh; }
+		int dilation() const { return header.dilation; }
+		uint64_t key() const { return header.key; }
+		size_t byte_size() const { return byte_count; }
+		bool is_mapped() const { return bool(mapping); }
+
+		// Level image referring to the model memory, empty when the level has none. Mapped models are read-only.
+		cv::Mat image(int level) const
+		{
+			const detail::template_model_level& entry = level_entry(level);
+			if(entry.rows == 0) return cv::Mat();
+			return cv::Mat(entry.rows, entry.cols, CV_8UC1, const_cast<unsigned char*>(bytes + entry.image_offset));
+		}
+
+		// edge_count(level) x (x, y, value)
+		const float* edge_points(int level) const
+		{
+			return reinterpret_cast<const float*>(bytes + level_entry(level).edge_offset);
+		}
+
+		int edge_count(int level) const
+		{
+			return level_entry(level).edge_count;
+		}
+
+	private:
+		template_model()
+			: bytes(nullptr), byte_count(0)
+		{
+			std::memset(&header, 0, sizeof(header));
+		}
+
+		static size_t align_offset(size_t offset)
+		{
+			return (offset + 63) & ~size_t(63);
+		}
+
+		const detail::template_model_level& level_entry(int level) const
+		{
+			if(level < 0 || level >= header.levels) throw std::runtime_error("template model level out of range");
+			return level_table[level];
+		}
+
+		static template_model build(const cv::Mat& templ, template_model_kind kind, int levels, double sobel_thresh, int dilation)
+		{
+			if(templ.empty() || templ.type() != CV_8UC1) throw std::runtime_error("template models need an 8UC1 template");
+			if(levels < 1 || levels > 16 || (templ.rows >> (levels - 1)) == 0 || (templ.cols >> (levels - 1)) == 0)
+				throw std::runtime_error("template is too small for the number of levels");
+			std::vector<cv::Mat> images(levels);
+			std::vector<std::vector<float>> edges(levels);
+			for(int level = 0; level < levels; level++)
+			{
+				cv::Mat scaled_templ = detail::template_level_image(templ, level);
+				if(kind == template_model_kind::dense || level + 1 == levels)
+				{
+					images[level] = scaled_templ;
+					continue;
+				}
+				cv::Mat grad_bin;
+				cv::threshold(detail::template_edge_strength(scaled_templ), grad_bin, sobel_thresh, 255.0, cv::THRESH_BINARY);
+				if(dilation != 0)
+				{
+					cv::dilate(grad_bin, grad_bin, cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(3, 3)));
+				}
+				std::vector<cv::Point> edge_points;
+				cv::findNonZero(grad_bin, edge_points);
+				if(edge_points.empty()) throw std::runtime_error("template has no edge points above sobel_thresh at level " + std::to_string(level));
+				std::vector<float>& values = edges[level];
+				values.reserve(edge_points.size() * 3);
+				for(size_t i = 0; i < edge_points.size(); i++)
+				{
+					values.push_back(float(edge_points[i].x));
+					values.push_back(float(edge_points[i].y));
+					values.push_back(float(scaled_templ.at<unsigned char>(edge_points[i].y, edge_points[i].x)));
+				}
+			}
+
+			std::vector<detail::template_model_level> table(levels);
+			size_t offset = align_offset(sizeof(detail::template_model_header) + sizeof(detail::template_model_level) * levels);
+			for(int level = 0; level < levels; level++)
+			{
+				detail::template_model_level& entry = table[level];
+				std::memset(&entry, 0, sizeof(entry));
+				entry.rows = images[level].rows;
+				entry.cols = images[level].cols;
+				entry.edge_count = int32_t(edges[level].size() / 3);
+				entry.image_offset = offset;
+				offset = align_offset(offset + size_t(entry.rows) * entry.cols);
+				entry.edge_offset = offset;
+				offset = align_offset(offset + edges[level].size() * sizeof(float));
+			}
+
+			std::shared_ptr<std::vector<unsigned char>> storage = std::make_shared<std::vector<unsigned char>>(offset, 0);
+			unsigned char* data = storage->data();
+			std::memcpy(data + sizeof(detail::template_model_header), table.data(), sizeof(detail::template_model_level) * levels);
+			for(int level = 0; level < levels; level++)
+			{
+				const detail::template_model_level& entry = table[level];
+				for(int r = 0; r < entry.rows; r++)
+				{
+					std::memcpy(data + entry.image_offset + size_t(r) * entry.cols, images[level].ptr<unsigned char>(r), size_t(entry.cols));
+				}
+				if(!edges[level].empty())
+				{
+					std::memcpy(data + entry.edge_offset, edges[level].data(), edges[level].size() * sizeof(float));
+				}
+			}
+
+			detail::template_model_header file_header;
+			std::memset(&file_header, 0, sizeof(file_header));
+			std::memcpy(file_header.magic, detail::template_model_magic, sizeof(file_header.magic));
+			file_header.version = detail::template_model_version;
+			file_header.kind = uint32_t(kind);
+			file_header.levels = levels;
+			file_header.templ_rows = templ.rows;
+			file_header.templ_cols = templ.cols;
+			file_header.dilation = kind == template_model_kind::sparse ? dilation : 0;
+			file_header.sobel_thresh = kind == template_model_kind::sparse ? sobel_thresh : 0.0;
+			file_header.key = detail::template_model_key(templ, kind, levels, sobel_thresh, dilation);
+			file_header.byte_size = offset;
+			file_header.checksum = detail::hash_bytes(data + sizeof(file_header), offset - sizeof(file_header));
+			std::memcpy(data, &file_header, sizeof(file_header));
+
+			template_model model;
+			model.attach(data, offset, "built template model");
+			model.storage = storage;
+			return model;
+		}
+
+		// Validate the layout and take the header and level table, what names the source in errors
+		void attach(const unsigned char* data, size_t size, const std::string& what)
+		{
+			const std::string error = "invalid template model: " + what;
+			if(size < sizeof(header)) throw std::runtime_error(error);
+			std::memcpy(&header, data, sizeof(header));
+			if(std::memcmp(header.magic, detail::template_model_magic, sizeof(header.magic)) != 0) throw std::runtime_error(error);
+			if(header.version != detail::template_model_version) throw std::runtime_error("unsupported template model version: " + what);
+			if(header.kind > uint32_t(template_model_kind::sparse) || header.levels < 1 || header.levels > 16 || header.byte_size != size)
+				throw std::runtime_error(error);
+			const size_t table_end = sizeof(header) + sizeof(detail::template_model_level) * size_t(header.levels);
+			if(table_end > size) throw std::runtime_error(error);
+			if(detail::hash_bytes(data + sizeof(header), size - sizeof(header)) != header.checksum) throw std::runtime_error("template model checksum mismatch: " + what);
+			level_table.resize(header.levels);
+			std::memcpy(level_table.data(), data + sizeof(header), sizeof(detail::template_model_level) * size_t(header.levels));
+			for(size_t level = 0; level < level_table.size(); level++)
+			{
+				const detail::template_model_level& entry = level_table[level];
+				if(entry.rows < 0 || entry.cols < 0 || entry.edge_count < 0) throw std::runtime_error(error);
+				const uint64_t image_bytes = uint64_t(entry.rows) * uint64_t(entry.cols);
+				const uint64_t edge_bytes = uint64_t(entry.edge_count) * 3 * sizeof(float);
+				if(entry.image_offset % 64 != 0 || entry.edge_offset % 64 != 0
+					|| entry.image_offset > size || image_bytes > size - entry.image_offset
+					|| entry.edge_offset > size || edge_bytes > size - entry.edge_offset)
+					throw std::runtime_error(error);
+			}
+			bytes = data;
+			byte_count = size;
+		}
+
+		detail::template_model_header header;
+		std::vector<detail::template_model_level> level_table;
+		const unsigned char* bytes;
+		size_t byte_count;
+		// one of them owns bytes
+		std::shared_ptr<std::vector<unsigned char>> storage;
+		std::shared_ptr<detail::mapped_file> mapping;
+	};
+
+	namespace detail
+	{
+		// Models in memory keyed by a 64-bit hash of their inputs, with a directory also kept as <key><extension> files
+		// that are mapped on the next run instead of rebuilt. model_type needs load(path), save(path) and key().
+		// Safe to call from several threads.
+		template<typename model_type>
+		class model_file_cache
+		{
+		public:
+			model_file_cache(const std::string& directory_, const std::string& extension_)
+				: directory(directory_), extension(extension_)
+			{
+			}
+
+			model_file_cache(const model_file_cache&) = delete;
+			model_file_cache& operator=(const model_file_cache&) = delete;
+
+			size_t size() const
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				return models.size();
+			}
+
+			void clear()
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				models.clear();
+			}
+
+			std::string path_of(uint64_t key) const
+			{
+				char name[32];
+				std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+				if(directory.empty()) return name + extension;
+				const char last = directory[directory.size() - 1];
+				return (last == '/' || last == '\\') ? directory + name + extension : directory + "/" + name + extension;
+			}
+
+			// Builds run outside the lock, when two threads build the same model the first one inserted wins
+			template<typename Build>
+			std::shared_ptr<const model_type> find_or_build(uint64_t key, Build build)
+			{
+				{
+					std::lock_guard<std::mutex> guard(mutex);
+					auto it = models.find(key);
+					if(it != models.end()) return it->second;
+				}
+				std::shared_ptr<const model_type> model;
+				if(!directory.empty())
+				{
+					const std::string path = path_of(key);
+					if(std::ifstream(path).good())
+					{
+						// stale or damaged files are rebuilt and overwritten
+						try
+						{
+							model_type loaded = model_type::load(path);
+							if(loaded.key() == key) model = std::make_shared<const model_type>(loaded);
+						}
+						catch(const std::runtime_error&)
+						{
+						}
+					}
+					if(!model)
+					{
+						model = std::make_shared<const model_type>(build());
+						model->save(path);
+					}
+				}
+				else
+				{
+					model = std::make_shared<const model_type>(build());
+				}
+				std::lock_guard<std::mutex> guard(mutex);
+				return models.emplace(key, model).first->second;
+			}
+
+		private:
+			std::string directory;
+			std::string extension;
+			mutable std::mutex mutex;
+			std::map<uint64_t, std::shared_ptr<const model_type>> models;
+		};
+	}
+
+	// Models keyed by template hash plus parameters. With a directory, models are also kept there as <key>.ampt files
+	// and mapped on the next run instead of rebuilt. Safe to call from several threads.
+	class template_model_cache
+	{
+	public:
+		template_model_cache()
+			: cache("", ".ampt")
+		{
+		}
+
+		explicit template_model_cache(const std::string& directory_)
+			: cache(directory_, ".ampt")
+		{
+		}
+
+		template_model_cache(const template_model_cache&) = delete;
+		template_model_cache& operator=(const template_model_cache&) = delete;
+
+		std::shared_ptr<const template_model> dense(const cv::Mat& templ, int levels = 4)
+		{
+			return cache.find_or_build(template_model::dense_key(templ, levels), [&]()
+			{
+				return template_model::build_dense(templ, levels);
+			});
+		}
+
+		std::shared_ptr<const template_model> sparse(const cv::Mat& templ, double sobel_thresh, int dilation = 0, int levels = 4)
+		{
+			return cache.find_or_build(template_model::sparse_key(templ, sobel_thresh, dilation, levels), [&]()
+			{
+				return template_model::build_sparse(templ, sobel_thresh, dilation, levels);
+			});
+		}
+
+		// Models held in memory
+		size_t size() const
+		{
+			return cache.size();
+		}
+
+		// Drop the models held in memory, the files stay
+		void clear()
+		{
+			cache.clear();
+		}
+
+		std::string path_of(uint64_t key) const
+		{
+			return cache.path_of(key);
+		}
+
+	private:
+		detail::model_file_cache<template_model> cache;
+	};
+}
@@ -4,6 +4,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	namespace detail
 	{
 		inline void thinning_32f_c1_iter_0(accelerator_view acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array)
@@ -44,10 +45,11 @@ namespace amp
 						(p8 == 0.0f && p9 > 0.0f) + (p9 == 0.0f && p2 > 0.0f);
 					int B = (p2 > 0.0f) + (p3 > 0.0f) + (p4 > 0.0f) + (p5 > 0.0f)
 						+ (p6 > 0.0f) + (p7 > 0.0f) + (p8 > 0.0f) + (p9 > 0.0f);
-					float m1 = p2 * p4 * p6;
-					float m2 = p4 * p6 * p8;
+					// zero tests, products of the FLT_MAX border overflow to inf and inf * 0 is NaN
+					bool m1 = p2 == 0.0f || p4 == 0.0f || p6 == 0.0f;
+					bool m2 = p4 == 0.0f || p6 == 0.0f || p8 == 0.0f;
 
-					bool set_zero = (A == 1 && (B >= 2 && B <= 6) && m1 == 0.0f && m2 == 0.0f);
+					bool set_zero = (A == 1 && (B >= 2 && B <= 6) && m1 && m2);
 					dest_array(idx.global) = set_zero ? 0.0f : data[local_row + 1][local_col + 1];
 				}
 			});
@@ -96,10 +98,10 @@ namespace amp
 						(p8 == 0.0f && p9 > 0.0f) + (p9 == 0.0f && p2 > 0.0f);
 					int B = (p2 > 0.0f) + (p3 > 0.0f) + (p4 > 0.0f) + (p5 > 0.0f)
 						+ (p6 > 0.0f) + (p7 > 0.0f) + (p8 > 0.0f) + (p9 > 0.0f);
-					float m1 = p2 * p4 * p8;
-					float m2 = p2 * p6 * p8;
+					bool m1 = p2 == 0.0f || p4 == 0.0f || p8 == 0.0f;
+					bool m2 = p2 == 0.0f || p6 == 0.0f || p8 == 0.0f;
 
-					bool set_zero = (A == 1 && (B >= 2 && B <= 6) && m1 == 0.0f && m2 == 0.0f);
+					bool set_zero = (A == 1 && (B >= 2 && B <= 6) && m1 && m2);
 					dest_array(idx.global) = set_zero ? 0.0f : data[local_row + 1][local_col + 1];
 					if(set_zero && 0.0f != data[local_row + 1][local_col + 1])
 					{
@@ -137,4 +139,209 @@ namespace amp
 			}
 		}
 	}
+#endif
+
+	// CPU backend
+	namespace detail
+	{
+		// 3x3 neighborhood of a pixel of a padded 8-bit image as a code, bit k is the k-th neighbor clockwise from the north(p2 .. p9)
+		inline int neighborhood_code(const unsigned char* p, int step)
+		{
+			return int(p[-step] != 0) | int(p[-step + 1] != 0) << 1 | int(p[1] != 0) << 2 | int(p[step + 1] != 0) << 3
+				| int(p[step] != 0) << 4 | int(p[step - 1] != 0) << 5 | int(p[-1] != 0) << 6 | int(p[-step - 1] != 0) << 7;
+		}
+
+		// Deletion tables indexed by neighborhood_code
+		struct thinning_tables
+		{
+			thinning_tables()
+			{
+				for(int code = 0; code < 256; code++)
+				{
+					bool p[10];
+					for(int k = 0; k < 8; k++)
+						p[k + 2] = ((code >> k) & 1) != 0;
+					// Zhang-Suen: one 0 -> 1 transition around the pixel, 2 .. 6 foreground neighbors
+					int a = 0;
+					int b = 0;
+					for(int k = 2; k <= 9; k++)
+					{
+						a += !p[k] && p[k == 9 ? 2 : k + 1];
+						b += p[k];
+					}
+					const bool candidate = a == 1 && b >= 2 && b <= 6;
+					zhang_suen[0][code] = candidate && !(p[2] && p[4] && p[6]) && !(p[4] && p[6] && p[8]);
+					zhang_suen[1][code] = candidate && !(p[2] && p[4] && p[8]) && !(p[2] && p[6] && p[8]);
+					// end points(pruning): one side neighbor, optionally with the diagonals next to it, or one diagonal alone
+					endpoint[code] = code == 0x01 || code == 0x03 || code == 0x81 || code == 0x83
+						|| code == 0x04 || code == 0x06 || code == 0x0c || code == 0x0e
+						|| code == 0x10 || code == 0x18 || code == 0x30 || code == 0x38
+						|| code == 0x40 || code == 0x60 || code == 0xc0 || code == 0xe0
+						|| code == 0x02 || code == 0x08 || code == 0x20 || code == 0x80;
+				}
+			}
+
+			unsigned char zhang_suen[2][256];
+			unsigned char endpoint[256];
+		};
+
+		inline const thinning_tables& thinning_luts()
+		{
+			static const thinning_tables tables;
+			return tables;
+		}
+
+		// Removes the foreground pixels whose neighborhood code is set in the table of a pass, all the pixels of a pass
+		// are tested on the image before it. A pixel is only tested again once a neighbor was deleted, so a pass costs
+		// the size of the frontier instead of the image. Tables must not delete pixels without a background neighbor.
+		class thinning_worklist
+		{
+		public:
+			// Foreground is src > 0, pixels outside the image count as foreground
+			thinning_worklist(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, int table_count)
+				: rows(src_array.rows), cols(src_array.cols), step(src_array.cols + 2), all_tables((1 << table_count) - 1)
+				, image(size_t(src_array.rows + 2) * (src_array.cols + 2), static_cast<unsigned char>(outside)), pending(image.size(), 0)
+			{
+				std::vector<std::vector<int>> strip_active(DIVUP(rows, 64));
+				pool.parallel_for(0, int(strip_active.size()), 1, [&](int strip_first, int strip_last)
+				{
+					for(int s = strip_first; s < strip_last; s++)
+					{
+						for(int y = s * 64; y < std::min(rows, s * 64 + 64); y++)
+						{
+							const float* src_row = src_array.row(y);
+							unsigned char* image_row = &image[size_t(y + 1) * step + 1];
+							for(int x = 0; x < cols; x++)
+								image_row[x] = src_row[x] > 0.0f ? foreground : 0;
+						}
+					}
+				});
+				pool.parallel_for(0, int(strip_active.size()), 1, [&](int strip_first, int strip_last)
+				{
+					for(int s = strip_first; s < strip_last; s++)
+					{
+						for(int y = s * 64; y < std::min(rows, s * 64 + 64); y++)
+						{
+							const int first = (y + 1) * step + 1;
+							for(int p = first; p < first + cols; p++)
+							{
+								if(image[p] == foreground && neighborhood_code(&image[p], step) != 0xff)
+								{
+									pending[p] = static_cast<unsigned char>(all_tables);
+									strip_active[s].push_back(p);
+								}
+							}
+						}
+					}
+				});
+				for(size_t s = 0; s < strip_active.size(); s++)
+					active.insert(active.end(), strip_active[s].begin(), strip_active[s].end());
+			}
+
+			// Returns the number of deleted pixels
+			size_t pass(cpu::thread_pool& pool, const unsigned char* table, int table_index)
+			{
+				static const int chunk_size = 4096;
+				const unsigned char bit = static_cast<unsigned char>(1 << table_index);
+				const int chunk_count = int(DIVUP(active.size(), size_t(chunk_size)));
+				if(int(deleted.size()) < chunk_count)
+					deleted.resize(chunk_count);
+				// 1.test, the image is only read
+				pool.parallel_for(0, chunk_count, 1, [&](int chunk_first, int chunk_last)
+				{
+					for(int c = chunk_first; c < chunk_last; c++)
+					{
+						deleted[c].clear();
+						const size_t last = std::min(active.size(), size_t(c + 1) * chunk_size);
+						for(size_t i = size_t(c) * chunk_size; i < last; i++)
+						{
+							const int p = active[i];
+							if(!(pending[p] & bit))
+								continue;
+							pending[p] &= ~bit;
+							if(table[neighborhood_code(&image[p], step)])
+								deleted[c].push_back(p);
+						}
+					}
+				});
+				// 2.delete
+				size_t count = 0;
+				for(int c = 0; c < chunk_count; c++)
+				{
+					for(size_t i = 0; i < deleted[c].size(); i++)
+					{
+						image[deleted[c][i]] = 0;
+						pending[deleted[c][i]] = 0;
+					}
+					count += deleted[c].size();
+				}
+				// 3.the pixels still waiting for a table, then the neighbors of the deleted pixels
+				active.erase(std::remove_if(active.begin(), active.end(), [&](int p) { return pending[p] == 0; }), active.end());
+				const int offsets[8] = { -step - 1, -step, -step + 1, -1, 1, step - 1, step, step + 1 };
+				for(int c = 0; c < chunk_count; c++)
+				{
+					for(size_t i = 0; i < deleted[c].size(); i++)
+					{
+						for(int k = 0; k < 8; k++)
+						{
+							const int q = deleted[c][i] + offsets[k];
+							if(image[q] != foreground)
+								continue;
+							if(!pending[q])
+								active.push_back(q);
+							pending[q] = static_cast<unsigned char>(all_tables);
+						}
+					}
+				}
+				return count;
+			}
+
+			// src with the deleted pixels set to 0
+			void write(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array) const
+			{
+				cpu::parallel_for_rows(pool, rows, [&](int row_first, int row_last)
+				{
+					for(int y = row_first; y < row_last; y++)
+					{
+						const float* src_row = src_array.row(y);
+						const unsigned char* image_row = &image[size_t(y + 1) * step + 1];
+						float* dest_row = dest_array.row(y);
+						for(int x = 0; x < cols; x++)
+							dest_row[x] = src_row[x] > 0.0f && !image_row[x] ? 0.0f : src_row[x];
+					}
+				});
+			}
+
+		private:
+			enum { foreground = 1, outside = 2 };
+
+			int rows;
+			int cols;
+			int step;
+			int all_tables;
+			// padded, 0 background, 1 foreground, 2 outside the image
+			std::vector<unsigned char> image;
+			// bit t: the pixel has to be tested against table t
+			std::vector<unsigned char> pending;
+			std::vector<int> active;
+			std::vector<std::vector<int>> deleted;
+		};
+	}
+
+	// Zhang-Suen thinning of a mask(0 background, positive foreground), max_iter = 0 runs until the second sub-iteration deletes nothing.
+	// Only the pixels next to a deleted pixel are tested again, temp_array is kept for the AMP signature.
+	inline void thinning_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, cpu::plane_view<float> temp_array, int max_iter = 0)
+	{
+		(void)temp_array;
+		const detail::thinning_tables& tables = detail::thinning_luts();
+		detail::thinning_worklist work(pool, src_array, 2);
+		for(int i = 0;;)
+		{
+			work.pass(pool, tables.zhang_suen[0], 0);
+			if(work.pass(pool, tables.zhang_suen[1], 1) == 0 || ++i == max_iter)
+				break;
+		}
+		work.write(pool, src_array, dest_array);
+	}
 }
@@ -6,40 +6,62 @@
 
 namespace amp
 {
-	inline float get_otsu_thresh(accelerator_view& acc_view, array_view<const float, 2> src_array)
+	namespace detail
+	{
+		inline float get_otsu_thresh(const std::vector<int>& h, int total)
+		{
+			static const int N = 256;
+			float mu = 0.0, scale = 1.0f / total;
+			for(int i = 0; i < N; i++)
+				mu += i * (float)h[i];
+			mu *= scale;
+			float mu1 = 0.0f, q1 = 0.0f;
+			float max_sigma = 0.0f, max_val = 0.0f;
+			for(int i = 0; i < N; i++)
+			{
+				float p_i, q2, mu2, sigma;
+				p_i = h[i] * scale;
+				mu1 *= q1;
+				q1 += p_i;
+				q2 = 1.0f - q1;
+				if(std::min<float>(q1, q2) < FLT_EPSILON || std::max<float>(q1, q2) > 1. - FLT_EPSILON)
+					continue;
+				mu1 = (mu1 + i*p_i) / q1;
+				mu2 = (mu - q1*mu1) / q2;
+				sigma = q1*q2*(mu1 - mu2)*(mu1 - mu2);
+				if(sigma > max_sigma)
+				{
+					max_sigma = sigma;
+					max_val = (float)i;
+				}
+			}
+			return max_val;
+		}
+	}
+
+#if AMP_HAS_CPP_AMP
+	inline float get_otsu_thresh(accelerator_view& acc_view, buffer_pool& buffers, array_view<const float, 2> src_array)
 	{
 		static const int N = 256;
 		// 1.calculate histogram
-		concurrency::array<int, 1> hist_array(N, acc_view);
+		buffer_pool::device_lease hist_buf = buffers.acquire_device<int>(N);
+		array_view<int, 1> hist_array = hist_buf.view<int>(N);
 		calc_hist_32f_c1(acc_view, src_array, hist_array, N);
 		std::vector<int> h(N);
 		concurrency::copy(hist_array, h.begin());
 		// 2.otsu
-		float mu = 0.0, scale = 1.0f / (src_array.get_extent()[0] * src_array.get_extent()[1]);
-		for(int i = 0; i < N; i++)
-			mu += i * (float)h[i];
-		mu *= scale;
-		float mu1 = 0.0f, q1 = 0.0f;
-		float max_sigma = 0.0f, max_val = 0.0f;
-		for(int i = 0; i < N; i++)
-		{
-			float p_i, q2, mu2, sigma;
-			p_i = h[i] * scale;
-			mu1 *= q1;
-			q1 += p_i;
-			q2 = 1.0f - q1;
-			if(std::min<float>(q1, q2) < FLT_EPSILON || std::max<float>(q1, q2) > 1. - FLT_EPSILON)
-				continue;
-			mu1 = (mu1 + i*p_i) / q1;
-			mu2 = (mu - q1*mu1) / q2;
-			sigma = q1*q2*(mu1 - mu2)*(mu1 - mu2);
-			if(sigma > max_sigma)
-			{
-				max_sigma = sigma;
-				max_val = (float)i;
-			}
-		}
-		return max_val;
+		return detail::get_otsu_thresh(h, src_array.get_extent()[0] * src_array.get_extent()[1]);
+	}
+
+	inline float get_otsu_thresh(vision_context& ctx, array_view<const float, 2> src_array)
+	{
+		return get_otsu_thresh(ctx.acc_view, ctx.buffers, src_array);
+	}
+
+	inline float get_otsu_thresh(accelerator_view& acc_view, array_view<const float, 2> src_array)
+	{
+		buffer_pool buffers(acc_view);
+		return get_otsu_thresh(acc_view, buffers, src_array);
 	}
 
 	inline float threshold_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array
@@ -93,4 +115,142 @@ namespace amp
 		}
 		return thresh;
 	}
+
+	// Otsu's histogram comes from the context's buffer pool
+	inline float threshold_32f_c1(vision_context& ctx, array_view<const float, 2> src_array, array_view<float, 2> dest_array
+		, float thresh, float max_value, int type)
+	{
+		if(type & cv::THRESH_OTSU)
+		{
+			thresh = get_otsu_thresh(ctx, src_array);
+			type &= ~cv::THRESH_OTSU;
+		}
+		return threshold_32f_c1(ctx.acc_view, src_array, dest_array, thresh, max_value, type);
+	}
+#endif
+
+	// CPU backend
+	inline float get_otsu_thresh(cpu::thread_pool& pool, cpu::plane_view<const float> src_array)
+	{
+		std::vector<int> h;
+		calc_hist_32f_c1(pool, src_array, h, 256);
+		return detail::get_otsu_thresh(h, src_array.rows * src_array.cols);
+	}
+
+	inline float threshold_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, float thresh, float max_value, int type)
+	{
+		if(type & cv::THRESH_OTSU)
+		{
+			thresh = get_otsu_thresh(pool, src_array);
+			type &= ~cv::THRESH_OTSU;
+		}
+		cpu::parallel_for_rows(pool, src_array.rows, [&](int row_first, int row_last)
+		{
+			for(int r = row_first; r < row_last; r++)
+			{
+				const float* src_row = src_array.row(r);
+				float* dest_row = dest_array.row(r);
+				for(int c = 0; c < src_array.cols; c++)
+				{
+					float src_val = src_row[c];
+					switch(type)
+					{
+					case cv::THRESH_BINARY_INV:
+						dest_row[c] = src_val > thresh ? 0.0f : max_value;
+						break;
+					case cv::THRESH_TRUNC:
+						dest_row[c] = src_val > thresh ? thresh : src_val;
+						break;
+					case cv::THRESH_TOZERO:
+						dest_row[c] = src_val > thresh ? src_val : 0.0f;
+						break;
+					case cv::THRESH_TOZERO_INV:
+						dest_row[c] = src_val > thresh ? 0.0f : src_val;
+						break;
+					case cv::THRESH_BINARY:
+					default:
+						dest_row[c] = src_val > thresh ? max_value : 0.0f;
+						break;
+					}
+				}
+			}
+		});
+		return thresh;
+	}
+
+	namespace detail
+	{
+		// Integer pixels are above thresh exactly when they are above floor(thresh)
+		template<typename value_type>
+		inline void threshold_packed(cpu::thread_pool& pool, cpu::plane_view<const value_type> src_array, cpu::plane_view<value_type> dest_array
+			, float thresh, float max_value, int type)
+		{
+			const float top = float(std::numeric_limits<value_type>::max());
+			const cpu::simd_level level = cpu::active_simd_level();
+			const value_type int_thresh = value_type(std::min(std::max(std::floor(thresh), 0.0f), top));
+			const value_type int_max_value = value_type(std::min(std::max(max_value, 0.0f), top) + 0.5f);
+			cpu::parallel_for_rows(pool, src_array.rows, [&](int row_first, int row_last)
+			{
+				for(int r = row_first; r < row_last; r++)
+				{
+					const value_type* src_row = src_array.row(r);
+					value_type* dest_row = dest_array.row(r);
+					if(thresh < 0.0f)
+					{
+						// every pixel is above a negative thresh, which the unsigned compare can't express
+						for(int c = 0; c < src_array.cols; c++)
+						{
+							switch(type)
+							{
+							case cv::THRESH_BINARY_INV:
+							case cv::THRESH_TRUNC:
+							case cv::THRESH_TOZERO_INV:
+								dest_row[c] = 0;
+								break;
+							case cv::THRESH_TOZERO:
+								dest_row[c] = src_row[c];
+								break;
+							case cv::THRESH_BINARY:
+							default:
+								dest_row[c] = int_max_value;
+								break;
+							}
+						}
+					}
+					else
+					{
+						cpu::threshold_row(src_row, dest_row, src_array.cols, int_thresh, int_max_value, type, level);
+					}
+				}
+			});
+		}
+	}
+
+	inline float get_otsu_thresh_8u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array)
+	{
+		std::vector<int> h;
+		calc_hist_8u_c1(pool, src_array, h, 256);
+		return detail::get_otsu_thresh(h, src_array.rows * src_array.cols);
+	}
+
+	inline float threshold_8u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned char> src_array, cpu::plane_view<unsigned char> dest_array
+		, float thresh, float max_value, int type)
+	{
+		if(type & cv::THRESH_OTSU)
+		{
+			thresh = get_otsu_thresh_8u_c1(pool, src_array);
+			type &= ~cv::THRESH_OTSU;
+		}
+		detail::threshold_packed(pool, src_array, dest_array, thresh, max_value, type);
+		return thresh;
+	}
+
+	// THRESH_OTSU needs 8-bit data and is ignored here
+	inline float threshold_16u_c1(cpu::thread_pool& pool, cpu::plane_view<const unsigned short> src_array, cpu::plane_view<unsigned short> dest_array
+		, float thresh, float max_value, int type)
+	{
+		detail::threshold_packed(pool, src_array, dest_array, thresh, max_value, int(type & ~cv::THRESH_OTSU));
+		return thresh;
+	}
 }
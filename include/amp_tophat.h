@@ -2,10 +2,12 @@
 
 #include "amp_core.h"
 #include "amp_open.h"
+#include "amp_fusion.h"
 #include "amp_geodesic_dilate.h"
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Top Hat
 	inline void top_hat_32f_c1(accelerator_view acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array
 		, array_view<float, 2> temp_array, const cv::Mat& kernel, int iterations = 1)
@@ -38,5 +40,37 @@ namespace amp
 			}
 		});
 	}
+#endif
 
+	// Top Hat, a single iteration runs as one fused pass(rectangles of any size, masked kernels up to 169 cells)
+	inline void top_hat_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, cpu::plane_view<float> temp_array, const cv::Mat& kernel, int iterations = 1)
+	{
+		const bool rectangular = detail::is_rect_kernel(kernel);
+		if(!rectangular && kernel.rows * kernel.cols > 169) throw std::runtime_error("top_hat_32f_c1 supports masked kernels up to 169 cells");
+		if(iterations <= 1 && rectangular)
+		{
+			fusion::evaluate(pool, fusion::input(src_array)
+				- fusion::dilate(fusion::erode(fusion::input(src_array), kernel.rows, kernel.cols), kernel.rows, kernel.cols), dest_array);
+			return;
+		}
+		if(iterations <= 1)
+		{
+			kernel_wrapper<float, 169U> wrapped_kernel(kernel);
+			fusion::evaluate(pool, fusion::input(src_array)
+				- fusion::dilate(fusion::erode(fusion::input(src_array), wrapped_kernel), wrapped_kernel), dest_array);
+			return;
+		}
+		open_32f_c1(pool, src_array, dest_array, temp_array, kernel, iterations);
+		fusion::evaluate(pool, fusion::input(src_array) - fusion::input(dest_array), dest_array);
+	}
+
+	// Reconstruction Top Hat
+	inline void reconstruction_top_hat_32f_c1(cpu::thread_pool& pool, cpu::plane_view<const float> src_array, cpu::plane_view<float> dest_array
+		, cpu::plane_view<float> temp_array, const cv::Mat& kernel, int iterations = 1)
+	{
+		erode_32f_c1(pool, src_array, dest_array, temp_array, kernel, iterations);
+		geodesic_dilate_32f_c1(pool, dest_array, src_array, temp_array, 0, true);
+		fusion::evaluate(pool, fusion::input(src_array) - fusion::input(dest_array), dest_array);
+	}
 }
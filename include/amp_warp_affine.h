@@ -4,6 +4,7 @@
 
 namespace amp
 {
+#if AMP_HAS_CPP_AMP
 	// Warp Affine
 	inline void warp_affine_linear_32f_c1(accelerator_view& acc_view, array_view<const float, 2> src_array, array_view<float, 2> dest_array, kernel_wrapper<float, 6U> M, float border_value = 0.0f, bool inverse_M = false)
 	{
@@ -83,4 +84,5 @@ namespace amp
 		kernel_wrapper<float, 6U> wrapped_M(M);
 		warp_affine_linear_32f_c1(acc_view, src_array, dest_array, wrapped_M, border_value, inverse_M);
 	}
+#endif
 }
@@ -0,0 +1,55 @@
+﻿// canny_32f_c1 with edges touching all four image borders: union_find must match stack hysteresis
+// cl /EHsc /O2 /I../include test_canny_border.cpp opencv_core.lib opencv_imgproc.lib
+
+#include <cstdio>
+#include <vector>
+#include <amp_core.h>
+#include <amp_canny.h>
+
+int main()
+{
+	const int rows = 70;
+	const int cols = 90;
+	// 8 pixel checkerboard, every block edge runs into the image border
+	std::vector<float> src(rows * cols);
+	for(int r = 0; r < rows; r++)
+	{
+		for(int c = 0; c < cols; c++)
+		{
+			src[r * cols + c] = ((r / 8 + c / 8) & 1) ? 255.0f : 0.0f;
+		}
+	}
+	concurrency::accelerator_view acc_view = concurrency::accelerator().create_view();
+	amp::canny_context ctx(acc_view, rows, cols);
+	concurrency::array_view<const float, 2> src_array(rows, cols, src.data());
+	std::vector<float> stack_edges(rows * cols), union_edges(rows * cols);
+	concurrency::array_view<float, 2> stack_array(rows, cols, stack_edges.data());
+	concurrency::array_view<float, 2> union_array(rows, cols, union_edges.data());
+	// run union_find twice so the second pass sees whatever the first left in map_buf
+	amp::canny_32f_c1(ctx, src_array, union_array, 50.0f, 150.0f, false, amp::canny_hysteresis::union_find);
+	amp::canny_32f_c1(ctx, src_array, stack_array, 50.0f, 150.0f, false, amp::canny_hysteresis::stack);
+	amp::canny_32f_c1(ctx, src_array, union_array, 50.0f, 150.0f, false, amp::canny_hysteresis::union_find);
+	stack_array.synchronize();
+	union_array.synchronize();
+	int mismatches = 0;
+	int border_edges[4] = { 0, 0, 0, 0 };
+	for(int r = 0; r < rows; r++)
+	{
+		for(int c = 0; c < cols; c++)
+		{
+			const float v = union_edges[r * cols + c];
+			if (v != stack_edges[r * cols + c])
+				mismatches++;
+			if (v != 0.0f)
+			{
+				border_edges[0] += r == 0;
+				border_edges[1] += r == rows - 1;
+				border_edges[2] += c == 0;
+				border_edges[3] += c == cols - 1;
+			}
+		}
+	}
+	const bool touches = border_edges[0] && border_edges[1] && border_edges[2] && border_edges[3];
+	printf("mismatches %d, border edges %d %d %d %d\n", mismatches, border_edges[0], border_edges[1], border_edges[2], border_edges[3]);
+	return mismatches == 0 && touches ? 0 : 1;
+}
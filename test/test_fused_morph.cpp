@@ -0,0 +1,72 @@
+﻿// Fused top_hat/black_hat/morph_gradient with rectangles past the 169 cell kernel_wrapper, against open/close/erode/dilate
+// g++ -O2 -std=c++14 -pthread -I../include test_fused_morph.cpp -lopencv_core -lopencv_imgproc -o test_fused_morph
+
+#include <cstdio>
+#include <stdexcept>
+#include <amp_core.h>
+#include <amp_tophat.h>
+#include <amp_blackhat.h>
+#include <amp_morph_gradient.h>
+
+int main()
+{
+	const int rows = 64;
+	const int cols = 96;
+	amp::cpu::thread_pool& pool = amp::cpu::default_thread_pool();
+	amp::cpu::plane<float> src(rows, cols), dest(rows, cols), temp(rows, cols), ref1(rows, cols), ref2(rows, cols);
+	unsigned int seed = 12345;
+	for(int r = 0; r < rows; r++)
+	{
+		for(int c = 0; c < cols; c++)
+		{
+			seed = seed * 1103515245 + 12345;
+			src.view()(r, c) = float((seed >> 16) & 0xff);
+		}
+	}
+	int mismatches = 0;
+	auto compare = [&](const char* name, int ksize, float(*expected)(float, float, float), amp::cpu::plane<float>& a, amp::cpu::plane<float>& b)
+	{
+		for(int r = 0; r < rows; r++)
+		{
+			for(int c = 0; c < cols; c++)
+			{
+				if(dest.view()(r, c) != expected(src.view()(r, c), a.view()(r, c), b.view()(r, c)))
+				{
+					if(mismatches++ < 4)
+						printf("%s %dx%d differs at %d %d\n", name, ksize, ksize, r, c);
+				}
+			}
+		}
+	};
+	const int ksizes[] = { 15, 21, 31, 61 };
+	for(int ksize : ksizes)
+	{
+		cv::Mat kernel(ksize, ksize, CV_32FC1);
+		kernel.setTo(cv::Scalar(1));
+		amp::open_32f_c1(pool, src, ref1, temp, kernel);
+		amp::top_hat_32f_c1(pool, src, dest, temp, kernel);
+		compare("top_hat", ksize, [](float s, float a, float) { return s - a; }, ref1, ref2);
+		amp::close_32f_c1(pool, src, ref1, temp, kernel);
+		amp::black_hat_32f_c1(pool, src, dest, temp, kernel);
+		compare("black_hat", ksize, [](float s, float a, float) { return a - s; }, ref1, ref2);
+		amp::dilate_32f_c1(pool, src, ref1, temp, kernel);
+		amp::erode_32f_c1(pool, src, ref2, temp, kernel);
+		amp::morph_gradient_32f_c1(pool, src, dest, temp, kernel);
+		compare("morph_gradient", ksize, [](float, float a, float b) { return a - b; }, ref1, ref2);
+	}
+	// masked kernels past 169 cells are refused instead of overflowing the wrapper
+	cv::Mat masked(15, 15, CV_32FC1);
+	masked.setTo(cv::Scalar(1));
+	masked.at<float>(0, 0) = 0.0f;
+	bool thrown = false;
+	try
+	{
+		amp::top_hat_32f_c1(pool, src, dest, temp, masked);
+	}
+	catch(const std::runtime_error&)
+	{
+		thrown = true;
+	}
+	printf("mismatches %d, masked kernel %s\n", mismatches, thrown ? "refused" : "accepted");
+	return mismatches == 0 && thrown ? 0 : 1;
+}
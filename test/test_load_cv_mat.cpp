@@ -0,0 +1,48 @@
+﻿// load_cv_mat/save_cv_mat round trip of 16UC3 input: every channel gets the 255/4095 scaling of 16UC1
+// g++ -O2 -std=c++14 -pthread -I../include test_load_cv_mat.cpp -lopencv_core -o test_load_cv_mat
+
+#include <cstdio>
+#include <cmath>
+#include <amp_core.h>
+
+int main()
+{
+	const int rows = 37;
+	const int cols = 53;
+	cv::Mat src(rows, cols, CV_16UC3);
+	for(int r = 0; r < rows; r++)
+	{
+		unsigned short* p = src.ptr<unsigned short>(r);
+		for(int c = 0; c < cols * 3; c++)
+		{
+			p[c] = (unsigned short)((r * 211 + c * 97) % 4096);
+		}
+	}
+	amp::vision_context ctx(amp::cpu::default_thread_pool());
+	amp::cpu::plane<float> channel1(rows, cols), channel2(rows, cols), channel3(rows, cols);
+	if (!ctx.load_cv_mat(src, channel1, channel2, channel3))
+	{
+		printf("load_cv_mat failed\n");
+		return 1;
+	}
+	cv::Mat dest;
+	ctx.save_cv_mat(channel1, channel2, channel3, dest);
+	const amp::cpu::plane<float>* channels[3] = { &channel1, &channel2, &channel3 };
+	int mismatches = 0;
+	for(int r = 0; r < rows; r++)
+	{
+		const unsigned short* p = src.ptr<unsigned short>(r);
+		const unsigned char* q = dest.ptr<unsigned char>(r);
+		for(int c = 0; c < cols; c++)
+		{
+			for(int ch = 0; ch < 3; ch++)
+			{
+				const float expected = p[c * 3 + ch] * (255.0f / 4095.0f);
+				if (std::fabs(channels[ch]->view()(r, c) - expected) > 1.0e-3f || std::fabs(q[c * 3 + ch] - expected) > 1.0f)
+					mismatches++;
+			}
+		}
+	}
+	printf("mismatches %d\n", mismatches);
+	return mismatches == 0 ? 0 : 1;
+}